@@ -0,0 +1,120 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Helpers for low-priority background workers
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "background.h"
+
+// From linux/ioprio.h, which not every toolchain ships
+#define IOPRIO_CLASS_SHIFT  13
+#define IOPRIO_CLASS_IDLE   3
+#define IOPRIO_WHO_PROCESS  1
+
+// Budgets are enforced over windows of this length
+#define BG_WINDOW_NS        100000000LL
+
+static int64_t clock_ns(clockid_t clk)
+{
+    struct timespec ts;
+
+    clock_gettime(clk, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Put the calling thread at the back of both the CPU and the I/O queue
+ *
+ * Parameters:
+ *   const char *who -> Worker name used in log messages
+ *
+ * Returns:
+ *   None
+ */
+void bg_lower_priority(const char *who)
+{
+    struct sched_param sp = { 0 };
+
+    if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &sp) != 0)
+        syslog(LOG_WARNING, "%s: SCHED_IDLE unavailable", who);
+    // who == 0 is the calling thread
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) == -1)
+        syslog(LOG_WARNING, "%s: idle I/O class unavailable: %s", who, strerror(errno));
+}
+
+/*
+ * Initialise a throttle for the calling thread
+ *
+ * Parameters:
+ *   struct bg_throttle *t -> Throttle state
+ *   unsigned int cpu_percent -> CPU share budget, 0 for none
+ *   uint64_t io_bytes_per_sec -> I/O bandwidth budget, 0 for none
+ *
+ * Returns:
+ *   None
+ */
+void bg_throttle_init(struct bg_throttle *t, unsigned int cpu_percent, uint64_t io_bytes_per_sec)
+{
+    t->cpu_percent = cpu_percent > 100 ? 100 : cpu_percent;
+    t->io_bytes_per_sec = io_bytes_per_sec;
+    t->window_start_ns = clock_ns(CLOCK_MONOTONIC);
+    t->window_cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    t->window_bytes = 0;
+}
+
+/*
+ * Account for a unit of work and sleep if the worker is over budget
+ *
+ * The worker sleeps until both its CPU time and its I/O volume in the
+ * current window fit the budget, then starts a new window.
+ *
+ * Parameters:
+ *   struct bg_throttle *t -> Throttle state
+ *   size_t io_bytes -> Bytes read or written since the last call
+ *
+ * Returns:
+ *   None
+ */
+void bg_throttle(struct bg_throttle *t, size_t io_bytes)
+{
+    int64_t now = clock_ns(CLOCK_MONOTONIC), wall, need = 0, cpu;
+    struct timespec ts;
+
+    t->window_bytes += io_bytes;
+    wall = now - t->window_start_ns;
+
+    if (t->cpu_percent)
+    {
+        cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID) - t->window_cpu_ns;
+        if (cpu * 100 / t->cpu_percent > need)
+            need = cpu * 100 / t->cpu_percent;
+    }
+    if (t->io_bytes_per_sec)
+    {
+        int64_t io_ns = (int64_t)(t->window_bytes * 1000000000ULL / t->io_bytes_per_sec);
+
+        if (io_ns > need)
+            need = io_ns;
+    }
+
+    if (need > wall)
+    {
+        ts.tv_sec = (need - wall) / 1000000000;
+        ts.tv_nsec = (need - wall) % 1000000000;
+        while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+            ;
+    }
+
+    if (need > BG_WINDOW_NS || wall > BG_WINDOW_NS)
+        bg_throttle_init(t, t->cpu_percent, t->io_bytes_per_sec);
+}
@@ -0,0 +1,30 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Helpers for low-priority background workers
+ *
+ * Housekeeping threads (retention, compaction) must never compete with
+ * live capture. They drop to SCHED_IDLE and the idle I/O class, and can
+ * additionally pace themselves against an explicit CPU share and I/O
+ * bandwidth budget.
+ */
+
+#ifndef BACKGROUND_H
+#define BACKGROUND_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct bg_throttle
+{
+    unsigned int cpu_percent;       // Share of one core the worker may use (0 = unlimited)
+    uint64_t io_bytes_per_sec;      // Read + write bandwidth budget (0 = unlimited)
+    int64_t window_start_ns;        // Start of the current accounting window (monotonic)
+    int64_t window_cpu_ns;          // Thread CPU time at window start
+    uint64_t window_bytes;          // I/O done in the current window
+};
+
+void bg_lower_priority(const char *who);
+void bg_throttle_init(struct bg_throttle *t, unsigned int cpu_percent, uint64_t io_bytes_per_sec);
+void bg_throttle(struct bg_throttle *t, size_t io_bytes);
+
+#endif
@@ -0,0 +1,401 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Sliding-window box filters and approximate Gaussian blur
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "blur.h"
+#include "memacct.h"
+
+// Zeros ahead of the prefix sums, so the first window and the first vector need no special case
+#define SUMS_LEAD   8
+
+/*
+ * Set up the scratch for images of one geometry
+ *
+ * Parameters:
+ *   struct blur *b -> Filter to initialise
+ *   uint32_t width, height -> Image geometry in pixels
+ *   uint32_t channels -> 1 for luma, 3 for interleaved RGB
+ *   uint32_t max_radius -> Largest radius that will be asked for (1..BF_MAX_RADIUS)
+ *
+ * Returns:
+ *   0 on success, -1 with errno set (EINVAL, ENOMEM)
+ */
+int bf_init(struct blur *b, uint32_t width, uint32_t height, uint32_t channels, uint32_t max_radius)
+{
+    size_t line;
+
+    memset(b, 0, sizeof(*b));
+    if (width == 0 || height == 0 || (channels != 1 && channels != 3) || max_radius == 0 ||
+        max_radius > BF_MAX_RADIUS)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    b->width = width;
+    b->height = height;
+    b->channels = channels;
+    b->max_radius = max_radius;
+    line = (size_t)(width + 2 * max_radius) * channels;
+    b->line = malloc(line);
+    b->sums = calloc(SUMS_LEAD + line, sizeof(*b->sums));
+    b->ring = malloc((size_t)(max_radius + 1) * width * channels);
+    if (!b->line || !b->sums || !b->ring)
+    {
+        bf_free(b);
+        errno = ENOMEM;
+        return -1;
+    }
+    b->scratch = line + (SUMS_LEAD + line) * sizeof(*b->sums) + (size_t)(max_radius + 1) * width * channels;
+    mem_charge(MEM_ANALYSIS, b->scratch);
+    return 0;
+}
+
+// Reciprocal of the window size for a 16-bit multiply-high, rounded to nearest
+static inline uint16_t reciprocal(uint32_t radius)
+{
+    uint32_t d = 2 * radius + 1;
+
+    return (65536 + d / 2) / d;
+}
+
+// Window average: (sum + radius) * reciprocal >> 16, saturated
+static inline uint8_t average(uint16_t sum, uint32_t radius, uint16_t recip)
+{
+    uint32_t v = ((uint32_t)(uint16_t)(sum + radius) * recip) >> 16;
+
+    return v > 255 ? 255 : v;
+}
+
+/*
+ * Prefix sums, channel by channel, of n interleaved bytes: q[j] = q[j - c] + line[j]
+ *
+ * q[-SUMS_LEAD..-1] are zero.
+ */
+static void prefix_sums(const uint8_t *line, uint16_t *q, size_t n, uint32_t c)
+{
+    size_t j = 0;
+
+#if defined(__x86_64__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i v, carry;
+
+    for (; j + 8 <= n; j += 8)
+    {
+        v = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(line + j)), zero);
+        carry = _mm_loadu_si128((const __m128i *)(q + j - 8));
+        if (c == 1)
+        {
+            v = _mm_add_epi16(v, _mm_srli_si128(carry, 14));
+            v = _mm_add_epi16(v, _mm_slli_si128(v, 2));
+            v = _mm_add_epi16(v, _mm_slli_si128(v, 4));
+            v = _mm_add_epi16(v, _mm_slli_si128(v, 8));
+        }
+        else
+        {
+            // The last pixel of the previous vector seeds lanes 0..2, then lags 3 and 6
+            v = _mm_add_epi16(v, _mm_srli_si128(carry, 10));
+            v = _mm_add_epi16(v, _mm_slli_si128(v, 6));
+            v = _mm_add_epi16(v, _mm_slli_si128(v, 12));
+        }
+        _mm_storeu_si128((__m128i *)(q + j), v);
+    }
+#elif defined(__ARM_NEON)
+    const uint16x8_t zero = vdupq_n_u16(0);
+    uint16x8_t v, carry;
+
+    for (; j + 8 <= n; j += 8)
+    {
+        v = vmovl_u8(vld1_u8(line + j));
+        carry = vld1q_u16(q + j - 8);
+        if (c == 1)
+        {
+            v = vaddq_u16(v, vextq_u16(carry, zero, 7));
+            v = vaddq_u16(v, vextq_u16(zero, v, 7));
+            v = vaddq_u16(v, vextq_u16(zero, v, 6));
+            v = vaddq_u16(v, vextq_u16(zero, v, 4));
+        }
+        else
+        {
+            v = vaddq_u16(v, vextq_u16(carry, zero, 5));
+            v = vaddq_u16(v, vextq_u16(zero, v, 5));
+            v = vaddq_u16(v, vextq_u16(zero, v, 2));
+        }
+        vst1q_u16(q + j, v);
+    }
+#endif
+    for (; j < n; j++)
+        q[j] = q[(ptrdiff_t)j - c] + line[j];
+}
+
+/*
+ * out[i] = average of the window sum a[i] - b[i] (modulo 2^16), or of a[i] when b is NULL
+ */
+static void window_average(const uint16_t *a, const uint16_t *b, size_t n, uint32_t radius, uint8_t *out)
+{
+    uint16_t recip = reciprocal(radius);
+    size_t i = 0;
+
+#if defined(__x86_64__)
+    const __m128i r = _mm_set1_epi16(radius), m = _mm_set1_epi16(recip);
+    __m128i s;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        s = _mm_loadu_si128((const __m128i *)(a + i));
+        if (b)
+            s = _mm_sub_epi16(s, _mm_loadu_si128((const __m128i *)(b + i)));
+        s = _mm_mulhi_epu16(_mm_add_epi16(s, r), m);
+        _mm_storel_epi64((__m128i *)(out + i), _mm_packus_epi16(s, s));
+    }
+#elif defined(__ARM_NEON)
+    uint16x8_t s;
+    uint32x4_t lo, hi;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        s = vld1q_u16(a + i);
+        if (b)
+            s = vsubq_u16(s, vld1q_u16(b + i));
+        s = vaddq_u16(s, vdupq_n_u16(radius));
+        lo = vmull_n_u16(vget_low_u16(s), recip);
+        hi = vmull_n_u16(vget_high_u16(s), recip);
+        vst1_u8(out + i, vqmovn_u16(vcombine_u16(vshrn_n_u32(lo, 16), vshrn_n_u32(hi, 16))));
+    }
+#endif
+    for (; i < n; i++)
+        out[i] = average(b ? a[i] - b[i] : a[i], radius, recip);
+}
+
+/*
+ * Horizontal box filter of every row, in place
+ *
+ * Parameters:
+ *   struct blur *b -> The filter
+ *   uint8_t *image -> Top-left pixel
+ *   size_t stride -> Bytes between rows
+ *   uint32_t radius -> Window radius (0..max_radius; 0 leaves the image alone)
+ *
+ * Returns:
+ *   None
+ */
+void bf_box_rows(struct blur *b, uint8_t *image, size_t stride, uint32_t radius)
+{
+    uint32_t c = b->channels, w = b->width, y, k;
+    size_t n = (size_t)(w + 2 * radius) * c;
+    uint16_t *q = b->sums + SUMS_LEAD;
+    uint8_t *row;
+
+    if (radius == 0 || radius > b->max_radius)
+        return;
+    for (y = 0; y < b->height; y++)
+    {
+        row = image + y * stride;
+        // Replicated edges: radius copies of the first and last pixel around the row
+        for (k = 0; k < radius; k++)
+        {
+            memcpy(b->line + (size_t)k * c, row, c);
+            memcpy(b->line + (size_t)(radius + w + k) * c, row + (size_t)(w - 1) * c, c);
+        }
+        memcpy(b->line + (size_t)radius * c, row, (size_t)w * c);
+        prefix_sums(b->line, q, n, c);
+
+        // The window of output x is line[x .. x + 2 * radius]
+        window_average(q + (size_t)2 * radius * c, q - c, (size_t)w * c, radius, row);
+    }
+}
+
+/*
+ * Vertical box filter of every column, in place
+ *
+ * Parameters:
+ *   struct blur *b -> The filter
+ *   uint8_t *image -> Top-left pixel
+ *   size_t stride -> Bytes between rows
+ *   uint32_t radius -> Window radius (0..max_radius; 0 leaves the image alone)
+ *
+ * Returns:
+ *   None
+ */
+void bf_box_columns(struct blur *b, uint8_t *image, size_t stride, uint32_t radius)
+{
+    size_t n = (size_t)b->width * b->channels, i;
+    uint32_t h = b->height, y, k;
+    uint16_t *s = b->sums + SUMS_LEAD;
+    const uint8_t *add, *sub;
+    uint8_t *row;
+
+    if (radius == 0 || radius > b->max_radius)
+        return;
+
+    // Column sums of the window of row 0, the rows above the image being copies of row 0
+    for (i = 0; i < n; i++)
+        s[i] = (radius + 1) * image[i];
+    for (k = 1; k <= radius; k++)
+    {
+        add = image + (k < h ? k : h - 1) * stride;
+        for (i = 0; i < n; i++)
+            s[i] += add[i];
+    }
+
+    for (y = 0; y < h; y++)
+    {
+        row = image + y * stride;
+        // Rows leave the window after they have been overwritten, so their originals are kept
+        memcpy(b->ring + (size_t)(y % (radius + 1)) * n, row, n);
+        window_average(s, NULL, n, radius, row);
+        if (y + 1 == h)
+            break;
+
+        add = image + (y + radius + 1 < h ? y + radius + 1 : h - 1) * stride;
+        sub = b->ring + (y >= radius ? (size_t)((y - radius) % (radius + 1)) * n : 0);
+        i = 0;
+#if defined(__x86_64__)
+        {
+            const __m128i zero = _mm_setzero_si128();
+            __m128i v;
+
+            for (; i + 8 <= n; i += 8)
+            {
+                v = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(add + i)), zero),
+                                  _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(sub + i)), zero));
+                _mm_storeu_si128((__m128i *)(s + i), _mm_add_epi16(_mm_loadu_si128((const __m128i *)(s + i)), v));
+            }
+        }
+#elif defined(__ARM_NEON)
+        for (; i + 8 <= n; i += 8)
+            vst1q_u16(s + i, vaddq_u16(vld1q_u16(s + i), vsubl_u8(vld1_u8(add + i), vld1_u8(sub + i))));
+#endif
+        for (; i < n; i++)
+            s[i] += add[i] - sub[i];
+    }
+}
+
+/*
+ * Box filter in both directions, in place
+ *
+ * Parameters:
+ *   struct blur *b -> The filter
+ *   uint8_t *image -> Top-left pixel
+ *   size_t stride -> Bytes between rows
+ *   uint32_t radius -> Window radius (0..max_radius)
+ *
+ * Returns:
+ *   None
+ */
+void bf_box(struct blur *b, uint8_t *image, size_t stride, uint32_t radius)
+{
+    bf_box_rows(b, image, stride, radius);
+    bf_box_columns(b, image, stride, radius);
+}
+
+/*
+ * Radii of the three box passes that approximate a Gaussian
+ *
+ * Parameters:
+ *   double sigma -> Standard deviation in pixels
+ *   uint32_t radii[3] -> Radius of each pass
+ *
+ * Returns:
+ *   None
+ */
+void bf_gaussian_radii(double sigma, uint32_t radii[3])
+{
+    double ideal = sqrt(12 * sigma * sigma / 3 + 1);
+    int lower = (int)floor(ideal), m, i;
+
+    // Passes of widths lower and lower + 2 (both odd), mixed to match the variance
+    if (lower % 2 == 0)
+        lower--;
+    if (lower < 1)
+        lower = 1;
+    m = (int)lround((12 * sigma * sigma - 3.0 * lower * lower - 12.0 * lower - 9) / (-4.0 * lower - 4));
+    for (i = 0; i < 3; i++)
+        radii[i] = ((i < m ? lower : lower + 2) - 1) / 2;
+}
+
+/*
+ * Approximate Gaussian blur, in place
+ *
+ * Parameters:
+ *   struct blur *b -> The filter
+ *   uint8_t *image -> Top-left pixel
+ *   size_t stride -> Bytes between rows
+ *   double sigma -> Standard deviation in pixels
+ *
+ * Returns:
+ *   0 on success, -1 with errno set to EINVAL when a pass exceeds max_radius
+ */
+int bf_gaussian(struct blur *b, uint8_t *image, size_t stride, double sigma)
+{
+    uint32_t radii[3];
+    int i;
+
+    bf_gaussian_radii(sigma, radii);
+    for (i = 0; i < 3; i++)
+    {
+        if (radii[i] > b->max_radius)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    for (i = 0; i < 3; i++)
+        bf_box_rows(b, image, stride, radii[i]);
+    for (i = 0; i < 3; i++)
+        bf_box_columns(b, image, stride, radii[i]);
+    return 0;
+}
+
+/*
+ * Name of the kernels in use
+ *
+ * Parameters:
+ *   None
+ *
+ * Returns:
+ *   "sse2", "neon" or "scalar"
+ */
+const char *bf_impl(void)
+{
+#if defined(__x86_64__)
+    return "sse2";
+#elif defined(__ARM_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
+
+/*
+ * Release the scratch
+ *
+ * Parameters:
+ *   struct blur *b -> The filter
+ *
+ * Returns:
+ *   None
+ */
+void bf_free(struct blur *b)
+{
+    if (b->scratch)
+        mem_release(MEM_ANALYSIS, b->scratch);
+    free(b->line);
+    free(b->sums);
+    free(b->ring);
+    memset(b, 0, sizeof(*b));
+}
@@ -0,0 +1,53 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Sliding-window box filters and approximate Gaussian blur
+ *
+ * Smoothing ahead of an analysis has to be cheap at any radius, so the
+ * box filter never sums a window: horizontally each row is turned into
+ * running (prefix) sums, and a window is the difference of two of them;
+ * vertically a row of column sums is carried down the image, adding the
+ * row entering the window and subtracting the one leaving it. Either way
+ * a pixel costs the same at radius 1 and at radius 100. A Gaussian is
+ * approximated by three box passes of suitably chosen widths, which is
+ * within a few percent of the true kernel.
+ *
+ * Images are 8-bit luma or interleaved RGB and are filtered in place.
+ * The sums are 16-bit, kept modulo 2^16, which is exact as long as a
+ * window sum fits, hence the radius limit; that lets SSE2/NEON work on 8
+ * samples at a time in both directions. Edges are replicated. The only
+ * scratch is one padded line and its sums for the horizontal pass, plus
+ * the column sums and a ring of radius + 1 original rows for the vertical
+ * pass, allocated once for the largest radius.
+ */
+
+#ifndef BLUR_H
+#define BLUR_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// (2 * 127 + 1) * 255 plus the rounding term still fits 16 bits
+#define BF_MAX_RADIUS   127
+
+struct blur
+{
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;          // 1 (luma) or 3 (interleaved RGB)
+    uint32_t max_radius;
+    uint8_t *line;              // Padded copy of a row
+    uint16_t *sums;             // Prefix sums of the padded row, or column sums
+    uint8_t *ring;              // Original rows still needed by the vertical pass
+    size_t scratch;             // Bytes allocated, for the memory accountant
+};
+
+int bf_init(struct blur *b, uint32_t width, uint32_t height, uint32_t channels, uint32_t max_radius);
+void bf_box_rows(struct blur *b, uint8_t *image, size_t stride, uint32_t radius);
+void bf_box_columns(struct blur *b, uint8_t *image, size_t stride, uint32_t radius);
+void bf_box(struct blur *b, uint8_t *image, size_t stride, uint32_t radius);
+int bf_gaussian(struct blur *b, uint8_t *image, size_t stride, double sigma);
+void bf_gaussian_radii(double sigma, uint32_t radii[3]);
+void bf_free(struct blur *b);
+const char *bf_impl(void);
+
+#endif
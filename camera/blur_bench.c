@@ -0,0 +1,276 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Correctness and throughput of the box and Gaussian blurs
+ *
+ * Filters a synthetic image (gradients, edges and noise), as luma and as
+ * interleaved RGB, at a range of radii. The sliding-window box filter is
+ * compared with a naive filter that sums every window, which must give
+ * the same bytes, and both are timed, so the constant cost per pixel of
+ * the former shows against the linear one of the latter. The three-pass
+ * Gaussian is then timed against a direct separable convolution with a
+ * sampled Gaussian kernel (floating point, truncated at 3 sigma), and the
+ * largest and mean difference between the two are reported.
+ *
+ * The exit status is non-zero if the box filter differs from the naive one.
+ *
+ * usage: blur_bench [-g WxH] [-n rounds] [-x seed]
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <stdbool.h>
+
+#include "blur.h"
+
+static const uint32_t radii[] = { 1, 2, 4, 8, 16, 32, 64, BF_MAX_RADIUS };
+static const double sigmas[] = { 1, 2, 4, 8, 16, 32 };
+
+#define N_RADII     (sizeof(radii) / sizeof(radii[0]))
+#define N_SIGMAS    (sizeof(sigmas) / sizeof(sigmas[0]))
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t xorshift(uint32_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 17;
+    *s ^= *s << 5;
+    return *s;
+}
+
+/*
+ * Gradients with a few hard-edged rectangles and some noise, every channel different
+ */
+static void fill_image(uint8_t *img, uint32_t w, uint32_t h, unsigned int c, uint32_t seed)
+{
+    uint32_t x, y, v;
+    unsigned int ch;
+
+    for (y = 0; y < h; y++)
+    {
+        for (x = 0; x < w; x++)
+        {
+            for (ch = 0; ch < c; ch++)
+            {
+                v = (x * (ch + 1) * 255 / w + y * 255 / h) / 2;
+                if ((x / 64 + y / 48) % 3 == ch % 3)
+                    v = 255 - v;
+                v += xorshift(&seed) % 32;
+                img[((size_t)y * w + x) * c + ch] = v > 255 ? 255 : v;
+            }
+        }
+    }
+}
+
+/*
+ * Naive box filter pass: every window summed, clamped borders, the filter's rounding
+ */
+static void naive_box_pass(const uint8_t *src, uint8_t *dst, uint32_t w, uint32_t h, unsigned int c,
+                           uint32_t radius, bool rows)
+{
+    uint32_t d = 2 * radius + 1, recip = (65536 + d / 2) / d, sum, v, x, y;
+    int r = radius, k, s, len = rows ? w : h;
+    unsigned int ch;
+
+    for (y = 0; y < h; y++)
+    {
+        for (x = 0; x < w; x++)
+        {
+            for (ch = 0; ch < c; ch++)
+            {
+                for (sum = 0, k = -r; k <= r; k++)
+                {
+                    s = (int)(rows ? x : y) + k;
+                    s = s < 0 ? 0 : s >= len ? len - 1 : s;
+                    sum += rows ? src[((size_t)y * w + s) * c + ch] : src[((size_t)s * w + x) * c + ch];
+                }
+                v = ((sum + radius) * recip) >> 16;
+                dst[((size_t)y * w + x) * c + ch] = v > 255 ? 255 : v;
+            }
+        }
+    }
+}
+
+/*
+ * Direct separable convolution with a sampled Gaussian, clamped borders
+ */
+static void naive_gaussian(const uint8_t *src, uint8_t *dst, float *tmp, uint32_t w, uint32_t h, unsigned int c,
+                           double sigma)
+{
+    int r = (int)ceil(3 * sigma), k, s, x, y;
+    float *kernel = malloc((2 * r + 1) * sizeof(*kernel)), sum;
+    double total = 0;
+    unsigned int ch;
+
+    if (!kernel)
+        return;
+    for (k = -r; k <= r; k++)
+        total += kernel[k + r] = exp(-(double)k * k / (2 * sigma * sigma));
+    for (k = 0; k <= 2 * r; k++)
+        kernel[k] /= total;
+
+    for (y = 0; y < (int)h; y++)
+        for (x = 0; x < (int)w; x++)
+            for (ch = 0; ch < c; ch++)
+            {
+                for (sum = 0, k = -r; k <= r; k++)
+                {
+                    s = x + k < 0 ? 0 : x + k >= (int)w ? (int)w - 1 : x + k;
+                    sum += kernel[k + r] * src[((size_t)y * w + s) * c + ch];
+                }
+                tmp[((size_t)y * w + x) * c + ch] = sum;
+            }
+    for (y = 0; y < (int)h; y++)
+        for (x = 0; x < (int)w; x++)
+            for (ch = 0; ch < c; ch++)
+            {
+                for (sum = 0, k = -r; k <= r; k++)
+                {
+                    s = y + k < 0 ? 0 : y + k >= (int)h ? (int)h - 1 : y + k;
+                    sum += kernel[k + r] * tmp[((size_t)s * w + x) * c + ch];
+                }
+                dst[((size_t)y * w + x) * c + ch] = lrintf(sum);
+            }
+    free(kernel);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-g WxH] [-n rounds] [-x seed]\n"
+                    "  -g  image size (default 640x480)\n"
+                    "  -n  filter runs per timing (default 20)\n"
+                    "  -x  seed of the synthetic image (default 1)\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t w = 640, h = 480, seed = 1, rounds = 20, i, j, mismatches = 0, ch;
+    uint8_t *image, *out, *ref, *mid;
+    float *tmp;
+    size_t n, k, differ;
+    double start, fast, naive, err, max_err, sum_err;
+    struct blur b;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "g:n:x:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'g':
+            if (sscanf(optarg, "%ux%u", &w, &h) != 2 || w == 0 || h == 0)
+                usage(argv[0]);
+            break;
+        case 'n':
+            rounds = strtoul(optarg, NULL, 0);
+            if (rounds == 0)
+                usage(argv[0]);
+            break;
+        case 'x':
+            seed = strtoul(optarg, NULL, 0) | 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    n = (size_t)w * h * 3;
+    image = malloc(n);
+    out = malloc(n);
+    ref = malloc(n);
+    mid = malloc(n);
+    tmp = malloc(n * sizeof(*tmp));
+    if (!image || !out || !ref || !mid || !tmp)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    printf("blur: %ux%u, %s kernels, %u runs per timing\n", w, h, bf_impl(), rounds);
+
+    for (ch = 1; ch <= 3; ch += 2)
+    {
+        n = (size_t)w * h * ch;
+        fill_image(image, w, h, ch, seed);
+        if (bf_init(&b, w, h, ch, BF_MAX_RADIUS) == -1)
+        {
+            fprintf(stderr, "Cannot set up the filter: %s\n", strerror(errno));
+            return EXIT_FAILURE;
+        }
+        printf("%s, box filter:\n", ch == 1 ? "luma" : "rgb");
+        for (i = 0; i < N_RADII; i++)
+        {
+            memcpy(out, image, n);
+            bf_box(&b, out, (size_t)w * ch, radii[i]);
+            start = now_sec();
+            naive_box_pass(image, mid, w, h, ch, radii[i], true);
+            naive_box_pass(mid, ref, w, h, ch, radii[i], false);
+            naive = now_sec() - start;
+            for (differ = 0, k = 0; k < n; k++)
+                differ += out[k] != ref[k];
+            if (differ)
+            {
+                fprintf(stderr, "radius %u: %zu of %zu bytes differ from the naive filter\n", radii[i], differ, n);
+                mismatches++;
+            }
+
+            start = now_sec();
+            for (j = 0; j < rounds; j++)
+                bf_box(&b, out, (size_t)w * ch, radii[i]);
+            fast = (now_sec() - start) / rounds;
+            printf("  radius %3u: %8.3f ms (%6.2f ns/px), naive %9.3f ms, %.1fx\n", radii[i], fast * 1e3,
+                   fast * 1e9 / ((double)w * h), naive * 1e3, naive / fast);
+        }
+
+        printf("%s, gaussian:\n", ch == 1 ? "luma" : "rgb");
+        for (i = 0; i < N_SIGMAS; i++)
+        {
+            uint32_t r[3];
+
+            bf_gaussian_radii(sigmas[i], r);
+            memcpy(out, image, n);
+            if (bf_gaussian(&b, out, (size_t)w * ch, sigmas[i]) == -1)
+            {
+                printf("  sigma %5.1f: radii %u/%u/%u exceed the limit\n", sigmas[i], r[0], r[1], r[2]);
+                continue;
+            }
+            start = now_sec();
+            naive_gaussian(image, ref, tmp, w, h, ch, sigmas[i]);
+            naive = now_sec() - start;
+            for (max_err = sum_err = 0, k = 0; k < n; k++)
+            {
+                err = abs((int)out[k] - (int)ref[k]);
+                max_err = err > max_err ? err : max_err;
+                sum_err += err;
+            }
+
+            start = now_sec();
+            for (j = 0; j < rounds; j++)
+                bf_gaussian(&b, out, (size_t)w * ch, sigmas[i]);
+            fast = (now_sec() - start) / rounds;
+            printf("  sigma %5.1f (radii %u/%u/%u): %8.3f ms, direct %9.3f ms, %.1fx, error max %.0f mean %.3f\n",
+                   sigmas[i], r[0], r[1], r[2], fast * 1e3, naive * 1e3, naive / fast, max_err, sum_err / n);
+        }
+        bf_free(&b);
+    }
+
+    printf("verify: %u radii differ from the naive filter\n", mismatches);
+    free(image);
+    free(out);
+    free(ref);
+    free(mid);
+    free(tmp);
+    return mismatches ? EXIT_FAILURE : 0;
+}
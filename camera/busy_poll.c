@@ -0,0 +1,213 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Busy-poll wait for capture buffers
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "busy_poll.h"
+
+// Pause instructions between two polls while spinning
+#define BP_SPIN_BATCH    64
+
+// The spin window around the expected arrival is interval / 16, clamped
+#define BP_GUARD_MIN_NS  200000ULL
+#define BP_GUARD_MAX_NS  2000000ULL
+
+// The readout offset moves 1/N of the way towards a larger sample
+#define BP_OFFSET_RISE   32
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ volatile("yield" ::: "memory");
+#else
+    __asm__ volatile("" ::: "memory");
+#endif
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t ns)
+{
+    struct timespec ts = {
+        .tv_sec = ns / 1000000000,
+        .tv_nsec = ns % 1000000000,
+    };
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+/*
+ * Set up a poller
+ *
+ * Parameters:
+ *   struct busy_poll *bp -> Poller to initialise
+ *   uint64_t interval_ns -> Nominal frame interval of the stream
+ *
+ * Returns:
+ *   None
+ */
+void bp_init(struct busy_poll *bp, uint64_t interval_ns)
+{
+    memset(bp, 0, sizeof(*bp));
+    bp->interval_ns = interval_ns;
+}
+
+/*
+ * Pin the calling thread to one CPU
+ *
+ * Threads the caller starts afterwards inherit the mask, so this is done
+ * once the background workers are running.
+ *
+ * Parameters:
+ *   int cpu -> CPU number
+ *
+ * Returns:
+ *   0 on success, -1 with errno set
+ */
+int bp_pin(int cpu)
+{
+    cpu_set_t set;
+    int r;
+
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    r = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (r != 0)
+    {
+        errno = r;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Note a dequeued frame and refine the expected interval and readout time
+ *
+ * The dequeue time overstates when the frame became available whenever
+ * the poller was late or busy, so the offset drops at once to a smaller
+ * sample and only creeps up towards larger ones.
+ *
+ * Parameters:
+ *   struct busy_poll *bp -> The poller
+ *   uint64_t ready_ns -> When the buffer became ready (CLOCK_MONOTONIC)
+ *   uint64_t dequeued_ns -> When VIDIOC_DQBUF returned it (CLOCK_MONOTONIC)
+ *   uint32_t sequence -> Driver sequence number of the frame
+ *
+ * Returns:
+ *   None
+ */
+void bp_frame(struct busy_poll *bp, uint64_t ready_ns, uint64_t dequeued_ns, uint32_t sequence)
+{
+    uint64_t offset = dequeued_ns > ready_ns ? dequeued_ns - ready_ns : 0;
+    int64_t delta;
+
+    if (!bp->last_ready_ns || offset < bp->avail_offset_ns)
+        bp->avail_offset_ns = offset;
+    else
+        bp->avail_offset_ns += (offset - bp->avail_offset_ns) / BP_OFFSET_RISE;
+
+    if (bp->last_ready_ns && sequence > bp->last_sequence && ready_ns > bp->last_ready_ns)
+    {
+        delta = (ready_ns - bp->last_ready_ns) / (sequence - bp->last_sequence);
+
+        // Follow rate changes (auto exposure halves it in low light), not stalls
+        if (delta > (int64_t)bp->interval_ns / 2 && delta < (int64_t)bp->interval_ns * 5 / 2)
+            bp->interval_ns += (delta - (int64_t)bp->interval_ns) / 8;
+    }
+    bp->last_ready_ns = ready_ns;
+    bp->last_sequence = sequence;
+}
+
+/*
+ * Wait a little after an empty poll
+ *
+ * Parameters:
+ *   struct busy_poll *bp -> The poller
+ *
+ * Returns:
+ *   None
+ */
+void bp_backoff(struct busy_poll *bp)
+{
+    uint64_t now = now_ns(), interval = bp->interval_ns, guard, expected;
+    unsigned int i;
+
+    __atomic_fetch_add(&bp->stats.polls, 1, __ATOMIC_RELAXED);
+
+    guard = interval / 16;
+    if (guard < BP_GUARD_MIN_NS)
+        guard = BP_GUARD_MIN_NS;
+    if (guard > BP_GUARD_MAX_NS)
+        guard = BP_GUARD_MAX_NS;
+
+    // Nothing to aim for before the first frame
+    if (!bp->last_ready_ns)
+    {
+        __atomic_fetch_add(&bp->stats.sleeps, 1, __ATOMIC_RELAXED);
+        sleep_until(now + guard);
+        return;
+    }
+
+    // A frame more than half an interval overdue was dropped; aim for the next one
+    expected = bp->last_ready_ns + bp->avail_offset_ns + interval;
+    if (now > expected + interval / 2)
+        expected += (now - expected + interval / 2) / interval * interval;
+
+    if (now + guard < expected)
+    {
+        __atomic_fetch_add(&bp->stats.sleeps, 1, __ATOMIC_RELAXED);
+        sleep_until(expected - guard);
+    }
+    else if (now < expected + guard)
+    {
+        __atomic_fetch_add(&bp->stats.spins, 1, __ATOMIC_RELAXED);
+        for (i = 0; i < BP_SPIN_BATCH; i++)
+            cpu_relax();
+    }
+    else
+    {
+        __atomic_fetch_add(&bp->stats.yields, 1, __ATOMIC_RELAXED);
+        sched_yield();
+    }
+}
+
+/*
+ * Snapshot the poller counters (safe from another thread)
+ *
+ * Parameters:
+ *   struct busy_poll *bp -> The poller
+ *   struct busy_poll_stats *out -> Copy of the counters
+ *
+ * Returns:
+ *   None
+ */
+void bp_get_stats(struct busy_poll *bp, struct busy_poll_stats *out)
+{
+    out->polls = __atomic_load_n(&bp->stats.polls, __ATOMIC_RELAXED);
+    out->spins = __atomic_load_n(&bp->stats.spins, __ATOMIC_RELAXED);
+    out->yields = __atomic_load_n(&bp->stats.yields, __ATOMIC_RELAXED);
+    out->sleeps = __atomic_load_n(&bp->stats.sleeps, __ATOMIC_RELAXED);
+}
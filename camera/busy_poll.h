@@ -0,0 +1,46 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Busy-poll wait for capture buffers
+ *
+ * Instead of sleeping in select() until the driver wakes the capture
+ * thread, a thread pinned to its own core polls VIDIOC_DQBUF without
+ * blocking. Between empty polls it backs off according to where it is
+ * in the frame interval: it sleeps until just before the next frame is
+ * due, spins with pause instructions around the expected arrival, falls
+ * back to sched_yield() when the frame is late, and once the frame is
+ * half an interval overdue assumes it was dropped and sleeps towards
+ * the one after. The interval starts from the driver's frame rate and
+ * follows the buffer timestamps. Those mark the start of the frame on
+ * UVC, so the arrival is aimed at the timestamp plus a learned offset to
+ * the moment frames actually become dequeueable (the readout time).
+ */
+
+#ifndef BUSY_POLL_H
+#define BUSY_POLL_H
+
+#include <stdint.h>
+
+struct busy_poll_stats
+{
+    uint64_t polls;             // Empty polls
+    uint64_t spins;             // Batches of pause instructions
+    uint64_t yields;
+    uint64_t sleeps;
+};
+
+struct busy_poll
+{
+    uint64_t interval_ns;       // Expected frame interval
+    uint64_t last_ready_ns;     // Monotonic ready time of the last frame, 0 before the first
+    uint64_t avail_offset_ns;   // Ready time to dequeueable: the readout time
+    uint32_t last_sequence;
+    struct busy_poll_stats stats;
+};
+
+void bp_init(struct busy_poll *bp, uint64_t interval_ns);
+int bp_pin(int cpu);
+void bp_frame(struct busy_poll *bp, uint64_t ready_ns, uint64_t dequeued_ns, uint32_t sequence);
+void bp_backoff(struct busy_poll *bp);
+void bp_get_stats(struct busy_poll *bp, struct busy_poll_stats *out);
+
+#endif
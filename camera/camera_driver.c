@@ -33,15 +33,55 @@
 #include <time.h>
 #include <syslog.h>
 #include <stdbool.h>
+#include <pthread.h>
+
+#include "frame_writer.h"
+#include "frame_container.h"
+#include "durability.h"
+#include "retention.h"
+#include "compactor.h"
+#include "frame_analysis.h"
+#include "frame_service.h"
+#include "udp_stream.h"
+#include "metrics.h"
+#include "memacct.h"
+#include "convert.h"
+#include "busy_poll.h"
+#include "device_cache.h"
+#include "warmup.h"
+#include "exposure.h"
+#include "timelapse.h"
+#include "cnn.h"
+#include "edge.h"
+#include "white_balance.h"
+#include "outputs.h"
 
 #define CLEAR(x) memset(&(x), 0, sizeof(x))
 #define HRES 320
 #define VRES 240
-#define HRES_STR "320"
-#define VRES_STR "240"
 
 #define PRINT_ENABLE  (0)
 
+// Streaming is restarted when the camera stalls, up to this many times in a row
+#define MAX_DEVICE_RESTARTS  (3)
+
+// Capture buffers requested, and how far the memory budget may cut them
+#define QUEUE_BUFFERS      (6)
+#define MIN_QUEUE_BUFFERS  (3)
+
+// Longest wait for the exposure to settle before the first frame is used
+#define WARMUP_TIMEOUT_MS  (1500)
+
+// Frame interval assumed when the driver does not report one (30 fps)
+#define DEFAULT_FRAME_INTERVAL_NS  (33333333ULL)
+
+// How often the capture thread samples the driver queue for the metrics
+#define QUEUE_SAMPLE_NS  (250000000ULL)
+
+// Largest motion blobs classified per frame, and the smallest worth a look (pixels)
+#define CLASSIFY_MAX_CROPS  (2)
+#define CLASSIFY_MIN_SIZE   (16)
+
 
 // Global flag for tracking the end of camera frame capture
 static volatile bool is_capture = true;
@@ -84,8 +124,188 @@ const char *dev_name = "/dev/video0";
 static int fd = -1;
 struct buffer *buffers;
 static unsigned int n_buffers;
+static unsigned int queue_depth = QUEUE_BUFFERS;
 static int force_format = 1;
 
+// Write frames with O_DIRECT through the aligned frame writer (-D)
+static bool direct_io = false;
+
+// Recording outputs (-O, -C for a container), each with its own format, resolution, rate and
+// trigger; one full-resolution PPM per frame when none is given
+static struct out_spec output_specs[OUT_MAX];
+static unsigned int n_output_specs = 0;
+static struct outputs outputs;
+
+// Frame statistics for the output triggers, the segment index and the classifier
+static struct frame_analyzer analyzer;
+static bool analysis_enabled = false;
+
+// Thumbnails in the segment index (-P): one every thumb_every stored frames, 0 for none
+#define THUMB_WIDTH         40
+#define THUMB_MAX_WIDTH     160
+static unsigned int thumb_every = 1;
+static uint32_t thumb_width = THUMB_WIDTH;
+
+// When recorded frames are forced to storage (-S)
+static struct durability_policy durability_policy;
+
+// Background cleanup of every output directory (-R, -A, -W); never runs on the capture path
+static struct retention_config retention_cfg;
+static struct retention retention;
+static bool retention_enabled = false;
+
+// Aging segments of the container outputs are rewritten at reduced quality in the background (-K)
+static struct compactor_config compactor_cfg = {
+    .cpu_percent = 10,
+    .io_bytes_per_sec = 4u << 20,
+};
+static struct compactor compactor;
+static bool compactor_enabled = false;
+
+// Local subscribers get frames over a Unix socket (-U)
+static const char *service_path = NULL;
+static struct frame_service service;
+static bool service_enabled = false;
+
+// Raw frames paced out as UDP datagrams to a viewer on the local segment (-N)
+static struct udp_stream_config stream_cfg;
+static char stream_dest[256];
+static struct udp_stream stream;
+static bool stream_requested = false, stream_enabled = false;
+
+// Prometheus metrics on a localhost port or Unix socket (-M)
+static const char *metrics_listen = NULL;
+static struct metrics_server metrics;
+static bool metrics_enabled = false;
+
+// Memory budget in bytes (-B); 0 leaves usage unchecked
+static uint64_t memory_budget = 0;
+
+// Low-latency capture (-L): frames are taken as soon as they are ready, either
+// waiting in select() or busy-polling DQBUF, instead of every 50 ms
+enum capture_wait
+{
+    WAIT_PACED,
+    WAIT_BLOCK,
+    WAIT_POLL,
+};
+static enum capture_wait capture_wait = WAIT_PACED;
+static int poll_cpu = -1;
+static struct busy_poll poller;
+
+// Negotiated device configuration, reused across runs (-c)
+static const char *device_cache = ".camera_cache";
+static struct device_config device_cfg;
+
+// Frames are discarded until the sensor's exposure has settled (-w)
+static uint32_t warmup_timeout_ms = WARMUP_TIMEOUT_MS;
+static struct warmup warmup;
+static bool warming_up = false;
+
+// Application-side exposure and gain control (-E) holding at least exposure_fps
+static struct ae_controller exposure;
+static struct ae_config exposure_cfg = { .every = 3 };
+static double exposure_fps = 0;
+static bool exposure_requested = false, exposure_enabled = false, have_gain = false;
+
+// Timelapse (-T): every timelapse_window frames are averaged into one stored frame,
+// a window starting every timelapse_interval seconds
+static struct timelapse timelapse;
+static uint32_t timelapse_window = 0, timelapse_interval = 0;
+static bool timelapse_enabled = false;
+
+// Motion blobs of every classify_every-th frame with motion are classified by a CNN (-Y)
+static struct cnn_net classifier;
+static const char *classifier_path = NULL;
+static unsigned int classify_every = 3, classify_skipped = 0;
+static bool classifier_enabled = false;
+static uint64_t detections[CNN_MAX_CLASSES];
+static unsigned int last_detected[CNN_MAX_CLASSES];    // Frame of the last detection per class, 0 for none
+
+// Gradient statistics of every frame (-G): focus measure, edge density and orientation
+static struct edge_filter edges;
+static struct edge_stats edge_last;
+static enum edge_kernel edge_kernel;
+static unsigned int edge_bins;
+static bool edges_requested = false, edges_enabled = false;
+
+// Colour-cast statistics of every wb_every-th frame (-H), labelled with the device for fleet dashboards
+static struct white_balance white_balance;
+static unsigned int wb_every = 0;
+static bool wb_enabled = false;
+
+// Startup timeline in ns since main() started; first_frame is 0 until the first usable frame
+static struct
+{
+    uint64_t start;
+    uint64_t open;
+    uint64_t format;
+    uint64_t buffers;
+    uint64_t streaming;
+    uint64_t storage;
+    uint64_t first_frame;
+    bool cached;
+} startup;
+
+/*
+ * Storage event handler
+ *
+ * Write, sync and out-of-space failures on the recording path end up
+ * here instead of being dropped.
+ *
+ * Parameters:
+ *   enum storage_event ev -> The kind of failure
+ *   int err -> errno of the failure
+ *   const char *path -> File being written
+ *   void *arg -> Unused
+ *
+ * Returns:
+ *   None
+ */
+static void storage_event(enum storage_event ev, int err, const char *path, void *arg)
+{
+    switch (ev)
+    {
+    case STORAGE_EV_NO_SPACE:
+        syslog(LOG_ERR, "Out of space writing %s", path);
+        if (retention_enabled)
+            retention_kick(&retention);
+        break;
+    case STORAGE_EV_SYNC_ERROR:
+        syslog(LOG_ERR, "Sync of %s failed: %s", path, strerror(err));
+        break;
+    default:
+        syslog(LOG_ERR, "Write to %s failed: %s", path, strerror(err));
+        break;
+    }
+    #if (PRINT_ENABLE == 1)
+    fprintf(stderr, "storage event %d on %s: %s\n", ev, path, strerror(err));
+    #endif
+}
+
+/*
+ * Add a directory to a list once
+ *
+ * Parameters:
+ *   const char **dirs -> The list
+ *   unsigned int *n -> Entries in the list
+ *   unsigned int max -> Capacity of the list
+ *   const char *dir -> Directory to add
+ *
+ * Returns:
+ *   None
+ */
+static void add_dir(const char **dirs, unsigned int *n, unsigned int max, const char *dir)
+{
+    unsigned int i;
+
+    for (i = 0; i < *n; i++)
+        if (strcmp(dirs[i], dir) == 0)
+            return;
+    if (*n < max)
+        dirs[(*n)++] = dir;
+}
+
 
 /*
  * Errro handling function
@@ -132,96 +352,73 @@ static int xioctl(int fh, int request, void *arg)
 }
 
 
-/*****************FUNCTION TO CONVERT RGB FRAME BUFFER TO A PPM FILE******************/
-char ppm_header[] = "P6\n#9999999999 sec 9999999999 msec \n" HRES_STR " " VRES_STR "\n255\n";
-char ppm_dumpname[] = "frames/test00000000.ppm";
-
-static void dump_ppm(const void *p, int size, unsigned int tag, struct timespec *time)
-{
-    int written, total, dumpfd;
-
-
-    snprintf(&ppm_dumpname[11], 9, "%08d", tag);
-    strncat(&ppm_dumpname[15], ".ppm", 5);
-    dumpfd = open(ppm_dumpname, O_WRONLY | O_NONBLOCK | O_CREAT, 00666);
+/**************************************************CAMERA CAPTURE FUNCTIONS**************************************************/
 
-    snprintf(&ppm_header[4], 11, "%010d", (int)time->tv_sec);
-    strncat(&ppm_header[14], " sec  ", 5);
-    snprintf(&ppm_header[19], 11, "%010d", (int)((time->tv_nsec) / 1000000));
-    strcat(&ppm_header[29], " msec \n" HRES_STR " " VRES_STR "\n255\n");
+unsigned int framecnt = 0;
 
-    // subtract 1 because sizeof for string includes null terminator
-    written = write(dumpfd, ppm_header, sizeof(ppm_header) - 1);
+/*
+ * Function to classify the largest motion blobs of a frame
+ *
+ * Parameters:
+ *   const uint8_t *frame -> The raw frame fa_analyze() has just seen
+ *
+ * Returns:
+ * 	 None
+ */
+static void classify_blobs(const uint8_t *frame)
+{
+    const struct fa_box *box;
+    struct cnn_result r;
+    unsigned int i;
+    uint64_t t;
 
-    total = 0;
+    if (analyzer.n_boxes == 0 || ++classify_skipped < classify_every)
+        return;
+    classify_skipped = 0;
 
-    do
+    t = metrics_now();
+    for (i = 0; i < analyzer.n_boxes && i < CLASSIFY_MAX_CROPS; i++)
     {
-        written = write(dumpfd, p, size);
-        total += written;
-    } while (total < size);
-
-    printf("Wrote a frame\n");
-
-    close(dumpfd);
+        box = &analyzer.boxes[i];
+        if (box->w < CLASSIFY_MIN_SIZE || box->h < CLASSIFY_MIN_SIZE ||
+            cnn_crop(&classifier, frame, fmt.fmt.pix.width, fmt.fmt.pix.height, fmt.fmt.pix.pixelformat, box->x,
+                     box->y, box->w, box->h) == -1)
+            continue;
+        cnn_run(&classifier, &r);
+        __atomic_fetch_add(&detections[r.label], 1, __ATOMIC_RELAXED);
+        last_detected[r.label] = framecnt;
+    }
+    metrics_observe(MS_CLASSIFY, t);
 }
 
-
-/**************************************************CAMERA CAPTURE FUNCTIONS**************************************************/
-// This is probably the most acceptable conversion from camera YUYV to RGB
-//
-// Wikipedia has a good discussion on the details of various conversions and cites good references:
-// http://en.wikipedia.org/wiki/YUV
-//
-// Also http://www.fourcc.org/yuv.php
-//
-// What's not clear without knowing more about the camera in question is how often U & V are sampled compared
-// to Y.
-//
-// E.g. YUV444, which is equivalent to RGB, where both require 3 bytes for each pixel
-//      YUV422, which we assume here, where there are 2 bytes for each pixel, with two Y samples for one U & V,
-//              or as the name implies, 4Y and 2 UV pairs
-//      YUV420, where for every 4 Ys, there is a single UV pair, 1.5 bytes for each pixel or 36 bytes for 24 pixels
-
-void yuv2rgb(int y, int u, int v, unsigned char *r, unsigned char *g, unsigned char *b)
+/*
+ * Classes detected within the last classification interval
+ *
+ * Blobs are classified on one in classify_every frames with motion, so a
+ * detection stands for the frames up to the next classification.
+ *
+ * Parameters:
+ *   None
+ *
+ * Returns:
+ *   Bit per class, for the output triggers
+ */
+static uint32_t recent_detections(void)
 {
-    int r1, g1, b1;
-
-    // replaces floating point coefficients
-    int c = y - 16, d = u - 128, e = v - 128;
-
-    // Conversion that avoids floating point
-    r1 = (298 * c + 409 * e + 128) >> 8;
-    g1 = (298 * c - 100 * d - 208 * e + 128) >> 8;
-    b1 = (298 * c + 516 * d + 128) >> 8;
-
-    // Computed values may need clipping.
-    if (r1 > 255)
-        r1 = 255;
-    if (g1 > 255)
-        g1 = 255;
-    if (b1 > 255)
-        b1 = 255;
-
-    if (r1 < 0)
-        r1 = 0;
-    if (g1 < 0)
-        g1 = 0;
-    if (b1 < 0)
-        b1 = 0;
-
-    *r = r1;
-    *g = g1;
-    *b = b1;
-}
+    uint32_t mask = 0;
+    unsigned int i;
 
-unsigned int framecnt = 0;
-unsigned char bigbuffer[(1280 * 960)];
+    for (i = 0; classifier_enabled && i < classifier.classes; i++)
+        if (last_detected[i] && framecnt - last_detected[i] < classify_every)
+            mask |= 1u << i;
+    return mask;
+}
 
 /*
  * Function to process the frames
  *
- * In each frame, pixel by pixel, the yuv pixels to rgb
+ * Statistics are taken from the raw frame, which is then offered to every
+ * recording output; the outputs convert what they keep.
  *  
  * Parameters:
  *   const void *p -> The buffer holding each frame
@@ -232,10 +429,11 @@ unsigned char bigbuffer[(1280 * 960)];
  */
 static void process_image(const void *p, int size)
 {
-    int i, newi = 0;
     struct timespec frame_time;
-    int y_temp, y2_temp, u_temp, v_temp;
+    struct frame_meta meta;
+    struct out_frame frame;
     unsigned char *pptr = (unsigned char *)p;
+    uint64_t t;
 
     // record when process was called
     clock_gettime(CLOCK_REALTIME, &frame_time);
@@ -245,17 +443,67 @@ static void process_image(const void *p, int size)
 
     if (fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_YUYV)
     {
+        // Subscribers convert from the raw frame on the service thread
+        t = metrics_now();
+        if (service_enabled)
+            fs_publish(&service, pptr, size, &frame_time);
+        if (stream_enabled)
+            us_publish(&stream, pptr, size, &frame_time);
+        if (service_enabled || stream_enabled)
+            metrics_observe(MS_PUBLISH, t);
+
+        if (edges_enabled)
+        {
+            struct edge_stats st;
+            unsigned int i;
+
+            t = metrics_now();
+            edge_frame(&edges, pptr, NULL, NULL, &st);
+            metrics_observe(MS_EDGE, t);
+            __atomic_store_n(&edge_last.mean, st.mean, __ATOMIC_RELAXED);
+            __atomic_store_n(&edge_last.edges, st.edges, __ATOMIC_RELAXED);
+            for (i = 0; i < edge_bins; i++)
+                __atomic_store_n(&edge_last.hist[i], st.hist[i], __ATOMIC_RELAXED);
+        }
 
-        for (i = 0, newi = 0; i < size; i = i + 4, newi = newi + 6)
+        if (wb_enabled && framecnt % wb_every == 0)
         {
-            y_temp = (int)pptr[i];
-            u_temp = (int)pptr[i + 1];
-            y2_temp = (int)pptr[i + 2];
-            v_temp = (int)pptr[i + 3];
-            yuv2rgb(y_temp, u_temp, v_temp, &bigbuffer[newi], &bigbuffer[newi + 1], &bigbuffer[newi + 2]);
-            yuv2rgb(y2_temp, u_temp, v_temp, &bigbuffer[newi + 3], &bigbuffer[newi + 4], &bigbuffer[newi + 5]);
+            t = metrics_now();
+            wb_frame(&white_balance, pptr);
+            metrics_observe(MS_COLOR, t);
         }
-        dump_ppm(bigbuffer, ((size * 6) / 4), framecnt, &frame_time);
+
+        // Only the averaged frame of a timelapse window goes on to conversion and storage
+        if (timelapse_enabled)
+        {
+            t = metrics_now();
+            pptr = (size == (int)timelapse.samples) ? (unsigned char *)tl_add(&timelapse, pptr, &frame_time) : NULL;
+            metrics_observe(MS_TIMELAPSE, t);
+            if (!pptr)
+            {
+                fflush(stderr);
+                return;
+            }
+            frame_time = timelapse.first;
+        }
+
+        // Motion/brightness/blob statistics feed the output triggers and the segment index; the blobs are classified
+        if (analysis_enabled)
+        {
+            t = metrics_now();
+            fa_analyze(&analyzer, pptr, &meta);
+            metrics_observe(MS_ANALYZE, t);
+        }
+        if (classifier_enabled)
+            classify_blobs(pptr);
+
+        // Outputs at the same resolution share one conversion; failures are reported through storage_event()
+        frame.data = pptr;
+        frame.number = framecnt;
+        frame.time = frame_time;
+        frame.meta = analysis_enabled ? &meta : NULL;
+        frame.detected = recent_detections();
+        out_frame(&outputs, &frame);
     }
 
     else
@@ -267,18 +515,180 @@ static void process_image(const void *p, int size)
     fflush(stdout);
 }
 
+// Driver sequence number expected next; gaps are frames the driver dropped
+static uint32_t next_sequence;
+static bool have_sequence = false;
+
+/*
+ * Record the arrival of the first usable frame and log the startup timeline
+ *
+ * Parameters:
+ *   uint64_t now -> When the frame was dequeued (metrics_now())
+ *
+ * Returns:
+ *   None
+ */
+static void startup_done(uint64_t now)
+{
+    __atomic_store_n(&startup.first_frame, now - startup.start, __ATOMIC_RELAXED);
+    syslog(LOG_INFO, "startup: first usable frame after %.1f ms (%s configuration: open %.1f, format %.1f, "
+                     "buffers %.1f, streaming %.1f ms; storage ready %.1f ms; %u warm-up frames, %s)",
+           startup.first_frame / 1e6, startup.cached ? "cached" : "negotiated", startup.open / 1e6,
+           startup.format / 1e6, startup.buffers / 1e6, startup.streaming / 1e6, startup.storage / 1e6,
+           warmup.frames ? warmup.frames - 1 : 0,
+           warmup.state == WU_STABLE ? "exposure settled" : warmup.state == WU_TIMEOUT ? "timed out" : "skipped");
+}
+
+/*
+ * Set exposure and gain as one batch
+ *
+ * Parameters:
+ *   const struct ae_controls *c -> Values from the control loop
+ *
+ * Returns:
+ *   None
+ */
+static void apply_exposure(const struct ae_controls *c)
+{
+    struct v4l2_ext_control ctrl[2];
+    struct v4l2_ext_controls ctrls;
+    struct v4l2_control single;
+    static bool ext_failed;
+    unsigned int i;
+
+    CLEAR(ctrl);
+    ctrl[0].id = V4L2_CID_EXPOSURE_ABSOLUTE;
+    ctrl[0].value = c->exposure;
+    ctrl[1].id = V4L2_CID_GAIN;
+    ctrl[1].value = c->gain;
+
+    // Exposure and gain live in different control classes, which class 0 allows to mix
+    CLEAR(ctrls);
+    ctrls.count = have_gain ? 2 : 1;
+    ctrls.controls = ctrl;
+    if (!ext_failed && 0 == xioctl(fd, VIDIOC_S_EXT_CTRLS, &ctrls))
+        return;
+
+    // Drivers without extended controls get one S_CTRL each
+    ext_failed = true;
+    for (i = 0; i < (have_gain ? 2u : 1u); i++)
+    {
+        single.id = ctrl[i].id;
+        single.value = ctrl[i].value;
+        if (-1 == xioctl(fd, VIDIOC_S_CTRL, &single))
+            syslog(LOG_WARNING, "Cannot set control %#x to %d: %s", single.id, single.value, strerror(errno));
+    }
+}
+
+/*
+ * Hand exposure and gain over to the control loop (-E)
+ *
+ * The camera's auto exposure is switched to manual, and the exposure is
+ * capped at the frame interval of the requested (or the nominal) rate.
+ *
+ * Parameters:
+ *   None
+ *
+ * Returns:
+ *   0 on success, -1 if the camera has no manual exposure control
+ */
+static int init_exposure(void)
+{
+    struct v4l2_queryctrl query;
+    struct v4l2_control ctrl;
+    struct ae_controls start;
+    uint64_t interval = device_cfg.interval_ns ? device_cfg.interval_ns : DEFAULT_FRAME_INTERVAL_NS;
+
+    CLEAR(query);
+    query.id = V4L2_CID_EXPOSURE_ABSOLUTE;
+    if (-1 == xioctl(fd, VIDIOC_QUERYCTRL, &query) || (query.flags & V4L2_CTRL_FLAG_DISABLED))
+        return -1;
+    exposure_cfg.exposure.min = query.minimum;
+    exposure_cfg.exposure.max = query.maximum;
+    start.exposure = query.default_value;
+
+    CLEAR(query);
+    query.id = V4L2_CID_GAIN;
+    have_gain = 0 == xioctl(fd, VIDIOC_QUERYCTRL, &query) && !(query.flags & V4L2_CTRL_FLAG_DISABLED);
+    exposure_cfg.gain.min = have_gain ? query.minimum : 0;
+    exposure_cfg.gain.max = have_gain ? query.maximum : 0;
+    start.gain = have_gain ? query.default_value : 0;
+
+    // Manual exposure, and no lowering of the frame rate behind our back
+    CLEAR(ctrl);
+    ctrl.id = V4L2_CID_EXPOSURE_AUTO;
+    ctrl.value = V4L2_EXPOSURE_MANUAL;
+    if (-1 == xioctl(fd, VIDIOC_S_CTRL, &ctrl))
+        return -1;
+    ctrl.id = V4L2_CID_EXPOSURE_AUTO_PRIORITY;
+    ctrl.value = 0;
+    xioctl(fd, VIDIOC_S_CTRL, &ctrl);
+
+    ctrl.id = V4L2_CID_EXPOSURE_ABSOLUTE;
+    if (0 == xioctl(fd, VIDIOC_G_CTRL, &ctrl))
+        start.exposure = ctrl.value;
+    ctrl.id = V4L2_CID_GAIN;
+    if (have_gain && 0 == xioctl(fd, VIDIOC_G_CTRL, &ctrl))
+        start.gain = ctrl.value;
+
+    // Exposure is in 100 us units
+    if (exposure_fps > 0)
+        interval = 1e9 / exposure_fps;
+    exposure_cfg.exposure_cap = interval / 100000;
+    return ae_init(&exposure, &exposure_cfg, fmt.fmt.pix.width, fmt.fmt.pix.height, fmt.fmt.pix.pixelformat,
+                   &start);
+}
+
+/*
+ * Publish how many buffers the driver holds empty and filled
+ *
+ * Runs on the capture thread, which owns the buffer pool, so the queries
+ * cannot race a restart or a shrink of the queue; the metrics thread only
+ * reads the gauges.
+ *
+ * Parameters:
+ *   None
+ *
+ * Returns:
+ *   None
+ */
+static void sample_queue_depth(void)
+{
+    struct v4l2_buffer buf;
+    unsigned int i, queued = 0, done = 0;
+
+    for (i = 0; i < n_buffers; i++)
+    {
+        CLEAR(buf);
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+        if (xioctl(fd, VIDIOC_QUERYBUF, &buf) == -1)
+            return;
+        if (buf.flags & V4L2_BUF_FLAG_DONE)
+            done++;
+        else if (buf.flags & V4L2_BUF_FLAG_QUEUED)
+            queued++;
+    }
+    metrics_gauge_set(MG_QUEUE_EMPTY, queued);
+    metrics_gauge_set(MG_QUEUE_FILLED, done);
+}
+
 /*
  * Function to read frames
  *  
  * Parameters:
- *   None
+ *   uint64_t wait_start -> When the wait for this frame began (metrics_now())
  *
  * Returns:
  * 	 None 
  */
-static int read_frame(void)
+static int read_frame(uint64_t wait_start)
 {
+    static uint64_t last_sample;
     struct v4l2_buffer buf;
+    struct ae_controls controls;
+    uint64_t dequeued, ready;
 
     CLEAR(buf);
 
@@ -309,6 +719,52 @@ static int read_frame(void)
 
     assert(buf.index < n_buffers);
 
+    // Driver timestamps are taken when the buffer is filled (UVC: at start of
+    // frame), so the ready latency also holds a constant readout time
+    dequeued = metrics_now();
+    if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+    {
+        ready = (uint64_t)buf.timestamp.tv_sec * 1000000000 + (uint64_t)buf.timestamp.tv_usec * 1000;
+        if (ready <= dequeued)
+            metrics_observe(MS_READY, ready);
+    }
+    else
+        ready = dequeued;
+    if (metrics_enabled && dequeued - last_sample >= QUEUE_SAMPLE_NS)
+    {
+        sample_queue_depth();
+        last_sample = dequeued;
+    }
+    if (capture_wait == WAIT_POLL)
+        bp_frame(&poller, ready, dequeued, buf.sequence);
+
+    if (exposure_enabled && !(buf.flags & V4L2_BUF_FLAG_ERROR) && buf.bytesused >= fmt.fmt.pix.sizeimage &&
+        ae_frame(&exposure, buffers[buf.index].start, &controls))
+        apply_exposure(&controls);
+
+    // Warm-up frames go straight back to the driver
+    if (warming_up)
+    {
+        if ((buf.flags & V4L2_BUF_FLAG_ERROR) ||
+            wu_feed(&warmup, buffers[buf.index].start, buf.bytesused) == WU_SETTLING)
+        {
+            if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
+                syslog(LOG_ERR, "VIDIOC_QBUF: %s", strerror(errno));
+            return 0;
+        }
+        warming_up = false;
+    }
+    if (!startup.first_frame && !(buf.flags & V4L2_BUF_FLAG_ERROR))
+        startup_done(dequeued);
+
+    metrics_observe(MS_DEQUEUE, wait_start);
+    metrics_add(MC_FRAMES_CAPTURED, 1);
+    metrics_gauge_add(MG_BUFFERS_HELD, 1);
+    if (have_sequence && buf.sequence != next_sequence)
+        metrics_add(MC_FRAMES_DROPPED, buf.sequence - next_sequence);
+    next_sequence = buf.sequence + 1;
+    have_sequence = true;
+
     process_image(buffers[buf.index].start, buf.bytesused);
 
     if (-1 == xioctl(fd, VIDIOC_QBUF, &buf)){
@@ -316,6 +772,7 @@ static int read_frame(void)
             errno_exit("VIDIOC_QBUF");
         #endif
     }
+    metrics_gauge_add(MG_BUFFERS_HELD, -1);
         
 
     return 1;
@@ -324,7 +781,8 @@ static int read_frame(void)
 /*
  * Function to captures frames
  *
- * The function captures frames every 500 milliseconds
+ * The function captures frames every 500 milliseconds, or as soon as
+ * the next one is ready in the low-latency modes (-L)
  *  
  * Parameters:
  *   None
@@ -332,10 +790,15 @@ static int read_frame(void)
  * Returns:
  * 	 None 
  */
+static void stop_capturing(void);
+static void start_capturing(void);
+
 static void capture_frame(void)
 {
     struct timespec read_delay;
     struct timespec time_error;
+    uint64_t wait_start = metrics_now();
+    static unsigned int restarts;
 
     read_delay.tv_sec = 0;
     read_delay.tv_nsec = 50000000;
@@ -346,14 +809,33 @@ static void capture_frame(void)
         struct timeval tv;
         int r;
 
-        FD_ZERO(&fds);
-        FD_SET(fd, &fds);
+        if (capture_wait == WAIT_POLL)
+        {
+            // Poll first, back off only when no buffer was ready
+            if (read_frame(wait_start))
+            {
+                restarts = 0;
+                mem_enforce();
+                break;
+            }
+            r = metrics_now() - wait_start < 2000000000ULL;
+            if (r)
+            {
+                bp_backoff(&poller);
+                continue;
+            }
+        }
+        else
+        {
+            FD_ZERO(&fds);
+            FD_SET(fd, &fds);
 
-        /* Timeout. */
-        tv.tv_sec = 2;
-        tv.tv_usec = 0;
+            /* Timeout. */
+            tv.tv_sec = 2;
+            tv.tv_usec = 0;
 
-        r = select(fd + 1, &fds, NULL, NULL, &tv);
+            r = select(fd + 1, &fds, NULL, NULL, &tv);
+        }
 
         if (-1 == r)
         {
@@ -368,11 +850,26 @@ static void capture_frame(void)
         if (0 == r)
         {
             fprintf(stderr, "select timeout\n");
-            exit(EXIT_FAILURE);
+            if (++restarts > MAX_DEVICE_RESTARTS)
+                exit(EXIT_FAILURE);
+
+            // A stalled camera often recovers when streaming is restarted
+            syslog(LOG_WARNING, "No frame for 2 s, restarting streaming (%u)", restarts);
+            stop_capturing();
+            start_capturing();
+            have_sequence = false;
+            metrics_add(MC_DEVICE_RESTARTS, 1);
+            wait_start = metrics_now();
+            continue;
         }
 
-        if (read_frame())
+        if (read_frame(wait_start))
         {
+            restarts = 0;
+            // Between frames no buffer is held, so the queue can be resized here
+            mem_enforce();
+            if (capture_wait == WAIT_BLOCK)
+                break;
             if (nanosleep(&read_delay, &time_error) != 0)
                 perror("nanosleep");
             else
@@ -466,12 +963,15 @@ static void uninit_device(void)
     unsigned int i;
 
     for (i = 0; i < n_buffers; ++i)
+    {
         if (-1 == munmap(buffers[i].start, buffers[i].length)){
             #if (PRINT_ENABLE == 1)
                 errno_exit("munmap");
             #endif
         }
-            
+        mem_release(MEM_V4L2, buffers[i].length);
+    }
+
 
     free(buffers);
 }
@@ -491,7 +991,7 @@ static void init_mmap(void)
 
     CLEAR(req);
 
-    req.count = 6;
+    req.count = queue_depth;
     req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     req.memory = V4L2_MEMORY_MMAP;
 
@@ -556,10 +1056,85 @@ static void init_mmap(void)
                 errno_exit("mmap");
             #endif
         }
+        mem_charge(MEM_V4L2, buf.length);
             
     }
 }
 
+/*
+ * Memory shrinker: give capture buffers back to the driver
+ *
+ * A shallower queue only lowers the tolerance to processing hiccups.
+ * Called from mem_enforce() on the capture thread between frames, when
+ * every buffer is queued, so streaming can be restarted with fewer.
+ *
+ * Parameters:
+ *   size_t excess -> Bytes over budget
+ *   void *arg -> Unused
+ *
+ * Returns:
+ *   Bytes released
+ */
+static size_t shrink_queue(size_t excess, void *arg)
+{
+    size_t length, before;
+    unsigned int drop;
+
+    if (n_buffers <= MIN_QUEUE_BUFFERS)
+        return 0;
+    length = buffers[0].length;
+    drop = (excess + length - 1) / length;
+    if (drop > n_buffers - MIN_QUEUE_BUFFERS)
+        drop = n_buffers - MIN_QUEUE_BUFFERS;
+    before = n_buffers * length;
+
+    stop_capturing();
+    uninit_device();
+    queue_depth = n_buffers - drop;
+    init_mmap();
+    start_capturing();
+    have_sequence = false;
+    metrics_gauge_set(MG_BUFFERS_TOTAL, n_buffers);
+    sample_queue_depth();
+
+    return before > n_buffers * length ? before - n_buffers * length : 0;
+}
+
+/*
+ * Nominal frame interval the driver reports
+ *
+ * Parameters:
+ *   None
+ *
+ * Returns:
+ *   Interval in nanoseconds, 0 if the driver has none
+ */
+static uint64_t query_interval_ns(void)
+{
+    struct v4l2_streamparm parm;
+
+    CLEAR(parm);
+    parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (0 == xioctl(fd, VIDIOC_G_PARM, &parm) &&
+        (parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME) &&
+        parm.parm.capture.timeperframe.numerator && parm.parm.capture.timeperframe.denominator)
+        return 1000000000ULL * parm.parm.capture.timeperframe.numerator /
+               parm.parm.capture.timeperframe.denominator;
+    return 0;
+}
+
+/*
+ * Check the device still has the cached format, which was negotiated for HRES x VRES YUYV
+ */
+static bool format_is_cached(const struct v4l2_pix_format *pix)
+{
+    return device_cfg.pixelformat == V4L2_PIX_FMT_YUYV && device_cfg.width == HRES && device_cfg.height == VRES &&
+           pix->pixelformat == device_cfg.pixelformat && pix->width == device_cfg.width &&
+           pix->height == device_cfg.height && pix->bytesperline == device_cfg.bytesperline &&
+           pix->sizeimage == device_cfg.sizeimage && pix->field == device_cfg.field &&
+           pix->colorspace == device_cfg.colorspace;
+}
+
 /*
  * Initializes the camera device
  * 
@@ -567,6 +1142,9 @@ static void init_mmap(void)
  * 1. Find if the camera has streaming capabilities
  * 2. To set the camera format (including the resolution)
  * 
+ * A configuration cached by an earlier run (-c) skips the crop reset, the
+ * frame rate query and, when the device still has the format, S_FMT.
+ *
  * Parameters:
  *   None
  *
@@ -578,6 +1156,7 @@ static void init_device(void)
     struct v4l2_capability cap;
     struct v4l2_cropcap cropcap;
     struct v4l2_crop crop;
+    struct device_config cached;
     unsigned int min;
 
     if (-1 == xioctl(fd, VIDIOC_QUERYCAP, &cap))
@@ -612,11 +1191,28 @@ static void init_device(void)
 
     /* Select video input, video standard and tune here. */
 
+    CLEAR(cached);
+    startup.cached = device_cache && device_cache[0] &&
+                     dc_load(device_cache, (const char *)cap.driver, (const char *)cap.bus_info, &cached) == 0;
+    if (startup.cached)
+        device_cfg = cached;
+    else
+    {
+        CLEAR(device_cfg);
+        snprintf(device_cfg.driver, sizeof(device_cfg.driver), "%s", (const char *)cap.driver);
+        snprintf(device_cfg.bus_info, sizeof(device_cfg.bus_info), "%s", (const char *)cap.bus_info);
+        device_cfg.crop = true;
+    }
+
     CLEAR(cropcap);
 
     cropcap.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
-    if (0 == xioctl(fd, VIDIOC_CROPCAP, &cropcap))
+    if (!device_cfg.crop)
+    {
+        /* Known from the cache that cropping is not supported. */
+    }
+    else if (0 == xioctl(fd, VIDIOC_CROPCAP, &cropcap))
     {
         crop.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
         crop.c = cropcap.defrect; /* reset to default */
@@ -637,14 +1233,21 @@ static void init_device(void)
     else
     {
         /* Errors ignored. */
+        device_cfg.crop = false;
     }
 
     CLEAR(fmt);
 
     fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
-    if (force_format)
+    if (force_format && startup.cached && 0 == xioctl(fd, VIDIOC_G_FMT, &fmt) && format_is_cached(&fmt.fmt.pix))
     {
+        /* Still negotiated from an earlier run. */
+    }
+    else if (force_format)
+    {
+        CLEAR(fmt);
+        fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
         fmt.fmt.pix.width = HRES;
         fmt.fmt.pix.height = VRES;
         fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
@@ -675,8 +1278,25 @@ static void init_device(void)
     min = fmt.fmt.pix.bytesperline * fmt.fmt.pix.height;
     if (fmt.fmt.pix.sizeimage < min)
         fmt.fmt.pix.sizeimage = min;
+    startup.format = metrics_now() - startup.start;
 
     init_mmap();
+    startup.buffers = metrics_now() - startup.start;
+
+    device_cfg.pixelformat = fmt.fmt.pix.pixelformat;
+    device_cfg.width = fmt.fmt.pix.width;
+    device_cfg.height = fmt.fmt.pix.height;
+    device_cfg.bytesperline = fmt.fmt.pix.bytesperline;
+    device_cfg.sizeimage = fmt.fmt.pix.sizeimage;
+    device_cfg.field = fmt.fmt.pix.field;
+    device_cfg.colorspace = fmt.fmt.pix.colorspace;
+    device_cfg.buffers = n_buffers;
+    if (!startup.cached)
+        device_cfg.interval_ns = query_interval_ns();
+
+    if (device_cache && device_cache[0] && memcmp(&cached, &device_cfg, sizeof(cached)) != 0 &&
+        dc_store(device_cache, &device_cfg) == -1)
+        syslog(LOG_WARNING, "Cannot update device cache %s: %s", device_cache, strerror(errno));
 }
 
 /*
@@ -742,24 +1362,652 @@ static void open_device(void)
     }
 }
 
-// Main camera capture logic
-// Captures frames till 
-int main()
+/*
+ * Metrics of the capture device and the background modules
+ *
+ * Called on the metrics thread for every scrape.
+ *
+ * Parameters:
+ *   FILE *out -> Exposition being built
+ *   void *arg -> Unused
+ *
+ * Returns:
+ *   None
+ */
+static void collect_metrics(FILE *out, void *arg)
+{
+    unsigned int i;
+    struct fs_stats fss;
+    struct udp_stream_stats uss;
+    struct retention_stats rs;
+    struct compactor_stats cs;
+    struct busy_poll_stats bps;
+    struct ae_stats aes;
+    struct mem_usage mu;
+    char label[32];
+
+    mem_get_usage(&mu);
+    for (i = 0; i < MEM_COUNT; i++)
+    {
+        snprintf(label, sizeof(label), "category=\"%s\"", mem_category_name(i));
+        metrics_print(out, "camera_memory_bytes", "gauge", i ? NULL : "Memory charged per category", label,
+                      mu.current[i]);
+    }
+    for (i = 0; i < MEM_COUNT; i++)
+    {
+        snprintf(label, sizeof(label), "category=\"%s\"", mem_category_name(i));
+        metrics_print(out, "camera_memory_peak_bytes", "gauge", i ? NULL : "Peak memory charged per category",
+                      label, mu.peak[i]);
+    }
+    metrics_print(out, "camera_memory_budget_bytes", "gauge", "Memory budget, 0 for none", NULL, mu.budget);
+    metrics_print(out, "camera_memory_shrinks_total", "counter", "Shrinker calls that released memory", NULL,
+                  mu.shrinks);
+
+    if (service_enabled)
+    {
+        fs_get_stats(&service, &fss);
+        metrics_print(out, "camera_service_clients", "gauge", "Frame service subscribers", NULL, fss.clients);
+        metrics_print(out, "camera_service_frames_total", "counter", "Frame service hand-over results",
+                      "result=\"published\"", fss.published);
+        metrics_print(out, "camera_service_frames_total", "counter", NULL, "result=\"skipped\"", fss.skipped);
+        metrics_print(out, "camera_service_frames_total", "counter", NULL, "result=\"delivered\"", fss.delivered);
+        metrics_print(out, "camera_service_frames_total", "counter", NULL, "result=\"dropped\"", fss.dropped);
+        metrics_print(out, "camera_service_conversions_total", "counter", "Frame service views produced", NULL,
+                      fss.conversions);
+    }
+    if (stream_enabled)
+    {
+        us_get_stats(&stream, &uss);
+        metrics_print(out, "camera_stream_frames_total", "counter", "UDP stream hand-over results",
+                      "result=\"sent\"", uss.frames);
+        metrics_print(out, "camera_stream_frames_total", "counter", NULL, "result=\"skipped\"", uss.skipped);
+        metrics_print(out, "camera_stream_bytes_total", "counter", "UDP stream payload bytes", NULL, uss.bytes);
+        metrics_print(out, "camera_stream_send_errors_total", "counter", "Datagrams the kernel refused", NULL,
+                      uss.send_errors);
+    }
+    if (retention_enabled)
+    {
+        retention_get_stats(&retention, &rs);
+        metrics_print(out, "camera_recordings_bytes", "gauge", "Recording size at the last retention scan", NULL,
+                      rs.bytes_used);
+        metrics_print(out, "camera_retention_deleted_bytes_total", "counter", "Bytes deleted by retention", NULL,
+                      rs.bytes_deleted);
+    }
+    metrics_print(out, "camera_startup_seconds", "gauge", "Startup timeline since launch", "phase=\"open\"",
+                  startup.open / 1e9);
+    metrics_print(out, "camera_startup_seconds", "gauge", NULL, "phase=\"format\"", startup.format / 1e9);
+    metrics_print(out, "camera_startup_seconds", "gauge", NULL, "phase=\"buffers\"", startup.buffers / 1e9);
+    metrics_print(out, "camera_startup_seconds", "gauge", NULL, "phase=\"streaming\"", startup.streaming / 1e9);
+    metrics_print(out, "camera_startup_seconds", "gauge", NULL, "phase=\"storage\"", startup.storage / 1e9);
+    metrics_print(out, "camera_startup_seconds", "gauge", NULL, "phase=\"first_frame\"",
+                  __atomic_load_n(&startup.first_frame, __ATOMIC_RELAXED) / 1e9);
+    metrics_print(out, "camera_device_config_cached", "gauge", "Device configuration came from the cache", NULL,
+                  startup.cached);
+    if (exposure_enabled)
+    {
+        ae_get_stats(&exposure, &aes);
+        metrics_print(out, "camera_exposure_updates_total", "counter", "Exposure/gain control batches issued", NULL,
+                      aes.updates);
+        metrics_print(out, "camera_exposure", "gauge", "Exposure set by the control loop, 100 us units", NULL,
+                      aes.controls.exposure);
+        metrics_print(out, "camera_gain", "gauge", "Gain set by the control loop", NULL, aes.controls.gain);
+        metrics_print(out, "camera_luma_mean", "gauge", "Mean luma of the last metered frame", NULL, aes.mean);
+    }
+    if (classifier_enabled)
+    {
+        for (i = 0; i < classifier.classes; i++)
+        {
+            snprintf(label, sizeof(label), "class=\"%s\"", classifier.labels[i]);
+            metrics_print(out, "camera_detections_total", "counter", i == 0 ? "Motion blobs classified" : NULL,
+                          label, __atomic_load_n(&detections[i], __ATOMIC_RELAXED));
+        }
+    }
+    if (edges_enabled)
+    {
+        uint64_t total = 0, hist[EDGE_MAX_BINS];
+
+        metrics_print(out, "camera_focus_measure", "gauge", "Mean gradient magnitude of the last frame", NULL,
+                      __atomic_load_n(&edge_last.mean, __ATOMIC_RELAXED) / 256.0);
+        metrics_print(out, "camera_edge_ratio", "gauge", "Share of edge pixels in the last frame", NULL,
+                      (double)__atomic_load_n(&edge_last.edges, __ATOMIC_RELAXED) / (edges.width * edges.height));
+        for (i = 0; i < edge_bins; i++)
+        {
+            hist[i] = __atomic_load_n(&edge_last.hist[i], __ATOMIC_RELAXED);
+            total += hist[i];
+        }
+        for (i = 0; i < edge_bins; i++)
+        {
+            snprintf(label, sizeof(label), "bin=\"%u\"", i);
+            metrics_print(out, "camera_edge_orientation", "gauge",
+                          i == 0 ? "Share of the gradient per orientation bin (bin 0 vertical edges)" : NULL, label,
+                          total ? (double)hist[i] / total : 0.0);
+        }
+    }
+    if (wb_enabled)
+    {
+        static const char *const methods[WB_METHODS] = { "gray_world", "white_patch" };
+        struct wb_stats wbs;
+        char wb_label[160];
+        double red, blue;
+
+        wb_get_stats(&white_balance, &wbs);
+        for (i = 0; i < WB_METHODS; i++)
+        {
+            wb_gains(&wbs, i, &red, &blue);
+            snprintf(wb_label, sizeof(wb_label), "camera=\"%s\",method=\"%s\",channel=\"red\"", dev_name, methods[i]);
+            metrics_print(out, "camera_white_balance_gain", "gauge",
+                          i == 0 ? "Gain that would neutralise the colour cast (G/R, G/B), smoothed" : NULL, wb_label,
+                          red);
+            snprintf(wb_label, sizeof(wb_label), "camera=\"%s\",method=\"%s\",channel=\"blue\"", dev_name,
+                     methods[i]);
+            metrics_print(out, "camera_white_balance_gain", "gauge", NULL, wb_label, blue);
+        }
+        for (i = 0; i < WB_METHODS; i++)
+        {
+            snprintf(wb_label, sizeof(wb_label), "camera=\"%s\",method=\"%s\"", dev_name, methods[i]);
+            metrics_print(out, "camera_color_cast", "gauge",
+                          i == 0 ? "Distance of the mean chroma from neutral, levels, smoothed" : NULL, wb_label,
+                          wb_cast(&wbs, i));
+        }
+        snprintf(wb_label, sizeof(wb_label), "camera=\"%s\"", dev_name);
+        metrics_print(out, "camera_colorfulness", "gauge", "Mean |U - 128| + |V - 128|, smoothed (near 0 in IR mode)",
+                      wb_label, wbs.chroma / 256.0);
+        metrics_print(out, "camera_white_patch_level", "gauge", "Luma above which pixels count as the white patch",
+                      wb_label, wbs.patch_level);
+    }
+    if (outputs.count)
+    {
+        struct out_stats ost[OUT_MAX];
+        char out_label[OUT_MAX][48];
+
+        for (i = 0; i < outputs.count; i++)
+        {
+            out_get_stats(&outputs, i, &ost[i]);
+            snprintf(out_label[i], sizeof(out_label[i]), "output=\"%u\",format=\"%s\"", i,
+                     out_format_name(outputs.out[i].spec.format));
+        }
+        for (i = 0; i < outputs.count; i++)
+            metrics_print(out, "camera_output_frames_total", "counter", i ? NULL : "Frames stored per output",
+                          out_label[i], ost[i].written);
+        for (i = 0; i < outputs.count; i++)
+            metrics_print(out, "camera_output_triggered_total", "counter",
+                          i ? NULL : "Frames that passed the output's trigger", out_label[i], ost[i].triggered);
+        for (i = 0; i < outputs.count; i++)
+            metrics_print(out, "camera_output_bytes_total", "counter", i ? NULL : "Bytes stored per output",
+                          out_label[i], ost[i].bytes);
+        for (i = 0; i < outputs.count; i++)
+            metrics_print(out, "camera_output_errors_total", "counter", i ? NULL : "Frames an output failed to store",
+                          out_label[i], ost[i].errors);
+    }
+    if (capture_wait == WAIT_POLL)
+    {
+        bp_get_stats(&poller, &bps);
+        metrics_print(out, "camera_busy_poll_total", "counter", "Busy-poll backoff steps after an empty DQBUF",
+                      "action=\"spin\"", bps.spins);
+        metrics_print(out, "camera_busy_poll_total", "counter", NULL, "action=\"yield\"", bps.yields);
+        metrics_print(out, "camera_busy_poll_total", "counter", NULL, "action=\"sleep\"", bps.sleeps);
+    }
+    if (compactor_enabled)
+    {
+        compactor_get_stats(&compactor, &cs);
+        metrics_print(out, "camera_compactor_segments_total", "counter", "Segments compacted", NULL, cs.segments);
+        metrics_print(out, "camera_compactor_bytes_saved_total", "counter", "Bytes reclaimed by compaction", NULL,
+                      cs.bytes_in - cs.bytes_out);
+    }
+}
+
+/*
+ * Bring the camera up to streaming
+ *
+ * Runs on its own thread while main() prepares storage, so the sensor is
+ * already delivering (and settling its exposure) when capture begins.
+ *
+ * Parameters:
+ *   void *arg -> Unused
+ *
+ * Returns:
+ *   NULL
+ */
+static void *bring_up_device(void *arg)
 {
     open_device();
+    startup.open = metrics_now() - startup.start;
     init_device();
+    if (exposure_requested)
+    {
+        exposure_enabled = init_exposure() == 0;
+        if (!exposure_enabled)
+            syslog(LOG_ERR, "Camera has no manual exposure control, leaving it on auto");
+    }
     start_capturing();
+    startup.streaming = metrics_now() - startup.start;
+    warming_up = warmup_timeout_ms &&
+                 wu_init(&warmup, fmt.fmt.pix.width, fmt.fmt.pix.height, fmt.fmt.pix.pixelformat,
+                         warmup_timeout_ms) == 0;
+    return NULL;
+}
 
-    // Keep capturing frames till a SIGINT or SIGTERM signal is not triggered
-    // while(is_capture){
-    //     capture_frame();
-    // }
+// Main camera capture logic
+// Captures frames till 
+int main(int argc, char **argv)
+{
+    int opt;
+    unsigned int i, j, frame_count = 1;
+    struct busy_poll_stats bps;
+    struct out_config out_cfg;
+    struct out_stats ost;
+    pthread_t device_thread;
+    bool device_threaded;
+
+    startup.start = metrics_now();
+    while ((opt = getopt(argc, argv, "DCO:n:S:R:A:W:K:U:N:M:B:L:c:w:E:T:Y:G:P:H:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'D':
+            direct_io = true;
+            break;
+        case 'C':
+            if (n_output_specs < OUT_MAX && out_parse("container", &output_specs[n_output_specs]) == 0)
+            {
+                n_output_specs++;
+                break;
+            }
+            fprintf(stderr, "Too many outputs\n");
+            exit(EXIT_FAILURE);
+        case 'O':
+            // "@file" reads a list, one output per line
+            if (optarg[0] == '@')
+            {
+                if (out_load(optarg + 1, output_specs, OUT_MAX, &n_output_specs) == 0)
+                    break;
+            }
+            else if (n_output_specs < OUT_MAX && out_parse(optarg, &output_specs[n_output_specs]) == 0)
+            {
+                n_output_specs++;
+                break;
+            }
+            fprintf(stderr, "Invalid output '%s'\n", optarg);
+            exit(EXIT_FAILURE);
+        case 'n':
+            frame_count = strtoul(optarg, NULL, 0);
+            break;
+        case 'R':
+            retention_cfg.max_bytes = strtoull(optarg, NULL, 0) << 20;
+            retention_enabled = true;
+            break;
+        case 'A':
+            retention_cfg.max_age_sec = strtoul(optarg, NULL, 0);
+            retention_enabled = true;
+            break;
+        case 'W':
+            if (sscanf(optarg, "%u:%u", &retention_cfg.high_watermark, &retention_cfg.low_watermark) < 1)
+                retention_cfg.high_watermark = 0;
+            retention_enabled = true;
+            break;
+        case 'K':
+            if (compactor_parse(optarg, &compactor_cfg) == 0)
+            {
+                compactor_enabled = true;
+                break;
+            }
+            fprintf(stderr, "Invalid compaction setting '%s'\n", optarg);
+            exit(EXIT_FAILURE);
+        case 'U':
+            service_path = optarg;
+            break;
+        case 'N':
+            if (us_parse(optarg, &stream_cfg, stream_dest, sizeof(stream_dest)) == 0)
+            {
+                stream_requested = true;
+                break;
+            }
+            fprintf(stderr, "Invalid stream destination '%s'\n", optarg);
+            exit(EXIT_FAILURE);
+        case 'M':
+            metrics_listen = optarg;
+            break;
+        case 'B':
+            memory_budget = strtoull(optarg, NULL, 0) << 20;
+            break;
+        case 'L':
+            if (strcmp(optarg, "block") == 0)
+            {
+                capture_wait = WAIT_BLOCK;
+                break;
+            }
+            if (strcmp(optarg, "poll") == 0 || sscanf(optarg, "poll:%d", &poll_cpu) == 1)
+            {
+                capture_wait = WAIT_POLL;
+                break;
+            }
+            fprintf(stderr, "Invalid low-latency mode '%s'\n", optarg);
+            exit(EXIT_FAILURE);
+        case 'c':
+            device_cache = optarg;
+            break;
+        case 'w':
+            warmup_timeout_ms = strtoul(optarg, NULL, 0);
+            break;
+        case 'E':
+            {
+                unsigned int target;
+
+                if (sscanf(optarg, "%u:%lf", &target, &exposure_fps) >= 1 && target > 0 && target < 256)
+                {
+                    exposure_cfg.target = target;
+                    exposure_requested = true;
+                    break;
+                }
+            }
+            fprintf(stderr, "Invalid exposure target '%s'\n", optarg);
+            exit(EXIT_FAILURE);
+        case 'T':
+            if (sscanf(optarg, "%u:%u", &timelapse_window, &timelapse_interval) >= 1 && timelapse_window > 0 &&
+                timelapse_window <= TL_MAX_WINDOW)
+                break;
+            fprintf(stderr, "Invalid timelapse '%s'\n", optarg);
+            exit(EXIT_FAILURE);
+        case 'Y':
+            {
+                char *every = strrchr(optarg, ':');
+
+                classifier_path = optarg;
+                if (!every)
+                    break;
+                *every++ = '\0';
+                classify_every = strtoul(every, NULL, 0);
+                if (classify_every > 0)
+                    break;
+            }
+            fprintf(stderr, "Invalid classification interval\n");
+            exit(EXIT_FAILURE);
+        case 'G':
+            if (edge_parse(optarg, &edge_kernel, &edge_bins) == 0)
+            {
+                edges_requested = true;
+                break;
+            }
+            fprintf(stderr, "Invalid gradient kernel '%s'\n", optarg);
+            exit(EXIT_FAILURE);
+        case 'P':
+            if (sscanf(optarg, "%u:%u", &thumb_every, &thumb_width) >= 1 && thumb_width >= 4 &&
+                thumb_width <= THUMB_MAX_WIDTH)
+                break;
+            fprintf(stderr, "Invalid thumbnail setting '%s'\n", optarg);
+            exit(EXIT_FAILURE);
+        case 'H':
+            wb_every = strtoul(optarg, NULL, 0);
+            if (wb_every > 0)
+                break;
+            fprintf(stderr, "Invalid colour statistics interval '%s'\n", optarg);
+            exit(EXIT_FAILURE);
+        case 'S':
+            if (dur_parse(optarg, &durability_policy) == 0)
+                break;
+            fprintf(stderr, "Invalid durability policy '%s'\n", optarg);
+            /* fall through */
+        default:
+            fprintf(stderr, "usage: %s [-D] [-C] [-O output|@file]... [-n frames] [-S policy] [-R MB] [-A seconds]\n"
+                            "       [-W high[:low]]"
+                            " [-K age[:scale[:divisor[:gray]]]] [-U socket] [-N host:port]\n"
+                            "       [-M port|socket] [-B MB] [-L block|poll[:cpu]] [-c file] [-w ms]\n"
+                            "       [-E luma[:fps]] [-T frames[:seconds]] [-Y model[:n]]\n"
+                            "       [-G sobel|scharr[:bins]] [-P n[:width]] [-H n]\n"
+                            "  -D  write frames with O_DIRECT (buffered fallback)\n"
+                            "  -C  append frames to 4 MB-batched segment files (same as -O container)\n"
+                            "  -O  record to this output, repeatable (default one PPM per frame):\n"
+                            "      raw|ppm|pgm|jpeg|container[,scale=1|2|4|8][,every=N][,quality=Q]\n"
+                            "      [,when=always|motion:LEVEL|blobs:N|detect:LABEL][,dir=PATH][,prefix=NAME];\n"
+                            "      outputs at the same scale share their conversion\n"
+                            "  -n  number of frames to capture, 0 until SIGINT/SIGTERM (default 1)\n"
+                            "  -S  durability: none, frames:N, ms:M, frames:N,ms:M or writeback (default none)\n"
+                            "  -R  keep at most MB of recordings, counted across all output directories\n"
+                            "  -A  delete recordings older than this many seconds\n"
+                            "  -W  clean up when the filesystem is high%% full, down to low%%\n"
+                            "  -K  rewrite segments older than age seconds at 1/scale resolution,\n"
+                            "      keeping 1 of divisor frames, optionally luma only\n"
+                            "  -U  serve frames to local subscribers on this Unix socket\n"
+                            "  -N  stream raw frames over UDP to host:port (see udp_receiver)\n"
+                            "  -M  serve Prometheus metrics on 127.0.0.1:port or a Unix socket path\n"
+                            "  -B  memory budget in MB; capture buffers are given up to stay under it\n"
+                            "  -L  take each frame as soon as it is ready, waiting in select() or\n"
+                            "      busy-polling on a thread pinned to cpu; prints the latency on exit\n"
+                            "  -c  device configuration cache (default .camera_cache, \"\" for none)\n"
+                            "  -w  wait up to ms for the exposure to settle before the first frame\n"
+                            "      (default 1500, 0 keeps the very first frame)\n"
+                            "  -E  control exposure and gain for this mean luma (1-255) without\n"
+                            "      dropping below fps (default the nominal rate)\n"
+                            "  -T  store one average of this many frames, every so many seconds\n"
+                            "      (default back to back); -n counts captured frames\n"
+                            "  -Y  classify the largest motion blobs of every n-th frame with motion\n"
+                            "      (default 3) with the CNN in model (see cnn_bench)\n"
+                            "  -G  export the focus measure, edge density and, with bins, the edge\n"
+                            "      orientation of every frame as metrics\n"
+                            "  -P  keep a thumbnail of width pixels (default 40) of every\n"
+                            "      n-th stored frame (default 1, 0 for none) in container indexes,\n"
+                            "      at most a quarter of the stored width\n"
+                            "  -H  export gray-world and white-patch colour cast metrics of every\n"
+                            "      n-th frame\n",
+                    argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (n_output_specs == 0)
+        out_parse("ppm", &output_specs[n_output_specs++]);
+    mem_set_budget(memory_budget);
+
+    // The camera comes up in parallel with recovery and the storage setup below
+    device_threaded = pthread_create(&device_thread, NULL, bring_up_device, NULL) == 0;
+    if (!device_threaded)
+        bring_up_device(NULL);
+
+    if (classifier_path)
+    {
+        if (cnn_load(&classifier, classifier_path) == 0)
+            classifier_enabled = true;
+        else
+            syslog(LOG_ERR, "Cannot load classifier %s: %s", classifier_path, strerror(errno));
+    }
+
+    // Detection triggers name a class of the model; without it loaded they never fire
+    for (i = 0; i < n_output_specs; i++)
+    {
+        if (output_specs[i].trigger != OUT_DETECT)
+            continue;
+        output_specs[i].threshold = CNN_MAX_CLASSES;
+        for (j = 0; classifier_enabled && j < classifier.classes; j++)
+            if (strcmp(classifier.labels[j], output_specs[i].label) == 0)
+                output_specs[i].threshold = j;
+        if (!classifier_path || (classifier_enabled && output_specs[i].threshold == CNN_MAX_CLASSES))
+        {
+            fprintf(stderr, "Output %u: no classifier class '%s' (see -Y)\n", i, output_specs[i].label);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Segments torn by a crash are repaired before anything else touches the container directories
+    out_cfg.direct = direct_io;
+    out_cfg.policy = durability_policy;
+    out_cfg.on_event = storage_event;
+    out_cfg.arg = NULL;
+    out_cfg.thumb_every = thumb_every;
+    out_cfg.thumb_width = thumb_width;
+    if (out_init(&outputs, &out_cfg, output_specs, n_output_specs) == -1)
+    {
+        fprintf(stderr, "Invalid output list\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Retention covers everything the outputs record, the compactor their containers
+    for (i = 0; i < n_output_specs; i++)
+    {
+        add_dir(retention_cfg.dirs, &retention_cfg.n_dirs, RETENTION_MAX_DIRS, output_specs[i].dir);
+        if (output_specs[i].format == OUT_CONTAINER)
+            add_dir(compactor_cfg.dirs, &compactor_cfg.n_dirs, COMPACTOR_MAX_DIRS, output_specs[i].dir);
+    }
+    if (retention_enabled && retention_start(&retention, &retention_cfg) == -1)
+    {
+        syslog(LOG_ERR, "Cannot start retention manager: %s", strerror(errno));
+        retention_enabled = false;
+    }
+    if (compactor_enabled && compactor_start(&compactor, &compactor_cfg) == -1)
+    {
+        syslog(LOG_ERR, "Cannot start compactor: %s", strerror(errno));
+        compactor_enabled = false;
+    }
+
+    signal(SIGINT, signalHandler);
+    signal(SIGTERM, signalHandler);
+
+    startup.storage = metrics_now() - startup.start;
+    if (device_threaded)
+        pthread_join(device_thread, NULL);
+
+    if (out_start(&outputs, fmt.fmt.pix.width, fmt.fmt.pix.height, fmt.fmt.pix.pixelformat) == -1)
+    {
+        fprintf(stderr, "Cannot record %ux%u frames to these outputs: %s\n", fmt.fmt.pix.width, fmt.fmt.pix.height,
+                strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    analysis_enabled = out_needs_meta(&outputs) || classifier_enabled;
+    if (analysis_enabled && fa_init(&analyzer, fmt.fmt.pix.width, fmt.fmt.pix.height, fmt.fmt.pix.pixelformat) == -1)
+    {
+        fprintf(stderr, "Cannot analyse %ux%u frames\n", fmt.fmt.pix.width, fmt.fmt.pix.height);
+        exit(EXIT_FAILURE);
+    }
 
-    // Edit: Capture a single frame - Testing for Gstreamer
-    capture_frame();
+    if (service_path)
+    {
+        if (fs_start(&service, service_path, fmt.fmt.pix.width, fmt.fmt.pix.height, fmt.fmt.pix.pixelformat) == 0)
+            service_enabled = true;
+        else
+            syslog(LOG_ERR, "Cannot start frame service on %s: %s", service_path, strerror(errno));
+    }
+    if (stream_requested)
+    {
+        if (us_start(&stream, &stream_cfg, fmt.fmt.pix.width, fmt.fmt.pix.height, fmt.fmt.pix.pixelformat,
+                     fmt.fmt.pix.sizeimage) == 0)
+            stream_enabled = true;
+        else
+            syslog(LOG_ERR, "Cannot stream to %s:%s: %s", stream_cfg.host, stream_cfg.port, strerror(errno));
+    }
+
+    if (edges_requested)
+    {
+        if (edge_init(&edges, fmt.fmt.pix.width, fmt.fmt.pix.height, fmt.fmt.pix.pixelformat, edge_kernel,
+                      edge_bins) == 0)
+            edges_enabled = true;
+        else
+            syslog(LOG_ERR, "Cannot compute gradients of %ux%u frames: %s", fmt.fmt.pix.width, fmt.fmt.pix.height,
+                   strerror(errno));
+    }
+    if (wb_every)
+    {
+        if (wb_init(&white_balance, fmt.fmt.pix.width, fmt.fmt.pix.height, fmt.fmt.pix.pixelformat) == 0)
+            wb_enabled = true;
+        else
+            syslog(LOG_ERR, "Cannot measure colour of %ux%u frames: %s", fmt.fmt.pix.width, fmt.fmt.pix.height,
+                   strerror(errno));
+    }
+    if (timelapse_window)
+    {
+        if (tl_init(&timelapse, fmt.fmt.pix.sizeimage, timelapse_window, timelapse_interval) == 0)
+            timelapse_enabled = true;
+        else
+            syslog(LOG_ERR, "Cannot start timelapse: %s", strerror(errno));
+    }
+
+    metrics_gauge_set(MG_BUFFERS_TOTAL, n_buffers);
+    if (memory_budget)
+        mem_register_shrinker("capture queue", shrink_queue, NULL);
+    if (metrics_listen)
+    {
+        if (metrics_start(&metrics, metrics_listen, collect_metrics, NULL) == 0)
+            metrics_enabled = true;
+        else
+            syslog(LOG_ERR, "Cannot serve metrics on %s: %s", metrics_listen, strerror(errno));
+    }
+
+    // Pinned last, so the worker threads started above are not tied to this CPU
+    if (capture_wait == WAIT_POLL)
+    {
+        bp_init(&poller, device_cfg.interval_ns ? device_cfg.interval_ns : DEFAULT_FRAME_INTERVAL_NS);
+        if (poll_cpu >= 0 && bp_pin(poll_cpu) == -1)
+            syslog(LOG_ERR, "Cannot pin capture thread to CPU %d: %s", poll_cpu, strerror(errno));
+    }
+
+    // Keep capturing frames till a SIGINT or SIGTERM signal is not triggered
+    // Edit: Capture a single frame by default - Testing for Gstreamer
+    for (i = 0; is_capture && (frame_count == 0 || i < frame_count); i++)
+        capture_frame();
     
     is_capture = false;
+    if (capture_wait != WAIT_PACED)
+    {
+        fprintf(stderr, "ready latency (%s): %llu frames, mean %.1f us, p50 <= %g us, p99 <= %g us\n",
+                capture_wait == WAIT_POLL ? "poll" : "block",
+                (unsigned long long)metrics_stages[MS_READY].count,
+                metrics_stages[MS_READY].count ?
+                    metrics_stages[MS_READY].sum_ns / 1e3 / metrics_stages[MS_READY].count : 0.0,
+                metrics_quantile(MS_READY, 0.5) * 1e6, metrics_quantile(MS_READY, 0.99) * 1e6);
+    }
+    if (capture_wait == WAIT_POLL)
+    {
+        bp_get_stats(&poller, &bps);
+        fprintf(stderr, "busy poll: %llu empty polls, %llu spins, %llu yields, %llu sleeps\n",
+                (unsigned long long)bps.polls, (unsigned long long)bps.spins,
+                (unsigned long long)bps.yields, (unsigned long long)bps.sleeps);
+    }
+    if (classifier_enabled)
+    {
+        fprintf(stderr, "classifier (%s):", cnn_impl());
+        for (i = 0; i < classifier.classes; i++)
+            fprintf(stderr, " %s %llu", classifier.labels[i], (unsigned long long)detections[i]);
+        fprintf(stderr, "\n");
+        cnn_free(&classifier);
+    }
+    for (i = 0; i < outputs.count; i++)
+    {
+        out_get_stats(&outputs, i, &ost);
+        fprintf(stderr, "output %u (%s %ux%u): %llu of %llu triggered frames written, %llu bytes, %llu errors\n", i,
+                out_format_name(outputs.out[i].spec.format), outputs.out[i].width, outputs.out[i].height,
+                (unsigned long long)ost.written, (unsigned long long)ost.triggered, (unsigned long long)ost.bytes,
+                (unsigned long long)ost.errors);
+    }
+    if (out_close(&outputs) == -1)
+        syslog(LOG_ERR, "Container close failed: %s", strerror(errno));
+    if (analysis_enabled)
+        fa_free(&analyzer);
+    if (edges_enabled)
+        edge_free(&edges);
+    if (wb_enabled)
+    {
+        struct wb_stats wbs;
+        double red, blue;
+
+        wb_get_stats(&white_balance, &wbs);
+        wb_gains(&wbs, WB_GRAY_WORLD, &red, &blue);
+        fprintf(stderr, "colour (%s): %llu frames, gray-world gains R %.2f B %.2f, cast %.1f, colourfulness %.1f\n",
+                wb_impl(), (unsigned long long)wbs.frames, red, blue, wb_cast(&wbs, WB_GRAY_WORLD), wbs.chroma / 256.0);
+    }
+    if (timelapse_enabled)
+    {
+        fprintf(stderr, "timelapse (%s): %llu averaged frames\n", tl_impl(), (unsigned long long)timelapse.emitted);
+        tl_free(&timelapse);
+    }
     stop_capturing();
+    if (metrics_enabled)
+        metrics_stop(&metrics);
+    if (service_enabled)
+        fs_stop(&service);
+    if (stream_enabled)
+        us_stop(&stream);
+    if (retention_enabled)
+        retention_stop(&retention);
+    if (compactor_enabled)
+        compactor_stop(&compactor);
     uninit_device();
     close_device();
     fprintf(stderr, "\n");
@@ -0,0 +1,587 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Int8 inference of a tiny CNN on motion-blob crops
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <linux/videodev2.h>
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "cnn.h"
+#include "memacct.h"
+
+#define ROUND_UP(n, a)  (((n) + (a) - 1) / (a) * (a))
+
+/*
+ * Dot products over multiples of CNN_ALIGN bytes
+ *
+ * dot3() is one output of a 3x3 convolution: three kernel rows of len
+ * weights against three input rows stride bytes apart.
+ */
+#if defined(__x86_64__)
+static inline __m128i madd_s8(__m128i acc, const int8_t *a, const int8_t *b, uint32_t n)
+{
+    __m128i va, vb;
+    uint32_t i;
+
+    for (i = 0; i < n; i += 16)
+    {
+        va = _mm_loadu_si128((const __m128i *)(a + i));
+        vb = _mm_loadu_si128((const __m128i *)(b + i));
+        // Sign extension: the byte lands in the high half, then an arithmetic shift
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_srai_epi16(_mm_unpacklo_epi8(va, va), 8),
+                                                _mm_srai_epi16(_mm_unpacklo_epi8(vb, vb), 8)));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_srai_epi16(_mm_unpackhi_epi8(va, va), 8),
+                                                _mm_srai_epi16(_mm_unpackhi_epi8(vb, vb), 8)));
+    }
+    return acc;
+}
+
+static inline int32_t hsum(__m128i v)
+{
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(v);
+}
+
+static int32_t dot(const int8_t *a, const int8_t *b, uint32_t n)
+{
+    return hsum(madd_s8(_mm_setzero_si128(), a, b, n));
+}
+
+static int32_t dot3(const int8_t *a, uint32_t stride, const int8_t *b, uint32_t len)
+{
+    __m128i acc = madd_s8(_mm_setzero_si128(), a, b, len);
+
+    acc = madd_s8(acc, a + stride, b + len, len);
+    acc = madd_s8(acc, a + 2 * stride, b + 2 * len, len);
+    return hsum(acc);
+}
+#elif defined(__ARM_NEON)
+static inline int32x4_t madd_s8(int32x4_t acc, const int8_t *a, const int8_t *b, uint32_t n)
+{
+    int8x16_t va, vb;
+    uint32_t i;
+
+    for (i = 0; i < n; i += 16)
+    {
+        va = vld1q_s8(a + i);
+        vb = vld1q_s8(b + i);
+#if defined(__ARM_FEATURE_DOTPROD)
+        acc = vdotq_s32(acc, va, vb);
+#else
+        acc = vpadalq_s16(acc, vmull_s8(vget_low_s8(va), vget_low_s8(vb)));
+        acc = vpadalq_s16(acc, vmull_s8(vget_high_s8(va), vget_high_s8(vb)));
+#endif
+    }
+    return acc;
+}
+
+static inline int32_t hsum(int32x4_t v)
+{
+    int64x2_t s = vpaddlq_s32(v);
+
+    return (int32_t)(vgetq_lane_s64(s, 0) + vgetq_lane_s64(s, 1));
+}
+
+static int32_t dot(const int8_t *a, const int8_t *b, uint32_t n)
+{
+    return hsum(madd_s8(vdupq_n_s32(0), a, b, n));
+}
+
+static int32_t dot3(const int8_t *a, uint32_t stride, const int8_t *b, uint32_t len)
+{
+    int32x4_t acc = madd_s8(vdupq_n_s32(0), a, b, len);
+
+    acc = madd_s8(acc, a + stride, b + len, len);
+    acc = madd_s8(acc, a + 2 * stride, b + 2 * len, len);
+    return hsum(acc);
+}
+#else
+static int32_t dot(const int8_t *a, const int8_t *b, uint32_t n)
+{
+    int32_t acc = 0;
+    uint32_t i;
+
+    for (i = 0; i < n; i++)
+        acc += a[i] * b[i];
+    return acc;
+}
+
+static int32_t dot3(const int8_t *a, uint32_t stride, const int8_t *b, uint32_t len)
+{
+    return dot(a, b, len) + dot(a + stride, b + len, len) + dot(a + 2 * stride, b + 2 * len, len);
+}
+#endif
+
+/*
+ * Name of the dot product kernel in use
+ *
+ * Parameters:
+ *   None
+ *
+ * Returns:
+ *   "sse2", "neon-dotprod", "neon" or "scalar"
+ */
+const char *cnn_impl(void)
+{
+#if defined(__x86_64__)
+    return "sse2";
+#elif defined(__ARM_NEON) && defined(__ARM_FEATURE_DOTPROD)
+    return "neon-dotprod";
+#elif defined(__ARM_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
+
+static inline int8_t requantize(const struct cnn_layer *l, int32_t acc)
+{
+    int64_t v = ((int64_t)acc * l->multiplier + ((int64_t)1 << (l->shift - 1))) >> l->shift;
+
+    if (v > 127)
+        return 127;
+    if (v < ((l->flags & CNN_RELU) ? 0 : -128))
+        return (l->flags & CNN_RELU) ? 0 : -128;
+    return (int8_t)v;
+}
+
+/*
+ * Zero the one-pixel border around a w x h x c tensor
+ */
+static void clear_border(int8_t *base, uint32_t w, uint32_t h, uint32_t c)
+{
+    uint32_t stride = (w + 2) * c, y;
+
+    memset(base, 0, stride);
+    memset(base + (size_t)(h + 1) * stride, 0, stride);
+    for (y = 1; y <= h; y++)
+    {
+        memset(base + (size_t)y * stride, 0, c);
+        memset(base + (size_t)y * stride + (w + 1) * c, 0, c);
+    }
+}
+
+/*
+ * One row of a convolution (before pooling), channels interleaved
+ */
+static void conv_row(const struct cnn_layer *l, uint32_t y, int8_t *dst)
+{
+    uint32_t stride = (l->in_w + 2) * l->in_c, x, oc;
+    const int8_t *p = l->in + (size_t)y * stride, *w;
+
+    for (x = 0; x < l->in_w; x++, p += l->in_c)
+    {
+        w = l->weights;
+        for (oc = 0; oc < l->out_c; oc++, w += 3 * l->row_len)
+            *dst++ = requantize(l, l->bias[oc] + dot3(p, stride, w, l->row_len));
+    }
+}
+
+/*
+ * Convolution, requantization, ReLU and pooling in one pass
+ *
+ * A pooled layer computes two convolution rows into scratch and reduces
+ * them straight into the output row.
+ */
+static void run_conv(const struct cnn_layer *l, int8_t *scratch)
+{
+    uint32_t c = l->out_c, row = l->in_w * c, x, y, oc;
+    const int8_t *a, *b;
+    int8_t *dst, m;
+
+    if (l->out_pad)
+        clear_border(l->out, l->out_w, l->out_h, c);
+    for (y = 0; y < l->out_h; y++)
+    {
+        dst = l->out + (size_t)(y + l->out_pad) * l->out_stride + l->out_pad * c;
+        if (!(l->flags & CNN_POOL2))
+        {
+            conv_row(l, y, dst);
+            continue;
+        }
+
+        conv_row(l, 2 * y, scratch);
+        conv_row(l, 2 * y + 1, scratch + row);
+        for (x = 0; x < l->out_w; x++)
+        {
+            a = scratch + 2 * x * c;
+            b = a + row;
+            for (oc = 0; oc < c; oc++)
+            {
+                m = a[oc] > a[oc + c] ? a[oc] : a[oc + c];
+                m = b[oc] > m ? b[oc] : m;
+                m = b[oc + c] > m ? b[oc + c] : m;
+                *dst++ = m;
+            }
+        }
+    }
+}
+
+static void run_dense(const struct cnn_layer *l)
+{
+    const int8_t *w = l->weights;
+    uint32_t o;
+
+    for (o = 0; o < l->out_c; o++, w += l->row_len)
+        l->out[o] = requantize(l, l->bias[o] + dot(l->in, w, l->row_len));
+}
+
+/*
+ * Read a whole file into memory
+ */
+static uint8_t *read_file(const char *path, size_t *size)
+{
+    struct stat st;
+    uint8_t *buf;
+    FILE *f;
+
+    f = fopen(path, "rb");
+    if (!f)
+        return NULL;
+    if (fstat(fileno(f), &st) == -1 || st.st_size <= 0 || st.st_size > (64 << 20))
+    {
+        fclose(f);
+        errno = EINVAL;
+        return NULL;
+    }
+    buf = malloc(st.st_size);
+    if (!buf)
+    {
+        fclose(f);
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (fread(buf, 1, st.st_size, f) != (size_t)st.st_size)
+    {
+        free(buf);
+        fclose(f);
+        errno = EIO;
+        return NULL;
+    }
+    fclose(f);
+    *size = st.st_size;
+    return buf;
+}
+
+/*
+ * Check the layers and work out the shapes and memory of the plan
+ *
+ * With params set, the weights are also copied in, each kernel row
+ * zero-padded to the layer's row_len.
+ */
+static int plan(struct cnn_net *net, const uint8_t *file, size_t size, uint8_t *params, size_t *params_size,
+                size_t *tensor_size, size_t *scratch_size)
+{
+    struct cnn_file_layer fl;
+    struct cnn_layer *l;
+    uint32_t w = net->width, h = net->height, c = net->channels, k, o, r, taps;
+    size_t off = sizeof(struct cnn_file_header) + (size_t)net->classes * CNN_LABEL_LEN, p = 0, bytes;
+    int8_t *weights;
+    unsigned int i;
+    bool spatial = true;
+
+    *tensor_size = 0;
+    *scratch_size = 0;
+    for (i = 0; i < net->layers; i++)
+    {
+        l = &net->layer[i];
+        if (off + sizeof(fl) > size)
+            return -1;
+        memcpy(&fl, file + off, sizeof(fl));
+        off += sizeof(fl);
+        if (fl.out == 0 || fl.out > CNN_MAX_DIM || fl.shift < 1 || fl.shift > 62 || (fl.flags & ~(CNN_RELU | CNN_POOL2)))
+            return -1;
+
+        l->type = fl.type;
+        l->flags = fl.flags;
+        l->multiplier = fl.multiplier;
+        l->shift = fl.shift;
+        l->out_c = fl.out;
+        if (fl.type == CNN_CONV3X3)
+        {
+            if (!spatial || ((fl.flags & CNN_POOL2) && (w < 2 || h < 2)))
+                return -1;
+            l->in_w = w;
+            l->in_h = h;
+            l->in_c = c;
+            l->out_w = (fl.flags & CNN_POOL2) ? w / 2 : w;
+            l->out_h = (fl.flags & CNN_POOL2) ? h / 2 : h;
+            l->row_len = ROUND_UP(3 * c, CNN_ALIGN);
+            taps = 9 * c;
+            net->macs += (uint64_t)w * h * fl.out * taps;
+            if ((fl.flags & CNN_POOL2) && (size_t)2 * w * fl.out > *scratch_size)
+                *scratch_size = (size_t)2 * w * fl.out;
+            w = l->out_w;
+            h = l->out_h;
+            c = fl.out;
+        }
+        else if (fl.type == CNN_DENSE)
+        {
+            if (fl.flags & CNN_POOL2)
+                return -1;
+            l->in_w = l->in_h = 1;
+            l->in_c = w * h * c;
+            l->out_w = l->out_h = 1;
+            l->row_len = ROUND_UP(l->in_c, CNN_ALIGN);
+            taps = l->in_c;
+            net->macs += (uint64_t)taps * fl.out;
+            w = h = 1;
+            c = fl.out;
+            spatial = false;
+        }
+        else
+            return -1;
+
+        bytes = (size_t)fl.out * taps;
+        if (off + bytes + (size_t)fl.out * sizeof(int32_t) > size)
+            return -1;
+        if (params)
+        {
+            l->bias = (const int32_t *)(params + p);
+            memcpy(params + p, file + off + bytes, (size_t)fl.out * sizeof(int32_t));
+            weights = (int8_t *)(params + p + ROUND_UP((size_t)fl.out * sizeof(int32_t), CNN_ALIGN));
+            l->weights = weights;
+            // Conv weights are [out][ky][kx * in_c] in the file; one padded row per ky
+            r = (fl.type == CNN_CONV3X3) ? 3 * l->in_c : taps;
+            for (o = 0; o < fl.out; o++)
+                for (k = 0; k < taps / r; k++)
+                    memcpy(weights + ((size_t)o * (taps / r) + k) * l->row_len, file + off + (size_t)o * taps + k * r, r);
+        }
+        p += ROUND_UP((size_t)fl.out * sizeof(int32_t), CNN_ALIGN) +
+             (size_t)fl.out * ((fl.type == CNN_CONV3X3) ? 3 : 1) * l->row_len;
+        off += bytes + (size_t)fl.out * sizeof(int32_t);
+    }
+
+    // The output of layer i is padded when layer i + 1 is a convolution
+    l = &net->layer[net->layers - 1];
+    if (l->type != CNN_DENSE || l->out_c != net->classes || off != size)
+        return -1;
+    for (i = 0; i < net->layers; i++)
+    {
+        l = &net->layer[i];
+        l->out_pad = (i + 1 < net->layers && net->layer[i + 1].type == CNN_CONV3X3);
+        l->out_stride = (l->out_w + 2 * l->out_pad) * l->out_c;
+        bytes = (size_t)l->out_stride * (l->out_h + 2 * l->out_pad);
+        if (bytes > *tensor_size)
+            *tensor_size = bytes;
+    }
+    l = &net->layer[0];
+    bytes = (l->type == CNN_CONV3X3) ? (size_t)(net->width + 2) * (net->height + 2) * net->channels
+                                     : (size_t)net->width * net->height * net->channels;
+    if (bytes > *tensor_size)
+        *tensor_size = bytes;
+    *params_size = p;
+    return 0;
+}
+
+/*
+ * Load a model and plan its execution
+ *
+ * Parameters:
+ *   struct cnn_net *net -> Network to initialise
+ *   const char *path -> Model file (see cnn.h)
+ *
+ * Returns:
+ *   0 on success, -1 with errno set (EINVAL for a malformed model, ENOMEM,
+ *   or the error opening the file)
+ */
+int cnn_load(struct cnn_net *net, const char *path)
+{
+    struct cnn_file_header hdr;
+    size_t size, tensor, scratch, params, unused[3];
+    uint8_t *file;
+    int8_t *buf[2];
+    struct cnn_layer *l;
+    unsigned int i;
+
+    memset(net, 0, sizeof(*net));
+    file = read_file(path, &size);
+    if (!file)
+        return -1;
+
+    if (size < sizeof(hdr))
+        goto invalid;
+    memcpy(&hdr, file, sizeof(hdr));
+    if (memcmp(hdr.magic, CNN_MAGIC, 4) != 0 || hdr.version != CNN_VERSION || hdr.layers == 0 ||
+        hdr.layers > CNN_MAX_LAYERS || hdr.width == 0 || hdr.width > CNN_MAX_DIM || hdr.height == 0 ||
+        hdr.height > CNN_MAX_DIM || hdr.channels == 0 || hdr.channels > CNN_MAX_DIM || hdr.classes == 0 ||
+        hdr.classes > CNN_MAX_CLASSES || size < sizeof(hdr) + (size_t)hdr.classes * CNN_LABEL_LEN)
+        goto invalid;
+
+    net->width = hdr.width;
+    net->height = hdr.height;
+    net->channels = hdr.channels;
+    net->layers = hdr.layers;
+    net->classes = hdr.classes;
+    for (i = 0; i < net->classes; i++)
+    {
+        memcpy(net->labels[i], file + sizeof(hdr) + i * CNN_LABEL_LEN, CNN_LABEL_LEN);
+        net->labels[i][CNN_LABEL_LEN - 1] = '\0';
+    }
+    if (plan(net, file, size, NULL, &params, &tensor, &scratch) == -1)
+        goto invalid;
+
+    // Two ping-pong activation buffers, each with slack for the padded dot products
+    tensor = ROUND_UP(tensor + CNN_ALIGN, CNN_ALIGN);
+    net->params_size = params;
+    net->arena_size = 2 * tensor + ROUND_UP(scratch, CNN_ALIGN);
+    if (posix_memalign((void **)&net->params, CNN_ALIGN, net->params_size) != 0 ||
+        posix_memalign((void **)&net->arena, CNN_ALIGN, net->arena_size) != 0)
+    {
+        cnn_free(net);
+        free(file);
+        errno = ENOMEM;
+        return -1;
+    }
+    memset(net->params, 0, net->params_size);
+    memset(net->arena, 0, net->arena_size);
+    net->macs = 0;
+    plan(net, file, size, net->params, &unused[0], &unused[1], &unused[2]);
+    free(file);
+
+    buf[0] = (int8_t *)net->arena;
+    buf[1] = (int8_t *)net->arena + tensor;
+    net->scratch = (int8_t *)net->arena + 2 * tensor;
+    for (i = 0; i < net->layers; i++)
+    {
+        l = &net->layer[i];
+        l->in = buf[i % 2];
+        l->out = buf[(i + 1) % 2];
+    }
+    if (net->layer[0].type == CNN_CONV3X3)
+    {
+        net->input_stride = (net->width + 2) * net->channels;
+        net->input = buf[0] + net->input_stride + net->channels;
+    }
+    else
+    {
+        net->input_stride = net->width * net->channels;
+        net->input = buf[0];
+    }
+    mem_charge(MEM_ANALYSIS, net->params_size + net->arena_size);
+    return 0;
+
+invalid:
+    free(file);
+    memset(net, 0, sizeof(*net));
+    errno = EINVAL;
+    return -1;
+}
+
+/*
+ * Fill the input with a crop of a packed 4:2:2 frame
+ *
+ * The crop is scaled to the network's input by nearest-neighbour sampling
+ * of the luma, so only single-channel models take crops.
+ *
+ * Parameters:
+ *   struct cnn_net *net -> The network
+ *   const uint8_t *frame -> Packed 4:2:2 frame
+ *   uint32_t width, height -> Frame geometry in pixels
+ *   uint32_t pixelformat -> V4L2_PIX_FMT_YUYV or V4L2_PIX_FMT_UYVY
+ *   uint32_t x, y, w, h -> Crop in pixels; clipped to the frame
+ *
+ * Returns:
+ *   0 on success, -1 with errno set to EINVAL
+ */
+int cnn_crop(struct cnn_net *net, const uint8_t *frame, uint32_t width, uint32_t height, uint32_t pixelformat,
+             uint32_t x, uint32_t y, uint32_t w, uint32_t h)
+{
+    unsigned int yo = (pixelformat == V4L2_PIX_FMT_UYVY) ? 1 : 0;
+    uint32_t xs[CNN_MAX_DIM], i, j;
+    const uint8_t *row;
+    int8_t *dst;
+
+    if (net->channels != 1 || (pixelformat != V4L2_PIX_FMT_YUYV && pixelformat != V4L2_PIX_FMT_UYVY) ||
+        x >= width || y >= height)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (w > width - x)
+        w = width - x;
+    if (h > height - y)
+        h = height - y;
+    if (w == 0 || h == 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (net->layer[0].type == CNN_CONV3X3)
+        clear_border(net->input - net->input_stride - 1, net->width, net->height, 1);
+    for (i = 0; i < net->width; i++)
+        xs[i] = (x + (2 * i + 1) * w / (2 * net->width)) * 2 + yo;
+    for (j = 0; j < net->height; j++)
+    {
+        row = frame + (size_t)(y + (2 * j + 1) * h / (2 * net->height)) * width * 2;
+        dst = net->input + (size_t)j * net->input_stride;
+        for (i = 0; i < net->width; i++)
+            dst[i] = (int8_t)(row[xs[i]] - 128);
+    }
+    return 0;
+}
+
+/*
+ * Run the network on its input
+ *
+ * Parameters:
+ *   struct cnn_net *net -> The network, its input filled
+ *   struct cnn_result *r -> Class scores and the winning class
+ *
+ * Returns:
+ *   None
+ */
+void cnn_run(struct cnn_net *net, struct cnn_result *r)
+{
+    const int8_t *scores;
+    unsigned int i;
+
+    for (i = 0; i < net->layers; i++)
+    {
+        if (net->layer[i].type == CNN_CONV3X3)
+            run_conv(&net->layer[i], net->scratch);
+        else
+            run_dense(&net->layer[i]);
+    }
+
+    scores = net->layer[net->layers - 1].out;
+    r->label = 0;
+    for (i = 0; i < net->classes; i++)
+    {
+        r->score[i] = scores[i];
+        if (scores[i] > scores[r->label])
+            r->label = i;
+    }
+}
+
+/*
+ * Release the network
+ *
+ * Parameters:
+ *   struct cnn_net *net -> The network
+ *
+ * Returns:
+ *   None
+ */
+void cnn_free(struct cnn_net *net)
+{
+    if (net->params && net->arena)
+        mem_release(MEM_ANALYSIS, net->params_size + net->arena_size);
+    free(net->params);
+    free(net->arena);
+    memset(net, 0, sizeof(*net));
+}
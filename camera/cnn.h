@@ -0,0 +1,123 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Int8 inference of a tiny CNN on motion-blob crops
+ *
+ * Motion alone fires on trees and shadows, so the blobs found by the
+ * frame analysis can be classified by a small convolutional network. The
+ * engine runs int8 activations and weights with int32 accumulators:
+ * 3x3 convolutions are computed directly on channel-interleaved (HWC)
+ * tensors rather than through im2col, so each kernel row is one
+ * contiguous dot product over 3 * channels bytes, done with SIMD (SSE2,
+ * NEON, or the ARMv8.2 dot product instructions) on rows padded to 16.
+ * Bias, requantization, ReLU and 2x2 max pooling are fused into the
+ * convolution, which produces two rows at a time and pools them on the
+ * spot, so the full-resolution activations never exist. The execution
+ * plan is made when the model is loaded: every tensor lives in one arena
+ * allocated then (ping-pong activation buffers with zero borders and a
+ * two-row pooling scratch), so inference itself never allocates.
+ *
+ * Model file (little endian), as written by cnn_bench -o:
+ *   struct cnn_file_header
+ *   char labels[classes][CNN_LABEL_LEN]
+ *   for each layer:
+ *     struct cnn_file_layer
+ *     int8_t weights[out][3][3][in channels] (conv) or [out][inputs] (dense)
+ *     int32_t bias[out]
+ * Dense layers take the previous tensor flattened in HWC order; the last
+ * layer must be dense with one output per class. A layer's output is
+ * (accumulator * multiplier) >> shift, rounded and saturated to int8 (or
+ * to 0..127 with ReLU). The input is luma - 128.
+ */
+
+#ifndef CNN_H
+#define CNN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CNN_MAGIC       "TCNN"
+#define CNN_VERSION     1
+#define CNN_MAX_LAYERS  16
+#define CNN_MAX_CLASSES 16
+#define CNN_LABEL_LEN   16
+#define CNN_MAX_DIM     256     // Tensor width, height and channels
+#define CNN_ALIGN       16      // Dot products run over multiples of this
+
+enum cnn_layer_type
+{
+    CNN_CONV3X3 = 1,            // Stride 1, zero padding 1
+    CNN_DENSE = 2,
+};
+
+#define CNN_RELU        0x01
+#define CNN_POOL2       0x02    // 2x2 max pooling after the activation (conv only)
+
+struct cnn_file_header
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t layers;
+    uint16_t width;
+    uint16_t height;
+    uint16_t channels;
+    uint16_t classes;
+};
+
+struct cnn_file_layer
+{
+    uint8_t type;               // enum cnn_layer_type
+    uint8_t flags;              // CNN_RELU, CNN_POOL2
+    uint16_t out;               // Output channels (conv) or outputs (dense)
+    int32_t multiplier;
+    uint8_t shift;              // 1..62
+    uint8_t reserved[3];
+};
+
+struct cnn_layer
+{
+    uint8_t type;
+    uint8_t flags;
+    uint32_t in_w, in_h, in_c;  // Dense: in_c is the flattened input length
+    uint32_t out_w, out_h, out_c;
+    uint32_t row_len;           // Weights per kernel row (conv) or per output (dense), padded to CNN_ALIGN
+    const int8_t *weights;      // [out_c][3][row_len] (conv) or [out_c][row_len] (dense)
+    const int32_t *bias;
+    int32_t multiplier;
+    uint8_t shift;
+    const int8_t *in;
+    int8_t *out;
+    uint32_t out_stride;        // Bytes per output row
+    uint32_t out_pad;           // 1 when the output has a zero border for the next convolution
+};
+
+struct cnn_net
+{
+    uint32_t width, height, channels;
+    unsigned int layers;
+    unsigned int classes;
+    char labels[CNN_MAX_CLASSES][CNN_LABEL_LEN];
+    struct cnn_layer layer[CNN_MAX_LAYERS];
+    int8_t *input;              // Pixel (0, 0) of the input, channels interleaved; cnn_run() overwrites it
+    uint32_t input_stride;      // Bytes per input row
+    uint8_t *params;            // Weights and biases
+    uint8_t *arena;             // Activations and scratch
+    size_t params_size;
+    size_t arena_size;
+    int8_t *scratch;            // Two convolution rows of a pooled layer
+    uint64_t macs;              // Multiply-accumulates per inference
+};
+
+struct cnn_result
+{
+    unsigned int label;         // Class with the highest score
+    int8_t score[CNN_MAX_CLASSES];
+};
+
+int cnn_load(struct cnn_net *net, const char *path);
+int cnn_crop(struct cnn_net *net, const uint8_t *frame, uint32_t width, uint32_t height, uint32_t pixelformat,
+             uint32_t x, uint32_t y, uint32_t w, uint32_t h);
+void cnn_run(struct cnn_net *net, struct cnn_result *r);
+void cnn_free(struct cnn_net *net);
+const char *cnn_impl(void);
+
+#endif
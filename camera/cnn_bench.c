@@ -0,0 +1,399 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Correctness and throughput of the int8 CNN engine
+ *
+ * Loads a model given with -m, or writes a synthetic one with random
+ * weights in the architecture the classifier is sized for (32x32 luma,
+ * three 3x3 conv + ReLU + 2x2 pool stages of 8, 16 and 32 channels, a
+ * 32-unit hidden layer and background/person/vehicle outputs) and loads
+ * that, which also exercises the model file format (-o keeps the file).
+ * Random crops of a synthetic frame are then classified by the engine
+ * and by a plain unfused reference that convolves with bounds checks and
+ * pools afterwards; any difference in the class scores is an error. The
+ * engine is finally timed for -s seconds on crops of the frame, crop
+ * sampling included, and the crops per second and multiply-accumulate
+ * rate are reported.
+ *
+ * The exit status is non-zero if the model does not load or the engine
+ * differs from the reference.
+ *
+ * usage: cnn_bench [-m model] [-o file] [-s seconds] [-x seed]
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <linux/videodev2.h>
+
+#include "cnn.h"
+
+#define FRAME_WIDTH      640
+#define FRAME_HEIGHT     480
+#define VERIFY_CROPS     64
+#define BENCH_CROPS      256
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t xorshift(uint32_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 17;
+    *s ^= *s << 5;
+    return *s;
+}
+
+/*
+ * Write the synthetic model
+ */
+static int write_model(const char *path, uint32_t seed)
+{
+    static const struct
+    {
+        uint8_t type;
+        uint8_t flags;
+        uint16_t out;
+    } arch[] = {
+        { CNN_CONV3X3, CNN_RELU | CNN_POOL2, 8 },
+        { CNN_CONV3X3, CNN_RELU | CNN_POOL2, 16 },
+        { CNN_CONV3X3, CNN_RELU | CNN_POOL2, 32 },
+        { CNN_DENSE, CNN_RELU, 32 },
+        { CNN_DENSE, 0, 3 },
+    };
+    static const char labels[3][CNN_LABEL_LEN] = { "background", "person", "vehicle" };
+    struct cnn_file_header hdr = {
+        .magic = CNN_MAGIC,
+        .version = CNN_VERSION,
+        .layers = sizeof(arch) / sizeof(arch[0]),
+        .width = 32,
+        .height = 32,
+        .channels = 1,
+        .classes = 3,
+    };
+    struct cnn_file_layer fl;
+    uint32_t w = hdr.width, h = hdr.height, c = hdr.channels, taps, i, n;
+    int8_t weight;
+    int32_t bias;
+    FILE *f;
+
+    f = fopen(path, "wb");
+    if (!f)
+        return -1;
+    fwrite(&hdr, sizeof(hdr), 1, f);
+    fwrite(labels, sizeof(labels), 1, f);
+    for (i = 0; i < hdr.layers; i++)
+    {
+        taps = arch[i].type == CNN_CONV3X3 ? 9 * c : w * h * c;
+        memset(&fl, 0, sizeof(fl));
+        fl.type = arch[i].type;
+        fl.flags = arch[i].flags;
+        fl.out = arch[i].out;
+        // Scaled for weights of +-24 on activations of about 40 to come out at about 32
+        fl.shift = 20;
+        fl.multiplier = (int32_t)(32.0 / (sqrt(taps) * 14 * 40) * (1 << 20));
+        fwrite(&fl, sizeof(fl), 1, f);
+        for (n = 0; n < taps * fl.out; n++)
+        {
+            weight = (int8_t)((int)(xorshift(&seed) % 49) - 24);
+            fwrite(&weight, 1, 1, f);
+        }
+        for (n = 0; n < fl.out; n++)
+        {
+            bias = (int32_t)(xorshift(&seed) % 512) - 256;
+            fwrite(&bias, sizeof(bias), 1, f);
+        }
+        if (arch[i].type == CNN_CONV3X3)
+        {
+            w /= 2;
+            h /= 2;
+            c = fl.out;
+        }
+        else
+        {
+            w = h = 1;
+            c = fl.out;
+        }
+    }
+    if (fclose(f) != 0)
+        return -1;
+    return 0;
+}
+
+static int8_t ref_requantize(const struct cnn_layer *l, int64_t acc)
+{
+    int64_t v = (acc * l->multiplier + ((int64_t)1 << (l->shift - 1))) >> l->shift;
+    int64_t lo = (l->flags & CNN_RELU) ? 0 : -128;
+
+    return v > 127 ? 127 : v < lo ? lo : v;
+}
+
+// The input, unpadded; it has to be saved before cnn_run() reuses the buffer
+static void save_input(const struct cnn_net *net, int8_t *a)
+{
+    uint32_t y;
+
+    for (y = 0; y < net->height; y++)
+        memcpy(a + (size_t)y * net->width * net->channels, net->input + (size_t)y * net->input_stride,
+               net->width * net->channels);
+}
+
+/*
+ * Reference: unpadded tensors, bounds-checked convolution, separate pooling
+ *
+ * a holds the input from save_input()
+ */
+static void reference(const struct cnn_net *net, int8_t *a, int8_t *b, int8_t *conv, int8_t *scores)
+{
+    const struct cnn_layer *l;
+    uint32_t x, y, oc, ic, kx, ky, i;
+    int ix, iy;
+    int8_t *swap, m;
+    int64_t acc;
+
+    for (i = 0; i < net->layers; i++)
+    {
+        l = &net->layer[i];
+        if (l->type == CNN_DENSE)
+        {
+            for (oc = 0; oc < l->out_c; oc++)
+            {
+                acc = l->bias[oc];
+                for (ic = 0; ic < l->in_c; ic++)
+                    acc += a[ic] * l->weights[(size_t)oc * l->row_len + ic];
+                b[oc] = ref_requantize(l, acc);
+            }
+        }
+        else
+        {
+            for (y = 0; y < l->in_h; y++)
+                for (x = 0; x < l->in_w; x++)
+                    for (oc = 0; oc < l->out_c; oc++)
+                    {
+                        acc = l->bias[oc];
+                        for (ky = 0; ky < 3; ky++)
+                            for (kx = 0; kx < 3; kx++)
+                            {
+                                iy = (int)y + (int)ky - 1;
+                                ix = (int)x + (int)kx - 1;
+                                if (iy < 0 || ix < 0 || iy >= (int)l->in_h || ix >= (int)l->in_w)
+                                    continue;
+                                for (ic = 0; ic < l->in_c; ic++)
+                                    acc += a[((size_t)iy * l->in_w + ix) * l->in_c + ic] *
+                                           l->weights[((size_t)oc * 3 + ky) * l->row_len + kx * l->in_c + ic];
+                            }
+                        conv[((size_t)y * l->in_w + x) * l->out_c + oc] = ref_requantize(l, acc);
+                    }
+            if (!(l->flags & CNN_POOL2))
+                memcpy(b, conv, (size_t)l->in_w * l->in_h * l->out_c);
+            else
+            {
+                for (y = 0; y < l->out_h; y++)
+                    for (x = 0; x < l->out_w; x++)
+                        for (oc = 0; oc < l->out_c; oc++)
+                        {
+                            m = -128;
+                            for (ky = 0; ky < 2; ky++)
+                                for (kx = 0; kx < 2; kx++)
+                                    if (conv[((size_t)(2 * y + ky) * l->in_w + 2 * x + kx) * l->out_c + oc] > m)
+                                        m = conv[((size_t)(2 * y + ky) * l->in_w + 2 * x + kx) * l->out_c + oc];
+                            b[((size_t)y * l->out_w + x) * l->out_c + oc] = m;
+                        }
+            }
+        }
+        swap = a;
+        a = b;
+        b = swap;
+    }
+    memcpy(scores, a, net->classes);
+}
+
+/*
+ * Textured gradient with a few solid shapes, as packed YUYV
+ */
+static void synthesize(uint8_t *frame, uint32_t seed)
+{
+    uint32_t x, y, i;
+    uint8_t *p;
+
+    for (y = 0; y < FRAME_HEIGHT; y++)
+    {
+        for (x = 0; x < FRAME_WIDTH; x++)
+        {
+            p = frame + ((size_t)y * FRAME_WIDTH + x) * 2;
+            p[0] = (x + y) / 5 + (xorshift(&seed) & 31);
+            p[1] = 128;
+        }
+    }
+    for (i = 0; i < 12; i++)
+    {
+        uint32_t bx = xorshift(&seed) % (FRAME_WIDTH - 64), by = xorshift(&seed) % (FRAME_HEIGHT - 96);
+        uint32_t bw = 8 + xorshift(&seed) % 56, bh = 8 + xorshift(&seed) % 88;
+        uint8_t luma = xorshift(&seed);
+
+        for (y = by; y < by + bh; y++)
+            for (x = bx; x < bx + bw; x++)
+                frame[((size_t)y * FRAME_WIDTH + x) * 2] = luma;
+    }
+}
+
+static void random_box(uint32_t *seed, uint32_t *box)
+{
+    box[2] = 16 + xorshift(seed) % 145;
+    box[3] = 16 + xorshift(seed) % 145;
+    box[0] = xorshift(seed) % (FRAME_WIDTH - box[2]);
+    box[1] = xorshift(seed) % (FRAME_HEIGHT - box[3]);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-m model] [-o file] [-s seconds] [-x seed]\n"
+                    "  -m  model file to check (default a synthetic model)\n"
+                    "  -o  write the synthetic model to this file and keep it\n"
+                    "  -s  benchmark duration in seconds (default 2)\n"
+                    "  -x  seed of the synthetic model, frame and crops (default 1)\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    const char *model = NULL, *out = NULL;
+    char tmp[] = "/tmp/cnn_benchXXXXXX";
+    struct cnn_net net;
+    struct cnn_result r;
+    uint32_t seed = 1, box[BENCH_CROPS][4], i, mismatches = 0;
+    size_t tensor = 0, t;
+    int8_t *a, *b, *conv, scores[CNN_MAX_CLASSES];
+    uint64_t crops = 0, labels[CNN_MAX_CLASSES] = { 0 };
+    double seconds = 2, start, elapsed;
+    uint8_t *frame;
+    int opt, fd;
+
+    while ((opt = getopt(argc, argv, "m:o:s:x:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'm':
+            model = optarg;
+            break;
+        case 'o':
+            out = optarg;
+            break;
+        case 's':
+            seconds = atof(optarg);
+            break;
+        case 'x':
+            seed = strtoul(optarg, NULL, 0) | 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (!model)
+    {
+        if (!out)
+        {
+            fd = mkstemp(tmp);
+            if (fd == -1)
+            {
+                perror("mkstemp");
+                return EXIT_FAILURE;
+            }
+            close(fd);
+        }
+        model = out ? out : tmp;
+        if (write_model(model, seed) == -1)
+        {
+            perror(model);
+            return EXIT_FAILURE;
+        }
+    }
+    if (cnn_load(&net, model) == -1)
+    {
+        fprintf(stderr, "Cannot load %s: %s\n", model, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if (model == tmp)
+        unlink(tmp);
+
+    printf("%s: %ux%ux%u, %u layers, %u classes, %.2f MMAC per crop, %zu bytes of weights, %zu bytes of arena, %s\n",
+           model == tmp ? "synthetic model" : model, net.width, net.height, net.channels, net.layers, net.classes,
+           net.macs / 1e6, net.params_size, net.arena_size, cnn_impl());
+
+    for (i = 0; i < net.layers; i++)
+    {
+        t = (size_t)net.layer[i].in_w * net.layer[i].in_h *
+            (net.layer[i].in_c > net.layer[i].out_c ? net.layer[i].in_c : net.layer[i].out_c);
+        if (t > tensor)
+            tensor = t;
+    }
+    frame = malloc((size_t)FRAME_WIDTH * FRAME_HEIGHT * 2);
+    a = malloc(tensor);
+    b = malloc(tensor);
+    conv = malloc(tensor);
+    if (!frame || !a || !b || !conv)
+    {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+    synthesize(frame, seed);
+    for (i = 0; i < BENCH_CROPS; i++)
+        random_box(&seed, box[i]);
+
+    for (i = 0; i < VERIFY_CROPS; i++)
+    {
+        if (cnn_crop(&net, frame, FRAME_WIDTH, FRAME_HEIGHT, V4L2_PIX_FMT_YUYV, box[i][0], box[i][1], box[i][2],
+                     box[i][3]) == -1)
+        {
+            fprintf(stderr, "Cannot crop: %s\n", strerror(errno));
+            return EXIT_FAILURE;
+        }
+        save_input(&net, a);
+        cnn_run(&net, &r);
+        reference(&net, a, b, conv, scores);
+        if (memcmp(r.score, scores, net.classes) != 0)
+        {
+            if (mismatches++ == 0)
+                fprintf(stderr, "crop %u (%ux%u at %u,%u): scores differ from the reference\n", i, box[i][2],
+                        box[i][3], box[i][0], box[i][1]);
+        }
+    }
+    printf("verify: %u crops, %u differ from the reference\n", VERIFY_CROPS, mismatches);
+
+    start = now_sec();
+    do
+    {
+        for (i = 0; i < BENCH_CROPS; i++)
+        {
+            cnn_crop(&net, frame, FRAME_WIDTH, FRAME_HEIGHT, V4L2_PIX_FMT_YUYV, box[i][0], box[i][1], box[i][2],
+                     box[i][3]);
+            cnn_run(&net, &r);
+            labels[r.label]++;
+        }
+        crops += BENCH_CROPS;
+        elapsed = now_sec() - start;
+    } while (elapsed < seconds);
+
+    printf("bench: %llu crops in %.2f s, %.0f crops/s, %.3f ms per crop, %.1f MMAC/s\n", (unsigned long long)crops,
+           elapsed, crops / elapsed, elapsed * 1e3 / crops, crops * (double)net.macs / elapsed / 1e6);
+    for (i = 0; i < net.classes; i++)
+        printf("  %-16s %llu\n", net.labels[i], (unsigned long long)labels[i]);
+
+    cnn_free(&net);
+    free(frame);
+    free(a);
+    free(b);
+    free(conv);
+    return mismatches ? EXIT_FAILURE : 0;
+}
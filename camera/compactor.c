@@ -0,0 +1,477 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Tiered retention: background segment compactor
+ *
+ * A segment is rewritten into "<name>.tmp" through the container writer
+ * with O_DIRECT (so compaction does not churn the page cache either), so
+ * it gets checkpoints and a fresh index like a recorded segment, with the
+ * statistics and thumbnails of the surviving frames taken from the old
+ * index. Both are synced, given the original modification time so
+ * retention still ages them correctly, and renamed over the originals.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <dirent.h>
+#include <syslog.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <linux/videodev2.h>
+
+#include "compactor.h"
+#include "background.h"
+#include "frame_container.h"
+#include "frame_index.h"
+#include "durability.h"
+
+#define COMPACTOR_INTERVAL_MS   60000
+
+/*
+ * Parse "age[:scale[:divisor[:gray]]]"
+ *
+ * Parameters:
+ *   const char *s -> Option string, e.g. "3600:2:5:gray"
+ *   struct compactor_config *cfg -> Fields age_sec, scale, frame_divisor, gray are set
+ *
+ * Returns:
+ *   0 on success, -1 on a malformed string
+ */
+int compactor_parse(const char *s, struct compactor_config *cfg)
+{
+    char gray[8] = "";
+    int n;
+
+    cfg->scale = 2;
+    cfg->frame_divisor = 1;
+    cfg->gray = false;
+    n = sscanf(s, "%u:%u:%u:%7s", &cfg->age_sec, &cfg->scale, &cfg->frame_divisor, gray);
+    if (n < 1 || cfg->scale == 0 || cfg->frame_divisor == 0)
+        return -1;
+    if (n == 4)
+    {
+        if (strcmp(gray, "gray") != 0)
+            return -1;
+        cfg->gray = true;
+    }
+    return 0;
+}
+
+/*
+ * Reduce one RGB24 frame: box-average scale x scale blocks, optionally to luma
+ *
+ * Parameters:
+ *   const struct compactor_config *cfg -> Scale and gray settings
+ *   const unsigned char *in -> RGB24 frame
+ *   uint32_t width, height -> Input geometry
+ *   unsigned char *out -> Output buffer
+ *
+ * Returns:
+ *   Number of bytes written to out
+ */
+static size_t reduce_frame(const struct compactor_config *cfg, const unsigned char *in,
+                           uint32_t width, uint32_t height, unsigned char *out)
+{
+    unsigned int s = cfg->scale, area = s * s;
+    uint32_t ow = width / s, oh = height / s, x, y, i, j;
+    unsigned int r, g, b;
+    unsigned char *o = out;
+    const unsigned char *px;
+
+    for (y = 0; y < oh; y++)
+    {
+        for (x = 0; x < ow; x++)
+        {
+            r = g = b = 0;
+            for (j = 0; j < s; j++)
+            {
+                px = in + ((size_t)(y * s + j) * width + x * s) * 3;
+                for (i = 0; i < s; i++, px += 3)
+                {
+                    r += px[0];
+                    g += px[1];
+                    b += px[2];
+                }
+            }
+            r /= area;
+            g /= area;
+            b /= area;
+            if (cfg->gray)
+                *o++ = (77 * r + 150 * g + 29 * b) >> 8;
+            else
+            {
+                *o++ = r;
+                *o++ = g;
+                *o++ = b;
+            }
+        }
+    }
+    return o - out;
+}
+
+/*
+ * Statistics and thumbnail the old index holds for a frame
+ *
+ * Rows are visited in sequence order, so the cursors only move forward.
+ *
+ * Parameters:
+ *   const struct fi_index *ix -> Index of the original segment
+ *   uint64_t seq -> Frame sequence number
+ *   uint32_t *row, *thumb -> Cursors into the rows and the thumbnails
+ *   struct frame_meta *m -> Statistics of the frame
+ *   const uint8_t **thumb_data -> Thumbnail of the frame, NULL if it has none
+ *
+ * Returns:
+ *   true if the index lists the frame
+ */
+static bool index_lookup(const struct fi_index *ix, uint64_t seq, uint32_t *row, uint32_t *thumb,
+                         struct frame_meta *m, const uint8_t **thumb_data)
+{
+    *thumb_data = NULL;
+    while (*row < ix->hdr->count && ix->hdr->first_seq + ix->seq[*row] < seq)
+        (*row)++;
+    if (*row == ix->hdr->count || ix->hdr->first_seq + ix->seq[*row] != seq)
+        return false;
+
+    memset(m, 0, sizeof(*m));
+    m->motion = ix->motion[*row];
+    m->brightness = ix->brightness[*row];
+    m->blobs = ix->blobs[*row];
+    while (*thumb < ix->thumb_count && ix->thumb_row[*thumb] < *row)
+        (*thumb)++;
+    if (*thumb < ix->thumb_count && ix->thumb_row[*thumb] == *row)
+        *thumb_data = ix->thumbs + (size_t)*thumb * ix->thumb_width * ix->thumb_height * 3;
+    return true;
+}
+
+/*
+ * Rewrite one segment at reduced quality
+ *
+ * A segment without a single full frame to keep is deleted with its index.
+ *
+ * Parameters:
+ *   struct compactor *c -> The compactor
+ *   const char *path -> Segment to compact
+ *   const struct stat *orig -> stat() of the segment
+ *   struct bg_throttle *t -> Throttle of the worker thread
+ *
+ * Returns:
+ *   0 if compacted or skipped, -1 on failure (the original is kept)
+ */
+static int compact_segment(struct compactor *c, const char *path, const struct stat *orig, struct bg_throttle *t)
+{
+    const struct compactor_config *cfg = &c->cfg;
+    const struct durability_policy policy = { .mode = DUR_PERIODIC };
+    const struct fc_record_header *rec;
+    const uint8_t *thumb;
+    struct frame_meta meta;
+    struct durability dur;
+    struct fc_config fc;
+    struct fc_writer cw;
+    struct fc_reader rd;
+    struct fi_index ix;
+    struct timespec times[2], ts;
+    unsigned char *out = NULL;
+    char tmp[FC_PATH_LEN], idx[FC_PATH_LEN], tmp_idx[FC_PATH_LEN];
+    size_t frame_bytes, out_bytes;
+    uint64_t index = 0, bytes_in, bytes_out;
+    uint32_t row = 0, thumb_row = 0;
+    bool have_index, found, kept;
+    int ret = 0, err;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    fi_index_path(idx, sizeof(idx), path);
+    fi_index_path(tmp_idx, sizeof(tmp_idx), tmp);
+
+    if (fc_reader_open(&rd, path) == -1)
+        return -1;
+
+    frame_bytes = (size_t)rd.hdr->width * rd.hdr->height * 3;
+    if ((rd.hdr->flags & FC_SEG_COMPACTED) || rd.hdr->pixelformat != V4L2_PIX_FMT_RGB24 ||
+        rd.hdr->width < cfg->scale || rd.hdr->height < cfg->scale)
+    {
+        fc_reader_close(&rd);
+        return 0;
+    }
+
+    // Statistics and thumbnails of the surviving frames carry over to the new index
+    have_index = fi_open(&ix, idx) == 0;
+
+    memset(&fc, 0, sizeof(fc));
+    fc.path = tmp;
+    fc.flags = rd.hdr->flags | FC_SEG_COMPACTED;
+    fc.width = rd.hdr->width / cfg->scale;
+    fc.height = rd.hdr->height / cfg->scale;
+    fc.pixelformat = cfg->gray ? V4L2_PIX_FMT_GREY : V4L2_PIX_FMT_RGB24;
+    fc.segment_size = rd.size + FC_CHUNK_SIZE;    // Never rotates: the rewrite is no larger than the original
+    fc.direct = true;
+    fc.first_seq = rd.hdr->first_seq;
+    if (have_index)
+    {
+        fc.thumb_width = ix.thumb_width;
+        fc.thumb_height = ix.thumb_height;
+        fc.thumb_every = ix.thumb_count ? ix.hdr->count / ix.thumb_count : 0;
+    }
+    // No syncs while writing; closing syncs the segment and its index once
+    dur_init(&dur, &policy, DUR_SCOPE_STREAM, NULL, NULL);
+    fc.durability = &dur;
+
+    out = malloc((size_t)fc.width * fc.height * 3);
+    if (!out || fc_writer_init(&cw, &fc) == -1)
+    {
+        free(out);
+        if (have_index)
+            fi_close(&ix);
+        fc_reader_close(&rd);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // Through the container writer, so the rewrite gets checkpoints and an index like any segment
+    while ((rec = fc_reader_next(&rd)) != NULL && !c->stop)
+    {
+        if (index++ % cfg->frame_divisor != 0 || rec->length < frame_bytes)
+            continue;
+        out_bytes = reduce_frame(cfg, (const unsigned char *)(rec + 1), rd.hdr->width, rd.hdr->height, out);
+        found = have_index && index_lookup(&ix, rec->seq, &row, &thumb_row, &meta, &thumb);
+        ts.tv_sec = rec->timestamp_ns / 1000000000;
+        ts.tv_nsec = rec->timestamp_ns % 1000000000;
+        cw.next_seq = rec->seq;
+        if (fc_append(&cw, out, out_bytes, &ts, found ? &meta : NULL, found ? thumb : NULL) == -1)
+        {
+            ret = -1;
+            break;
+        }
+        bg_throttle(t, rec->length + out_bytes);
+    }
+    if (c->stop && ret == 0)
+    {
+        errno = ECANCELED;
+        ret = -1;
+    }
+
+    err = errno;
+    kept = cw.open;
+    bytes_in = rd.size;
+    bytes_out = cw.fw.length;
+    if (fc_writer_close(&cw) == -1 && ret == 0)
+    {
+        err = errno;
+        ret = -1;
+    }
+    if (have_index)
+        fi_close(&ix);
+    fc_reader_close(&rd);
+    free(out);
+
+    // Keep the original age so retention and later scans see the footage's real age. The index goes
+    // first: between the renames it lists a subset of the frames the segment still holds.
+    times[0] = orig->st_atim;
+    times[1] = orig->st_mtim;
+    if (ret == 0 && kept)
+    {
+        if (utimensat(AT_FDCWD, tmp, times, 0) == -1 || access(path, F_OK) == -1 ||
+            rename(tmp_idx, idx) == -1 || rename(tmp, path) == -1)
+        {
+            err = errno;
+            ret = -1;
+        }
+    }
+    // Not one full frame to keep: left in place it would be read again on every pass
+    else if (ret == 0)
+    {
+        bytes_out = 0;
+        if ((unlink(idx) == -1 && errno != ENOENT) || unlink(path) == -1)
+        {
+            err = errno;
+            ret = -1;
+        }
+    }
+    if (ret == 0)
+    {
+        pthread_mutex_lock(&c->lock);
+        c->stats.segments++;
+        c->stats.bytes_in += bytes_in;
+        c->stats.bytes_out += bytes_out;
+        pthread_mutex_unlock(&c->lock);
+    }
+    if (ret == -1 || !kept)
+    {
+        unlink(tmp);
+        unlink(tmp_idx);
+    }
+    errno = err;
+    return ret;
+}
+
+/*
+ * Compact the aged segments of one container directory
+ *
+ * Parameters:
+ *   struct compactor *c -> The compactor
+ *   struct bg_throttle *t -> Throttle of the worker thread
+ *   const char *dir -> Container directory
+ *
+ * Returns:
+ *   None
+ */
+static void compact_dir(struct compactor *c, struct bg_throttle *t, const char *dir)
+{
+    char newest[256] = "", path[FC_PATH_LEN - 4];
+    size_t len;
+    time_t now = time(NULL);
+    struct dirent *de;
+    struct stat st;
+    DIR *d;
+
+    d = opendir(dir);
+    if (!d)
+        return;
+
+    // Segment names sort by first sequence number; the last one is being written
+    while ((de = readdir(d)) != NULL)
+    {
+        len = strlen(de->d_name);
+        if (len > 4 && strcmp(de->d_name + len - 4, ".fcs") == 0 && strcmp(de->d_name, newest) > 0 &&
+            len < sizeof(newest))
+            strcpy(newest, de->d_name);
+    }
+
+    rewinddir(d);
+    while ((de = readdir(d)) != NULL && !c->stop)
+    {
+        len = strlen(de->d_name);
+        if (len <= 4 || strcmp(de->d_name + len - 4, ".fcs") != 0 || strcmp(de->d_name, newest) == 0)
+            continue;
+        if (snprintf(path, sizeof(path), "%s/%s", dir, de->d_name) >= (int)sizeof(path) ||
+            stat(path, &st) == -1 || now - st.st_mtime < (time_t)c->cfg.age_sec)
+            continue;
+        if (compact_segment(c, path, &st, t) == -1)
+            syslog(LOG_WARNING, "compactor: %s left at full quality: %s", path, strerror(errno));
+    }
+    closedir(d);
+}
+
+/*
+ * One compaction pass over every container directory
+ *
+ * Parameters:
+ *   struct compactor *c -> The compactor
+ *   struct bg_throttle *t -> Throttle of the worker thread
+ *
+ * Returns:
+ *   None
+ */
+static void compact_pass(struct compactor *c, struct bg_throttle *t)
+{
+    unsigned int i;
+
+    for (i = 0; i < c->cfg.n_dirs && !c->stop; i++)
+        compact_dir(c, t, c->cfg.dirs[i]);
+}
+
+static void *compactor_thread(void *arg)
+{
+    struct compactor *c = arg;
+    struct pollfd pfd = { .fd = c->wake_fd, .events = POLLIN };
+    struct bg_throttle t;
+    uint64_t v;
+
+    bg_lower_priority("compactor");
+    bg_throttle_init(&t, c->cfg.cpu_percent, c->cfg.io_bytes_per_sec);
+    while (!c->stop)
+    {
+        compact_pass(c, &t);
+        if (poll(&pfd, 1, c->cfg.interval_ms) > 0 && read(c->wake_fd, &v, sizeof(v)) == -1)
+            continue;
+    }
+    return NULL;
+}
+
+/*
+ * Start the compactor thread
+ *
+ * Parameters:
+ *   struct compactor *c -> Compactor state
+ *   const struct compactor_config *cfg -> Thresholds, reduction and budgets
+ *
+ * Returns:
+ *   0 on success, -1 with errno set on failure
+ */
+int compactor_start(struct compactor *c, const struct compactor_config *cfg)
+{
+    int err;
+
+    memset(c, 0, sizeof(*c));
+    c->cfg = *cfg;
+    if (c->cfg.scale == 0)
+        c->cfg.scale = 1;
+    if (c->cfg.frame_divisor == 0)
+        c->cfg.frame_divisor = 1;
+    if (c->cfg.interval_ms == 0)
+        c->cfg.interval_ms = COMPACTOR_INTERVAL_MS;
+
+    c->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (c->wake_fd == -1)
+        return -1;
+    pthread_mutex_init(&c->lock, NULL);
+
+    err = pthread_create(&c->thread, NULL, compactor_thread, c);
+    if (err != 0)
+    {
+        close(c->wake_fd);
+        pthread_mutex_destroy(&c->lock);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Snapshot of the compaction counters
+ *
+ * Parameters:
+ *   struct compactor *c -> The compactor
+ *   struct compactor_stats *out -> Copy of the counters
+ *
+ * Returns:
+ *   None
+ */
+void compactor_get_stats(struct compactor *c, struct compactor_stats *out)
+{
+    pthread_mutex_lock(&c->lock);
+    *out = c->stats;
+    pthread_mutex_unlock(&c->lock);
+}
+
+/*
+ * Stop the compactor; a segment being rewritten is abandoned untouched
+ *
+ * Parameters:
+ *   struct compactor *c -> The compactor
+ *
+ * Returns:
+ *   None
+ */
+void compactor_stop(struct compactor *c)
+{
+    uint64_t one = 1;
+
+    c->stop = true;
+    if (write(c->wake_fd, &one, sizeof(one)) == -1)
+        syslog(LOG_WARNING, "compactor: wakeup failed: %s", strerror(errno));
+    pthread_join(c->thread, NULL);
+    close(c->wake_fd);
+    pthread_mutex_destroy(&c->lock);
+}
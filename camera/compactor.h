@@ -0,0 +1,57 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Tiered retention: background segment compactor
+ *
+ * Recent footage stays at full quality. Segments older than a threshold
+ * are rewritten at reduced resolution and frame rate, optionally as
+ * luma-only (GREY) frames, keeping every surviving frame's sequence
+ * number and timestamp. Every container output's directory is scanned.
+ * The worker runs at idle priority and is paced against a CPU share and
+ * an I/O bandwidth budget.
+ */
+
+#ifndef COMPACTOR_H
+#define COMPACTOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#define COMPACTOR_MAX_DIRS  8
+
+struct compactor_config
+{
+    const char *dirs[COMPACTOR_MAX_DIRS];   // Container directories
+    unsigned int n_dirs;
+    unsigned int age_sec;           // Compact segments not modified for this long
+    unsigned int scale;             // Downscale factor per axis (1 keeps the resolution)
+    unsigned int frame_divisor;     // Keep one frame out of this many (1 keeps all)
+    bool gray;                      // Store luma only
+    unsigned int cpu_percent;       // CPU share budget (0 = unlimited)
+    uint64_t io_bytes_per_sec;      // I/O budget (0 = unlimited)
+    unsigned int interval_ms;       // Scan period
+};
+
+struct compactor_stats
+{
+    unsigned int segments;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+};
+
+struct compactor
+{
+    struct compactor_config cfg;
+    pthread_t thread;
+    int wake_fd;
+    volatile bool stop;
+    pthread_mutex_t lock;
+    struct compactor_stats stats;
+};
+
+int compactor_parse(const char *s, struct compactor_config *cfg);
+int compactor_start(struct compactor *c, const struct compactor_config *cfg);
+void compactor_get_stats(struct compactor *c, struct compactor_stats *out);
+void compactor_stop(struct compactor *c);
+
+#endif
@@ -0,0 +1,482 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Crash recovery of container segments
+ *
+ * A segment that was closed cleanly has its index next to it; one that
+ * was being written when power was lost does not, and may end in a torn
+ * record or in chunk padding. Such a segment is recovered by:
+ *
+ *   1. probing FC_CHECKPOINT_ALIGN offsets backwards from the end of the
+ *      file for the last intact checkpoint,
+ *   2. verifying every record from the first frame that checkpoint lists
+ *      (so records it covers are checked too, whatever order the device
+ *      completed the chunk's writes in) up to the first damaged one,
+ *   3. truncating the file there, and
+ *   4. rebuilding the index from the earlier checkpoints plus the records
+ *      just verified.
+ *
+ * Only about two chunks are read whatever the segment size.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <syslog.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "frame_container.h"
+
+struct scan_buf
+{
+    unsigned char *p;
+    size_t cap;
+};
+
+// Entries of one checkpoint read back from a segment
+struct entry_list
+{
+    struct fc_checkpoint_entry *e;
+    uint32_t count;
+};
+
+/*
+ * Read the record at an offset and verify its checksum
+ *
+ * Parameters:
+ *   int fd -> Segment file
+ *   off_t off -> Record offset
+ *   off_t size -> File size
+ *   struct fc_record_header *rec -> Record header read
+ *   struct scan_buf *buf -> Receives the payload; grown as needed
+ *
+ * Returns:
+ *   0 if the record is intact, -1 otherwise
+ */
+static int read_record(int fd, off_t off, off_t size, struct fc_record_header *rec, struct scan_buf *buf)
+{
+    unsigned char *p;
+
+    if (off + (off_t)sizeof(*rec) > size || pread(fd, rec, sizeof(*rec), off) != sizeof(*rec) ||
+        rec->magic != FC_RECORD_MAGIC || (off_t)fc_record_span(rec->length) > size - off)
+        return -1;
+
+    if (rec->length > buf->cap)
+    {
+        p = realloc(buf->p, rec->length);
+        if (!p)
+            return -1;
+        buf->p = p;
+        buf->cap = rec->length;
+    }
+    if (pread(fd, buf->p, rec->length, off + sizeof(*rec)) != (ssize_t)rec->length)
+        return -1;
+    return rec->crc == fc_record_crc(rec, buf->p) ? 0 : -1;
+}
+
+/*
+ * Read an intact checkpoint record
+ *
+ * Parameters:
+ *   int fd -> Segment file
+ *   off_t off -> Record offset
+ *   off_t size -> File size
+ *   struct scan_buf *buf -> Receives the struct fc_checkpoint and its entries
+ *
+ * Returns:
+ *   0 if a valid checkpoint is at off, -1 otherwise
+ */
+static int read_checkpoint(int fd, off_t off, off_t size, struct scan_buf *buf)
+{
+    struct fc_record_header rec;
+    const struct fc_checkpoint *cp;
+
+    // Look at the header alone first: probes mostly land inside frames
+    if (pread(fd, &rec, sizeof(rec), off) != sizeof(rec) || rec.magic != FC_RECORD_MAGIC ||
+        !(rec.flags & FC_REC_CHECKPOINT) || rec.length < sizeof(*cp))
+        return -1;
+    if (read_record(fd, off, size, &rec, buf) == -1)
+        return -1;
+
+    cp = (const struct fc_checkpoint *)buf->p;
+    if (sizeof(*cp) + (size_t)cp->count * sizeof(struct fc_checkpoint_entry) != rec.length ||
+        cp->prev_offset >= (uint64_t)off)
+        return -1;
+    return 0;
+}
+
+/*
+ * Copy the entries of the checkpoint in buf
+ *
+ * Parameters:
+ *   const struct scan_buf *buf -> Checkpoint read by read_checkpoint()
+ *   struct entry_list *out -> Allocated copy (caller frees out->e)
+ *
+ * Returns:
+ *   0 on success, -1 on allocation failure
+ */
+static int copy_entries(const struct scan_buf *buf, struct entry_list *out)
+{
+    const struct fc_checkpoint *cp = (const struct fc_checkpoint *)buf->p;
+
+    out->count = cp->count;
+    out->e = malloc(cp->count * sizeof(*out->e) + 1);
+    if (!out->e)
+        return -1;
+    memcpy(out->e, cp + 1, cp->count * sizeof(*out->e));
+    return 0;
+}
+
+/*
+ * Rebuild the index of a recovered segment
+ *
+ * The frames before the scanned range come from the chain of checkpoints
+ * ending at prev; the scanned frames are already in tail. Checkpoints do
+ * not carry thumbnails, so the rebuilt index has none.
+ *
+ * Parameters:
+ *   int fd -> Segment file
+ *   off_t size -> File size after truncation
+ *   const struct fc_segment_header *hdr -> Segment header
+ *   uint64_t prev -> Last checkpoint before the scanned range (0: none)
+ *   const struct entry_list *tail -> Frames verified by the scan
+ *   const char *idx -> Index file to write
+ *
+ * Returns:
+ *   0 on success, -1 with errno set on failure
+ */
+static int rebuild_index(int fd, off_t size, const struct fc_segment_header *hdr, uint64_t prev,
+                         const struct entry_list *tail, const char *idx)
+{
+    struct entry_list *chain = NULL, *grown;
+    struct scan_buf buf = { NULL, 0 };
+    struct fi_builder b;
+    struct frame_meta m;
+    size_t n = 0, cap = 0, i;
+    uint32_t j, total = tail->count;
+    int ret = -1;
+
+    // Walk back through the checkpoints; a damaged one ends the chain
+    while (prev >= hdr->header_size && read_checkpoint(fd, prev, size, &buf) == 0)
+    {
+        if (n == cap)
+        {
+            cap = cap ? cap * 2 : 16;
+            grown = realloc(chain, cap * sizeof(*chain));
+            if (!grown)
+                goto out;
+            chain = grown;
+        }
+        if (copy_entries(&buf, &chain[n]) == -1)
+            goto out;
+        total += chain[n++].count;
+        prev = ((const struct fc_checkpoint *)buf.p)->prev_offset;
+    }
+
+    memset(&b, 0, sizeof(b));
+    fi_builder_reset(&b, hdr->first_seq);
+    if (fi_builder_reserve(&b, total + 1) == 0)
+    {
+        for (i = n; i-- > 0;)
+        {
+            for (j = 0; j < chain[i].count; j++)
+            {
+                m.motion = chain[i].e[j].motion;
+                m.brightness = chain[i].e[j].brightness;
+                m.blobs = chain[i].e[j].blobs;
+                fi_builder_add(&b, chain[i].e[j].seq, chain[i].e[j].timestamp_ns, &m, NULL);
+            }
+        }
+        for (j = 0; j < tail->count; j++)
+        {
+            m.motion = tail->e[j].motion;
+            m.brightness = tail->e[j].brightness;
+            m.blobs = tail->e[j].blobs;
+            fi_builder_add(&b, tail->e[j].seq, tail->e[j].timestamp_ns, &m, NULL);
+        }
+        ret = fi_builder_write(&b, idx, 1);
+    }
+    fi_builder_free(&b);
+
+out:
+    for (i = 0; i < n; i++)
+        free(chain[i].e);
+    free(chain);
+    free(buf.p);
+    return ret;
+}
+
+/*
+ * Find the last frame of a segment written before records had checksums
+ * and give it an index, so later starts skip it
+ *
+ * Version 1 segments have no checkpoints, so the index holds only the
+ * timestamps; frame statistics read as zero.
+ *
+ * Parameters:
+ *   const char *path -> Version 1 segment
+ *   struct fc_recovery *out -> next_seq, frames and index_rebuilt are set
+ *
+ * Returns:
+ *   0 on success, -1 with errno set on failure
+ */
+static int scan_legacy(const char *path, struct fc_recovery *out)
+{
+    const struct fc_record_header *rec;
+    struct fc_reader r;
+    struct fi_builder b;
+    char idx[512];
+    int ret = 0, err;
+
+    if (fc_reader_open(&r, path) == -1)
+        return -1;
+    memset(&b, 0, sizeof(b));
+    fi_builder_reset(&b, r.hdr->first_seq);
+    out->next_seq = r.hdr->first_seq;
+    while ((rec = fc_reader_next(&r)) != NULL)
+    {
+        if (ret == 0 && fi_builder_add(&b, rec->seq, rec->timestamp_ns, NULL, NULL) == -1)
+            ret = -1;
+        out->next_seq = rec->seq + 1;
+        out->frames++;
+    }
+    out->scanned = r.pos;
+    fc_reader_close(&r);
+
+    fi_index_path(idx, sizeof(idx), path);
+    if (ret == 0 && access(idx, F_OK) == -1)
+    {
+        ret = fi_builder_write(&b, idx, 1);
+        out->index_rebuilt = (ret == 0);
+    }
+    err = errno;
+    fi_builder_free(&b);
+    errno = err;
+    return ret;
+}
+
+/*
+ * Recover a segment that was not closed cleanly
+ *
+ * Parameters:
+ *   const char *path -> Segment file
+ *   struct fc_recovery *out -> What was found and repaired
+ *
+ * Returns:
+ *   0 on success, -1 with errno set on failure (EINVAL: not a segment)
+ */
+int fc_recover_segment(const char *path, struct fc_recovery *out)
+{
+    struct fc_segment_header hdr;
+    struct fc_record_header rec;
+    struct scan_buf buf = { NULL, 0 };
+    struct entry_list last = { NULL, 0 }, tail = { NULL, 0 };
+    struct fc_checkpoint_entry *e;
+    uint64_t prev = 0;
+    uint32_t cap = 0, j = 0;
+    char idx[512];
+    struct stat st;
+    off_t size, start, off;
+    int fd, ret = -1, err;
+
+    memset(out, 0, sizeof(*out));
+    fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    if (fstat(fd, &st) == -1)
+        goto out;
+    size = st.st_size;
+    if (size < (off_t)sizeof(hdr) || pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+        hdr.magic != FC_SEGMENT_MAGIC || hdr.header_size < sizeof(hdr) || hdr.header_size > size)
+    {
+        errno = EINVAL;
+        goto out;
+    }
+    if (hdr.version < 2)
+    {
+        close(fd);
+        return scan_legacy(path, out);
+    }
+    out->next_seq = hdr.first_seq;
+
+    // Last checkpoint; the scan starts at the first frame it covers
+    start = hdr.header_size;
+    for (off = (size - (off_t)sizeof(rec)) / FC_CHECKPOINT_ALIGN * FC_CHECKPOINT_ALIGN; off >= start;
+         off -= FC_CHECKPOINT_ALIGN)
+    {
+        if (read_checkpoint(fd, off, size, &buf) == 0)
+        {
+            if (copy_entries(&buf, &last) == -1)
+                goto out;
+            prev = ((const struct fc_checkpoint *)buf.p)->prev_offset;
+            if (last.count && last.e[0].offset >= (uint64_t)start && last.e[0].offset < (uint64_t)off)
+                start = last.e[0].offset;
+            else
+                prev = 0;
+            break;
+        }
+    }
+
+    for (off = start; read_record(fd, off, size, &rec, &buf) == 0; off += fc_record_span(rec.length))
+    {
+        if (rec.flags & (FC_REC_PAD | FC_REC_CHECKPOINT))
+            continue;
+        if (tail.count == cap)
+        {
+            cap = cap ? cap * 2 : 64;
+            e = realloc(tail.e, cap * sizeof(*e));
+            if (!e)
+                goto out;
+            tail.e = e;
+        }
+        e = &tail.e[tail.count++];
+        memset(e, 0, sizeof(*e));
+        e->offset = off;
+        e->seq = rec.seq;
+        e->timestamp_ns = rec.timestamp_ns;
+
+        // Frame statistics survive only in the checkpoint
+        while (j < last.count && last.e[j].offset < (uint64_t)off)
+            j++;
+        if (j < last.count && last.e[j].offset == (uint64_t)off)
+        {
+            e->motion = last.e[j].motion;
+            e->brightness = last.e[j].brightness;
+            e->blobs = last.e[j].blobs;
+        }
+        out->next_seq = rec.seq + 1;
+    }
+    out->frames = tail.count;
+    out->scanned = off - start;
+
+    // Trimming also releases the preallocation of a segment that was never closed
+    if (ftruncate(fd, off) == -1 || (off < size && fdatasync(fd) == -1))
+        goto out;
+    out->truncated = size - off;
+
+    fi_index_path(idx, sizeof(idx), path);
+    if (access(idx, F_OK) == -1)
+    {
+        if (rebuild_index(fd, off, &hdr, prev, &tail, idx) == -1)
+            goto out;
+        out->index_rebuilt = true;
+    }
+    ret = 0;
+
+out:
+    err = errno;
+    close(fd);
+    free(buf.p);
+    free(last.e);
+    free(tail.e);
+    errno = err;
+    return ret;
+}
+
+/*
+ * Sequence number following the last frame of a cleanly closed segment
+ *
+ * Parameters:
+ *   const char *path -> Segment file
+ *   uint64_t *next_seq -> Raised to the segment's next sequence number
+ *
+ * Returns:
+ *   None
+ */
+static void indexed_next_seq(const char *path, uint64_t *next_seq)
+{
+    struct fi_index ix;
+    char idx[512];
+    uint64_t next;
+
+    fi_index_path(idx, sizeof(idx), path);
+    if (fi_open(&ix, idx) == -1)
+        return;
+    next = ix.hdr->first_seq;
+    if (ix.hdr->count)
+        next += ix.seq[ix.hdr->count - 1] + 1;
+    if (next > *next_seq)
+        *next_seq = next;
+    fi_close(&ix);
+}
+
+static double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/*
+ * Recover every segment of a directory that has no index
+ *
+ * Leftover temporary files of interrupted index writes and compactions
+ * are removed, so this must run before the compactor is started.
+ *
+ * Parameters:
+ *   const char *dir -> Recording directory
+ *   uint64_t *next_seq -> Sequence number the next recording should start at
+ *
+ * Returns:
+ *   0 on success (also when dir does not exist), -1 with errno set on failure
+ */
+int fc_recover_dir(const char *dir, uint64_t *next_seq)
+{
+    char newest[256] = "", path[512], idx[512];
+    struct fc_recovery rec;
+    struct dirent *de;
+    size_t len;
+    double start;
+    DIR *d;
+
+    *next_seq = 0;
+    d = opendir(dir);
+    if (!d)
+        return errno == ENOENT ? 0 : -1;
+
+    while ((de = readdir(d)) != NULL)
+    {
+        len = strlen(de->d_name);
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        if (len > 4 && strcmp(de->d_name + len - 4, ".tmp") == 0)
+        {
+            unlink(path);
+            continue;
+        }
+        if (len <= 4 || strcmp(de->d_name + len - 4, ".fcs") != 0)
+            continue;
+        if (strcmp(de->d_name, newest) > 0 && len < sizeof(newest))
+            strcpy(newest, de->d_name);
+
+        fi_index_path(idx, sizeof(idx), path);
+        if (access(idx, F_OK) == 0)
+            continue;
+
+        start = now_ms();
+        if (fc_recover_segment(path, &rec) == -1)
+        {
+            syslog(LOG_ERR, "recovery: %s: %s", path, strerror(errno));
+            continue;
+        }
+        syslog(LOG_INFO, "recovery: %s: %u frames verified (%lld KB), %lld bytes of torn tail removed, "
+               "index %s, %.1f ms", path, rec.frames, (long long)rec.scanned >> 10, (long long)rec.truncated,
+               rec.index_rebuilt ? "rebuilt" : "kept", now_ms() - start);
+        if (rec.next_seq > *next_seq)
+            *next_seq = rec.next_seq;
+    }
+    closedir(d);
+
+    if (newest[0])
+    {
+        snprintf(path, sizeof(path), "%s/%s", dir, newest);
+        indexed_next_seq(path, next_seq);
+    }
+    return 0;
+}
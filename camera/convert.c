@@ -0,0 +1,255 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Packed YUV 4:2:2 conversion kernels
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <linux/videodev2.h>
+
+#include "convert.h"
+
+// This is probably the most acceptable conversion from camera YUYV to RGB
+//
+// Wikipedia has a good discussion on the details of various conversions and cites good references:
+// http://en.wikipedia.org/wiki/YUV
+//
+// Also http://www.fourcc.org/yuv.php
+//
+// What's not clear without knowing more about the camera in question is how often U & V are sampled compared
+// to Y.
+//
+// E.g. YUV444, which is equivalent to RGB, where both require 3 bytes for each pixel
+//      YUV422, which we assume here, where there are 2 bytes for each pixel, with two Y samples for one U & V,
+//              or as the name implies, 4Y and 2 UV pairs
+//      YUV420, where for every 4 Ys, there is a single UV pair, 1.5 bytes for each pixel or 36 bytes for 24 pixels
+void yuv2rgb(int y, int u, int v, unsigned char *r, unsigned char *g, unsigned char *b)
+{
+    int r1, g1, b1;
+
+    // replaces floating point coefficients
+    int c = y - 16, d = u - 128, e = v - 128;
+
+    // Conversion that avoids floating point
+    r1 = (298 * c + 409 * e + 128) >> 8;
+    g1 = (298 * c - 100 * d - 208 * e + 128) >> 8;
+    b1 = (298 * c + 516 * d + 128) >> 8;
+
+    // Computed values may need clipping.
+    if (r1 > 255)
+        r1 = 255;
+    if (g1 > 255)
+        g1 = 255;
+    if (b1 > 255)
+        b1 = 255;
+
+    if (r1 < 0)
+        r1 = 0;
+    if (g1 < 0)
+        g1 = 0;
+    if (b1 < 0)
+        b1 = 0;
+
+    *r = r1;
+    *g = g1;
+    *b = b1;
+}
+
+static inline uint8_t clip(int v)
+{
+    return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+/*
+ * Convert n pixels of a packed row to RGB24, starting at pixel x
+ *
+ * The chroma terms are computed once per two-pixel group instead of once
+ * per pixel; the integer arithmetic is that of yuv2rgb().
+ *
+ * Parameters:
+ *   const uint8_t *row -> Start of the source row (YUYV or UYVY)
+ *   uint32_t x -> First pixel to convert
+ *   uint32_t n -> Number of pixels
+ *   uint32_t pixelformat -> V4L2_PIX_FMT_YUYV or V4L2_PIX_FMT_UYVY
+ *   uint8_t *out -> 3 * n bytes
+ *
+ * Returns:
+ *   None
+ */
+void cv_to_rgb24(const uint8_t *row, uint32_t x, uint32_t n, uint32_t pixelformat, uint8_t *out)
+{
+    // Byte offsets inside a two-pixel group: YUYV = Y0 U Y1 V, UYVY = U Y0 V Y1
+    unsigned int yo = pixelformat == V4L2_PIX_FMT_UYVY ? 1 : 0, uo = 1 - yo, vo = 3 - yo;
+    uint32_t end = x + n;
+    const uint8_t *pair;
+    int c, d, e, rd, gd, bd;
+
+    for (; x < end; x++, out += 3)
+    {
+        // Whole groups in the middle, single pixels at odd edges
+        pair = row + (x & ~1u) * 2;
+        d = pair[uo] - 128;
+        e = pair[vo] - 128;
+        rd = 409 * e + 128;
+        gd = -100 * d - 208 * e + 128;
+        bd = 516 * d + 128;
+
+        c = 298 * (pair[yo + (x & 1) * 2] - 16);
+        out[0] = clip((c + rd) >> 8);
+        out[1] = clip((c + gd) >> 8);
+        out[2] = clip((c + bd) >> 8);
+        if ((x & 1) || x + 1 == end)
+            continue;
+
+        x++;
+        out += 3;
+        c = 298 * (pair[yo + 2] - 16);
+        out[0] = clip((c + rd) >> 8);
+        out[1] = clip((c + gd) >> 8);
+        out[2] = clip((c + bd) >> 8);
+    }
+}
+
+/*
+ * Extract the luma of n pixels of a packed row, starting at pixel x
+ *
+ * Parameters:
+ *   const uint8_t *row -> Start of the source row (YUYV or UYVY)
+ *   uint32_t x -> First pixel
+ *   uint32_t n -> Number of pixels
+ *   uint32_t pixelformat -> V4L2_PIX_FMT_YUYV or V4L2_PIX_FMT_UYVY
+ *   uint8_t *out -> n bytes
+ *
+ * Returns:
+ *   None
+ */
+void cv_to_grey(const uint8_t *row, uint32_t x, uint32_t n, uint32_t pixelformat, uint8_t *out)
+{
+    const uint8_t *p = row + (size_t)x * 2 + (pixelformat == V4L2_PIX_FMT_UYVY ? 1 : 0);
+    uint32_t i;
+
+    for (i = 0; i < n; i++)
+        out[i] = p[2 * i];
+}
+
+/*
+ * Shrink an RGB24 image to a thumbnail
+ *
+ * Each thumbnail pixel is the mean of a grid of at most
+ * CV_THUMB_SAMPLES x CV_THUMB_SAMPLES pixels spread evenly over its block
+ * of the image: an area average that reads a small fraction of the frame.
+ * The sample positions are worked out once per call and the grid sides
+ * are powers of two, so the inner loops only add and shift.
+ *
+ * Parameters:
+ *   const uint8_t *rgb -> width x height RGB24 image
+ *   uint32_t width, height -> Image geometry
+ *   uint8_t *thumb -> tw x th RGB24 output
+ *   uint32_t tw, th -> Thumbnail geometry (1..CV_THUMB_MAX each, at most width x height)
+ *
+ * Returns:
+ *   None
+ */
+void cv_thumbnail(const uint8_t *rgb, uint32_t width, uint32_t height, uint8_t *thumb, uint32_t tw, uint32_t th)
+{
+    uint32_t xs[CV_THUMB_MAX * CV_THUMB_SAMPLES], ys[CV_THUMB_MAX * CV_THUMB_SAMPLES];
+    uint32_t nx = CV_THUMB_SAMPLES, ny = CV_THUMB_SAMPLES, shift, t, i, j, x0, x1, r, g, b;
+    const uint8_t *p;
+
+    // Samples at the centres of equal slices of each block, no more of them than the block has pixels
+    while (nx > 1 && nx > width / tw)
+        nx /= 2;
+    while (ny > 1 && ny > height / th)
+        ny /= 2;
+    for (shift = 0; (1u << shift) < nx * ny; shift++)
+        ;
+    for (t = 0; t < tw; t++)
+    {
+        x0 = t * width / tw;
+        x1 = (t + 1) * width / tw;
+        for (i = 0; i < nx; i++)
+            xs[t * nx + i] = (x0 + ((2 * i + 1) * (x1 - x0)) / (2 * nx)) * 3;
+    }
+    for (t = 0; t < th; t++)
+    {
+        x0 = t * height / th;
+        x1 = (t + 1) * height / th;
+        for (j = 0; j < ny; j++)
+            ys[t * ny + j] = x0 + ((2 * j + 1) * (x1 - x0)) / (2 * ny);
+    }
+
+    for (t = 0; t < th; t++)
+    {
+        for (i = 0; i < tw; i++)
+        {
+            r = g = b = (1u << shift) / 2;
+            for (j = 0; j < ny; j++)
+            {
+                p = rgb + (size_t)ys[t * ny + j] * width * 3;
+                for (x0 = i * nx; x0 < (i + 1) * nx; x0++)
+                {
+                    r += p[xs[x0]];
+                    g += p[xs[x0] + 1];
+                    b += p[xs[x0] + 2];
+                }
+            }
+            *thumb++ = r >> shift;
+            *thumb++ = g >> shift;
+            *thumb++ = b >> shift;
+        }
+    }
+}
+
+/*
+ * Shrink a packed 4:2:2 frame by 2^shift in each direction
+ *
+ * Every output sample is the rounded mean of the samples of its kind in
+ * the block it covers: s x s luma samples for a pixel, and the s x s U
+ * (or V) samples of the s macropixels per row under an output macropixel,
+ * so the result is again packed 4:2:2 in the same byte order. Columns and
+ * rows that do not fill a whole output macropixel are dropped.
+ *
+ * Parameters:
+ *   const uint8_t *frame -> width x height frame, rows contiguous
+ *   uint32_t width, height -> Frame geometry in pixels (width even)
+ *   uint32_t pixelformat -> V4L2_PIX_FMT_YUYV or V4L2_PIX_FMT_UYVY
+ *   unsigned int shift -> 1..CV_MAX_SHIFT
+ *   uint8_t *out -> (width >> shift & ~1) x (height >> shift) frame
+ *
+ * Returns:
+ *   None
+ */
+void cv_downscale(const uint8_t *frame, uint32_t width, uint32_t height, uint32_t pixelformat, unsigned int shift,
+                  uint8_t *out)
+{
+    unsigned int yo = pixelformat == V4L2_PIX_FMT_UYVY ? 1 : 0, co = 1 - yo, s = 1u << shift, i, j;
+    uint32_t ow = (width >> shift) & ~1u, oh = height >> shift, x, y, l0, l1, u, v;
+    size_t stride = (size_t)width * 2;
+    const uint8_t *p;
+
+    for (y = 0; y < oh; y++)
+    {
+        for (x = 0; x < ow; x += 2, out += 4)
+        {
+            l0 = l1 = u = v = s * s / 2;
+            for (j = 0; j < s; j++)
+            {
+                // The s input macropixels under this output macropixel, the first half under its first pixel
+                p = frame + ((size_t)y * s + j) * stride + (size_t)x * s * 2;
+                for (i = 0; i < s; i++, p += 4)
+                {
+                    if (i < s / 2)
+                        l0 += p[yo] + p[yo + 2];
+                    else
+                        l1 += p[yo] + p[yo + 2];
+                    u += p[co];
+                    v += p[co + 2];
+                }
+            }
+            out[yo] = l0 >> (2 * shift);
+            out[yo + 2] = l1 >> (2 * shift);
+            out[co] = u >> (2 * shift);
+            out[co + 2] = v >> (2 * shift);
+        }
+    }
+}
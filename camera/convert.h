@@ -0,0 +1,31 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Packed YUV 4:2:2 conversion kernels
+ *
+ * yuv2rgb() is the reference: the per-pixel fixed-point conversion the
+ * recording path has always used. The row kernels produce bit-identical
+ * output (convert_check verifies this) and are what the capture path and
+ * the frame service call. A row may start and end on an odd pixel, which
+ * is how the frame service crops a region of interest. cv_thumbnail()
+ * makes the previews kept in the segment index from a converted frame.
+ */
+
+#ifndef CONVERT_H
+#define CONVERT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CV_THUMB_SAMPLES    2       // Samples per direction averaged into a thumbnail pixel (a power of two)
+#define CV_THUMB_MAX        256     // Largest thumbnail width or height
+#define CV_MAX_SHIFT        3       // cv_downscale() shrinks by up to 2^3 per direction
+
+void yuv2rgb(int y, int u, int v, unsigned char *r, unsigned char *g, unsigned char *b);
+
+void cv_to_rgb24(const uint8_t *row, uint32_t x, uint32_t n, uint32_t pixelformat, uint8_t *out);
+void cv_to_grey(const uint8_t *row, uint32_t x, uint32_t n, uint32_t pixelformat, uint8_t *out);
+void cv_thumbnail(const uint8_t *rgb, uint32_t width, uint32_t height, uint8_t *thumb, uint32_t tw, uint32_t th);
+void cv_downscale(const uint8_t *frame, uint32_t width, uint32_t height, uint32_t pixelformat, unsigned int shift,
+                  uint8_t *out);
+
+#endif
@@ -0,0 +1,922 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Golden-output and throughput check of the frame kernels
+ *
+ * Runs every conversion and analysis kernel over a corpus of synthetic
+ * YUYV/UYVY frames (gradients, noise, saturated extremes, odd sizes)
+ * plus any recorded raw frames given with -r. Kernels with a naive scalar
+ * reference must match it byte for byte, and every kernel's output over
+ * the synthetic frames must reproduce the hash in the golden file, which
+ * is committed with the sources: it is the same on every target, and a
+ * missing file or kernel is a failure. Throughput is the only per-machine
+ * part: it is compared with a baseline recorded with -u on the target.
+ * Any divergence, or a throughput more than -t percent below the
+ * baseline, makes the exit status non-zero.
+ *
+ * After a deliberate change of a kernel's output, check the output and
+ * record the new hashes with -G.
+ *
+ * usage: convert_check [-g golden] [-G] [-b baseline] [-u] [-t percent] [-r file:WxH[:uyvy]]...
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <linux/videodev2.h>
+
+#include "convert.h"
+#include "frame_analysis.h"
+#include "exposure.h"
+#include "timelapse.h"
+#include "edge.h"
+#include "blur.h"
+#include "white_balance.h"
+#include "jpeg.h"
+#include "crc32c.h"
+
+#define MAX_FRAMES      256
+#define MAX_KERNELS     16
+#define BOX_RADIUS      5
+#define GAUSS_SIGMA     3.0
+#define DOWNSCALE_SHIFT 2
+#define BENCH_SECONDS   0.2
+#define BENCH_ROUNDS    5
+
+struct frame
+{
+    char name[64];
+    uint32_t width;
+    uint32_t height;
+    uint32_t pixelformat;
+    uint8_t *data;
+    bool recorded;              // From -r, so not part of the golden hash
+};
+
+struct corpus
+{
+    struct frame frames[MAX_FRAMES];
+    unsigned int count;
+    size_t max_out;             // Largest output any kernel produces for a frame
+};
+
+// Produces the kernel's output for one frame, returns its size
+typedef size_t (*kernel_fn)(const struct frame *f, uint8_t *out);
+
+struct kernel
+{
+    const char *name;
+    kernel_fn run;
+    kernel_fn reference;        // NULL: checked against the golden hash only
+};
+
+// A kernel's line in the golden file (hash) or the baseline (throughput)
+struct expected
+{
+    char name[32];
+    double mpix;
+    uint32_t hash;
+};
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t xorshift(uint32_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 17;
+    *s ^= *s << 5;
+    return *s;
+}
+
+/*
+ * Kernels under test and their references
+ */
+static size_t rgb24(const struct frame *f, uint8_t *out)
+{
+    uint32_t y;
+
+    for (y = 0; y < f->height; y++)
+        cv_to_rgb24(f->data + (size_t)y * f->width * 2, 0, f->width, f->pixelformat, out + (size_t)y * f->width * 3);
+    return (size_t)f->width * f->height * 3;
+}
+
+// A crop starting and ending on odd pixels, as the frame service does it
+static size_t rgb24_roi(const struct frame *f, uint8_t *out)
+{
+    uint32_t y, w = f->width - 3;
+
+    for (y = 1; y < f->height; y++)
+        cv_to_rgb24(f->data + (size_t)y * f->width * 2, 1, w, f->pixelformat, out + (size_t)(y - 1) * w * 3);
+    return (size_t)w * (f->height - 1) * 3;
+}
+
+static size_t grey(const struct frame *f, uint8_t *out)
+{
+    uint32_t y;
+
+    for (y = 0; y < f->height; y++)
+        cv_to_grey(f->data + (size_t)y * f->width * 2, 0, f->width, f->pixelformat, out + (size_t)y * f->width);
+    return (size_t)f->width * f->height;
+}
+
+// Reference: yuv2rgb() one pixel at a time
+static size_t ref_rgb(const struct frame *f, uint8_t *out, uint32_t x0, uint32_t y0, uint32_t w)
+{
+    unsigned int yo = f->pixelformat == V4L2_PIX_FMT_UYVY ? 1 : 0;
+    const uint8_t *pair;
+    uint32_t x, y;
+    size_t n = 0;
+
+    for (y = y0; y < f->height; y++)
+    {
+        for (x = x0; x < x0 + w; x++, n += 3)
+        {
+            pair = f->data + ((size_t)y * f->width + (x & ~1u)) * 2;
+            yuv2rgb(pair[yo + (x & 1) * 2], pair[1 - yo], pair[3 - yo], &out[n], &out[n + 1], &out[n + 2]);
+        }
+    }
+    return n;
+}
+
+static size_t ref_rgb24(const struct frame *f, uint8_t *out)
+{
+    return ref_rgb(f, out, 0, 0, f->width);
+}
+
+static size_t ref_rgb24_roi(const struct frame *f, uint8_t *out)
+{
+    return ref_rgb(f, out, 1, 1, f->width - 3);
+}
+
+static size_t ref_grey(const struct frame *f, uint8_t *out)
+{
+    size_t i, n = (size_t)f->width * f->height;
+    unsigned int yo = f->pixelformat == V4L2_PIX_FMT_UYVY ? 1 : 0;
+
+    for (i = 0; i < n; i++)
+        out[i] = f->data[2 * i + yo];
+    return n;
+}
+
+// Motion analysis of the frame followed by a copy with an inverted block
+static size_t analyze(const struct frame *f, uint8_t *out)
+{
+    struct frame_analyzer a;
+    struct frame_meta m[2];
+    size_t size = (size_t)f->width * f->height * 2;
+    uint8_t *moved = out + sizeof(m);
+    uint32_t x, y;
+
+    memset(m, 0, sizeof(m));
+    if (fa_init(&a, f->width, f->height, f->pixelformat) == -1)
+    {
+        memcpy(out, m, sizeof(m));
+        return sizeof(m);
+    }
+    memcpy(moved, f->data, size);
+    for (y = f->height / 4; y < f->height / 2; y++)
+        for (x = f->width / 4; x < f->width / 2; x++)
+            moved[((size_t)y * f->width + x) * 2] ^= 0xff;
+    fa_analyze(&a, f->data, &m[0]);
+    fa_analyze(&a, moved, &m[1]);
+    fa_free(&a);
+    memcpy(out, m, sizeof(m));
+    return sizeof(m);
+}
+
+// Exposure metering of the frame: the control decision from fixed starting controls
+static size_t ae_meter(const struct frame *f, uint8_t *out)
+{
+    static const struct ae_config cfg = {
+        .exposure = { 1, 2047 },
+        .gain = { 0, 255 },
+        .exposure_cap = 333,
+        .target = 110,
+        .every = 1,
+    };
+    static const struct ae_controls start = { 100, 0 };
+    struct ae_controller ae;
+    struct ae_controls next = start;
+
+    if (ae_init(&ae, &cfg, f->width, f->height, f->pixelformat, &start) == 0)
+        ae_frame(&ae, f->data, &next);
+    memcpy(out, ae.hist, sizeof(ae.hist));
+    memcpy(out + sizeof(ae.hist), &next, sizeof(next));
+    return sizeof(ae.hist) + sizeof(next);
+}
+
+// Timelapse average of four frames, stand-ins being the frame shifted by 0..3 bytes
+static size_t tl_window(const struct frame *f, uint8_t *out)
+{
+    size_t n = (size_t)f->width * f->height * 2 - 3;
+    uint16_t *partial = calloc(n, sizeof(*partial));
+    uint32_t *total = calloc(n, sizeof(*total));
+    unsigned int k;
+
+    if (!partial || !total)
+    {
+        free(partial);
+        free(total);
+        memset(out, 0, n);
+        return n;
+    }
+    for (k = 0; k < 4; k++)
+        tl_accumulate(partial, f->data + k, n);
+    tl_fold(total, partial, n);
+    tl_average(total, n, 4, out);
+    free(partial);
+    free(total);
+    return n;
+}
+
+static size_t ref_tl_window(const struct frame *f, uint8_t *out)
+{
+    size_t i, n = (size_t)f->width * f->height * 2 - 3;
+    const uint8_t *d = f->data;
+
+    for (i = 0; i < n; i++)
+        out[i] = (d[i] + d[i + 1] + d[i + 2] + d[i + 3] + 2) / 4;
+    return n;
+}
+
+// Gradient magnitude and orientation maps, one after the other
+static size_t gradient(const struct frame *f, uint8_t *out, enum edge_kernel kernel, unsigned int bins)
+{
+    size_t n = (size_t)f->width * f->height;
+    struct edge_filter e;
+
+    if (edge_init(&e, f->width, f->height, f->pixelformat, kernel, bins) == -1)
+    {
+        memset(out, 0, 2 * n);
+        return 2 * n;
+    }
+    memset(out + n, 0, n);
+    edge_frame(&e, f->data, out, out + n, NULL);
+    edge_free(&e);
+    return 2 * n;
+}
+
+static size_t sobel(const struct frame *f, uint8_t *out)
+{
+    return gradient(f, out, EDGE_SOBEL, 4);
+}
+
+static size_t scharr(const struct frame *f, uint8_t *out)
+{
+    return gradient(f, out, EDGE_SCHARR, 8);
+}
+
+// Reference: direct 3x3 convolution with clamped borders; bins use the filter's boundary table
+static size_t ref_gradient(const struct frame *f, uint8_t *out, enum edge_kernel kernel, unsigned int bins)
+{
+    static const int sobel_w[3] = { 1, 2, 1 }, scharr_w[3] = { 3, 10, 3 };
+    const int *k = kernel == EDGE_SOBEL ? sobel_w : scharr_w;
+    unsigned int yo = f->pixelformat == V4L2_PIX_FMT_UYVY ? 1 : 0, b, i, shift = kernel == EDGE_SOBEL ? 2 : 4;
+    size_t n = (size_t)f->width * f->height;
+    int x, y, j, gx, gy, sx, sy, w = f->width, h = f->height;
+    struct edge_filter e;
+
+    if (edge_init(&e, f->width, f->height, f->pixelformat, kernel, bins) == -1)
+    {
+        memset(out, 0, 2 * n);
+        return 2 * n;
+    }
+    for (y = 0; y < h; y++)
+    {
+        for (x = 0; x < w; x++)
+        {
+            gx = gy = 0;
+            for (j = -1; j <= 1; j++)
+            {
+                sy = y + j < 0 ? 0 : y + j >= h ? h - 1 : y + j;
+                sx = x + j < 0 ? 0 : x + j >= w ? w - 1 : x + j;
+                gx += k[j + 1] * (f->data[((size_t)sy * w + (x + 1 < w ? x + 1 : w - 1)) * 2 + yo] -
+                                  f->data[((size_t)sy * w + (x > 0 ? x - 1 : 0)) * 2 + yo]);
+                gy += k[j + 1] * (f->data[((size_t)(y + 1 < h ? y + 1 : h - 1) * w + sx) * 2 + yo] -
+                                  f->data[((size_t)(y > 0 ? y - 1 : 0) * w + sx) * 2 + yo]);
+            }
+            b = (abs(gx) + abs(gy)) >> shift;
+            out[(size_t)y * w + x] = b > 255 ? 255 : b;
+            if (gy < 0 || (gy == 0 && gx < 0))
+            {
+                gx = -gx;
+                gy = -gy;
+            }
+            for (b = 0, i = 1; i <= bins; i++)
+                b += gy * e.bound[i][0] + gx * e.bound[i][1] > 0;
+            out[n + (size_t)y * w + x] = b % bins;
+        }
+    }
+    edge_free(&e);
+    return 2 * n;
+}
+
+static size_t box_grey(const struct frame *f, uint8_t *out)
+{
+    size_t n = grey(f, out);
+    struct blur b;
+
+    if (bf_init(&b, f->width, f->height, 1, BOX_RADIUS) == 0)
+    {
+        bf_box(&b, out, f->width, BOX_RADIUS);
+        bf_free(&b);
+    }
+    return n;
+}
+
+static size_t gauss_rgb(const struct frame *f, uint8_t *out)
+{
+    size_t n = rgb24(f, out);
+    struct blur b;
+
+    if (bf_init(&b, f->width, f->height, 3, BOX_RADIUS) == 0)
+    {
+        bf_gaussian(&b, out, (size_t)f->width * 3, GAUSS_SIGMA);
+        bf_free(&b);
+    }
+    return n;
+}
+
+// Reference: one box pass summing the whole window with clamped borders, same rounding as the filter
+static void ref_box_pass(const struct frame *f, uint8_t *img, unsigned int c, uint32_t radius, bool rows)
+{
+    int w = f->width, h = f->height, r = radius, x, y, k, s;
+    uint32_t d = 2 * radius + 1, recip = (65536 + d / 2) / d, sum, v;
+    size_t i;
+    uint8_t *copy = malloc((size_t)w * h * c);
+    unsigned int ch;
+
+    if (!copy)
+        return;
+    memcpy(copy, img, (size_t)w * h * c);
+    for (y = 0; y < h; y++)
+    {
+        for (x = 0; x < w; x++)
+        {
+            for (ch = 0; ch < c; ch++)
+            {
+                for (sum = 0, k = -r; k <= r; k++)
+                {
+                    s = (rows ? x : y) + k;
+                    s = s < 0 ? 0 : s >= (rows ? w : h) ? (rows ? w : h) - 1 : s;
+                    i = rows ? ((size_t)y * w + s) * c + ch : ((size_t)s * w + x) * c + ch;
+                    sum += copy[i];
+                }
+                v = ((sum + radius) * recip) >> 16;
+                img[((size_t)y * w + x) * c + ch] = v > 255 ? 255 : v;
+            }
+        }
+    }
+    free(copy);
+}
+
+// Colour sums at a low and a high white-patch level
+static size_t wb_sums(const struct frame *f, uint8_t *out)
+{
+    static const uint32_t levels[2] = { 60, 200 };
+    struct white_balance wb;
+    struct wb_sums s[2];
+    int i;
+
+    memset(s, 0, sizeof(s));
+    if (wb_init(&wb, f->width, f->height, f->pixelformat) == 0)
+        for (i = 0; i < 2; i++)
+            wb_measure(&wb, f->data, levels[i], &s[i]);
+    memcpy(out, s, sizeof(s));
+    return sizeof(s);
+}
+
+// The reduced-resolution source of the outputs
+static size_t downscale(const struct frame *f, uint8_t *out)
+{
+    cv_downscale(f->data, f->width, f->height, f->pixelformat, DOWNSCALE_SHIFT, out);
+    return (size_t)((f->width >> DOWNSCALE_SHIFT) & ~1u) * (f->height >> DOWNSCALE_SHIFT) * 2;
+}
+
+static size_t jpeg(const struct frame *f, uint8_t *out)
+{
+    struct jpeg_encoder e;
+
+    if (jpeg_init(&e, f->width, f->height, f->pixelformat, JPEG_QUALITY) == -1)
+        return 0;
+    return jpeg_encode(&e, f->data, NULL, out, (size_t)f->width * f->height * 4);
+}
+
+static size_t ref_wb_sums(const struct frame *f, uint8_t *out)
+{
+    static const uint32_t levels[2] = { 60, 200 };
+    unsigned int yo = f->pixelformat == V4L2_PIX_FMT_UYVY ? 1 : 0;
+    struct wb_sums s[2];
+    const uint8_t *p;
+    uint32_t x, y, l, u, v;
+    int i;
+
+    memset(s, 0, sizeof(s));
+    for (i = 0; i < 2; i++)
+    {
+        for (y = 0; y < f->height; y += WB_ROW_STEP)
+        {
+            for (x = 0; x + 1 < f->width; x += 2)
+            {
+                p = f->data + ((size_t)y * f->width + x) * 2;
+                l = (p[yo] + p[yo + 2]) / 2;
+                u = p[yo ? 0 : 1];
+                v = p[yo ? 2 : 3];
+                if (l < WB_DARK || l >= WB_CLIP)
+                    continue;
+                s[i].usable++;
+                s[i].y += l;
+                s[i].u += u;
+                s[i].v += v;
+                s[i].chroma += abs((int)u - 128) + abs((int)v - 128);
+                if (l < levels[i])
+                    continue;
+                s[i].patch++;
+                s[i].patch_y += l;
+                s[i].patch_u += u;
+                s[i].patch_v += v;
+            }
+        }
+    }
+    memcpy(out, s, sizeof(s));
+    return sizeof(s);
+}
+
+static size_t ref_sobel(const struct frame *f, uint8_t *out)
+{
+    return ref_gradient(f, out, EDGE_SOBEL, 4);
+}
+
+static size_t ref_scharr(const struct frame *f, uint8_t *out)
+{
+    return ref_gradient(f, out, EDGE_SCHARR, 8);
+}
+
+static size_t ref_box_grey(const struct frame *f, uint8_t *out)
+{
+    size_t n = ref_grey(f, out);
+
+    ref_box_pass(f, out, 1, BOX_RADIUS, true);
+    ref_box_pass(f, out, 1, BOX_RADIUS, false);
+    return n;
+}
+
+static size_t ref_gauss_rgb(const struct frame *f, uint8_t *out)
+{
+    size_t n = ref_rgb24(f, out);
+    uint32_t radii[3];
+    int i;
+
+    bf_gaussian_radii(GAUSS_SIGMA, radii);
+    for (i = 0; i < 3; i++)
+        ref_box_pass(f, out, 3, radii[i], true);
+    for (i = 0; i < 3; i++)
+        ref_box_pass(f, out, 3, radii[i], false);
+    return n;
+}
+
+// Reference: every output sample averaged from input pixel coordinates
+static size_t ref_downscale(const struct frame *f, uint8_t *out)
+{
+    unsigned int yo = f->pixelformat == V4L2_PIX_FMT_UYVY ? 1 : 0, s = 1u << DOWNSCALE_SHIFT;
+    uint32_t ow = (f->width / s) & ~1u, oh = f->height / s, ox, oy, x, y, sum, cu, cv;
+    const uint8_t *p;
+
+    for (oy = 0; oy < oh; oy++)
+    {
+        for (ox = 0; ox < ow; ox++)
+        {
+            for (sum = 0, y = oy * s; y < (oy + 1) * s; y++)
+                for (x = ox * s; x < (ox + 1) * s; x++)
+                    sum += f->data[((size_t)y * f->width + x) * 2 + yo];
+            out[((size_t)oy * ow + ox) * 2 + yo] = (sum + s * s / 2) / (s * s);
+            if (ox % 2)
+                continue;
+            // Chroma of the output macropixel from the pixel pairs under it
+            for (cu = cv = 0, y = oy * s; y < (oy + 1) * s; y++)
+            {
+                for (x = ox * s; x < (ox + 2) * s; x += 2)
+                {
+                    p = f->data + ((size_t)y * f->width + x) * 2;
+                    cu += p[yo ? 0 : 1];
+                    cv += p[yo ? 2 : 3];
+                }
+            }
+            out[((size_t)oy * ow + ox) * 2 + (yo ? 0 : 1)] = (cu + s * s / 2) / (s * s);
+            out[((size_t)oy * ow + ox) * 2 + (yo ? 2 : 3)] = (cv + s * s / 2) / (s * s);
+        }
+    }
+    return (size_t)ow * oh * 2;
+}
+
+static const struct kernel kernels[] = {
+    { "rgb24", rgb24, ref_rgb24 },
+    { "rgb24-roi", rgb24_roi, ref_rgb24_roi },
+    { "grey", grey, ref_grey },
+    { "analyze", analyze, NULL },
+    { "ae-meter", ae_meter, NULL },
+    { "tl-average", tl_window, ref_tl_window },
+    { "sobel", sobel, ref_sobel },
+    { "scharr", scharr, ref_scharr },
+    { "box-grey", box_grey, ref_box_grey },
+    { "gauss-rgb", gauss_rgb, ref_gauss_rgb },
+    { "wb-sums", wb_sums, ref_wb_sums },
+    { "downscale", downscale, ref_downscale },
+    { "jpeg", jpeg, NULL },
+};
+
+#define N_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+static struct frame *new_frame(struct corpus *c, const char *name, uint32_t w, uint32_t h, uint32_t pixelformat)
+{
+    struct frame *f;
+
+    if (c->count == MAX_FRAMES)
+    {
+        fprintf(stderr, "corpus full, ignoring %s\n", name);
+        return NULL;
+    }
+    f = &c->frames[c->count];
+    f->data = malloc((size_t)w * h * 2);
+    if (!f->data)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(f->name, sizeof(f->name), "%s-%ux%u-%s", name, w, h,
+             pixelformat == V4L2_PIX_FMT_UYVY ? "uyvy" : "yuyv");
+    f->width = w;
+    f->height = h;
+    f->pixelformat = pixelformat;
+    f->recorded = false;
+    // Analysis needs room for the frame itself after its metadata
+    if ((size_t)w * h * 4 > c->max_out)
+        c->max_out = (size_t)w * h * 4;
+    c->count++;
+    return f;
+}
+
+/*
+ * Synthetic frames covering the whole input range
+ *
+ * Parameters:
+ *   struct corpus *c -> Corpus to add to
+ *
+ * Returns:
+ *   None
+ */
+static void synthesize(struct corpus *c)
+{
+    static const uint32_t sizes[][2] = { { 320, 240 }, { 640, 480 }, { 66, 34 } };
+    static const uint32_t formats[] = { V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_UYVY };
+    static const char *const patterns[] = { "gradient", "noise", "zero", "full", "checker" };
+    uint32_t seed = 0x2545f491, s, f, p, i, w, h;
+    struct frame *fr;
+    size_t n;
+
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        for (f = 0; f < 2; f++)
+        {
+            for (p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++)
+            {
+                w = sizes[s][0];
+                h = sizes[s][1];
+                fr = new_frame(c, patterns[p], w, h, formats[f]);
+                if (!fr)
+                    return;
+                n = (size_t)w * h * 2;
+                for (i = 0; i < n; i++)
+                {
+                    switch (p)
+                    {
+                    case 0:
+                        // Luma ramps along x, chroma along y: every Y/U/V combination shows up
+                        fr->data[i] = (i & 1) ? (uint8_t)((i / (w * 2)) * 256 / h + (i & 2) * 64)
+                                              : (uint8_t)((i / 2 % w) * 256 / w);
+                        break;
+                    case 1:
+                        fr->data[i] = xorshift(&seed);
+                        break;
+                    case 2:
+                        fr->data[i] = 0;
+                        break;
+                    case 3:
+                        fr->data[i] = 255;
+                        break;
+                    default:
+                        fr->data[i] = ((i / 2 % w / 8 + i / (w * 2) / 8) & 1) ? 235 : 16;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Add the frames of a raw recording ("file:WxH" or "file:WxH:uyvy")
+ *
+ * Parameters:
+ *   struct corpus *c -> Corpus to add to
+ *   const char *spec -> File and geometry
+ *
+ * Returns:
+ *   0 on success, -1 on a bad spec or unreadable file
+ */
+static int add_recording(struct corpus *c, const char *spec)
+{
+    char path[256], fmt[8] = "yuyv";
+    uint32_t w, h, i;
+    struct stat st;
+    struct frame *f;
+    size_t size;
+    int fd;
+
+    if (sscanf(spec, "%255[^:]:%ux%u:%7s", path, &w, &h, fmt) < 3 || w < 4 || (w & 1) || h < 2)
+        return -1;
+    fd = open(path, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1)
+    {
+        perror(path);
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+    size = (size_t)w * h * 2;
+    for (i = 0; (off_t)(i + 1) * size <= st.st_size; i++)
+    {
+        f = new_frame(c, "recorded", w, h, strcmp(fmt, "uyvy") == 0 ? V4L2_PIX_FMT_UYVY : V4L2_PIX_FMT_YUYV);
+        if (f)
+            f->recorded = true;
+        if (!f || pread(fd, f->data, size, (off_t)i * size) != (ssize_t)size)
+            break;
+    }
+    close(fd);
+    return 0;
+}
+
+/*
+ * Read a golden file ("kernel crc32c") or a baseline ("kernel Mpixel/s")
+ *
+ * Parameters:
+ *   const char *path -> The file
+ *   bool golden -> Which of the two it is
+ *   struct expected *e -> MAX_KERNELS entries
+ *
+ * Returns:
+ *   Number of kernels listed, -1 if the file cannot be read
+ */
+static int load_expected(const char *path, bool golden, struct expected *e)
+{
+    FILE *fp = fopen(path, "r");
+    char line[128];
+    int n = 0;
+
+    if (!fp)
+        return -1;
+    while (n < MAX_KERNELS && fgets(line, sizeof(line), fp))
+    {
+        if (line[0] == '#')
+            continue;
+        if (golden ? sscanf(line, "%31s %x", e[n].name, &e[n].hash) == 2
+                   : sscanf(line, "%31s %lf", e[n].name, &e[n].mpix) == 2)
+            n++;
+    }
+    fclose(fp);
+    return n;
+}
+
+static const struct expected *find_expected(const struct expected *e, int n, const char *name)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        if (strcmp(e[i].name, name) == 0)
+            return &e[i];
+    }
+    return NULL;
+}
+
+/*
+ * Check one kernel against its reference over the whole corpus
+ *
+ * Parameters:
+ *   const struct kernel *k -> The kernel
+ *   const struct corpus *c -> Input frames
+ *   uint8_t *out, *ref -> c->max_out bytes each
+ *   uint32_t *hash -> CRC32C of the outputs of the synthetic frames
+ *
+ * Returns:
+ *   Number of frames whose output differs from the reference
+ */
+static unsigned int verify(const struct kernel *k, const struct corpus *c, uint8_t *out, uint8_t *ref,
+                           uint32_t *hash)
+{
+    unsigned int i, bad = 0;
+    size_t n, r, at;
+
+    *hash = 0;
+    for (i = 0; i < c->count; i++)
+    {
+        n = k->run(&c->frames[i], out);
+        if (!c->frames[i].recorded)
+            *hash = crc32c(*hash, out, n);
+        if (!k->reference)
+            continue;
+        r = k->reference(&c->frames[i], ref);
+        if (n != r || memcmp(out, ref, n) != 0)
+        {
+            for (at = 0; at < n && at < r && out[at] == ref[at]; at++)
+                ;
+            fprintf(stderr, "%s: %s differs from the reference at byte %zu\n", k->name, c->frames[i].name, at);
+            bad++;
+        }
+    }
+    return bad;
+}
+
+// Best of BENCH_ROUNDS rounds, in megapixels per second
+static double throughput(const struct kernel *k, const struct corpus *c, uint8_t *out)
+{
+    double start, elapsed, best = 0;
+    uint64_t pixels;
+    unsigned int i, round;
+
+    for (round = 0; round < BENCH_ROUNDS; round++)
+    {
+        pixels = 0;
+        start = now_sec();
+        do
+        {
+            for (i = 0; i < c->count; i++)
+            {
+                k->run(&c->frames[i], out);
+                pixels += (uint64_t)c->frames[i].width * c->frames[i].height;
+            }
+            elapsed = now_sec() - start;
+        } while (elapsed < BENCH_SECONDS);
+        if (pixels / elapsed / 1e6 > best)
+            best = pixels / elapsed / 1e6;
+    }
+    return best;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-g golden] [-G] [-b baseline] [-u] [-t percent] [-r file:WxH[:uyvy]]...\n"
+                    "  -g  golden output hashes (default convert_golden.txt)\n"
+                    "  -G  record the golden hashes instead of checking against them\n"
+                    "  -b  throughput baseline of this machine (default convert_baseline.txt)\n"
+                    "  -u  record the baseline instead of checking against it\n"
+                    "  -t  allowed throughput regression in percent (default 10)\n"
+                    "  -r  add the raw YUYV (or UYVY) frames of a recording to the corpus\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * Open a file the results are recorded in
+ *
+ * Parameters:
+ *   const char *path -> The file
+ *   const char *header -> Comment line describing the columns
+ *
+ * Returns:
+ *   The open file; exits on failure
+ */
+static FILE *record_file(const char *path, const char *header)
+{
+    FILE *fp = fopen(path, "w");
+
+    if (!fp)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(fp, "# %s\n", header);
+    return fp;
+}
+
+int main(int argc, char **argv)
+{
+    struct expected golden[MAX_KERNELS], base[MAX_KERNELS];
+    const struct expected *g, *b;
+    const char *golden_path = "convert_golden.txt", *baseline_path = "convert_baseline.txt";
+    struct corpus c = { .count = 0 };
+    double tolerance = 10, mpix;
+    bool update = false, update_golden = false, ok;
+    unsigned int i, bad, failures = 0;
+    uint8_t *out, *ref;
+    uint32_t hash;
+    int opt, ngolden = 0, nbase = 0;
+    FILE *fp = NULL, *gp = NULL;
+
+    while ((opt = getopt(argc, argv, "g:Gb:ut:r:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'g':
+            golden_path = optarg;
+            break;
+        case 'G':
+            update_golden = true;
+            break;
+        case 'b':
+            baseline_path = optarg;
+            break;
+        case 'u':
+            update = true;
+            break;
+        case 't':
+            tolerance = atof(optarg);
+            break;
+        case 'r':
+            if (add_recording(&c, optarg) == -1)
+                usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    synthesize(&c);
+    out = malloc(c.max_out);
+    ref = malloc(c.max_out);
+    if (!out || !ref)
+    {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+
+    // Without the golden hashes nothing checks the kernels that have no reference
+    if (!update_golden)
+    {
+        ngolden = load_expected(golden_path, true, golden);
+        if (ngolden <= 0)
+        {
+            fprintf(stderr, "%s: no golden hashes%s\n", golden_path, ngolden ? "" : " in the file");
+            return EXIT_FAILURE;
+        }
+    }
+    if (!update)
+        nbase = load_expected(baseline_path, false, base);
+    if (update)
+        fp = record_file(baseline_path, "kernel Mpixel/s");
+    if (update_golden)
+        gp = record_file(golden_path, "kernel crc32c of the outputs of the synthetic frames");
+
+    printf("%u frames, crc32c %s\n%-12s %10s %10s %10s  %s\n", c.count, crc32c_impl(), "kernel", "Mpix/s",
+           "baseline", "hash", "result");
+    for (i = 0; i < N_KERNELS; i++)
+    {
+        bad = verify(&kernels[i], &c, out, ref, &hash);
+        mpix = throughput(&kernels[i], &c, out);
+        g = find_expected(golden, ngolden, kernels[i].name);
+        b = find_expected(base, nbase, kernels[i].name);
+        ok = bad == 0;
+        if (ok && !update_golden && (!g || g->hash != hash))
+        {
+            if (g)
+                fprintf(stderr, "%s: output hash %08x, golden %08x\n", kernels[i].name, hash, g->hash);
+            else
+                fprintf(stderr, "%s: no golden hash in %s\n", kernels[i].name, golden_path);
+            ok = false;
+        }
+        if (ok && b && mpix < b->mpix * (1 - tolerance / 100))
+        {
+            fprintf(stderr, "%s: %.1f Mpix/s is more than %.0f%% below the baseline %.1f\n", kernels[i].name, mpix,
+                    tolerance, b->mpix);
+            ok = false;
+        }
+        failures += !ok;
+        printf("%-12s %10.1f %10.1f   %08x  %s\n", kernels[i].name, mpix, b ? b->mpix : 0, hash,
+               !ok ? "FAIL" : update || update_golden ? "recorded" : b ? "ok" : "ok (no baseline)");
+        if (fp)
+            fprintf(fp, "%s %.1f\n", kernels[i].name, mpix);
+        if (gp && ok)
+            fprintf(gp, "%s %08x\n", kernels[i].name, hash);
+    }
+
+    if (fp)
+        fclose(fp);
+    if (gp)
+        fclose(gp);
+    for (i = 0; i < c.count; i++)
+        free(c.frames[i].data);
+    free(out);
+    free(ref);
+    return failures ? EXIT_FAILURE : 0;
+}
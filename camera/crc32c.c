@@ -0,0 +1,188 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - CRC32C (Castagnoli) checksums
+ *
+ * crc32c(0, p, n) gives the standard CRC32C of p; passing a previous
+ * result as crc continues the checksum over more data.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#endif
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#include "crc32c.h"
+
+#define CRC32C_POLY 0x82f63b78u    // Reflected Castagnoli polynomial
+
+static uint32_t table[8][256];
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;
+
+typedef uint32_t (*crc_fn)(uint32_t crc, const uint8_t *p, size_t len);
+
+static void build_table(void)
+{
+    uint32_t i, j, c;
+
+    for (i = 0; i < 256; i++)
+    {
+        c = i;
+        for (j = 0; j < 8; j++)
+            c = (c >> 1) ^ (CRC32C_POLY & (0u - (c & 1)));
+        table[0][i] = c;
+    }
+    for (i = 0; i < 256; i++)
+    {
+        for (j = 1; j < 8; j++)
+            table[j][i] = (table[j - 1][i] >> 8) ^ table[0][table[j - 1][i] & 0xff];
+    }
+}
+
+/*
+ * Portable slicing-by-8: eight table lookups per 8 input bytes
+ */
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *p, size_t len)
+{
+    uint32_t lo, hi;
+
+    while (len && ((uintptr_t)p & 7))
+    {
+        crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xff];
+        len--;
+    }
+    while (len >= 8)
+    {
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff] ^
+              table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24] ^
+              table[3][hi & 0xff] ^ table[2][(hi >> 8) & 0xff] ^
+              table[1][(hi >> 16) & 0xff] ^ table[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len--)
+        crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xff];
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t *p, size_t len)
+{
+    uint64_t c = crc, v;
+
+    while (len && ((uintptr_t)p & 7))
+    {
+        c = _mm_crc32_u8((uint32_t)c, *p++);
+        len--;
+    }
+    while (len >= 8)
+    {
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        len -= 8;
+    }
+    while (len--)
+        c = _mm_crc32_u8((uint32_t)c, *p++);
+    return (uint32_t)c;
+}
+#elif defined(__ARM_FEATURE_CRC32) && defined(__aarch64__)
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t *p, size_t len)
+{
+    uint64_t v;
+
+    while (len && ((uintptr_t)p & 7))
+    {
+        crc = __crc32cb(crc, *p++);
+        len--;
+    }
+    while (len >= 8)
+    {
+        memcpy(&v, p, 8);
+        crc = __crc32cd(crc, v);
+        p += 8;
+        len -= 8;
+    }
+    while (len--)
+        crc = __crc32cb(crc, *p++);
+    return crc;
+}
+#elif defined(__ARM_FEATURE_CRC32)
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t *p, size_t len)
+{
+    uint32_t v;
+
+    while (len >= 4)
+    {
+        memcpy(&v, p, 4);
+        crc = __crc32cw(crc, v);
+        p += 4;
+        len -= 4;
+    }
+    while (len--)
+        crc = __crc32cb(crc, *p++);
+    return crc;
+}
+#endif
+
+static crc_fn impl;
+static const char *impl_name;
+
+static void select_impl(void)
+{
+    build_table();
+    impl = crc32c_sw;
+    impl_name = "slicing-by-8";
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        impl = crc32c_hw;
+        impl_name = "sse4.2";
+    }
+#elif defined(__ARM_FEATURE_CRC32)
+    impl = crc32c_hw;
+    impl_name = "armv8-crc";
+#endif
+}
+
+/*
+ * CRC32C of a buffer
+ *
+ * Parameters:
+ *   uint32_t crc -> 0, or the result of a previous call to continue from
+ *   const void *p -> Data
+ *   size_t len -> Number of bytes
+ *
+ * Returns:
+ *   The CRC32C
+ */
+uint32_t crc32c(uint32_t crc, const void *p, size_t len)
+{
+    pthread_once(&table_once, select_impl);
+    return ~impl(~crc, p, len);
+}
+
+/*
+ * Name of the implementation in use, for logs and benchmarks
+ *
+ * Parameters:
+ *   None
+ *
+ * Returns:
+ *   "sse4.2", "armv8-crc" or "slicing-by-8"
+ */
+const char *crc32c_impl(void)
+{
+    pthread_once(&table_once, select_impl);
+    return impl_name;
+}
@@ -0,0 +1,20 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - CRC32C (Castagnoli) checksums
+ *
+ * Uses the CPU's CRC32C instruction where available (SSE4.2 on x86,
+ * selected at run time; the ARMv8 CRC extension when the compiler targets
+ * it, e.g. -march=armv8-a+crc on the Pi 3B+) and slicing-by-8 tables
+ * otherwise.
+ */
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+uint32_t crc32c(uint32_t crc, const void *p, size_t len);
+const char *crc32c_impl(void);
+
+#endif
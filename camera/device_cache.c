@@ -0,0 +1,142 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - On-disk cache of negotiated device configurations
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "device_cache.h"
+
+#define DC_LINE_MAX  256
+
+// Identifiers are stored as single words
+static void key_token(char *dst, size_t size, const char *src)
+{
+    size_t i;
+
+    for (i = 0; i + 1 < size && src[i]; i++)
+        dst[i] = isspace((unsigned char)src[i]) ? '_' : src[i];
+    dst[i] = '\0';
+    if (i == 0 && size > 1)
+        snprintf(dst, size, "-");
+}
+
+static int parse_line(const char *line, struct device_config *cfg)
+{
+    unsigned long long interval;
+    int crop;
+
+    memset(cfg, 0, sizeof(*cfg));
+    if (sscanf(line, "%15s %31s %x %u %u %u %u %u %u %d %u %llu", cfg->driver, cfg->bus_info,
+               &cfg->pixelformat, &cfg->width, &cfg->height, &cfg->bytesperline, &cfg->sizeimage,
+               &cfg->field, &cfg->colorspace, &crop, &cfg->buffers, &interval) != 12)
+        return -1;
+    cfg->crop = crop != 0;
+    cfg->interval_ns = interval;
+    return 0;
+}
+
+/*
+ * Look up the cached configuration of a device
+ *
+ * Parameters:
+ *   const char *path -> Cache file
+ *   const char *driver, *bus_info -> Identity from VIDIOC_QUERYCAP
+ *   struct device_config *cfg -> The cached configuration
+ *
+ * Returns:
+ *   0 on success, -1 with errno set (ENOENT when the device is not cached)
+ */
+int dc_load(const char *path, const char *driver, const char *bus_info, struct device_config *cfg)
+{
+    char line[DC_LINE_MAX], drv[sizeof(cfg->driver)], bus[sizeof(cfg->bus_info)];
+    FILE *f = fopen(path, "r");
+
+    if (!f)
+        return -1;
+
+    key_token(drv, sizeof(drv), driver);
+    key_token(bus, sizeof(bus), bus_info);
+    while (fgets(line, sizeof(line), f))
+    {
+        if (parse_line(line, cfg) == 0 && strcmp(cfg->driver, drv) == 0 && strcmp(cfg->bus_info, bus) == 0)
+        {
+            fclose(f);
+            return 0;
+        }
+    }
+    fclose(f);
+    errno = ENOENT;
+    return -1;
+}
+
+/*
+ * Record the configuration of a device, replacing its previous entry
+ *
+ * The file is rewritten under a temporary name and renamed into place.
+ *
+ * Parameters:
+ *   const char *path -> Cache file
+ *   const struct device_config *cfg -> Configuration to store
+ *
+ * Returns:
+ *   0 on success, -1 with errno set
+ */
+int dc_store(const char *path, const struct device_config *cfg)
+{
+    char tmp[4096], line[DC_LINE_MAX], drv[sizeof(cfg->driver)], bus[sizeof(cfg->bus_info)];
+    struct device_config old;
+    FILE *in, *out;
+    int err;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    out = fopen(tmp, "w");
+    if (!out)
+        return -1;
+
+    key_token(drv, sizeof(drv), cfg->driver);
+    key_token(bus, sizeof(bus), cfg->bus_info);
+
+    // Keep the other devices
+    in = fopen(path, "r");
+    if (in)
+    {
+        while (fgets(line, sizeof(line), in))
+        {
+            if (parse_line(line, &old) == 0 && (strcmp(old.driver, drv) != 0 || strcmp(old.bus_info, bus) != 0))
+                fputs(line, out);
+        }
+        fclose(in);
+    }
+
+    fprintf(out, "%s %s %08x %u %u %u %u %u %u %d %u %llu\n", drv, bus, cfg->pixelformat, cfg->width,
+            cfg->height, cfg->bytesperline, cfg->sizeimage, cfg->field, cfg->colorspace, cfg->crop ? 1 : 0,
+            cfg->buffers, (unsigned long long)cfg->interval_ns);
+
+    if (ferror(out))
+    {
+        err = EIO;
+        fclose(out);
+        unlink(tmp);
+        errno = err;
+        return -1;
+    }
+    if (fclose(out) == EOF || rename(tmp, path) == -1)
+    {
+        err = errno;
+        unlink(tmp);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
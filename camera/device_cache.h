@@ -0,0 +1,38 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - On-disk cache of negotiated device configurations
+ *
+ * Format negotiation is the slow part of bringing a UVC camera up: every
+ * S_FMT is a probe/commit exchange over USB. The outcome for each device,
+ * identified by its driver and bus info, is kept in a small text file
+ * (one line per device) so the next start can check the current format
+ * with a G_FMT and skip the negotiation, the crop reset and the frame
+ * rate query when nothing changed.
+ */
+
+#ifndef DEVICE_CACHE_H
+#define DEVICE_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct device_config
+{
+    char driver[16];            // v4l2_capability.driver
+    char bus_info[32];          // v4l2_capability.bus_info
+    uint32_t pixelformat;
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytesperline;
+    uint32_t sizeimage;
+    uint32_t field;
+    uint32_t colorspace;
+    bool crop;                  // CROPCAP worked; the crop rectangle is reset on start
+    uint32_t buffers;           // Granted by REQBUFS
+    uint64_t interval_ns;       // From G_PARM, 0 if the driver has none
+};
+
+int dc_load(const char *path, const char *driver, const char *bus_info, struct device_config *cfg);
+int dc_store(const char *path, const struct device_config *cfg);
+
+#endif
@@ -0,0 +1,298 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Durability policy for recorded frames
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include "durability.h"
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Parse a policy string: none, frames:N, ms:M, frames:N,ms:M or writeback
+ *
+ * Parameters:
+ *   const char *s -> Policy string
+ *   struct durability_policy *p -> Parsed policy
+ *
+ * Returns:
+ *   0 on success, -1 if the string is not a valid policy
+ */
+int dur_parse(const char *s, struct durability_policy *p)
+{
+    const char *tok = s;
+    char *end;
+    unsigned long v;
+
+    memset(p, 0, sizeof(*p));
+    if (strcmp(s, "none") == 0)
+        return 0;
+    if (strcmp(s, "writeback") == 0)
+    {
+        p->mode = DUR_WRITEBACK;
+        return 0;
+    }
+
+    p->mode = DUR_PERIODIC;
+    while (*tok)
+    {
+        if (strncmp(tok, "frames:", 7) == 0)
+        {
+            v = strtoul(tok + 7, &end, 10);
+            p->every_frames = v;
+        }
+        else if (strncmp(tok, "ms:", 3) == 0)
+        {
+            v = strtoul(tok + 3, &end, 10);
+            p->every_ms = v;
+        }
+        else
+            return -1;
+
+        if (end == tok || v == 0 || (*end != ',' && *end != '\0'))
+            return -1;
+        tok = (*end == ',') ? end + 1 : end;
+    }
+    return (p->every_frames || p->every_ms) ? 0 : -1;
+}
+
+/*
+ * Initialise durability state for one output
+ *
+ * Parameters:
+ *   struct durability *d -> State to initialise
+ *   const struct durability_policy *p -> The policy
+ *   enum durability_scope scope -> File-per-frame or stream output
+ *   storage_event_fn on_event -> Called for every write/sync failure (may be NULL)
+ *   void *arg -> Passed through to on_event
+ *
+ * Returns:
+ *   None
+ */
+void dur_init(struct durability *d, const struct durability_policy *p, enum durability_scope scope,
+              storage_event_fn on_event, void *arg)
+{
+    memset(d, 0, sizeof(*d));
+    d->policy = *p;
+    d->scope = scope;
+    if (d->policy.mode == DUR_WRITEBACK && scope == DUR_SCOPE_FILE && d->policy.every_ms == 0)
+        d->policy.every_ms = DUR_FILE_SYNC_MS;
+    d->on_event = on_event;
+    d->arg = arg;
+}
+
+/*
+ * Surface a write or space failure as a storage event
+ *
+ * Parameters:
+ *   struct durability *d -> Durability state
+ *   int err -> errno of the failure
+ *   const char *path -> File being written
+ *
+ * Returns:
+ *   None
+ */
+void dur_report(struct durability *d, int err, const char *path)
+{
+    enum storage_event ev = (err == ENOSPC || err == EDQUOT) ? STORAGE_EV_NO_SPACE : STORAGE_EV_WRITE_ERROR;
+
+    d->events++;
+    if (d->on_event)
+        d->on_event(ev, err, path, d->arg);
+}
+
+static void report_sync(struct durability *d, int err, const char *path)
+{
+    d->events++;
+    if (d->on_event)
+        d->on_event(err == ENOSPC ? STORAGE_EV_NO_SPACE : STORAGE_EV_SYNC_ERROR, err, path, d->arg);
+}
+
+/*
+ * Account for one frame handed to the kernel
+ *
+ * Parameters:
+ *   struct durability *d -> Durability state
+ *
+ * Returns:
+ *   true if the policy wants dur_sync() called now
+ */
+bool dur_frame_written(struct durability *d)
+{
+    int64_t now = now_ns();
+
+    if (d->pending_frames++ == 0)
+        d->pending_since_ns = now;
+
+    if (d->pending_frames > d->max_loss_frames)
+        d->max_loss_frames = d->pending_frames;
+    if (now - d->pending_since_ns > d->max_loss_ns)
+        d->max_loss_ns = now - d->pending_since_ns;
+
+    switch (d->policy.mode)
+    {
+    case DUR_PERIODIC:
+        if (d->policy.every_frames && d->pending_frames >= d->policy.every_frames)
+            return true;
+        return d->policy.every_ms && (now - d->pending_since_ns) >= (int64_t)d->policy.every_ms * 1000000;
+    case DUR_WRITEBACK:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+ * Mark everything written so far as durable
+ */
+static void all_durable(struct durability *d)
+{
+    d->pending_frames = 0;
+    d->inflight_frames = 0;
+    d->syncs++;
+}
+
+/*
+ * Rolling writeback on a stream: wait for the window submitted last
+ * time, drop it from the page cache, then start writeback of new data
+ */
+static int rolling_writeback(struct durability *d, int fd, off_t end)
+{
+    if (d->submitted > d->waited)
+    {
+        if (sync_file_range(fd, d->waited, d->submitted - d->waited,
+                            SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER) == -1)
+            return -1;
+        posix_fadvise(fd, d->waited, d->submitted - d->waited, POSIX_FADV_DONTNEED);
+        d->waited = d->submitted;
+        d->pending_frames -= d->inflight_frames;
+        d->syncs++;
+    }
+
+    d->inflight_frames = d->pending_frames;
+    if (end > d->submitted)
+    {
+        if (sync_file_range(fd, d->submitted, end - d->submitted, SYNC_FILE_RANGE_WRITE) == -1)
+            return -1;
+        d->submitted = end;
+    }
+    return 0;
+}
+
+/*
+ * Writeback of one file per frame: start the file's data on its way
+ * without waiting, and make the files and their directory entries durable
+ * with a periodic syncfs(); until then the frames stay pending
+ */
+static int file_writeback(struct durability *d, int fd)
+{
+    if (sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE) == -1)
+        return -1;
+    if (now_ns() - d->pending_since_ns < (int64_t)d->policy.every_ms * 1000000)
+        return 0;
+    if (syncfs(fd) == -1)
+        return -1;
+    all_durable(d);
+    return 0;
+}
+
+/*
+ * Make data up to 'end' durable according to the policy
+ *
+ * For DUR_SCOPE_FILE the per-frame file is about to be closed, so a
+ * periodic sync covers the whole filesystem (syncfs) to include the
+ * frames written since the last one.
+ *
+ * Parameters:
+ *   struct durability *d -> Durability state
+ *   int fd -> Descriptor holding the data (all of it handed to the kernel)
+ *   off_t end -> Offset up to which data has been written
+ *   const char *path -> File name used in events
+ *
+ * Returns:
+ *   0 on success, -1 after reporting a sync event
+ */
+int dur_sync(struct durability *d, int fd, off_t end, const char *path)
+{
+    int r = 0;
+
+    switch (d->policy.mode)
+    {
+    case DUR_PERIODIC:
+        r = (d->scope == DUR_SCOPE_FILE) ? syncfs(fd) : fdatasync(fd);
+        if (r == 0)
+            all_durable(d);
+        break;
+    case DUR_WRITEBACK:
+        if (d->scope == DUR_SCOPE_FILE)
+            r = file_writeback(d, fd);
+        else
+            r = rolling_writeback(d, fd, end);
+        break;
+    default:
+        break;
+    }
+
+    if (r == -1)
+    {
+        report_sync(d, errno, path);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Make a stream durable before its file is closed (segment rotation)
+ *
+ * Parameters:
+ *   struct durability *d -> Durability state
+ *   int fd -> Descriptor about to be closed
+ *   const char *path -> File name used in events
+ *
+ * Returns:
+ *   0 on success, -1 after reporting a sync event
+ */
+int dur_finish(struct durability *d, int fd, const char *path)
+{
+    if (d->policy.mode != DUR_NONE && d->pending_frames > 0)
+    {
+        if (fdatasync(fd) == -1)
+        {
+            report_sync(d, errno, path);
+            dur_stream_reset(d);
+            return -1;
+        }
+        all_durable(d);
+    }
+    dur_stream_reset(d);
+    return 0;
+}
+
+/*
+ * Forget writeback offsets when a new stream file is started
+ *
+ * Parameters:
+ *   struct durability *d -> Durability state
+ *
+ * Returns:
+ *   None
+ */
+void dur_stream_reset(struct durability *d)
+{
+    d->submitted = 0;
+    d->waited = 0;
+}
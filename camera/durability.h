@@ -0,0 +1,89 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Durability policy for recorded frames
+ *
+ * Decides when written frames are forced to stable storage and turns
+ * write/sync failures into storage events instead of silently losing
+ * frames. Policies:
+ *   none       - leave it to kernel writeback (loss window ~30 s)
+ *   frames:N   - fdatasync every N frames
+ *   ms:M       - fdatasync when the oldest unsynced frame is M ms old
+ *   writeback  - rolling sync_file_range(): start writeback of new data
+ *                every frame, wait for the previous window to land
+ *
+ * sync_file_range() never writes the inode or the directory entry, so for
+ * one file per frame writeback only starts each file's data on its way,
+ * without waiting, and the frames count as durable once a syncfs() every
+ * DUR_FILE_SYNC_MS (or every_ms, if set) has run.
+ */
+
+#ifndef DURABILITY_H
+#define DURABILITY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define DUR_FILE_SYNC_MS    1000    // DUR_WRITEBACK, DUR_SCOPE_FILE: default syncfs() period
+
+enum durability_mode
+{
+    DUR_NONE,
+    DUR_PERIODIC,
+    DUR_WRITEBACK,
+};
+
+// One file per frame (dump_ppm) or one long stream (container segment)
+enum durability_scope
+{
+    DUR_SCOPE_FILE,
+    DUR_SCOPE_STREAM,
+};
+
+enum storage_event
+{
+    STORAGE_EV_WRITE_ERROR,
+    STORAGE_EV_NO_SPACE,
+    STORAGE_EV_SYNC_ERROR,
+};
+
+typedef void (*storage_event_fn)(enum storage_event ev, int err, const char *path, void *arg);
+
+struct durability_policy
+{
+    enum durability_mode mode;
+    unsigned int every_frames;  // DUR_PERIODIC: 0 disables the frame trigger
+    unsigned int every_ms;      // DUR_PERIODIC: 0 disables the time trigger; DUR_WRITEBACK: syncfs() period of files
+};
+
+struct durability
+{
+    struct durability_policy policy;
+    enum durability_scope scope;
+    storage_event_fn on_event;
+    void *arg;
+
+    unsigned int pending_frames;    // Written but not yet known durable
+    int64_t pending_since_ns;       // Write time of the oldest pending frame
+    unsigned int inflight_frames;   // DUR_WRITEBACK: submitted, not yet waited on
+    int64_t inflight_since_ns;
+    off_t submitted;                // DUR_WRITEBACK: offset writeback was started up to
+    off_t waited;                   // DUR_WRITEBACK: offset known to be on the device
+
+    // Largest loss window observed: what a power cut at the worst moment costs
+    unsigned int max_loss_frames;
+    int64_t max_loss_ns;
+    unsigned int syncs;
+    unsigned int events;
+};
+
+int dur_parse(const char *s, struct durability_policy *p);
+void dur_init(struct durability *d, const struct durability_policy *p, enum durability_scope scope,
+              storage_event_fn on_event, void *arg);
+bool dur_frame_written(struct durability *d);
+int dur_sync(struct durability *d, int fd, off_t end, const char *path);
+int dur_finish(struct durability *d, int fd, const char *path);
+void dur_stream_reset(struct durability *d);
+void dur_report(struct durability *d, int err, const char *path);
+
+#endif
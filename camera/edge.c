@@ -0,0 +1,403 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Row-streamed 3x3 Sobel/Scharr gradient of the luma
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <linux/videodev2.h>
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "edge.h"
+#include "memacct.h"
+
+// Right shift that turns |Gx| + |Gy| of a step of n levels into n
+#define SOBEL_SHIFT     2
+#define SCHARR_SHIFT    4
+
+/*
+ * Set up a gradient stage for a packed 4:2:2 stream
+ *
+ * Parameters:
+ *   struct edge_filter *e -> Filter to initialise
+ *   uint32_t width, height -> Frame geometry in pixels
+ *   uint32_t pixelformat -> V4L2_PIX_FMT_YUYV or V4L2_PIX_FMT_UYVY
+ *   enum edge_kernel kernel -> EDGE_SOBEL or EDGE_SCHARR
+ *   unsigned int bins -> Orientation bins (2..EDGE_MAX_BINS), 0 for none
+ *
+ * Returns:
+ *   0 on success, -1 with errno set (EINVAL, ENOMEM)
+ */
+int edge_init(struct edge_filter *e, uint32_t width, uint32_t height, uint32_t pixelformat, enum edge_kernel kernel,
+              unsigned int bins)
+{
+    unsigned int i;
+    double angle;
+
+    memset(e, 0, sizeof(*e));
+    if ((pixelformat != V4L2_PIX_FMT_YUYV && pixelformat != V4L2_PIX_FMT_UYVY) || width < 2 || height < 1 ||
+        (kernel != EDGE_SOBEL && kernel != EDGE_SCHARR) || bins == 1 || bins > EDGE_MAX_BINS)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    e->width = width;
+    e->height = height;
+    e->y_offset = (pixelformat == V4L2_PIX_FMT_UYVY) ? 1 : 0;
+    e->kernel = kernel;
+    e->bins = bins;
+    // Boundary i is half a bin before the centre of bin i
+    for (i = 1; i <= bins; i++)
+    {
+        angle = M_PI * (i - 0.5) / bins;
+        e->bound[i][0] = (int16_t)lround(cos(angle) * 16384);
+        e->bound[i][1] = (int16_t)lround(-sin(angle) * 16384);
+    }
+
+    // One allocation: 3 + 3 lines of int16 terms, then the two output lines
+    e->diff[0] = malloc((size_t)width * (6 * sizeof(int16_t) + 2));
+    if (!e->diff[0])
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    for (i = 0; i < 3; i++)
+    {
+        e->diff[i] = e->diff[0] + (size_t)i * width;
+        e->smooth[i] = e->diff[0] + (size_t)(3 + i) * width;
+    }
+    e->mag_line = (uint8_t *)(e->diff[0] + (size_t)6 * width);
+    e->bin_line = e->mag_line + width;
+    mem_charge(MEM_ANALYSIS, (size_t)width * (6 * sizeof(int16_t) + 2));
+    return 0;
+}
+
+/*
+ * Parse "sobel" or "scharr", optionally followed by ":bins"
+ *
+ * Parameters:
+ *   const char *s -> The string
+ *   enum edge_kernel *kernel -> The kernel
+ *   unsigned int *bins -> Orientation bins, 0 when not given
+ *
+ * Returns:
+ *   0 on success, -1 with errno set to EINVAL
+ */
+int edge_parse(const char *s, enum edge_kernel *kernel, unsigned int *bins)
+{
+    const char *colon = strchr(s, ':');
+    size_t len = colon ? (size_t)(colon - s) : strlen(s);
+    char *end;
+
+    if (len == 5 && strncmp(s, "sobel", 5) == 0)
+        *kernel = EDGE_SOBEL;
+    else if (len == 6 && strncmp(s, "scharr", 6) == 0)
+        *kernel = EDGE_SCHARR;
+    else
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *bins = 0;
+    if (colon)
+    {
+        *bins = strtoul(colon + 1, &end, 0);
+        if (*end != '\0' || *bins < 2 || *bins > EDGE_MAX_BINS)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static inline int luma_at(const uint8_t *row, unsigned int yo, uint32_t width, int x)
+{
+    if (x < 0)
+        x = 0;
+    if (x >= (int)width)
+        x = width - 1;
+    return row[x * 2 + yo];
+}
+
+/*
+ * Horizontal difference and smoothing term of one luma row
+ */
+static void row_terms(const struct edge_filter *e, const uint8_t *row, int16_t *d, int16_t *s)
+{
+    unsigned int yo = e->y_offset;
+    int w = e->width, x = 1, l, c, r;
+
+#if defined(__x86_64__)
+    const __m128i mask = _mm_set1_epi16(0x00ff), three = _mm_set1_epi16(3), ten = _mm_set1_epi16(10);
+    __m128i lm, lc, lp;
+
+    for (; x + 9 <= w; x += 8)
+    {
+        lm = _mm_loadu_si128((const __m128i *)(row + (x - 1) * 2));
+        lc = _mm_loadu_si128((const __m128i *)(row + x * 2));
+        lp = _mm_loadu_si128((const __m128i *)(row + (x + 1) * 2));
+        if (yo)
+        {
+            lm = _mm_srli_epi16(lm, 8);
+            lc = _mm_srli_epi16(lc, 8);
+            lp = _mm_srli_epi16(lp, 8);
+        }
+        else
+        {
+            lm = _mm_and_si128(lm, mask);
+            lc = _mm_and_si128(lc, mask);
+            lp = _mm_and_si128(lp, mask);
+        }
+        _mm_storeu_si128((__m128i *)(d + x), _mm_sub_epi16(lp, lm));
+        if (e->kernel == EDGE_SOBEL)
+            _mm_storeu_si128((__m128i *)(s + x), _mm_add_epi16(_mm_add_epi16(lm, lp), _mm_slli_epi16(lc, 1)));
+        else
+            _mm_storeu_si128((__m128i *)(s + x), _mm_add_epi16(_mm_mullo_epi16(_mm_add_epi16(lm, lp), three),
+                                                               _mm_mullo_epi16(lc, ten)));
+    }
+#elif defined(__ARM_NEON)
+    uint16x8_t lm, lc, lp;
+
+    for (; x + 9 <= w; x += 8)
+    {
+        lm = vreinterpretq_u16_u8(vld1q_u8(row + (x - 1) * 2));
+        lc = vreinterpretq_u16_u8(vld1q_u8(row + x * 2));
+        lp = vreinterpretq_u16_u8(vld1q_u8(row + (x + 1) * 2));
+        if (yo)
+        {
+            lm = vshrq_n_u16(lm, 8);
+            lc = vshrq_n_u16(lc, 8);
+            lp = vshrq_n_u16(lp, 8);
+        }
+        else
+        {
+            lm = vandq_u16(lm, vdupq_n_u16(0x00ff));
+            lc = vandq_u16(lc, vdupq_n_u16(0x00ff));
+            lp = vandq_u16(lp, vdupq_n_u16(0x00ff));
+        }
+        vst1q_s16(d + x, vreinterpretq_s16_u16(vsubq_u16(lp, lm)));
+        if (e->kernel == EDGE_SOBEL)
+            vst1q_s16(s + x, vreinterpretq_s16_u16(vaddq_u16(vaddq_u16(lm, lp), vshlq_n_u16(lc, 1))));
+        else
+            vst1q_s16(s + x, vreinterpretq_s16_u16(vmlaq_n_u16(vmulq_n_u16(vaddq_u16(lm, lp), 3), lc, 10)));
+    }
+#endif
+    // Tail, then the first pixel; the first and last use their clamped neighbours
+    for (;; x++)
+    {
+        if (x == w)
+            x = 0;
+        l = luma_at(row, yo, w, x - 1);
+        c = luma_at(row, yo, w, x);
+        r = luma_at(row, yo, w, x + 1);
+        d[x] = r - l;
+        s[x] = (e->kernel == EDGE_SOBEL) ? l + 2 * c + r : 3 * (l + r) + 10 * c;
+        if (x == 0)
+            break;
+    }
+}
+
+/*
+ * Magnitude and orientation bin of one output row
+ */
+static void row_gradient(const struct edge_filter *e, const int16_t *d0, const int16_t *d1, const int16_t *d2,
+                         const int16_t *s0, const int16_t *s2, uint8_t *mag, uint8_t *bin)
+{
+    int shift = (e->kernel == EDGE_SOBEL) ? SOBEL_SHIFT : SCHARR_SHIFT;
+    uint32_t w = e->width, x = 0;
+    unsigned int k, n;
+    int gx, gy;
+
+#if defined(__x86_64__)
+    const __m128i zero = _mm_setzero_si128(), three = _mm_set1_epi16(3), ten = _mm_set1_epi16(10);
+    __m128i gxv, gyv, flip, count, lo, hi, bound;
+
+    for (; x + 8 <= w; x += 8)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(d0 + x)), c = _mm_loadu_si128((const __m128i *)(d2 + x));
+        __m128i b = _mm_loadu_si128((const __m128i *)(d1 + x));
+
+        if (e->kernel == EDGE_SOBEL)
+            gxv = _mm_add_epi16(_mm_add_epi16(a, c), _mm_slli_epi16(b, 1));
+        else
+            gxv = _mm_add_epi16(_mm_mullo_epi16(_mm_add_epi16(a, c), three), _mm_mullo_epi16(b, ten));
+        gyv = _mm_sub_epi16(_mm_loadu_si128((const __m128i *)(s2 + x)), _mm_loadu_si128((const __m128i *)(s0 + x)));
+
+        // |Gx| + |Gy| fits 16 bits for both kernels; packus saturates at 255
+        a = _mm_add_epi16(_mm_max_epi16(gxv, _mm_sub_epi16(zero, gxv)), _mm_max_epi16(gyv, _mm_sub_epi16(zero, gyv)));
+        _mm_storel_epi64((__m128i *)(mag + x), _mm_packus_epi16(_mm_srai_epi16(a, shift), zero));
+        if (!bin)
+            continue;
+
+        // Fold into the upper half plane, then count the boundaries the gradient lies beyond
+        flip = _mm_or_si128(_mm_cmplt_epi16(gyv, zero),
+                            _mm_and_si128(_mm_cmpeq_epi16(gyv, zero), _mm_cmplt_epi16(gxv, zero)));
+        gxv = _mm_sub_epi16(_mm_xor_si128(gxv, flip), flip);
+        gyv = _mm_sub_epi16(_mm_xor_si128(gyv, flip), flip);
+        lo = _mm_unpacklo_epi16(gyv, gxv);
+        hi = _mm_unpackhi_epi16(gyv, gxv);
+        count = zero;
+        for (k = 1; k <= e->bins; k++)
+        {
+            bound = _mm_set1_epi32((uint16_t)e->bound[k][0] | ((uint32_t)(uint16_t)e->bound[k][1] << 16));
+            count = _mm_sub_epi16(count, _mm_packs_epi32(_mm_cmpgt_epi32(_mm_madd_epi16(lo, bound), zero),
+                                                         _mm_cmpgt_epi32(_mm_madd_epi16(hi, bound), zero)));
+        }
+        // Past the last boundary is back at bin 0
+        count = _mm_andnot_si128(_mm_cmpeq_epi16(count, _mm_set1_epi16(e->bins)), count);
+        _mm_storel_epi64((__m128i *)(bin + x), _mm_packus_epi16(count, zero));
+    }
+#elif defined(__ARM_NEON)
+    int16x8_t gxv, gyv, count;
+    uint16x8_t flip, beyond;
+    int32x4_t lo, hi;
+
+    for (; x + 8 <= w; x += 8)
+    {
+        int16x8_t a = vld1q_s16(d0 + x), b = vld1q_s16(d1 + x), c = vld1q_s16(d2 + x);
+
+        if (e->kernel == EDGE_SOBEL)
+            gxv = vaddq_s16(vaddq_s16(a, c), vshlq_n_s16(b, 1));
+        else
+            gxv = vmlaq_n_s16(vmulq_n_s16(vaddq_s16(a, c), 3), b, 10);
+        gyv = vsubq_s16(vld1q_s16(s2 + x), vld1q_s16(s0 + x));
+        a = vaddq_s16(vabsq_s16(gxv), vabsq_s16(gyv));
+        vst1_u8(mag + x, vqmovun_s16(vshlq_s16(a, vdupq_n_s16(-shift))));
+        if (!bin)
+            continue;
+
+        flip = vorrq_u16(vcltq_s16(gyv, vdupq_n_s16(0)),
+                         vandq_u16(vceqq_s16(gyv, vdupq_n_s16(0)), vcltq_s16(gxv, vdupq_n_s16(0))));
+        gxv = vbslq_s16(flip, vnegq_s16(gxv), gxv);
+        gyv = vbslq_s16(flip, vnegq_s16(gyv), gyv);
+        count = vdupq_n_s16(0);
+        for (k = 1; k <= e->bins; k++)
+        {
+            lo = vmlal_n_s16(vmull_n_s16(vget_low_s16(gyv), e->bound[k][0]), vget_low_s16(gxv), e->bound[k][1]);
+            hi = vmlal_n_s16(vmull_n_s16(vget_high_s16(gyv), e->bound[k][0]), vget_high_s16(gxv), e->bound[k][1]);
+            beyond = vcombine_u16(vmovn_u32(vcgtq_s32(lo, vdupq_n_s32(0))), vmovn_u32(vcgtq_s32(hi, vdupq_n_s32(0))));
+            count = vsubq_s16(count, vreinterpretq_s16_u16(beyond));
+        }
+        count = vbslq_s16(vceqq_s16(count, vdupq_n_s16(e->bins)), vdupq_n_s16(0), count);
+        vst1_u8(bin + x, vmovn_u16(vreinterpretq_u16_s16(count)));
+    }
+#endif
+    for (; x < w; x++)
+    {
+        gx = (e->kernel == EDGE_SOBEL) ? d0[x] + 2 * d1[x] + d2[x] : 3 * (d0[x] + d2[x]) + 10 * d1[x];
+        gy = s2[x] - s0[x];
+        n = (abs(gx) + abs(gy)) >> shift;
+        mag[x] = n > 255 ? 255 : n;
+        if (!bin)
+            continue;
+        if (gy < 0 || (gy == 0 && gx < 0))
+        {
+            gx = -gx;
+            gy = -gy;
+        }
+        for (n = 0, k = 1; k <= e->bins; k++)
+            n += gy * e->bound[k][0] + gx * e->bound[k][1] > 0;
+        bin[x] = n % e->bins;
+    }
+}
+
+/*
+ * Gradient of one frame
+ *
+ * Parameters:
+ *   struct edge_filter *e -> The filter
+ *   const uint8_t *frame -> Packed 4:2:2 frame of the configured geometry
+ *   uint8_t *mag -> width x height magnitudes, or NULL for statistics only
+ *   uint8_t *bin -> width x height orientation bins, or NULL
+ *   struct edge_stats *st -> Statistics of the frame, or NULL
+ *
+ * Returns:
+ *   None
+ */
+void edge_frame(struct edge_filter *e, const uint8_t *frame, uint8_t *mag, uint8_t *bin, struct edge_stats *st)
+{
+    size_t stride = (size_t)e->width * 2;
+    uint32_t y, x, prev, next;
+    uint64_t sum = 0;
+    uint8_t *m, *b;
+
+    if (st)
+        memset(st, 0, sizeof(*st));
+    row_terms(e, frame, e->diff[0], e->smooth[0]);
+    if (e->height > 1)
+        row_terms(e, frame + stride, e->diff[1], e->smooth[1]);
+
+    for (y = 0; y < e->height; y++)
+    {
+        // The ring slot of row y + 1 held row y - 2, which is no longer needed
+        if (y >= 1 && y + 1 < e->height)
+            row_terms(e, frame + (y + 1) * stride, e->diff[(y + 1) % 3], e->smooth[(y + 1) % 3]);
+        prev = (y > 0) ? (y - 1) % 3 : 0;
+        next = (y + 1 < e->height) ? (y + 1) % 3 : y % 3;
+
+        m = mag ? mag + (size_t)y * e->width : e->mag_line;
+        b = !e->bins ? NULL : bin ? bin + (size_t)y * e->width : st ? e->bin_line : NULL;
+        row_gradient(e, e->diff[prev], e->diff[y % 3], e->diff[next], e->smooth[prev], e->smooth[next], m, b);
+        if (!st)
+            continue;
+
+        for (x = 0; x < e->width; x++)
+        {
+            sum += m[x];
+            st->edges += m[x] >= EDGE_THRESHOLD;
+            if (b)
+                st->hist[b[x]] += m[x];
+        }
+    }
+    if (st)
+        st->mean = (sum << 8) / ((uint64_t)e->width * e->height);
+}
+
+/*
+ * Name of the row kernels in use
+ *
+ * Parameters:
+ *   None
+ *
+ * Returns:
+ *   "sse2", "neon" or "scalar"
+ */
+const char *edge_impl(void)
+{
+#if defined(__x86_64__)
+    return "sse2";
+#elif defined(__ARM_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
+
+/*
+ * Release the line buffers
+ *
+ * Parameters:
+ *   struct edge_filter *e -> The filter
+ *
+ * Returns:
+ *   None
+ */
+void edge_free(struct edge_filter *e)
+{
+    if (e->diff[0])
+        mem_release(MEM_ANALYSIS, (size_t)e->width * (6 * sizeof(int16_t) + 2));
+    free(e->diff[0]);
+    memset(e, 0, sizeof(*e));
+}
@@ -0,0 +1,65 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Row-streamed 3x3 Sobel/Scharr gradient of the luma
+ *
+ * Edge maps are less sensitive to lighting than raw luma, which makes
+ * them the input of choice for focus and tamper checks. Both kernels are
+ * separable, so each luma row is reduced once to a horizontal difference
+ * and a horizontal smoothing term; the gradient of a row then only needs
+ * those terms of the rows above and below it. They are kept in a ring of
+ * three lines, read straight from the packed 4:2:2 frame, so apart from
+ * the caller's optional output no more than four lines of intermediate
+ * data ever exist. The row passes run on 8 pixels at a time with SSE2 or
+ * NEON (scalar fallback), including the orientation binning, which
+ * compares the gradient against the bin boundaries with fixed-point
+ * cross products instead of calling atan2().
+ *
+ * The magnitude is |Gx| + |Gy| normalised so that a step of n levels
+ * reads n, saturated to 255. Orientation is unsigned (0..180 degrees) in
+ * equal bins, bin 0 centred on a horizontal gradient (a vertical edge);
+ * flat pixels land in bin 0 too, with no weight in the histogram.
+ */
+
+#ifndef EDGE_H
+#define EDGE_H
+
+#include <stdint.h>
+
+#define EDGE_MAX_BINS   16
+#define EDGE_THRESHOLD  24      // Magnitude counted as an edge pixel
+
+enum edge_kernel
+{
+    EDGE_SOBEL,                 // [1 2 1] x [-1 0 1]
+    EDGE_SCHARR,                // [3 10 3] x [-1 0 1], better rotational symmetry
+};
+
+struct edge_stats
+{
+    uint32_t mean;              // Mean magnitude, x256 (a focus measure)
+    uint32_t edges;             // Pixels at or above EDGE_THRESHOLD
+    uint64_t hist[EDGE_MAX_BINS];   // Magnitude summed per orientation bin
+};
+
+struct edge_filter
+{
+    uint32_t width;
+    uint32_t height;
+    unsigned int y_offset;      // Byte of the first luma sample in a 4-byte macropixel
+    enum edge_kernel kernel;
+    unsigned int bins;          // 0 for no orientation
+    int16_t bound[EDGE_MAX_BINS + 1][2];    // cos, -sin of the bin boundaries, Q14
+    int16_t *diff[3];           // Ring of horizontal differences
+    int16_t *smooth[3];         // Ring of horizontal smoothing terms
+    uint8_t *mag_line;          // Output rows when the caller wants statistics only
+    uint8_t *bin_line;
+};
+
+int edge_init(struct edge_filter *e, uint32_t width, uint32_t height, uint32_t pixelformat, enum edge_kernel kernel,
+              unsigned int bins);
+void edge_frame(struct edge_filter *e, const uint8_t *frame, uint8_t *mag, uint8_t *bin, struct edge_stats *st);
+void edge_free(struct edge_filter *e);
+int edge_parse(const char *s, enum edge_kernel *kernel, unsigned int *bins);
+const char *edge_impl(void);
+
+#endif
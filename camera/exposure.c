@@ -0,0 +1,196 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Histogram-driven exposure and gain control
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <linux/videodev2.h>
+
+#include "exposure.h"
+
+// Every AE_ROW_STEP-th row and every AE_COL_STEP-th pixel are metered
+#define AE_ROW_STEP         4
+#define AE_COL_STEP         2
+
+// Errors within this factor of the target are left alone
+#define AE_DEAD_BAND        1.08
+
+// Share of the error corrected by one update
+#define AE_DAMPING          0.6
+
+// The 99th percentile is not pushed above this level when brightening
+#define AE_HIGHLIGHT_LEVEL  250.0
+
+// Gain multiplier at the top of the gain range; the range is taken as linear
+#define AE_MAX_GAIN         8.0
+
+static int32_t clamp(double v, int32_t lo, int32_t hi)
+{
+    if (v < lo)
+        return lo;
+    if (v > hi)
+        return hi;
+    return (int32_t)(v + 0.5);
+}
+
+static double gain_factor(const struct ae_config *cfg, int32_t gain)
+{
+    if (cfg->gain.max <= cfg->gain.min)
+        return 1.0;
+    return 1.0 + (double)(gain - cfg->gain.min) * (AE_MAX_GAIN - 1.0) / (cfg->gain.max - cfg->gain.min);
+}
+
+static int32_t gain_control(const struct ae_config *cfg, double factor)
+{
+    if (cfg->gain.max <= cfg->gain.min)
+        return cfg->gain.min;
+    return clamp(cfg->gain.min + (factor - 1.0) * (cfg->gain.max - cfg->gain.min) / (AE_MAX_GAIN - 1.0),
+                 cfg->gain.min, cfg->gain.max);
+}
+
+/*
+ * Set up a controller for a packed 4:2:2 stream
+ *
+ * Parameters:
+ *   struct ae_controller *c -> Controller to initialise
+ *   const struct ae_config *cfg -> Control ranges, frame-rate cap and target
+ *   uint32_t width, height -> Frame geometry in pixels
+ *   uint32_t pixelformat -> V4L2_PIX_FMT_YUYV or V4L2_PIX_FMT_UYVY
+ *   const struct ae_controls *start -> Controls currently set on the device
+ *
+ * Returns:
+ *   0 on success, -1 with errno set to EINVAL
+ */
+int ae_init(struct ae_controller *c, const struct ae_config *cfg, uint32_t width, uint32_t height,
+            uint32_t pixelformat, const struct ae_controls *start)
+{
+    memset(c, 0, sizeof(*c));
+    if ((pixelformat != V4L2_PIX_FMT_YUYV && pixelformat != V4L2_PIX_FMT_UYVY) ||
+        width < AE_COL_STEP || height < AE_ROW_STEP || cfg->exposure.max < cfg->exposure.min ||
+        cfg->gain.max < cfg->gain.min || cfg->target == 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    c->cfg = *cfg;
+    if (c->cfg.exposure_cap > cfg->exposure.max || c->cfg.exposure_cap <= 0)
+        c->cfg.exposure_cap = cfg->exposure.max;
+    if (c->cfg.exposure_cap < cfg->exposure.min)
+        c->cfg.exposure_cap = cfg->exposure.min;
+    if (c->cfg.every == 0)
+        c->cfg.every = 1;
+
+    c->width = width;
+    c->height = height;
+    c->y_offset = (pixelformat == V4L2_PIX_FMT_UYVY) ? 1 : 0;
+    c->stats.controls.exposure = clamp(start->exposure, cfg->exposure.min, cfg->exposure.max);
+    c->stats.controls.gain = clamp(start->gain, cfg->gain.min, cfg->gain.max);
+    return 0;
+}
+
+/*
+ * Luma histogram of the metered pixels
+ */
+static uint32_t build_histogram(struct ae_controller *c, const uint8_t *frame)
+{
+    size_t stride = (size_t)c->width * 2;
+    uint32_t x, y, n = 0;
+    const uint8_t *p;
+
+    memset(c->hist, 0, sizeof(c->hist));
+    for (y = 0; y < c->height; y += AE_ROW_STEP)
+    {
+        p = frame + y * stride + c->y_offset;
+        for (x = 0; x < c->width; x += AE_COL_STEP, n++)
+            c->hist[p[x * 2] >> 2]++;
+    }
+    return n;
+}
+
+/*
+ * Meter one frame and decide whether the controls should change
+ *
+ * Parameters:
+ *   struct ae_controller *c -> The controller
+ *   const uint8_t *frame -> Packed 4:2:2 frame of the configured geometry
+ *   struct ae_controls *out -> Controls to apply, when true is returned
+ *
+ * Returns:
+ *   true if the caller should apply *out (as one batch), false otherwise
+ */
+bool ae_frame(struct ae_controller *c, const uint8_t *frame, struct ae_controls *out)
+{
+    uint32_t n = build_histogram(c, frame), b;
+    uint64_t sum = 0, cumulative = 0;
+    double mean, p99 = 0, ratio, total;
+    struct ae_controls next;
+
+    for (b = 0; b < AE_BINS; b++)
+        sum += (uint64_t)c->hist[b] * (b * 4 + 2);
+    for (b = 0; b < AE_BINS; b++)
+    {
+        cumulative += c->hist[b];
+        if (cumulative * 100 >= (uint64_t)n * 99)
+        {
+            p99 = b * 4 + 3;
+            break;
+        }
+    }
+    mean = (double)sum / n;
+    __atomic_store_n(&c->stats.mean, (uint32_t)mean, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->stats.frames, 1, __ATOMIC_RELAXED);
+
+    // Give the sensor time to apply the previous change before metering again
+    if (++c->since < c->cfg.every)
+        return false;
+
+    ratio = c->cfg.target / (mean < 1.0 ? 1.0 : mean);
+    if (ratio > 1.0 && p99 * ratio > AE_HIGHLIGHT_LEVEL)
+        ratio = AE_HIGHLIGHT_LEVEL / p99 > 1.0 ? AE_HIGHLIGHT_LEVEL / p99 : 1.0;
+    if (ratio < AE_DEAD_BAND && ratio > 1.0 / AE_DEAD_BAND)
+        return false;
+
+    // Damped symmetrically, so brightening and darkening converge alike
+    if (ratio > 1.0)
+        ratio = 1.0 + (ratio - 1.0) * AE_DAMPING;
+    else
+        ratio = 1.0 / (1.0 + (1.0 / ratio - 1.0) * AE_DAMPING);
+
+    // Exposure first, up to the frame-rate cap; gain makes up the rest
+    total = (c->stats.controls.exposure > 0 ? c->stats.controls.exposure : 1) *
+            gain_factor(&c->cfg, c->stats.controls.gain) * ratio;
+    next.exposure = clamp(total, c->cfg.exposure.min, c->cfg.exposure_cap);
+    next.gain = gain_control(&c->cfg, total / next.exposure);
+    if (next.exposure == c->stats.controls.exposure && next.gain == c->stats.controls.gain)
+        return false;
+
+    c->since = 0;
+    __atomic_store_n(&c->stats.controls.exposure, next.exposure, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->stats.controls.gain, next.gain, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->stats.updates, 1, __ATOMIC_RELAXED);
+    *out = next;
+    return true;
+}
+
+/*
+ * Snapshot the controller state (safe from another thread)
+ *
+ * Parameters:
+ *   struct ae_controller *c -> The controller
+ *   struct ae_stats *out -> Copy of the statistics
+ *
+ * Returns:
+ *   None
+ */
+void ae_get_stats(struct ae_controller *c, struct ae_stats *out)
+{
+    out->frames = __atomic_load_n(&c->stats.frames, __ATOMIC_RELAXED);
+    out->updates = __atomic_load_n(&c->stats.updates, __ATOMIC_RELAXED);
+    out->mean = __atomic_load_n(&c->stats.mean, __ATOMIC_RELAXED);
+    out->controls.exposure = __atomic_load_n(&c->stats.controls.exposure, __ATOMIC_RELAXED);
+    out->controls.gain = __atomic_load_n(&c->stats.controls.gain, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,75 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Histogram-driven exposure and gain control
+ *
+ * UVC auto exposure is allowed to lengthen the exposure past the frame
+ * interval in low light, which silently drops 30 fps to 7 or less. This
+ * loop runs in the application instead: a luma histogram of a sparse
+ * sample of every frame is metered against a target mean (holding back
+ * when the highlights would clip), and the correction is spent on
+ * exposure time up to the longest exposure the frame rate allows, and
+ * only then on gain. Corrections are damped, ignored inside a dead band
+ * and issued at most every few frames, as one batch of both controls, so
+ * the ioctl traffic stays at a handful per second and the sensor has
+ * time to apply one change before the next is metered.
+ *
+ * The controller only computes control values; applying them is up to
+ * the caller, which is what lets exposure_sim drive it with a simulated
+ * sensor.
+ */
+
+#ifndef EXPOSURE_H
+#define EXPOSURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Luma histogram resolution (4 levels per bin)
+#define AE_BINS 64
+
+struct ae_range
+{
+    int32_t min;
+    int32_t max;
+};
+
+struct ae_config
+{
+    struct ae_range exposure;   // V4L2_CID_EXPOSURE_ABSOLUTE range, 100 us units
+    struct ae_range gain;       // V4L2_CID_GAIN range; min == max when there is no gain control
+    int32_t exposure_cap;       // Longest exposure that keeps the frame rate
+    uint8_t target;             // Mean luma to aim for
+    unsigned int every;         // Frames between two updates at least
+};
+
+struct ae_controls
+{
+    int32_t exposure;
+    int32_t gain;
+};
+
+struct ae_stats
+{
+    uint64_t frames;
+    uint64_t updates;           // Control batches issued
+    uint32_t mean;              // Mean luma of the last frame
+    struct ae_controls controls;
+};
+
+struct ae_controller
+{
+    struct ae_config cfg;
+    uint32_t width;
+    uint32_t height;
+    unsigned int y_offset;      // Byte offset of the first luma sample (0 YUYV, 1 UYVY)
+    unsigned int since;         // Frames since the last update
+    uint32_t hist[AE_BINS];
+    struct ae_stats stats;
+};
+
+int ae_init(struct ae_controller *c, const struct ae_config *cfg, uint32_t width, uint32_t height,
+            uint32_t pixelformat, const struct ae_controls *start);
+bool ae_frame(struct ae_controller *c, const uint8_t *frame, struct ae_controls *out);
+void ae_get_stats(struct ae_controller *c, struct ae_stats *out);
+
+#endif
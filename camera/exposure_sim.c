@@ -0,0 +1,360 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Exposure control loop against a simulated sensor
+ *
+ * Replays a scene (a synthetic textured gradient, or the first frame of a
+ * raw YUYV/UYVY recording given with -r) through a simulated sensor whose
+ * brightness follows illumination x exposure x gain, with a few levels of
+ * noise. The sensor applies new controls -l frames after they are set,
+ * and lengthens the frame when the exposure does not fit the frame
+ * interval, as UVC cameras do. The illumination steps from daylight to
+ * low light and to bright light; for each phase the tool reports how long
+ * the loop takes to settle, where it ends up, the control batches issued
+ * and the lowest frame rate reached. The same scene is run through an
+ * emulation of the camera's own auto exposure for comparison.
+ *
+ * The exit status is non-zero if the loop does not settle (on target, or
+ * pegged at a control limit) within -s frames of a step, or if the frame
+ * rate falls below -f.
+ *
+ * usage: exposure_sim [-t target] [-f fps] [-l latency] [-e every] [-s frames] [-r file:WxH[:uyvy]]
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <linux/videodev2.h>
+
+#include "exposure.h"
+
+#define SIM_WIDTH        320
+#define SIM_HEIGHT       240
+#define PHASE_FRAMES     150
+#define MAX_LATENCY      8
+
+// Simulated control ranges (UVC-like: exposure in 100 us units)
+#define EXPOSURE_MIN     1
+#define EXPOSURE_MAX     2047
+#define GAIN_MIN         0
+#define GAIN_MAX         255
+
+// The scene frame is what the sensor delivers at this exposure, unity gain and illumination 1
+#define REF_EXPOSURE     100
+
+// Same linear gain model as the controller
+#define SIM_MAX_GAIN     8.0
+
+static const struct
+{
+    const char *name;
+    double illumination;
+} phases[] = {
+    { "daylight", 1.0 },
+    { "low light", 0.04 },
+    { "bright", 3.0 },
+    { "daylight", 1.0 },
+};
+
+#define N_PHASES (sizeof(phases) / sizeof(phases[0]))
+
+struct scene
+{
+    uint32_t width;
+    uint32_t height;
+    uint32_t pixelformat;
+    uint8_t *data;
+};
+
+struct phase_result
+{
+    unsigned int settle;        // Frames until the last control change took effect
+    unsigned int mean;          // Mean luma at the end of the phase
+    struct ae_controls controls;
+    unsigned int updates;
+    double min_fps;
+    bool settled;
+};
+
+static uint32_t xorshift(uint32_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 17;
+    *s ^= *s << 5;
+    return *s;
+}
+
+static double gain_factor(int32_t gain)
+{
+    return 1.0 + (double)(gain - GAIN_MIN) * (SIM_MAX_GAIN - 1.0) / (GAIN_MAX - GAIN_MIN);
+}
+
+/*
+ * Sensor output for the scene under the given illumination and controls
+ */
+static void expose(const struct scene *s, double illumination, const struct ae_controls *c, uint8_t *out,
+                   uint32_t *seed)
+{
+    size_t i, n = (size_t)s->width * s->height * 2;
+    unsigned int yo = s->pixelformat == V4L2_PIX_FMT_UYVY ? 1 : 0;
+    double scale = illumination * c->exposure / REF_EXPOSURE * gain_factor(c->gain);
+    int v;
+
+    for (i = 0; i < n; i++)
+    {
+        if ((i & 1) != yo)
+        {
+            out[i] = s->data[i];
+            continue;
+        }
+        v = 16 + (int)((s->data[i] - 16) * scale) + (int)(xorshift(seed) % 5) - 2;
+        out[i] = v < 0 ? 0 : v > 255 ? 255 : v;
+    }
+}
+
+static unsigned int mean_luma(const struct scene *s, const uint8_t *frame)
+{
+    size_t i, n = (size_t)s->width * s->height;
+    unsigned int yo = s->pixelformat == V4L2_PIX_FMT_UYVY ? 1 : 0;
+    uint64_t sum = 0;
+
+    for (i = 0; i < n; i++)
+        sum += frame[2 * i + yo];
+    return sum / n;
+}
+
+static void synthesize(struct scene *s)
+{
+    uint32_t x, y;
+    uint8_t *p;
+
+    s->width = SIM_WIDTH;
+    s->height = SIM_HEIGHT;
+    s->pixelformat = V4L2_PIX_FMT_YUYV;
+    s->data = malloc((size_t)s->width * s->height * 2);
+    if (!s->data)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    // Gradient with a fine checker texture and a bright window in one corner
+    for (y = 0; y < s->height; y++)
+    {
+        for (x = 0; x < s->width; x++)
+        {
+            p = s->data + ((size_t)y * s->width + x) * 2;
+            p[0] = 40 + x * 120 / s->width + (((x / 4 + y / 4) & 1) ? 20 : 0);
+            if (x > s->width * 3 / 4 && y < s->height / 4)
+                p[0] = 230;
+            p[1] = (x & 1) ? 120 : 136;
+        }
+    }
+}
+
+static int load_scene(struct scene *s, const char *spec)
+{
+    char path[256], fmt[8] = "yuyv";
+    size_t size;
+    int fd;
+
+    if (sscanf(spec, "%255[^:]:%ux%u:%7s", path, &s->width, &s->height, fmt) < 3 || s->width < 4 ||
+        (s->width & 1) || s->height < 4)
+        return -1;
+    s->pixelformat = strcmp(fmt, "uyvy") == 0 ? V4L2_PIX_FMT_UYVY : V4L2_PIX_FMT_YUYV;
+    size = (size_t)s->width * s->height * 2;
+    s->data = malloc(size);
+    fd = open(path, O_RDONLY);
+    if (!s->data || fd == -1 || pread(fd, s->data, size, 0) != (ssize_t)size)
+    {
+        perror(path);
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+/*
+ * Emulated camera auto exposure: whatever exposure meets the target, no gain, no frame-rate limit
+ */
+static bool camera_auto(unsigned int mean, uint8_t target, struct ae_controls *c)
+{
+    int32_t next = mean > 16 ? (int32_t)(c->exposure * (double)(target - 16) / (mean - 16) + 0.5) : c->exposure * 4;
+
+    if (next < EXPOSURE_MIN)
+        next = EXPOSURE_MIN;
+    if (next > EXPOSURE_MAX)
+        next = EXPOSURE_MAX;
+    if (abs(next - c->exposure) * 20 < c->exposure)
+        return false;
+    c->exposure = next;
+    c->gain = GAIN_MIN;
+    return true;
+}
+
+/*
+ * Run all phases with one controller
+ *
+ * Parameters:
+ *   const struct scene *s -> The scene
+ *   const struct ae_config *cfg -> Controller configuration
+ *   double fps -> Nominal frame rate
+ *   unsigned int latency -> Frames before the sensor applies new controls
+ *   bool builtin -> Emulate the camera's own auto exposure instead
+ *   struct phase_result *r -> One result per phase
+ *
+ * Returns:
+ *   None
+ */
+static void run(const struct scene *s, const struct ae_config *cfg, double fps, unsigned int latency, bool builtin,
+                struct phase_result *r)
+{
+    struct ae_controls pending[MAX_LATENCY + 1], active = { REF_EXPOSURE, GAIN_MIN }, next;
+    struct ae_controller ae;
+    uint32_t seed = 0x9e3779b9;
+    unsigned int p, i, k, mean = 0, since = 0;
+    double frame_sec;
+    uint8_t *frame = malloc((size_t)s->width * s->height * 2);
+    bool changed;
+
+    if (!frame || ae_init(&ae, cfg, s->width, s->height, s->pixelformat, &active) == -1)
+    {
+        fprintf(stderr, "Cannot set up the controller\n");
+        exit(EXIT_FAILURE);
+    }
+    for (k = 0; k <= latency; k++)
+        pending[k] = active;
+
+    for (p = 0; p < N_PHASES; p++)
+    {
+        memset(&r[p], 0, sizeof(r[p]));
+        r[p].min_fps = fps;
+        for (i = 0; i < PHASE_FRAMES; i++)
+        {
+            // The sensor picks up what was set latency frames ago
+            active = pending[0];
+            memmove(pending, pending + 1, latency * sizeof(pending[0]));
+            expose(s, phases[p].illumination, &active, frame, &seed);
+            mean = mean_luma(s, frame);
+
+            frame_sec = active.exposure / 1e4 > 1.0 / fps ? active.exposure / 1e4 : 1.0 / fps;
+            if (1.0 / frame_sec < r[p].min_fps)
+                r[p].min_fps = 1.0 / frame_sec;
+
+            next = pending[latency];
+            // The camera waits for its own changes to land before metering again
+            if (builtin)
+                changed = ++since > latency && camera_auto(mean, cfg->target, &next);
+            else
+                changed = ae_frame(&ae, frame, &next);
+            if (changed)
+                since = 0;
+            pending[latency] = next;
+            if (changed)
+            {
+                r[p].updates++;
+                r[p].settle = i + latency + 1;
+            }
+        }
+        r[p].mean = mean;
+        r[p].controls = active;
+        r[p].settled = r[p].settle < PHASE_FRAMES &&
+                       ((mean * 10 >= cfg->target * 9 && mean * 10 <= cfg->target * 11) ||
+                        (active.exposure >= cfg->exposure_cap && active.gain == GAIN_MAX && mean < cfg->target) ||
+                        (active.exposure == EXPOSURE_MIN && mean > cfg->target));
+    }
+    free(frame);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-t target] [-f fps] [-l latency] [-e every] [-s frames] [-r file:WxH[:uyvy]]\n"
+                    "  -t  mean luma to aim for (default 110)\n"
+                    "  -f  frame rate to hold (default 30)\n"
+                    "  -l  frames before the sensor applies new controls (default 2, at most %d)\n"
+                    "  -e  frames between control updates at least (default 3)\n"
+                    "  -s  frames a step may take to settle (default 60)\n"
+                    "  -r  use the first frame of a raw YUYV (or UYVY) recording as the scene\n",
+            prog, MAX_LATENCY);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    struct ae_config cfg = {
+        .exposure = { EXPOSURE_MIN, EXPOSURE_MAX },
+        .gain = { GAIN_MIN, GAIN_MAX },
+        .target = 110,
+        .every = 3,
+    };
+    struct phase_result loop[N_PHASES], builtin[N_PHASES];
+    struct scene s = { .data = NULL };
+    unsigned int latency = 2, settle_limit = 60, p, failures = 0;
+    double fps = 30;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:f:l:e:s:r:")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            cfg.target = atoi(optarg);
+            break;
+        case 'f':
+            fps = atof(optarg);
+            break;
+        case 'l':
+            latency = strtoul(optarg, NULL, 0);
+            break;
+        case 'e':
+            cfg.every = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            settle_limit = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            if (load_scene(&s, optarg) == -1)
+                usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (cfg.target == 0 || fps <= 0 || latency > MAX_LATENCY)
+        usage(argv[0]);
+    if (!s.data)
+        synthesize(&s);
+
+    // The frame-rate constraint: no exposure longer than one frame interval
+    cfg.exposure_cap = (int32_t)(1e4 / fps);
+
+    run(&s, &cfg, fps, latency, false, loop);
+    run(&s, &cfg, fps, latency, true, builtin);
+
+    printf("%ux%u scene, target %u, %.0f fps, control latency %u frames, update every %u frames\n", s.width,
+           s.height, cfg.target, fps, latency, cfg.every);
+    printf("%-16s | %-38s | %s\n", "", "application loop", "camera auto exposure");
+    printf("%-10s %5s | %-4s %6s %5s %6s %5s %7s | %5s %6s %7s\n", "phase", "illum", "", "settle", "mean", "expo",
+           "gain", "min fps", "mean", "expo", "min fps");
+    for (p = 0; p < N_PHASES; p++)
+    {
+        bool ok = loop[p].settled && loop[p].settle <= settle_limit && loop[p].min_fps >= fps * 0.999;
+
+        failures += !ok;
+        printf("%-10s %5.2f | %-4s %6u %5u %6d %5d %7.1f | %5u %6d %7.1f\n", phases[p].name,
+               phases[p].illumination, ok ? "ok" : "FAIL", loop[p].settle, loop[p].mean,
+               (int)loop[p].controls.exposure, (int)loop[p].controls.gain, loop[p].min_fps, builtin[p].mean,
+               (int)builtin[p].controls.exposure, builtin[p].min_fps);
+    }
+    for (p = 0; p < N_PHASES; p++)
+        printf("%s: %u control batches over %u frames (%.1f per second)\n", phases[p].name, loop[p].updates,
+               PHASE_FRAMES, loop[p].updates * fps / PHASE_FRAMES);
+
+    free(s.data);
+    return failures ? EXIT_FAILURE : 0;
+}
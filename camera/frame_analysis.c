@@ -0,0 +1,239 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Cheap per-frame statistics on the raw YUV stream
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <linux/videodev2.h>
+
+#include "frame_analysis.h"
+#include "memacct.h"
+
+/*
+ * Set up an analyzer for a packed 4:2:2 stream
+ *
+ * Parameters:
+ *   struct frame_analyzer *a -> Analyzer to initialise
+ *   uint32_t width, height -> Frame geometry in pixels
+ *   uint32_t pixelformat -> V4L2_PIX_FMT_YUYV or V4L2_PIX_FMT_UYVY
+ *
+ * Returns:
+ *   0 on success, -1 with errno set (EINVAL for other formats, ENOMEM)
+ */
+int fa_init(struct frame_analyzer *a, uint32_t width, uint32_t height, uint32_t pixelformat)
+{
+    size_t cells;
+
+    memset(a, 0, sizeof(*a));
+    if ((pixelformat != V4L2_PIX_FMT_YUYV && pixelformat != V4L2_PIX_FMT_UYVY) ||
+        width < FA_CELL || height < FA_CELL)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    a->width = width;
+    a->height = height;
+    a->y_offset = (pixelformat == V4L2_PIX_FMT_UYVY) ? 1 : 0;
+    a->grid_w = width / FA_CELL;
+    a->grid_h = height / FA_CELL;
+    cells = (size_t)a->grid_w * a->grid_h;
+    if (cells > UINT16_MAX)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    a->grid = malloc(cells);
+    a->prev = malloc(cells);
+    a->seen = malloc(cells);
+    a->stack = malloc(cells * sizeof(*a->stack));
+    if (!a->grid || !a->prev || !a->seen || !a->stack)
+    {
+        fa_free(a);
+        errno = ENOMEM;
+        return -1;
+    }
+    mem_charge(MEM_ANALYSIS, cells * (3 + sizeof(*a->stack)));
+    a->charged = true;
+    return 0;
+}
+
+/*
+ * Average luma of every FA_CELL x FA_CELL cell into a->grid
+ */
+static uint32_t build_grid(struct frame_analyzer *a, const uint8_t *frame)
+{
+    size_t stride = (size_t)a->width * 2;
+    uint32_t gx, gy, row, total = 0;
+    unsigned int sum, i;
+    const uint8_t *p;
+
+    for (gy = 0; gy < a->grid_h; gy++)
+    {
+        for (gx = 0; gx < a->grid_w; gx++)
+        {
+            sum = 0;
+            for (row = 0; row < FA_CELL; row++)
+            {
+                p = frame + (gy * FA_CELL + row) * stride + gx * FA_CELL * 2 + a->y_offset;
+                for (i = 0; i < FA_CELL; i++)
+                    sum += p[i * 2];
+            }
+            a->grid[gy * a->grid_w + gx] = sum / (FA_CELL * FA_CELL);
+            total += a->grid[gy * a->grid_w + gx];
+        }
+    }
+    return total;
+}
+
+/*
+ * Keep the box among the FA_MAX_BOXES largest, sorted by size
+ */
+static void keep_box(struct frame_analyzer *a, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1,
+                     uint32_t cells)
+{
+    unsigned int i = a->n_boxes;
+
+    if (i == FA_MAX_BOXES)
+    {
+        if (a->boxes[i - 1].cells >= cells)
+            return;
+        i--;
+    }
+    else
+        a->n_boxes++;
+    for (; i > 0 && a->boxes[i - 1].cells < cells; i--)
+        a->boxes[i] = a->boxes[i - 1];
+    a->boxes[i].x = x0 * FA_CELL;
+    a->boxes[i].y = y0 * FA_CELL;
+    a->boxes[i].w = (x1 - x0 + 1) * FA_CELL;
+    a->boxes[i].h = (y1 - y0 + 1) * FA_CELL;
+    a->boxes[i].cells = cells;
+}
+
+/*
+ * Count 4-connected regions of changed cells of at least FA_MIN_BLOB_CELLS
+ */
+static uint16_t count_blobs(struct frame_analyzer *a)
+{
+    uint32_t w = a->grid_w, cells = w * a->grid_h, start, c, size, top, x0, y0, x1, y1;
+    unsigned int blobs = 0;
+
+    // seen[] = 1 for changed cells not yet assigned to a blob
+    for (c = 0; c < cells; c++)
+        a->seen[c] = abs((int)a->grid[c] - (int)a->prev[c]) > FA_DIFF_THRESHOLD;
+
+    for (start = 0; start < cells; start++)
+    {
+        if (!a->seen[start])
+            continue;
+
+        a->seen[start] = 0;
+        a->stack[0] = start;
+        top = 1;
+        size = 0;
+        x0 = x1 = start % w;
+        y0 = y1 = start / w;
+        while (top > 0)
+        {
+            c = a->stack[--top];
+            size++;
+            if (c % w < x0)
+                x0 = c % w;
+            if (c % w > x1)
+                x1 = c % w;
+            if (c / w > y1)
+                y1 = c / w;
+            if (c % w > 0 && a->seen[c - 1])
+            {
+                a->seen[c - 1] = 0;
+                a->stack[top++] = c - 1;
+            }
+            if (c % w < w - 1 && a->seen[c + 1])
+            {
+                a->seen[c + 1] = 0;
+                a->stack[top++] = c + 1;
+            }
+            if (c >= w && a->seen[c - w])
+            {
+                a->seen[c - w] = 0;
+                a->stack[top++] = c - w;
+            }
+            if (c + w < cells && a->seen[c + w])
+            {
+                a->seen[c + w] = 0;
+                a->stack[top++] = c + w;
+            }
+        }
+        if (size >= FA_MIN_BLOB_CELLS)
+        {
+            keep_box(a, x0, y0, x1, y1, size);
+            if (blobs < UINT16_MAX)
+                blobs++;
+        }
+    }
+    return blobs;
+}
+
+/*
+ * Compute brightness, motion score and blob count of one frame
+ *
+ * The first frame has no reference and reports zero motion. The largest
+ * blobs are left in a->boxes.
+ *
+ * Parameters:
+ *   struct frame_analyzer *a -> The analyzer
+ *   const uint8_t *frame -> Packed 4:2:2 frame of the configured geometry
+ *   struct frame_meta *m -> Statistics of the frame
+ *
+ * Returns:
+ *   None
+ */
+void fa_analyze(struct frame_analyzer *a, const uint8_t *frame, struct frame_meta *m)
+{
+    uint32_t cells = a->grid_w * a->grid_h, c, diff = 0;
+    uint8_t *swap;
+
+    m->brightness = build_grid(a, frame) / cells;
+    m->motion = 0;
+    m->blobs = 0;
+    a->n_boxes = 0;
+
+    if (a->have_prev)
+    {
+        for (c = 0; c < cells; c++)
+            diff += abs((int)a->grid[c] - (int)a->prev[c]);
+        m->motion = (uint16_t)(((uint64_t)diff << 8) / cells);
+        m->blobs = count_blobs(a);
+    }
+
+    swap = a->prev;
+    a->prev = a->grid;
+    a->grid = swap;
+    a->have_prev = true;
+}
+
+/*
+ * Release the analyzer buffers
+ *
+ * Parameters:
+ *   struct frame_analyzer *a -> The analyzer
+ *
+ * Returns:
+ *   None
+ */
+void fa_free(struct frame_analyzer *a)
+{
+    if (a->charged)
+        mem_release(MEM_ANALYSIS, (size_t)a->grid_w * a->grid_h * (3 + sizeof(*a->stack)));
+    free(a->grid);
+    free(a->prev);
+    free(a->seen);
+    free(a->stack);
+    memset(a, 0, sizeof(*a));
+}
@@ -0,0 +1,62 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Cheap per-frame statistics on the raw YUV stream
+ *
+ * Luma is reduced to a coarse grid of FA_CELL x FA_CELL averages. The
+ * grid gives the frame brightness, a motion score against the previous
+ * frame and the number of connected changed regions (blobs). These end
+ * up in the segment index so recordings can be searched without decoding
+ * frames. The bounding boxes of the largest blobs are kept in the
+ * analyzer for whoever wants to look closer (the classifier).
+ */
+
+#ifndef FRAME_ANALYSIS_H
+#define FRAME_ANALYSIS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define FA_CELL             4       // Grid cell edge in pixels
+#define FA_DIFF_THRESHOLD   20      // Cell luma change that counts as motion
+#define FA_MIN_BLOB_CELLS   2       // Smaller changed regions are noise
+#define FA_MAX_BOXES        8       // Bounding boxes kept, largest blobs first
+
+struct frame_meta
+{
+    uint16_t motion;        // Mean absolute cell difference, 8.8 fixed point
+    uint8_t brightness;     // Mean luma
+    uint16_t blobs;         // Connected regions of changed cells
+};
+
+// Bounding box of a blob in pixels
+struct fa_box
+{
+    uint32_t x;
+    uint32_t y;
+    uint32_t w;
+    uint32_t h;
+    uint32_t cells;         // Changed cells in the blob
+};
+
+struct frame_analyzer
+{
+    uint32_t width;
+    uint32_t height;
+    unsigned int y_offset;  // Byte of the first luma sample in a 4-byte macropixel
+    uint32_t grid_w;
+    uint32_t grid_h;
+    uint8_t *grid;          // Current frame
+    uint8_t *prev;          // Previous frame
+    uint16_t *stack;        // Flood fill work list
+    uint8_t *seen;
+    struct fa_box boxes[FA_MAX_BOXES];  // Largest blobs of the last frame
+    unsigned int n_boxes;
+    bool have_prev;
+    bool charged;           // Buffers are charged to the memory accountant
+};
+
+int fa_init(struct frame_analyzer *a, uint32_t width, uint32_t height, uint32_t pixelformat);
+void fa_analyze(struct frame_analyzer *a, const uint8_t *frame, struct frame_meta *m);
+void fa_free(struct frame_analyzer *a);
+
+#endif
@@ -0,0 +1,565 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Segmented frame container writer
+ *
+ * Records are staged in a chunk-sized aligned buffer (struct frame_writer)
+ * and reach the device one whole chunk at a time, at chunk-aligned file
+ * offsets. Each segment is preallocated with fallocate() so the
+ * filesystem can hand out contiguous extents up front; unused space is
+ * released when the segment is closed and truncated.
+ *
+ * Checkpoint entries are reserved per chunk when a segment is opened, so
+ * the capture path never allocates.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "frame_container.h"
+#include "crc32c.h"
+#include "memacct.h"
+
+/*
+ * Bytes a record with the given payload occupies in a segment
+ *
+ * Parameters:
+ *   size_t payload -> Payload size in bytes
+ *
+ * Returns:
+ *   Header plus payload, padded to FC_RECORD_ALIGN
+ */
+size_t fc_record_span(size_t payload)
+{
+    size_t span = sizeof(struct fc_record_header) + payload;
+
+    return (span + FC_RECORD_ALIGN - 1) & ~(size_t)(FC_RECORD_ALIGN - 1);
+}
+
+/*
+ * Checksum of a record as stored in its crc field
+ *
+ * Parameters:
+ *   const struct fc_record_header *rec -> Record header (its crc field is ignored)
+ *   const void *payload -> rec->length payload bytes
+ *
+ * Returns:
+ *   CRC32C of the header with crc = 0, followed by the payload
+ */
+uint32_t fc_record_crc(const struct fc_record_header *rec, const void *payload)
+{
+    struct fc_record_header h = *rec;
+
+    h.crc = 0;
+    return crc32c(crc32c(0, &h, sizeof(h)), payload, h.length);
+}
+
+/*
+ * Build the file name of a segment
+ *
+ * Segments are named after the sequence number of their first frame so
+ * that lexical and chronological order agree.
+ *
+ * Parameters:
+ *   char *path -> Output buffer
+ *   size_t len -> Size of the output buffer
+ *   const char *dir -> Directory holding the segments
+ *   uint64_t first_seq -> Sequence number of the first frame
+ *
+ * Returns:
+ *   None
+ */
+void fc_segment_path(char *path, size_t len, const char *dir, uint64_t first_seq)
+{
+    snprintf(path, len, "%s/seg%010llu.fcs", dir, (unsigned long long)first_seq);
+}
+
+/*
+ * Initialise a container writer; the first segment is created lazily
+ *
+ * Parameters:
+ *   struct fc_writer *cw -> Writer to initialise
+ *   const struct fc_config *cfg -> Output directory and frame geometry
+ *
+ * Returns:
+ *   0 on success, -1 with errno set on invalid configuration
+ */
+int fc_writer_init(struct fc_writer *cw, const struct fc_config *cfg)
+{
+    memset(cw, 0, sizeof(*cw));
+    cw->cfg = *cfg;
+    cw->fw.fd = -1;
+    cw->next_seq = cfg->first_seq;
+
+    if (cw->cfg.chunk_size == 0)
+        cw->cfg.chunk_size = FC_CHUNK_SIZE;
+    if (cw->cfg.segment_size == 0)
+        cw->cfg.segment_size = FC_SEGMENT_SIZE;
+    if (cw->cfg.segment_size < cw->cfg.chunk_size)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    fi_builder_thumbnails(&cw->index, cw->cfg.thumb_width, cw->cfg.thumb_height, cw->cfg.thumb_every);
+    return 0;
+}
+
+/*
+ * Create the next segment, preallocate it and write its header
+ *
+ * Parameters:
+ *   struct fc_writer *cw -> The writer
+ *   const struct timespec *ts -> Timestamp of the first frame
+ *   size_t span -> Record span of the first frame, used to size the index
+ *
+ * Returns:
+ *   0 on success, -1 with errno set on failure
+ */
+static int open_segment(struct fc_writer *cw, const struct timespec *ts, size_t span)
+{
+    struct fc_segment_header hdr;
+    struct fc_checkpoint *cp;
+    uint32_t entries = cw->cfg.chunk_size / span + 2;
+
+    // Size the index for a full segment up front; no allocations mid-segment
+    fi_builder_reset(&cw->index, cw->next_seq);
+    if (fi_builder_reserve(&cw->index, cw->cfg.segment_size / span + 1) == -1)
+        return -1;
+
+    // Same for the frames of one checkpoint interval
+    if (entries > cw->entry_cap)
+    {
+        cp = realloc(cw->checkpoint, sizeof(*cp) + entries * sizeof(*cw->entries));
+        if (!cp)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        cw->checkpoint = cp;
+        cw->entries = (struct fc_checkpoint_entry *)(cp + 1);
+        mem_charge(MEM_WRITER, (entries - cw->entry_cap) * sizeof(*cw->entries) +
+                               (cw->entry_cap ? 0 : sizeof(*cp)));
+        cw->entry_cap = entries;
+    }
+    memset(cw->checkpoint, 0, sizeof(*cw->checkpoint));
+    cw->last_checkpoint = 0;
+    cw->checkpoint_due = cw->cfg.chunk_size;
+
+    if (cw->cfg.path)
+        snprintf(cw->path, sizeof(cw->path), "%s", cw->cfg.path);
+    else
+        fc_segment_path(cw->path, sizeof(cw->path), cw->cfg.dir, cw->next_seq);
+    if (fw_open(&cw->fw, cw->path, cw->cfg.direct, cw->cfg.chunk_size) == -1)
+        return -1;
+
+    // Reserve the whole segment; not every filesystem can, which is fine
+    if (fw_preallocate(&cw->fw, cw->cfg.segment_size) == -1 && errno != EOPNOTSUPP && errno != ENOSYS)
+        syslog(LOG_WARNING, "fallocate %s: %s", cw->path, strerror(errno));
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = FC_SEGMENT_MAGIC;
+    hdr.version = FC_VERSION;
+    hdr.header_size = sizeof(hdr);
+    hdr.width = cw->cfg.width;
+    hdr.height = cw->cfg.height;
+    hdr.pixelformat = cw->cfg.pixelformat;
+    hdr.flags = cw->cfg.flags;
+    hdr.first_seq = cw->next_seq;
+    hdr.start_ns = (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+
+    if (fw_write(&cw->fw, &hdr, sizeof(hdr)) == -1)
+    {
+        fw_close(&cw->fw);
+        return -1;
+    }
+    cw->open = true;
+    return 0;
+}
+
+/*
+ * Make the entries of a file's directory durable
+ *
+ * Parameters:
+ *   const char *path -> A file in the directory
+ *
+ * Returns:
+ *   0 on success, -1 with errno set on failure
+ */
+static int sync_dir(const char *path)
+{
+    char dir[FC_PATH_LEN];
+    const char *slash = strrchr(path, '/');
+    int fd, ret;
+
+    if (slash)
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+    else
+        strcpy(dir, ".");
+    fd = open(dir[0] ? dir : "/", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    ret = fsync(fd);
+    close(fd);
+    return ret;
+}
+
+/*
+ * Close the current segment and write its index; the next append
+ * starts a new segment
+ *
+ * Parameters:
+ *   struct fc_writer *cw -> The writer
+ *
+ * Returns:
+ *   0 on success, -1 with errno set on failure
+ */
+int fc_rotate(struct fc_writer *cw)
+{
+    struct durability *dur = cw->cfg.durability;
+    bool sync = dur && dur->policy.mode != DUR_NONE;
+    char idx[sizeof(cw->path) + 4];
+    int ret = 0;
+
+    if (!cw->open)
+        return 0;
+    cw->open = false;
+
+    // The segment is complete on disk before its index, which recovery takes as the mark of a clean close
+    if (fw_flush(&cw->fw) == -1 || ftruncate(cw->fw.fd, cw->fw.length) == -1)
+    {
+        if (dur)
+            dur_report(dur, errno, cw->path);
+        ret = -1;
+    }
+    else if (dur && dur_finish(dur, cw->fw.fd, cw->path) == -1)
+        ret = -1;
+    if (fw_close(&cw->fw) == -1)
+    {
+        if (dur)
+            dur_report(dur, errno, cw->path);
+        ret = -1;
+    }
+    // A segment that did not make it is left without an index, so recovery checks it
+    if (ret == -1)
+        return -1;
+
+    fi_index_path(idx, sizeof(idx), cw->path);
+    if (fi_builder_write(&cw->index, idx, sync) == -1 || (sync && sync_dir(cw->path) == -1))
+    {
+        if (dur)
+            dur_report(dur, errno, idx);
+        ret = -1;
+    }
+    return ret;
+}
+
+/*
+ * Apply the durability policy after a record was appended
+ *
+ * Periodic syncs flush the chunk stage first so the synced range covers
+ * every frame; rolling writeback only covers what already reached the
+ * kernel so that chunks stay erase-block sized.
+ *
+ * Parameters:
+ *   struct fc_writer *cw -> The writer
+ *
+ * Returns:
+ *   0 on success, -1 after an event was reported
+ */
+static int apply_durability(struct fc_writer *cw)
+{
+    struct durability *dur = cw->cfg.durability;
+
+    if (!dur_frame_written(dur))
+        return 0;
+
+    if (dur->policy.mode == DUR_PERIODIC)
+    {
+        if (fw_flush(&cw->fw) == -1)
+        {
+            dur_report(dur, errno, cw->path);
+            return -1;
+        }
+        return dur_sync(dur, cw->fw.fd, cw->fw.length, cw->path);
+    }
+    return dur_sync(dur, cw->fw.fd, cw->fw.length - cw->fw.stage_len, cw->path);
+}
+
+/*
+ * Write one record (header, payload, padding) through a frame writer
+ *
+ * Parameters:
+ *   struct frame_writer *fw -> Writer positioned at a record boundary
+ *   uint64_t seq -> Frame sequence number
+ *   int64_t timestamp_ns -> Capture time of the frame
+ *   uint32_t flags -> Record flags
+ *   const void *p -> Payload
+ *   size_t size -> Payload size in bytes
+ *
+ * Returns:
+ *   0 on success, -1 with errno set on failure
+ */
+int fc_write_record(struct frame_writer *fw, uint64_t seq, int64_t timestamp_ns, uint32_t flags,
+                    const void *p, size_t size)
+{
+    static const unsigned char pad[FC_RECORD_ALIGN];
+    struct fc_record_header rec;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.magic = FC_RECORD_MAGIC;
+    rec.length = size;
+    rec.seq = seq;
+    rec.timestamp_ns = timestamp_ns;
+    rec.flags = flags;
+    rec.crc = fc_record_crc(&rec, p);
+
+    if (fw_write(fw, &rec, sizeof(rec)) == -1 ||
+        fw_write(fw, p, size) == -1 ||
+        fw_write(fw, pad, fc_record_span(size) - sizeof(rec) - size) == -1)
+        return -1;
+    return 0;
+}
+
+/*
+ * Write a checkpoint listing the frames since the previous one
+ *
+ * A padding record first moves the checkpoint to an FC_CHECKPOINT_ALIGN
+ * offset, which is where recovery looks for it.
+ *
+ * Parameters:
+ *   struct fc_writer *cw -> The writer
+ *   int64_t ts_ns -> Timestamp of the latest frame
+ *
+ * Returns:
+ *   0 on success, -1 with errno set on failure
+ */
+static int write_checkpoint(struct fc_writer *cw, int64_t ts_ns)
+{
+    static const unsigned char zero[FC_CHECKPOINT_ALIGN];
+    struct fc_checkpoint *cp = cw->checkpoint;
+    size_t pad = (FC_CHECKPOINT_ALIGN - cw->fw.length % FC_CHECKPOINT_ALIGN) % FC_CHECKPOINT_ALIGN;
+    off_t at;
+
+    if (pad && pad < sizeof(struct fc_record_header))
+        pad += FC_CHECKPOINT_ALIGN;
+    if (pad && fc_write_record(&cw->fw, cw->next_seq, ts_ns, FC_REC_PAD, zero,
+                               pad - sizeof(struct fc_record_header)) == -1)
+        return -1;
+
+    at = cw->fw.length;
+    cp->prev_offset = cw->last_checkpoint;
+    if (fc_write_record(&cw->fw, cw->next_seq, ts_ns, FC_REC_CHECKPOINT, cp,
+                        sizeof(*cp) + cp->count * sizeof(*cw->entries)) == -1)
+        return -1;
+
+    cw->last_checkpoint = at;
+    cw->checkpoint_due = cw->fw.length + cw->cfg.chunk_size;
+    cp->count = 0;
+    return 0;
+}
+
+/*
+ * Append one frame record
+ *
+ * Parameters:
+ *   struct fc_writer *cw -> The writer
+ *   const void *p -> Frame payload
+ *   size_t size -> Payload size in bytes
+ *   const struct timespec *ts -> Capture time of the frame
+ *   const struct frame_meta *meta -> Statistics for the index (NULL: none)
+ *   const uint8_t *thumb -> Thumbnail for the index in the configured geometry (NULL: none)
+ *
+ * Returns:
+ *   0 on success, -1 with errno set on failure (also reported as a
+ *   storage event when a durability policy is configured)
+ */
+int fc_append(struct fc_writer *cw, const void *p, size_t size, const struct timespec *ts,
+              const struct frame_meta *meta, const uint8_t *thumb)
+{
+    static const struct frame_meta none;
+    struct fc_checkpoint_entry *e;
+    size_t span = fc_record_span(size);
+    int64_t ts_ns;
+    off_t at;
+    int err;
+
+    if (cw->open && (size_t)cw->fw.length + span > cw->cfg.segment_size &&
+        cw->fw.length > (off_t)sizeof(struct fc_segment_header))
+    {
+        if (fc_rotate(cw) == -1)
+            return -1;
+    }
+    if (!cw->open && open_segment(cw, ts, span) == -1)
+    {
+        if (cw->cfg.durability)
+            dur_report(cw->cfg.durability, errno, cw->path);
+        return -1;
+    }
+
+    ts_ns = (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+    at = cw->fw.length;
+    if (fc_write_record(&cw->fw, cw->next_seq, ts_ns, 0, p, size) == -1)
+        goto fail;
+
+    // Reserved for a full segment in open_segment(), so this cannot fail
+    fi_builder_add(&cw->index, cw->next_seq, ts_ns, meta, thumb);
+
+    if (!meta)
+        meta = &none;
+    e = &cw->entries[cw->checkpoint->count++];
+    memset(e, 0, sizeof(*e));
+    e->offset = at;
+    e->seq = cw->next_seq;
+    e->timestamp_ns = ts_ns;
+    e->motion = meta->motion;
+    e->brightness = meta->brightness;
+    e->blobs = meta->blobs;
+    cw->next_seq++;
+
+    if ((cw->fw.length >= cw->checkpoint_due || cw->checkpoint->count == cw->entry_cap) &&
+        write_checkpoint(cw, ts_ns) == -1)
+        goto fail;
+    if (cw->cfg.durability)
+        return apply_durability(cw);
+    return 0;
+
+fail:
+    err = errno;
+    if (cw->cfg.durability)
+        dur_report(cw->cfg.durability, err, cw->path);
+    // Never append after a torn record; the next frame starts a new segment
+    fc_rotate(cw);
+    errno = err;
+    return -1;
+}
+
+/*
+ * Flush and close the writer
+ *
+ * Parameters:
+ *   struct fc_writer *cw -> The writer
+ *
+ * Returns:
+ *   0 on success, -1 with errno set on failure
+ */
+int fc_writer_close(struct fc_writer *cw)
+{
+    int ret = fc_rotate(cw);
+
+    fi_builder_free(&cw->index);
+    if (cw->entry_cap)
+        mem_release(MEM_WRITER, sizeof(*cw->checkpoint) + cw->entry_cap * sizeof(*cw->entries));
+    free(cw->checkpoint);
+    cw->checkpoint = NULL;
+    cw->entries = NULL;
+    cw->entry_cap = 0;
+    return ret;
+}
+
+/*
+ * Map a segment for reading and validate its header
+ *
+ * Parameters:
+ *   struct fc_reader *r -> Reader state to initialise
+ *   const char *path -> Segment file
+ *
+ * Returns:
+ *   0 on success, -1 with errno set on failure (EINVAL: not a segment)
+ */
+int fc_reader_open(struct fc_reader *r, const char *path)
+{
+    struct stat st;
+
+    memset(r, 0, sizeof(*r));
+    r->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (r->fd == -1)
+        return -1;
+    if (fstat(r->fd, &st) == -1)
+        goto fail;
+    if ((size_t)st.st_size < sizeof(struct fc_segment_header))
+    {
+        errno = EINVAL;
+        goto fail;
+    }
+
+    r->size = st.st_size;
+    r->map = mmap(NULL, r->size, PROT_READ, MAP_SHARED, r->fd, 0);
+    if (r->map == MAP_FAILED)
+    {
+        r->map = NULL;
+        goto fail;
+    }
+    madvise((void *)r->map, r->size, MADV_SEQUENTIAL);
+
+    r->hdr = (const struct fc_segment_header *)r->map;
+    if (r->hdr->magic != FC_SEGMENT_MAGIC || r->hdr->header_size < sizeof(struct fc_segment_header) ||
+        r->hdr->header_size > r->size)
+    {
+        fc_reader_close(r);
+        errno = EINVAL;
+        return -1;
+    }
+    r->pos = r->hdr->header_size;
+    return 0;
+
+fail:
+    fc_reader_close(r);
+    return -1;
+}
+
+/*
+ * Next complete frame record of the segment
+ *
+ * Padding and checkpoint records are skipped. Iteration stops at the
+ * first record that is not intact (zero padding after a flush, a tail
+ * torn by a crash, or a checksum mismatch).
+ *
+ * Parameters:
+ *   struct fc_reader *r -> The reader
+ *
+ * Returns:
+ *   Record header (payload follows it), or NULL at the end
+ */
+const struct fc_record_header *fc_reader_next(struct fc_reader *r)
+{
+    const struct fc_record_header *rec;
+
+    do
+    {
+        if (r->pos + sizeof(*rec) > r->size)
+            return NULL;
+        rec = (const struct fc_record_header *)(r->map + r->pos);
+        if (rec->magic != FC_RECORD_MAGIC || fc_record_span(rec->length) > r->size - r->pos ||
+            (r->hdr->version >= 2 && rec->crc != fc_record_crc(rec, rec + 1)))
+            return NULL;
+        r->pos += fc_record_span(rec->length);
+    } while (rec->flags & (FC_REC_PAD | FC_REC_CHECKPOINT));
+    return rec;
+}
+
+/*
+ * Unmap and close a segment
+ *
+ * Parameters:
+ *   struct fc_reader *r -> The reader
+ *
+ * Returns:
+ *   None
+ */
+void fc_reader_close(struct fc_reader *r)
+{
+    if (r->map)
+        munmap((void *)r->map, r->size);
+    if (r->fd != -1)
+        close(r->fd);
+    r->map = NULL;
+    r->fd = -1;
+}
@@ -0,0 +1,174 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Segmented frame container
+ *
+ * Instead of one small PPM file per frame, frames are appended as records
+ * to large preallocated segment files. Records are batched into
+ * erase-block sized, block-aligned chunks before they reach the device so
+ * SD/eMMC cards see long sequential writes instead of many small ones.
+ *
+ * Each segment has a column-wise metadata index "segN.idx" next to it
+ * (frame_index.h), written when the segment is closed.
+ *
+ * Every record carries a CRC32C of its header and payload. Roughly once
+ * per chunk a checkpoint record is written at an FC_CHECKPOINT_ALIGN
+ * boundary, listing the frames since the previous checkpoint. After a
+ * crash a segment without its index is recovered by probing backwards for
+ * the last checkpoint and verifying only the records after the one
+ * before it, so recovery time depends on the chunk size, not the segment
+ * size (container_recovery.c).
+ *
+ * Segment layout:
+ *   struct fc_segment_header
+ *   struct fc_record_header + payload (padded to FC_RECORD_ALIGN)
+ *   ...
+ *   [padding record] checkpoint record (at an FC_CHECKPOINT_ALIGN offset)
+ *   ...
+ */
+
+#ifndef FRAME_CONTAINER_H
+#define FRAME_CONTAINER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "frame_writer.h"
+#include "durability.h"
+#include "frame_index.h"
+
+#define FC_SEGMENT_MAGIC    0x47455343u    // "CSEG"
+#define FC_RECORD_MAGIC     0x4d524643u    // "CFRM"
+#define FC_VERSION          2               // 2: records carry a CRC32C, checkpoints
+#define FC_RECORD_ALIGN     8
+#define FC_CHECKPOINT_ALIGN (64u << 10)
+
+// fc_segment_header.flags
+#define FC_SEG_COMPACTED    (1u << 0)       // Rewritten at reduced quality by the compactor
+
+// fc_record_header.flags
+#define FC_REC_PAD          (1u << 0)       // Filler in front of a checkpoint
+#define FC_REC_CHECKPOINT   (1u << 1)       // Payload is a struct fc_checkpoint
+
+#define FC_CHUNK_SIZE       (4u << 20)      // Typical SD erase block
+#define FC_SEGMENT_SIZE     (64u << 20)     // Preallocated per segment
+#define FC_PATH_LEN         256
+
+struct fc_segment_header
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pixelformat;       // V4L2 fourcc of the record payload
+    uint32_t flags;
+    uint64_t first_seq;
+    int64_t start_ns;           // CLOCK_REALTIME of the first frame
+};
+
+struct fc_record_header
+{
+    uint32_t magic;
+    uint32_t length;            // Payload bytes, excluding header and padding
+    uint64_t seq;
+    int64_t timestamp_ns;
+    uint32_t flags;
+    uint32_t crc;               // CRC32C of the header (with crc = 0) and payload; 0 before version 2
+};
+
+// One frame listed by a checkpoint
+struct fc_checkpoint_entry
+{
+    uint64_t offset;            // Of the frame's record in the segment
+    uint64_t seq;
+    int64_t timestamp_ns;
+    uint16_t motion;            // struct frame_meta, so a lost index can be rebuilt
+    uint8_t brightness;
+    uint8_t reserved;
+    uint16_t blobs;
+    uint16_t reserved2;
+};
+
+// Checkpoint record payload, followed by count entries
+struct fc_checkpoint
+{
+    uint64_t prev_offset;       // Previous checkpoint record, 0 for the first one
+    uint32_t count;
+    uint32_t reserved;
+};
+
+struct fc_config
+{
+    const char *dir;
+    const char *path;           // Write this one segment file instead of naming segments in dir (may be NULL)
+    uint32_t flags;             // fc_segment_header.flags of the segments
+    uint32_t width;
+    uint32_t height;
+    uint32_t pixelformat;
+    size_t chunk_size;          // 0 for FC_CHUNK_SIZE
+    size_t segment_size;        // 0 for FC_SEGMENT_SIZE
+    bool direct;                // Write chunks with O_DIRECT
+    uint64_t first_seq;         // Sequence number of the first frame (see fc_recover_dir())
+    uint16_t thumb_width;       // Geometry of the thumbnails kept in the index (0: none)
+    uint16_t thumb_height;
+    uint32_t thumb_every;       // Thumbnail of about one in this many frames, sizes the index (0: 1)
+    struct durability *durability;  // Sync policy and event sink (may be NULL)
+};
+
+struct fc_writer
+{
+    struct fc_config cfg;
+    struct frame_writer fw;
+    struct fi_builder index;
+    bool open;
+    uint64_t next_seq;          // Of the next frame; may be moved forward to keep existing numbers
+    char path[FC_PATH_LEN];
+    struct fc_checkpoint *checkpoint;       // Pending checkpoint, entries follow it
+    struct fc_checkpoint_entry *entries;
+    uint32_t entry_cap;
+    off_t last_checkpoint;
+    off_t checkpoint_due;                   // Segment length at which the next one is written
+};
+
+// Sequential reader over a memory-mapped segment
+struct fc_reader
+{
+    int fd;
+    const unsigned char *map;
+    size_t size;
+    const struct fc_segment_header *hdr;
+    size_t pos;
+};
+
+struct fc_recovery
+{
+    uint64_t next_seq;          // Sequence number following the last intact frame
+    uint32_t frames;            // Intact frames in the segment
+    off_t scanned;              // Bytes verified
+    off_t truncated;            // Bytes of torn tail removed
+    bool index_rebuilt;
+};
+
+int fc_writer_init(struct fc_writer *cw, const struct fc_config *cfg);
+int fc_append(struct fc_writer *cw, const void *p, size_t size, const struct timespec *ts,
+              const struct frame_meta *meta, const uint8_t *thumb);
+int fc_rotate(struct fc_writer *cw);
+int fc_writer_close(struct fc_writer *cw);
+int fc_write_record(struct frame_writer *fw, uint64_t seq, int64_t timestamp_ns, uint32_t flags,
+                    const void *p, size_t size);
+
+uint32_t fc_record_crc(const struct fc_record_header *rec, const void *payload);
+
+int fc_reader_open(struct fc_reader *r, const char *path);
+const struct fc_record_header *fc_reader_next(struct fc_reader *r);
+void fc_reader_close(struct fc_reader *r);
+
+size_t fc_record_span(size_t payload);
+void fc_segment_path(char *path, size_t len, const char *dir, uint64_t first_seq);
+
+int fc_recover_segment(const char *path, struct fc_recovery *out);
+int fc_recover_dir(const char *dir, uint64_t *next_seq);
+
+#endif
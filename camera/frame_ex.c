@@ -15,6 +15,9 @@
   * Modified the code slightly for the target USB camera
   * This code captures frames (in raw format) - Basic implementation for checking functioning of camera and the v4l2 library
   * 
+  * Frames are only kept once the sensor's exposure has settled (see warmup.h):
+  *   cc -o frame_ex frame_ex.c warmup.c
+  * 
   * 
   */
 
@@ -33,8 +36,13 @@
 
 #include <linux/videodev2.h>
 
+#include "warmup.h"
+
 #define CLEAR(x) memset(&(x), 0, sizeof(x))
 
+/* longest wait for the exposure to settle before frames are kept */
+#define WARMUP_TIMEOUT_MS 1500
+
 struct buffer {
         void   *start;
         size_t  length;
@@ -148,6 +156,8 @@ int main(int argc, char **argv)
         unsigned int count;
         unsigned int i;
         char filename[32];
+        struct warmup warmup;
+        int warm, skipped = 0;
 
         /* parse args */
         if (argc < 5) {
@@ -330,8 +340,12 @@ int main(int argc, char **argv)
         if (-1 == xioctl(fd, VIDIOC_STREAMON, &type))
                 errno_exit("VIDIOC_STREAMON");
 
-        /* capture frame(s) (we throw away first incomplete frame ) */
-        for (i = 0; i < count + 1; i++) {
+        /* without a detector for this format fall back to skipping the first frame */
+        warm = wu_init(&warmup, fmt.fmt.pix.width, fmt.fmt.pix.height,
+                       fmt.fmt.pix.pixelformat, WARMUP_TIMEOUT_MS) == 0;
+
+        /* capture frame(s) (we throw away frames until the exposure settles) */
+        for (i = 1; i <= count; i++) {
                 for (;;) {
                         fd_set fds;
                         struct timeval tv;
@@ -366,15 +380,25 @@ int main(int argc, char **argv)
                         }
                         assert(buf.index < n_buffers);
 
-                        /* skip first image as it may not be sync'd */
-                        if (i > 0) {
-                                process_image(buffers[buf.index].start,
-                                        &fmt.fmt.pix);
-                                sprintf(filename, "frame%d.raw", i);
-                                save_frame(filename,
-                                        buffers[buf.index].start,
-                                        buf.bytesused);
+                        /* skip images until the sensor is stable (the first may not even be sync'd) */
+                        if (warm ? wu_feed(&warmup, buffers[buf.index].start, buf.bytesused) == WU_SETTLING
+                                 : skipped == 0) {
+                                skipped++;
+                                if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
+                                        errno_exit("VIDIOC_QBUF");
+                                continue;
                         }
+                        if (i == 1)
+                                printf("Skipped %d warm-up frames in %.1f ms%s\n", skipped,
+                                        warm ? wu_elapsed_ns(&warmup) / 1e6 : 0.0,
+                                        warm && warmup.state == WU_TIMEOUT ? " (exposure did not settle)" : "");
+
+                        process_image(buffers[buf.index].start,
+                                &fmt.fmt.pix);
+                        sprintf(filename, "frame%d.raw", i);
+                        save_frame(filename,
+                                buffers[buf.index].start,
+                                buf.bytesused);
 
                         /* queue buffer */
                         if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
@@ -0,0 +1,466 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Column-wise per-frame metadata index of a segment
+ *
+ * The index is written in one go when its segment is closed, to a
+ * temporary name that is renamed into place, so a reader never sees a
+ * partial index. Thumbnail space is reserved with the other columns at
+ * the announced thumbnail cadence, up to FI_THUMB_RESERVE bytes; past
+ * that the thumbnail column doubles when it fills.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "frame_index.h"
+#include "memacct.h"
+
+#define ALIGN8(x) (((x) + 7) & ~(size_t)7)
+
+// Builder bytes per frame across all columns
+#define FI_FRAME_BYTES (sizeof(int64_t) + sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint8_t) + sizeof(uint16_t))
+
+// Thumbnail bytes reserved up front at most; the column doubles past that
+#define FI_THUMB_RESERVE (1024 * 1024)
+
+static inline size_t thumb_bytes(uint16_t width, uint16_t height)
+{
+    return (size_t)width * height * 3;
+}
+
+// Builder bytes per thumbnail, its row included
+static inline size_t thumb_slot_bytes(const struct fi_builder *b)
+{
+    return sizeof(uint32_t) + thumb_bytes(b->thumb_width, b->thumb_height);
+}
+
+/*
+ * Keep thumbnails of this geometry; must come before the first reservation
+ *
+ * Parameters:
+ *   struct fi_builder *b -> The builder
+ *   uint16_t width, height -> Thumbnail geometry (0: none)
+ *   uint32_t every -> One thumbnail expected in this many frames (0: 1)
+ *
+ * Returns:
+ *   None
+ */
+void fi_builder_thumbnails(struct fi_builder *b, uint16_t width, uint16_t height, uint32_t every)
+{
+    if (b->cap)
+        return;
+    b->thumb_width = height ? width : 0;
+    b->thumb_height = width ? height : 0;
+    b->thumb_every = every ? every : 1;
+}
+
+/*
+ * Make room for a number of thumbnails
+ *
+ * Parameters:
+ *   struct fi_builder *b -> The builder
+ *   uint32_t thumbs -> Capacity to guarantee
+ *
+ * Returns:
+ *   0 on success, -1 with errno set to ENOMEM
+ */
+static int reserve_thumbs(struct fi_builder *b, uint32_t thumbs)
+{
+    void *row, *data;
+
+    if (thumbs <= b->thumb_cap)
+        return 0;
+
+    row = realloc(b->thumb_row, thumbs * sizeof(*b->thumb_row));
+    if (row)
+        b->thumb_row = row;
+    data = realloc(b->thumbs, thumbs * thumb_bytes(b->thumb_width, b->thumb_height));
+    if (data)
+        b->thumbs = data;
+
+    if (!row || !data)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    mem_charge(MEM_INDEX, (size_t)(thumbs - b->thumb_cap) * thumb_slot_bytes(b));
+    b->thumb_cap = thumbs;
+    return 0;
+}
+
+/*
+ * Make room for a number of frames without reallocating on the capture path
+ *
+ * Thumbnails get room at the cadence given to fi_builder_thumbnails().
+ *
+ * Parameters:
+ *   struct fi_builder *b -> The builder
+ *   uint32_t frames -> Capacity to guarantee
+ *
+ * Returns:
+ *   0 on success, -1 with errno set to ENOMEM
+ */
+int fi_builder_reserve(struct fi_builder *b, uint32_t frames)
+{
+    void *ts, *seq, *motion, *brightness, *blobs;
+    uint32_t thumbs;
+
+    if (frames <= b->cap)
+        return 0;
+
+    ts = realloc(b->timestamp, frames * sizeof(*b->timestamp));
+    if (ts)
+        b->timestamp = ts;
+    seq = realloc(b->seq, frames * sizeof(*b->seq));
+    if (seq)
+        b->seq = seq;
+    motion = realloc(b->motion, frames * sizeof(*b->motion));
+    if (motion)
+        b->motion = motion;
+    brightness = realloc(b->brightness, frames * sizeof(*b->brightness));
+    if (brightness)
+        b->brightness = brightness;
+    blobs = realloc(b->blobs, frames * sizeof(*b->blobs));
+    if (blobs)
+        b->blobs = blobs;
+
+    if (!ts || !seq || !motion || !brightness || !blobs)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    mem_charge(MEM_INDEX, (size_t)(frames - b->cap) * FI_FRAME_BYTES);
+    b->cap = frames;
+
+    if (!b->thumb_width)
+        return 0;
+    thumbs = frames / b->thumb_every + 1;
+    if (thumbs > frames)
+        thumbs = frames;
+    if (thumbs > FI_THUMB_RESERVE / thumb_slot_bytes(b))
+        thumbs = FI_THUMB_RESERVE / thumb_slot_bytes(b) + 1;
+    return reserve_thumbs(b, thumbs);
+}
+
+/*
+ * Start the index of a new segment
+ *
+ * Parameters:
+ *   struct fi_builder *b -> The builder
+ *   uint64_t first_seq -> Sequence number of the segment's first frame
+ *
+ * Returns:
+ *   None
+ */
+void fi_builder_reset(struct fi_builder *b, uint64_t first_seq)
+{
+    b->first_seq = first_seq;
+    b->count = 0;
+    b->thumb_count = 0;
+}
+
+/*
+ * Add the metadata of one frame
+ *
+ * Parameters:
+ *   struct fi_builder *b -> The builder
+ *   uint64_t seq -> Frame sequence number
+ *   int64_t timestamp_ns -> Capture time
+ *   const struct frame_meta *m -> Frame statistics (NULL: all zero)
+ *   const uint8_t *thumb -> Thumbnail of the frame in the builder's geometry (NULL: none)
+ *
+ * Returns:
+ *   0 on success, -1 with errno set to ENOMEM
+ */
+int fi_builder_add(struct fi_builder *b, uint64_t seq, int64_t timestamp_ns, const struct frame_meta *m,
+                   const uint8_t *thumb)
+{
+    static const struct frame_meta none;
+
+    if (b->count == b->cap && fi_builder_reserve(b, b->cap ? b->cap * 2 : 256) == -1)
+        return -1;
+    if (thumb && b->thumb_width && b->thumb_count == b->thumb_cap &&
+        reserve_thumbs(b, b->thumb_cap ? b->thumb_cap * 2 : 16) == -1)
+        return -1;
+    if (!m)
+        m = &none;
+
+    b->timestamp[b->count] = timestamp_ns;
+    b->seq[b->count] = (uint32_t)(seq - b->first_seq);
+    b->motion[b->count] = m->motion;
+    b->brightness[b->count] = m->brightness;
+    b->blobs[b->count] = m->blobs;
+    if (thumb && b->thumb_width)
+    {
+        memcpy(b->thumbs + b->thumb_count * thumb_bytes(b->thumb_width, b->thumb_height), thumb,
+               thumb_bytes(b->thumb_width, b->thumb_height));
+        b->thumb_row[b->thumb_count++] = b->count;
+    }
+    b->count++;
+    return 0;
+}
+
+/*
+ * Write the index file
+ *
+ * Parameters:
+ *   const struct fi_builder *b -> The builder
+ *   const char *path -> Index file name
+ *   int sync -> fdatasync() before the rename
+ *
+ * Returns:
+ *   0 on success, -1 with errno set on failure
+ */
+int fi_builder_write(const struct fi_builder *b, const char *path, int sync)
+{
+    static const uint8_t zero[8];
+    struct fi_header hdr;
+    struct iovec iov[15];
+    char tmp[512];
+    size_t off, total = 0;
+    ssize_t written;
+    uint32_t i;
+    int fd, n = 0, err;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = FI_MAGIC;
+    hdr.version = FI_VERSION;
+    hdr.header_size = sizeof(hdr);
+    hdr.count = b->count;
+    hdr.first_seq = b->first_seq;
+    hdr.ts_min = INT64_MAX;
+    hdr.ts_max = INT64_MIN;
+    hdr.brightness_min = UINT8_MAX;
+    hdr.thumb_width = b->thumb_width;
+    hdr.thumb_height = b->thumb_height;
+    hdr.thumb_count = b->thumb_count;
+    for (i = 0; i < b->count; i++)
+    {
+        if (b->timestamp[i] < hdr.ts_min)
+            hdr.ts_min = b->timestamp[i];
+        if (b->timestamp[i] > hdr.ts_max)
+            hdr.ts_max = b->timestamp[i];
+        if (b->motion[i] > hdr.motion_max)
+            hdr.motion_max = b->motion[i];
+        if (b->blobs[i] > hdr.blobs_max)
+            hdr.blobs_max = b->blobs[i];
+        if (b->brightness[i] < hdr.brightness_min)
+            hdr.brightness_min = b->brightness[i];
+        if (b->brightness[i] > hdr.brightness_max)
+            hdr.brightness_max = b->brightness[i];
+    }
+
+    off = ALIGN8(sizeof(hdr));
+    hdr.off_timestamp = off;
+    off = ALIGN8(off + b->count * sizeof(*b->timestamp));
+    hdr.off_seq = off;
+    off = ALIGN8(off + b->count * sizeof(*b->seq));
+    hdr.off_motion = off;
+    off = ALIGN8(off + b->count * sizeof(*b->motion));
+    hdr.off_brightness = off;
+    off = ALIGN8(off + b->count * sizeof(*b->brightness));
+    hdr.off_blobs = off;
+    off = ALIGN8(off + b->count * sizeof(*b->blobs));
+    hdr.off_thumb_row = off;
+    off = ALIGN8(off + b->thumb_count * sizeof(*b->thumb_row));
+    hdr.off_thumbs = off;
+
+    // Header, then every column followed by its padding to 8 bytes
+#define ADD_IOV(p, len)                         \
+    do                                          \
+    {                                           \
+        iov[n].iov_base = (void *)(p);          \
+        iov[n].iov_len = (len);                 \
+        total += iov[n++].iov_len;              \
+    } while (0)
+    ADD_IOV(&hdr, sizeof(hdr));
+    ADD_IOV(zero, hdr.off_timestamp - total);
+    ADD_IOV(b->timestamp, b->count * sizeof(*b->timestamp));
+    ADD_IOV(zero, hdr.off_seq - total);
+    ADD_IOV(b->seq, b->count * sizeof(*b->seq));
+    ADD_IOV(zero, hdr.off_motion - total);
+    ADD_IOV(b->motion, b->count * sizeof(*b->motion));
+    ADD_IOV(zero, hdr.off_brightness - total);
+    ADD_IOV(b->brightness, b->count * sizeof(*b->brightness));
+    ADD_IOV(zero, hdr.off_blobs - total);
+    ADD_IOV(b->blobs, b->count * sizeof(*b->blobs));
+    ADD_IOV(zero, hdr.off_thumb_row - total);
+    ADD_IOV(b->thumb_row, b->thumb_count * sizeof(*b->thumb_row));
+    ADD_IOV(zero, hdr.off_thumbs - total);
+    ADD_IOV(b->thumbs, b->thumb_count * thumb_bytes(b->thumb_width, b->thumb_height));
+#undef ADD_IOV
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 00666);
+    if (fd == -1)
+        return -1;
+
+    // The index is at most a few MB; a short write is an error
+    written = writev(fd, iov, n);
+    if (written != (ssize_t)total || (sync && fdatasync(fd) == -1))
+    {
+        err = (written >= 0 && written != (ssize_t)total) ? ENOSPC : errno;
+        close(fd);
+        unlink(tmp);
+        errno = err;
+        return -1;
+    }
+    if (close(fd) == -1 || rename(tmp, path) == -1)
+    {
+        err = errno;
+        unlink(tmp);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Release the builder's columns
+ *
+ * Parameters:
+ *   struct fi_builder *b -> The builder
+ *
+ * Returns:
+ *   None
+ */
+void fi_builder_free(struct fi_builder *b)
+{
+    mem_release(MEM_INDEX, (size_t)b->cap * FI_FRAME_BYTES + (size_t)b->thumb_cap * thumb_slot_bytes(b));
+    free(b->timestamp);
+    free(b->seq);
+    free(b->motion);
+    free(b->brightness);
+    free(b->blobs);
+    free(b->thumb_row);
+    free(b->thumbs);
+    memset(b, 0, sizeof(*b));
+}
+
+/*
+ * Map an index file and locate its columns
+ *
+ * Parameters:
+ *   struct fi_index *ix -> Index to initialise
+ *   const char *path -> Index file
+ *
+ * Returns:
+ *   0 on success, -1 with errno set (EINVAL for a malformed index)
+ */
+int fi_open(struct fi_index *ix, const char *path)
+{
+    const struct fi_header *h;
+    struct stat st;
+    void *map;
+    int fd;
+
+    memset(ix, 0, sizeof(*ix));
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < FI_HEADER_V1_SIZE)
+    {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    h = map;
+    ix->hdr = h;
+    ix->size = st.st_size;
+    if (h->magic != FI_MAGIC || h->off_blobs + (size_t)h->count * sizeof(uint16_t) > ix->size ||
+        h->header_size < FI_HEADER_V1_SIZE || h->off_timestamp < h->header_size ||
+        h->off_seq < h->off_timestamp + (size_t)h->count * 8 ||
+        h->off_motion < h->off_seq + (size_t)h->count * 4 || h->off_brightness < h->off_motion + (size_t)h->count * 2 ||
+        h->off_blobs < h->off_brightness + h->count ||
+        h->off_timestamp % 8 || h->off_seq % 4 || h->off_motion % 2 || h->off_blobs % 2)
+    {
+        fi_close(ix);
+        errno = EINVAL;
+        return -1;
+    }
+
+    ix->timestamp = (const int64_t *)((const uint8_t *)map + h->off_timestamp);
+    ix->seq = (const uint32_t *)((const uint8_t *)map + h->off_seq);
+    ix->motion = (const uint16_t *)((const uint8_t *)map + h->off_motion);
+    ix->brightness = (const uint8_t *)map + h->off_brightness;
+    ix->blobs = (const uint16_t *)((const uint8_t *)map + h->off_blobs);
+
+    // Version 1 headers end before the thumbnail fields
+    if (h->version < 2)
+        return 0;
+    if (h->header_size < sizeof(*h) || h->off_thumb_row % 4 ||
+        h->off_thumb_row < h->off_blobs + (size_t)h->count * 2 ||
+        h->off_thumbs < h->off_thumb_row + (size_t)h->thumb_count * 4 ||
+        h->off_thumbs + (size_t)h->thumb_count * thumb_bytes(h->thumb_width, h->thumb_height) > ix->size)
+    {
+        fi_close(ix);
+        errno = EINVAL;
+        return -1;
+    }
+    if (h->thumb_width == 0 || h->thumb_height == 0)
+        return 0;
+    ix->thumb_width = h->thumb_width;
+    ix->thumb_height = h->thumb_height;
+    ix->thumb_count = h->thumb_count;
+    ix->thumb_row = (const uint32_t *)((const uint8_t *)map + h->off_thumb_row);
+    ix->thumbs = (const uint8_t *)map + h->off_thumbs;
+    return 0;
+}
+
+/*
+ * Unmap an index
+ *
+ * Parameters:
+ *   struct fi_index *ix -> The index
+ *
+ * Returns:
+ *   None
+ */
+void fi_close(struct fi_index *ix)
+{
+    if (ix->hdr)
+        munmap((void *)ix->hdr, ix->size);
+    memset(ix, 0, sizeof(*ix));
+}
+
+/*
+ * Name of the index belonging to a segment ("segN.fcs" -> "segN.idx"); a
+ * segment being rewritten has a temporary index ("segN.fcs.tmp" ->
+ * "segN.idx.tmp") that is renamed with it
+ *
+ * Parameters:
+ *   char *path -> Output buffer
+ *   size_t len -> Size of the output buffer
+ *   const char *segment_path -> Segment file name
+ *
+ * Returns:
+ *   None
+ */
+void fi_index_path(char *path, size_t len, const char *segment_path)
+{
+    size_t n = strlen(segment_path);
+    const char *tmp = "";
+
+    if (n > 4 && strcmp(segment_path + n - 4, ".tmp") == 0)
+    {
+        n -= 4;
+        tmp = ".tmp";
+    }
+    if (n > 4 && strncmp(segment_path + n - 4, ".fcs", 4) == 0)
+        n -= 4;
+    snprintf(path, len, "%.*s.idx%s", (int)n, segment_path, tmp);
+}
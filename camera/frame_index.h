@@ -0,0 +1,111 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Column-wise per-frame metadata index of a segment
+ *
+ * Every segment "segN.fcs" gets a sidecar "segN.idx" holding one column
+ * per field (timestamp, sequence, motion, brightness, blobs) so a query
+ * only touches the columns it filters on. The header carries min/max
+ * summaries so whole segments can be skipped without reading a column.
+ *
+ * Since version 2 the index can also hold small RGB24 thumbnails of some
+ * or all of the frames, made by the writer while it has the converted
+ * frame at hand, so browsing a recording never decodes a full frame. A
+ * second column gives the row of the frame each thumbnail belongs to.
+ * Version 1 indexes are still read; they have no thumbnails.
+ */
+
+#ifndef FRAME_INDEX_H
+#define FRAME_INDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "frame_analysis.h"
+
+#define FI_MAGIC    0x58444946u     // "FIDX"
+#define FI_VERSION  2
+
+struct fi_header
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t count;
+    uint32_t reserved;
+    uint64_t first_seq;
+    int64_t ts_min;
+    int64_t ts_max;
+    uint16_t motion_max;
+    uint16_t blobs_max;
+    uint8_t brightness_min;
+    uint8_t brightness_max;
+    uint16_t pad;
+    // Byte offsets of the columns from the start of the file
+    uint32_t off_timestamp;         // int64_t[count], ns since the epoch
+    uint32_t off_seq;               // uint32_t[count], seq - first_seq
+    uint32_t off_motion;            // uint16_t[count]
+    uint32_t off_brightness;        // uint8_t[count]
+    uint32_t off_blobs;             // uint16_t[count]
+    uint32_t pad2;
+    // Version 2
+    uint16_t thumb_width;           // 0: no thumbnails
+    uint16_t thumb_height;
+    uint32_t thumb_count;
+    uint32_t off_thumb_row;         // uint32_t[thumb_count], row of the frame, ascending
+    uint32_t off_thumbs;            // uint8_t[thumb_count][thumb_height][thumb_width][3]
+};
+
+// Size of a version 1 header
+#define FI_HEADER_V1_SIZE   offsetof(struct fi_header, thumb_width)
+
+// Accumulates the columns of the segment being written
+struct fi_builder
+{
+    uint64_t first_seq;
+    uint32_t count;
+    uint32_t cap;
+    int64_t *timestamp;
+    uint32_t *seq;
+    uint16_t *motion;
+    uint8_t *brightness;
+    uint16_t *blobs;
+    uint16_t thumb_width;           // 0: no thumbnails
+    uint16_t thumb_height;
+    uint32_t thumb_every;           // Expected cadence: one thumbnail in this many frames
+    uint32_t thumb_count;
+    uint32_t thumb_cap;
+    uint32_t *thumb_row;
+    uint8_t *thumbs;
+};
+
+// A memory-mapped index
+struct fi_index
+{
+    const struct fi_header *hdr;
+    size_t size;
+    const int64_t *timestamp;
+    const uint32_t *seq;
+    const uint16_t *motion;
+    const uint8_t *brightness;
+    const uint16_t *blobs;
+    uint16_t thumb_width;           // 0 when the index has no thumbnails
+    uint16_t thumb_height;
+    uint32_t thumb_count;
+    const uint32_t *thumb_row;
+    const uint8_t *thumbs;
+};
+
+void fi_builder_thumbnails(struct fi_builder *b, uint16_t width, uint16_t height, uint32_t every);
+int fi_builder_reserve(struct fi_builder *b, uint32_t frames);
+void fi_builder_reset(struct fi_builder *b, uint64_t first_seq);
+int fi_builder_add(struct fi_builder *b, uint64_t seq, int64_t timestamp_ns, const struct frame_meta *m,
+                   const uint8_t *thumb);
+int fi_builder_write(const struct fi_builder *b, const char *path, int sync);
+void fi_builder_free(struct fi_builder *b);
+
+int fi_open(struct fi_index *ix, const char *path);
+void fi_close(struct fi_index *ix);
+
+void fi_index_path(char *path, size_t len, const char *segment_path);
+
+#endif
@@ -0,0 +1,509 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Offline frame timing and drop analysis of recordings
+ *
+ * Reconstructs the frame-interval distribution of a recording and finds
+ * the frames that never made it to storage. Container recordings are
+ * read from their mapped segment indexes (or, without an index, by
+ * walking the record headers of the mapped segment); PPM recordings from
+ * the "sec/msec" comment in each file header. Intervals are measured
+ * against the nominal frame interval (the median unless given); a gap
+ * of more than -t intervals counts round(gap / nominal) - 1 dropped
+ * frames as one burst. Gaps longer than -g seconds, or timestamps that
+ * go backwards, split the recording into runs instead of counting as
+ * drops. Sequence number gaps are reported separately.
+ *
+ * usage: frame_jitter [-i interval_ms] [-t factor] [-g seconds] [-b bursts] [path...]
+ *   path is a directory (default frames), a .idx, a .fcs, a .ppm or a .pgm file
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <dirent.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "frame_container.h"
+#include "frame_index.h"
+
+#define PPM_HEADER_PEEK 64
+#define BURST_CLASSES   5
+
+struct samples
+{
+    int64_t *ts;                // ns since the epoch
+    uint64_t *seq;
+    size_t count;
+    size_t cap;
+    unsigned int indexes;
+    unsigned int segments;
+    unsigned int images;
+    unsigned int unreadable;
+};
+
+struct burst
+{
+    size_t at;                  // Sample after which the frames are missing
+    uint64_t missing;
+};
+
+struct options
+{
+    int64_t nominal_ns;         // 0: median interval
+    double factor;
+    int64_t break_ns;
+    unsigned int show_bursts;
+};
+
+static double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int by_name(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int by_value(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static int by_missing(const void *a, const void *b)
+{
+    const struct burst *x = a, *y = b;
+
+    return (x->missing < y->missing) - (x->missing > y->missing);
+}
+
+static bool has_suffix(const char *name, const char *suffix)
+{
+    size_t n = strlen(name), s = strlen(suffix);
+
+    return n > s && strcmp(name + n - s, suffix) == 0;
+}
+
+static void add_sample(struct samples *s, uint64_t seq, int64_t ts)
+{
+    if (s->count == s->cap)
+    {
+        s->cap = s->cap ? s->cap * 2 : 65536;
+        s->ts = realloc(s->ts, s->cap * sizeof(*s->ts));
+        s->seq = realloc(s->seq, s->cap * sizeof(*s->seq));
+        if (!s->ts || !s->seq)
+        {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    s->ts[s->count] = ts;
+    s->seq[s->count] = seq;
+    s->count++;
+}
+
+/*
+ * Take the timestamps of a segment from its index
+ *
+ * Parameters:
+ *   struct samples *s -> Samples to append to
+ *   const char *path -> Index file
+ *
+ * Returns:
+ *   0 on success, -1 if the index cannot be used
+ */
+static int load_index(struct samples *s, const char *path)
+{
+    struct fi_index ix;
+    uint32_t i;
+
+    if (fi_open(&ix, path) == -1)
+        return -1;
+    for (i = 0; i < ix.hdr->count; i++)
+        add_sample(s, ix.hdr->first_seq + ix.seq[i], ix.timestamp[i]);
+    fi_close(&ix);
+    s->indexes++;
+    return 0;
+}
+
+/*
+ * Take the timestamps of a segment that has no index from its record headers
+ *
+ * Payload CRCs are not checked; only headers are touched, so most of
+ * the mapping is never faulted in.
+ *
+ * Parameters:
+ *   struct samples *s -> Samples to append to
+ *   const char *path -> Segment file
+ *
+ * Returns:
+ *   0 on success, -1 if the segment cannot be read
+ */
+static int load_segment(struct samples *s, const char *path)
+{
+    const struct fc_segment_header *hdr;
+    const struct fc_record_header *rec;
+    const unsigned char *map;
+    struct stat st;
+    size_t pos;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(*hdr))
+    {
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    hdr = (const struct fc_segment_header *)map;
+    if (hdr->magic != FC_SEGMENT_MAGIC)
+    {
+        munmap((void *)map, st.st_size);
+        return -1;
+    }
+    // Stop at the first torn or preallocated (zero) record
+    for (pos = hdr->header_size; pos + sizeof(*rec) <= (size_t)st.st_size; pos += fc_record_span(rec->length))
+    {
+        rec = (const struct fc_record_header *)(map + pos);
+        if (rec->magic != FC_RECORD_MAGIC || fc_record_span(rec->length) > (size_t)st.st_size - pos)
+            break;
+        if (!(rec->flags & (FC_REC_PAD | FC_REC_CHECKPOINT)))
+            add_sample(s, rec->seq, rec->timestamp_ns);
+    }
+    munmap((void *)map, st.st_size);
+    s->segments++;
+    return 0;
+}
+
+/*
+ * Take the timestamp of a PPM or PGM frame from its header comment
+ *
+ * Only the first bytes are read; a pread() is cheaper than mapping a
+ * file this small.
+ *
+ * Parameters:
+ *   struct samples *s -> Samples to append to
+ *   const char *path -> Image written by dump_ppm()
+ *
+ * Returns:
+ *   0 on success, -1 if the file carries no timestamp
+ */
+static int load_ppm(struct samples *s, const char *path)
+{
+    char head[PPM_HEADER_PEEK + 1];
+    const char *end;
+    long long sec, msec;
+    unsigned long tag = 0;
+    char kind;
+    ssize_t n;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+    n = pread(fd, head, PPM_HEADER_PEEK, 0);
+    close(fd);
+    if (n <= 0)
+        return -1;
+    head[n] = '\0';
+    if (sscanf(head, "P%c\n#%lld sec %lld msec", &kind, &sec, &msec) != 3 || (kind != '5' && kind != '6'))
+        return -1;
+
+    // The frame counter ends the name, whatever the output's prefix: test00000042.ppm
+    end = strrchr(path, '.');
+    if (!end || (strrchr(path, '/') && end < strrchr(path, '/')))
+        end = path + strlen(path);
+    while (end > path && end[-1] >= '0' && end[-1] <= '9')
+        end--;
+    tag = strtoul(end, NULL, 10);
+    add_sample(s, tag, sec * 1000000000 + msec * 1000000);
+    s->images++;
+    return 0;
+}
+
+static void load_file(struct samples *s, const char *path)
+{
+    int ret;
+
+    if (has_suffix(path, ".idx"))
+        ret = load_index(s, path);
+    else if (has_suffix(path, ".fcs"))
+        ret = load_segment(s, path);
+    else
+        ret = load_ppm(s, path);
+    if (ret == -1)
+    {
+        fprintf(stderr, "%s: no frame timestamps\n", path);
+        s->unreadable++;
+    }
+}
+
+/*
+ * Load every recording in a directory in name (= capture) order
+ *
+ * A segment that has an index is read from the index only.
+ */
+static void load_dir(struct samples *s, const char *dir)
+{
+    char path[512], idx[512];
+    struct dirent *de;
+    char **names = NULL;
+    size_t count = 0, cap = 0, i;
+    DIR *d;
+
+    d = opendir(dir);
+    if (!d)
+    {
+        perror(dir);
+        exit(EXIT_FAILURE);
+    }
+    while ((de = readdir(d)) != NULL)
+    {
+        if (!has_suffix(de->d_name, ".idx") && !has_suffix(de->d_name, ".fcs") && !has_suffix(de->d_name, ".ppm") &&
+            !has_suffix(de->d_name, ".pgm"))
+            continue;
+        if (count == cap)
+        {
+            cap = cap ? cap * 2 : 256;
+            names = realloc(names, cap * sizeof(*names));
+            if (!names)
+            {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        names[count++] = strdup(de->d_name);
+    }
+    closedir(d);
+    qsort(names, count, sizeof(*names), by_name);
+
+    for (i = 0; i < count; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        if (has_suffix(names[i], ".fcs"))
+        {
+            fi_index_path(idx, sizeof(idx), path);
+            if (access(idx, R_OK) == 0)
+            {
+                free(names[i]);
+                continue;
+            }
+        }
+        load_file(s, path);
+        free(names[i]);
+    }
+    free(names);
+}
+
+static double percentile(const int64_t *sorted, size_t n, double p)
+{
+    size_t i = (size_t)(p / 100 * (n - 1) + 0.5);
+
+    return sorted[i < n ? i : n - 1] / 1e6;
+}
+
+/*
+ * Print the timing and drop report
+ *
+ * Parameters:
+ *   const struct samples *s -> All frames in capture order
+ *   const struct options *o -> Thresholds
+ *
+ * Returns:
+ *   None
+ */
+static void report(const struct samples *s, const struct options *o)
+{
+    static const char *const class_names[BURST_CLASSES] = { "1", "2", "3-5", "6-10", ">10" };
+    uint64_t classes[BURST_CLASSES] = { 0 }, drops = 0, seq_missing = 0, seq_gaps = 0, missing;
+    int64_t *intervals, *sorted, d, nominal, span = 0;
+    struct burst *bursts;
+    size_t n = 0, nbursts = 0, runs = 1, backwards = 0, i;
+    double mean = 0, var = 0;
+    char when[32];
+    time_t sec;
+
+    intervals = malloc(s->count * sizeof(*intervals) + 1);
+    sorted = malloc(s->count * sizeof(*sorted) + 1);
+    bursts = malloc(s->count * sizeof(*bursts) + 1);
+    if (!intervals || !sorted || !bursts)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 1; i < s->count; i++)
+    {
+        d = s->ts[i] - s->ts[i - 1];
+        if (s->seq[i] > s->seq[i - 1] + 1)
+        {
+            seq_gaps++;
+            seq_missing += s->seq[i] - s->seq[i - 1] - 1;
+        }
+        if (d <= 0 || d > o->break_ns)
+        {
+            runs++;
+            backwards += d <= 0;
+            continue;
+        }
+        intervals[n++] = d;
+        span += d;
+    }
+    if (n == 0)
+    {
+        printf("%zu frames: not enough to measure intervals\n", s->count);
+        goto out;
+    }
+
+    memcpy(sorted, intervals, n * sizeof(*sorted));
+    qsort(sorted, n, sizeof(*sorted), by_value);
+    nominal = o->nominal_ns ? o->nominal_ns : sorted[n / 2];
+
+    // Second pass in capture order, now that the nominal interval is known
+    for (i = 1, n = 0; i < s->count; i++)
+    {
+        d = s->ts[i] - s->ts[i - 1];
+        if (d <= 0 || d > o->break_ns)
+            continue;
+        n++;
+        mean += d;
+        if (d > o->factor * nominal)
+        {
+            missing = llround((double)d / nominal) - 1;
+            if (missing == 0)
+                missing = 1;
+            drops += missing;
+            bursts[nbursts].at = i - 1;
+            bursts[nbursts].missing = missing;
+            nbursts++;
+            classes[missing == 1 ? 0 : missing == 2 ? 1 : missing <= 5 ? 2 : missing <= 10 ? 3 : 4]++;
+        }
+    }
+    mean /= n;
+    // From here on intervals holds the deviations from nominal
+    for (i = 0; i < n; i++)
+    {
+        var += (intervals[i] - mean) * (intervals[i] - mean);
+        intervals[i] = llabs(intervals[i] - nominal);
+    }
+    qsort(intervals, n, sizeof(*intervals), by_value);
+
+    printf("frames      %zu in %zu run%s, %.3f s of capture (%u indexes, %u segments, %u images)\n", s->count,
+           runs, runs == 1 ? "" : "s", span / 1e9, s->indexes, s->segments, s->images);
+    printf("rate        %.3f fps effective, nominal interval %.3f ms (%.3f fps)%s\n", n / (span / 1e9),
+           nominal / 1e6, 1e9 / nominal, o->nominal_ns ? "" : " [median]");
+    printf("interval ms min %.3f  p1 %.3f  p50 %.3f  p99 %.3f  p99.9 %.3f  max %.3f  stddev %.3f\n",
+           sorted[0] / 1e6, percentile(sorted, n, 1), percentile(sorted, n, 50), percentile(sorted, n, 99),
+           percentile(sorted, n, 99.9), sorted[n - 1] / 1e6, sqrt(var / n) / 1e6);
+    printf("jitter ms   p50 %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  max %.3f  (|interval - nominal|)\n",
+           percentile(intervals, n, 50), percentile(intervals, n, 90), percentile(intervals, n, 99),
+           percentile(intervals, n, 99.9), intervals[n - 1] / 1e6);
+    printf("drops       %llu frames (%.3f%%) in %zu bursts, gaps over %.2f intervals\n", (unsigned long long)drops,
+           100.0 * drops / (drops + s->count), nbursts, o->factor);
+    printf("burst sizes");
+    for (i = 0; i < BURST_CLASSES; i++)
+        printf("  %s: %llu", class_names[i], (unsigned long long)classes[i]);
+    printf("\nsequence    %llu frames missing in %llu gaps\n", (unsigned long long)seq_missing,
+           (unsigned long long)seq_gaps);
+    if (backwards)
+        printf("clock       %zu backward steps (treated as run breaks)\n", backwards);
+
+    if (o->show_bursts && nbursts)
+    {
+        qsort(bursts, nbursts, sizeof(*bursts), by_missing);
+        printf("longest bursts:\n");
+        for (i = 0; i < nbursts && i < o->show_bursts; i++)
+        {
+            sec = s->ts[bursts[i].at] / 1000000000;
+            strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&sec));
+            printf("  %6llu frames after seq %llu at %s.%03lld (gap %.3f ms)\n",
+                   (unsigned long long)bursts[i].missing, (unsigned long long)s->seq[bursts[i].at], when,
+                   (long long)(s->ts[bursts[i].at] / 1000000 % 1000),
+                   (s->ts[bursts[i].at + 1] - s->ts[bursts[i].at]) / 1e6);
+        }
+    }
+
+out:
+    free(intervals);
+    free(sorted);
+    free(bursts);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-i interval_ms] [-t factor] [-g seconds] [-b bursts] [path...]\n"
+                    "  path  directory (default frames), .idx, .fcs, .ppm or .pgm files\n"
+                    "  -i    nominal frame interval in ms (default: median interval)\n"
+                    "  -t    a gap over this many intervals holds dropped frames (default 1.5)\n"
+                    "  -g    gaps longer than this many seconds start a new run (default 5)\n"
+                    "  -b    list the longest bursts\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    struct options o = { 0, 1.5, 5000000000LL, 0 };
+    struct samples s = { 0 };
+    struct stat st;
+    double start;
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "i:t:g:b:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'i':
+            o.nominal_ns = (int64_t)(atof(optarg) * 1e6);
+            break;
+        case 't':
+            o.factor = atof(optarg);
+            break;
+        case 'g':
+            o.break_ns = (int64_t)(atof(optarg) * 1e9);
+            break;
+        case 'b':
+            o.show_bursts = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (o.factor <= 1 || o.break_ns <= 0 || o.nominal_ns < 0)
+        usage(argv[0]);
+
+    start = now_ms();
+    if (optind == argc)
+        load_dir(&s, "frames");
+    for (i = optind; i < argc; i++)
+    {
+        if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode))
+            load_dir(&s, argv[i]);
+        else
+            load_file(&s, argv[i]);
+    }
+    report(&s, &o);
+    fprintf(stderr, "%.2f ms\n", now_ms() - start);
+
+    free(s.ts);
+    free(s.seq);
+    return s.count ? 0 : EXIT_FAILURE;
+}
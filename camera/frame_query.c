@@ -0,0 +1,356 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Search recordings through their metadata indexes
+ *
+ * Maps every segment index in a directory and prints the frames that
+ * fall in a time range and pass motion/brightness/blob thresholds.
+ * Whole segments are skipped on their header summaries; inside a segment
+ * the time range is found by binary search on the timestamp column and
+ * only the filtered columns are touched. With -p the thumbnails of the
+ * matching frames are laid out in rows of a preview strip, written as a
+ * PPM image, without opening a single segment.
+ *
+ * usage: frame_query [-d dir] [-f from] [-t to] [-m motion] [-b blobs]
+ *                    [-l min_luma] [-L max_luma] [-c] [-p file[:columns]]
+ *   from/to are seconds since the epoch, motion is a mean luma difference
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <dirent.h>
+#include <stdbool.h>
+
+#include "frame_index.h"
+
+struct query
+{
+    int64_t from_ns;
+    int64_t to_ns;
+    uint16_t min_motion;    // 8.8 fixed point, as stored
+    uint16_t min_blobs;
+    uint8_t min_brightness;
+    uint8_t max_brightness;
+    bool count_only;
+};
+
+// Thumbnails of the matching frames, for the preview strip (-p)
+struct preview
+{
+    const char *path;
+    unsigned int columns;
+    uint16_t width;             // Geometry of the first thumbnail seen; others are left out
+    uint16_t height;
+    size_t count;
+    size_t cap;
+    uint8_t *thumbs;
+};
+
+struct query_stats
+{
+    unsigned int indexes;
+    unsigned int skipped;
+    uint64_t frames;
+    uint64_t matches;
+};
+
+static double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/*
+ * First entry whose timestamp is >= t (inclusive) or > t (!inclusive);
+ * timestamps ascend within a segment
+ */
+static uint32_t bound(const struct fi_index *ix, int64_t t, bool inclusive)
+{
+    uint32_t lo = 0, hi = ix->hdr->count, mid;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (ix->timestamp[mid] < t || (!inclusive && ix->timestamp[mid] == t))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/*
+ * Add the thumbnail of a frame to the preview, if the index has one
+ */
+static void add_preview(struct preview *pv, const struct fi_index *ix, uint32_t row)
+{
+    size_t bytes = (size_t)ix->thumb_width * ix->thumb_height * 3;
+    uint32_t lo = 0, hi = ix->thumb_count, mid;
+    uint8_t *grown;
+
+    if (!ix->thumb_width)
+        return;
+    if (!pv->width)
+    {
+        pv->width = ix->thumb_width;
+        pv->height = ix->thumb_height;
+    }
+    if (ix->thumb_width != pv->width || ix->thumb_height != pv->height)
+        return;
+
+    // Thumbnail rows ascend
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (ix->thumb_row[mid] < row)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == ix->thumb_count || ix->thumb_row[lo] != row)
+        return;
+
+    if (pv->count == pv->cap)
+    {
+        grown = realloc(pv->thumbs, (pv->cap ? pv->cap * 2 : 64) * bytes);
+        if (!grown)
+            return;
+        pv->thumbs = grown;
+        pv->cap = pv->cap ? pv->cap * 2 : 64;
+    }
+    memcpy(pv->thumbs + pv->count++ * bytes, ix->thumbs + (size_t)lo * bytes, bytes);
+}
+
+/*
+ * Write the preview strip: the thumbnails in rows of pv->columns, in match order
+ */
+static int write_preview(const struct preview *pv)
+{
+    unsigned int cols = pv->count < pv->columns ? pv->count : pv->columns;
+    size_t rows = (pv->count + cols - 1) / cols, r, i, bytes = (size_t)pv->width * pv->height * 3;
+    uint32_t y;
+    uint8_t *line;
+    FILE *f;
+
+    line = calloc((size_t)cols * pv->width, 3);
+    f = fopen(pv->path, "wb");
+    if (!line || !f)
+    {
+        free(line);
+        if (f)
+            fclose(f);
+        return -1;
+    }
+    fprintf(f, "P6\n%u %zu\n255\n", cols * pv->width, rows * pv->height);
+    for (r = 0; r < rows; r++)
+    {
+        for (y = 0; y < pv->height; y++)
+        {
+            // A short last row is padded with black
+            memset(line, 0, (size_t)cols * pv->width * 3);
+            for (i = 0; i < cols && r * cols + i < pv->count; i++)
+                memcpy(line + i * pv->width * 3, pv->thumbs + (r * cols + i) * bytes + (size_t)y * pv->width * 3,
+                       (size_t)pv->width * 3);
+            fwrite(line, 3, (size_t)cols * pv->width, f);
+        }
+    }
+    free(line);
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+/*
+ * Run the query against one index
+ *
+ * Parameters:
+ *   const struct query *q -> The query
+ *   const char *name -> Index file name (for output)
+ *   const struct fi_index *ix -> The mapped index
+ *   struct query_stats *st -> Counters to update
+ *   struct preview *pv -> Preview strip to extend (path NULL: none)
+ *
+ * Returns:
+ *   None
+ */
+static void query_index(const struct query *q, const char *name, const struct fi_index *ix, struct query_stats *st,
+                        struct preview *pv)
+{
+    const struct fi_header *h = ix->hdr;
+    uint32_t i, end;
+    char when[32];
+    time_t sec;
+
+    if (h->count == 0 || h->ts_max < q->from_ns || h->ts_min > q->to_ns || h->motion_max < q->min_motion ||
+        h->blobs_max < q->min_blobs || h->brightness_max < q->min_brightness ||
+        h->brightness_min > q->max_brightness)
+    {
+        st->skipped++;
+        return;
+    }
+
+    i = bound(ix, q->from_ns, true);
+    end = bound(ix, q->to_ns, false);
+    st->frames += end - i;
+    for (; i < end; i++)
+    {
+        if (ix->motion[i] < q->min_motion || ix->blobs[i] < q->min_blobs ||
+            ix->brightness[i] < q->min_brightness || ix->brightness[i] > q->max_brightness)
+            continue;
+
+        st->matches++;
+        if (pv->path)
+            add_preview(pv, ix, i);
+        if (q->count_only)
+            continue;
+        sec = ix->timestamp[i] / 1000000000;
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&sec));
+        printf("%s %10llu %s.%03lld motion=%6.2f luma=%3u blobs=%u\n", name,
+               (unsigned long long)(h->first_seq + ix->seq[i]), when,
+               (long long)(ix->timestamp[i] / 1000000 % 1000), ix->motion[i] / 256.0,
+               ix->brightness[i], ix->blobs[i]);
+    }
+}
+
+static int by_name(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-d dir] [-f from] [-t to] [-m motion] [-b blobs] [-l min_luma] [-L max_luma] [-c]\n"
+                    "       [-p file[:columns]]\n"
+                    "  -f/-t  time range in seconds since the epoch\n"
+                    "  -m     minimum motion score (mean luma difference, e.g. 2.5)\n"
+                    "  -b     minimum number of moving blobs\n"
+                    "  -l/-L  brightness range (0-255)\n"
+                    "  -c     print only the number of matching frames\n"
+                    "  -p     write the thumbnails of the matching frames to a PPM preview strip,\n"
+                    "         columns wide (default 8)\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    struct query q = { INT64_MIN, INT64_MAX, 0, 0, 0, 255, false };
+    struct query_stats st = { 0 };
+    struct preview pv = { NULL, 8 };
+    char *columns;
+    const char *dir = "frames";
+    char path[512];
+    struct fi_index ix;
+    struct dirent *de;
+    char **names = NULL;
+    size_t len, count = 0, cap = 0, i;
+    double start;
+    DIR *d;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:f:t:m:b:l:L:cp:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'd':
+            dir = optarg;
+            break;
+        case 'f':
+            q.from_ns = (int64_t)(atof(optarg) * 1e9);
+            break;
+        case 't':
+            q.to_ns = (int64_t)(atof(optarg) * 1e9);
+            break;
+        case 'm':
+            q.min_motion = (uint16_t)(atof(optarg) * 256);
+            break;
+        case 'b':
+            q.min_blobs = atoi(optarg);
+            break;
+        case 'l':
+            q.min_brightness = atoi(optarg);
+            break;
+        case 'L':
+            q.max_brightness = atoi(optarg);
+            break;
+        case 'c':
+            q.count_only = true;
+            break;
+        case 'p':
+            pv.path = optarg;
+            columns = strrchr(optarg, ':');
+            if (columns)
+            {
+                *columns++ = '\0';
+                pv.columns = strtoul(columns, NULL, 0);
+                if (pv.columns == 0)
+                    usage(argv[0]);
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    start = now_ms();
+    d = opendir(dir);
+    if (!d)
+    {
+        perror(dir);
+        return EXIT_FAILURE;
+    }
+    // Segment names sort by sequence number, so sorted output is chronological
+    while ((de = readdir(d)) != NULL)
+    {
+        len = strlen(de->d_name);
+        if (len <= 4 || strcmp(de->d_name + len - 4, ".idx") != 0)
+            continue;
+        if (count == cap)
+        {
+            cap = cap ? cap * 2 : 256;
+            names = realloc(names, cap * sizeof(*names));
+            if (!names)
+            {
+                perror("realloc");
+                return EXIT_FAILURE;
+            }
+        }
+        names[count++] = strdup(de->d_name);
+    }
+    closedir(d);
+    qsort(names, count, sizeof(*names), by_name);
+
+    for (i = 0; i < count; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        if (fi_open(&ix, path) == -1)
+            fprintf(stderr, "%s: not a valid index\n", path);
+        else
+        {
+            st.indexes++;
+            query_index(&q, names[i], &ix, &st, &pv);
+            fi_close(&ix);
+        }
+        free(names[i]);
+    }
+    free(names);
+
+    if (q.count_only)
+        printf("%llu\n", (unsigned long long)st.matches);
+    if (pv.path)
+    {
+        if (pv.count == 0)
+            fprintf(stderr, "%s: no thumbnails among the matches\n", pv.path);
+        else if (write_preview(&pv) == -1)
+            perror(pv.path);
+        else
+            fprintf(stderr, "%s: %zu thumbnails of %ux%u\n", pv.path, pv.count, pv.width, pv.height);
+        free(pv.thumbs);
+    }
+    fprintf(stderr, "%u indexes (%u skipped), %llu frames in range, %llu matches, %.2f ms\n", st.indexes,
+            st.skipped, (unsigned long long)st.frames, (unsigned long long)st.matches, now_ms() - start);
+    return 0;
+}
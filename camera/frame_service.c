@@ -0,0 +1,637 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Frame subscription service on a Unix domain socket
+ *
+ * The capture thread only copies the newest frame into a hand-over
+ * buffer and signals an eventfd; conversion, memfd creation and sending
+ * happen on the service thread. If the service falls behind, a pending
+ * frame is replaced by the newer one.
+ *
+ * Every view gets a fresh memfd per frame which is sealed against writes
+ * and resizing before it is sent, so a client may keep a frame mapped as
+ * long as it likes without seeing it change.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <syslog.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <linux/videodev2.h>
+
+#include "frame_service.h"
+#include "memacct.h"
+#include "convert.h"
+
+// Small send buffers: a slow client holds a few frames, not a few hundred
+#define FS_SNDBUF       8192
+#define FS_BACKLOG      16
+
+/*
+ * Bytes of a frame in one of the served formats
+ *
+ * Parameters:
+ *   uint32_t pixelformat -> V4L2 fourcc
+ *   uint32_t width, height -> Geometry
+ *
+ * Returns:
+ *   Frame size, or 0 for an unsupported format
+ */
+size_t fs_frame_size(uint32_t pixelformat, uint32_t width, uint32_t height)
+{
+    switch (pixelformat)
+    {
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_UYVY:
+        return (size_t)width * height * 2;
+    case V4L2_PIX_FMT_RGB24:
+        return (size_t)width * height * 3;
+    case V4L2_PIX_FMT_GREY:
+        return (size_t)width * height;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Crop and convert the current frame into a view's buffer
+ *
+ * Parameters:
+ *   const struct frame_service *s -> The service (source geometry and format)
+ *   const struct fs_view *v -> Format and region
+ *   unsigned char *out -> v->size bytes
+ *
+ * Returns:
+ *   None
+ */
+static void convert(const struct frame_service *s, const struct fs_view *v, unsigned char *out)
+{
+    size_t stride = (size_t)s->width * 2;
+    const unsigned char *row;
+    uint32_t y;
+
+    for (y = 0; y < v->height; y++)
+    {
+        row = s->current + (v->y + y) * stride;
+        if (v->pixelformat == s->pixelformat)
+        {
+            memcpy(out, row + v->x * 2, (size_t)v->width * 2);
+            out += (size_t)v->width * 2;
+            continue;
+        }
+        // Same kernels as the recording path
+        if (v->pixelformat == V4L2_PIX_FMT_GREY)
+        {
+            cv_to_grey(row, v->x, v->width, s->pixelformat, out);
+            out += v->width;
+        }
+        else
+        {
+            cv_to_rgb24(row, v->x, v->width, s->pixelformat, out);
+            out += (size_t)v->width * 3;
+        }
+    }
+}
+
+/*
+ * Produce a view of the current frame as a sealed memfd
+ *
+ * Parameters:
+ *   const struct frame_service *s -> The service
+ *   struct fs_view *v -> View; v->memfd is set on success
+ *
+ * Returns:
+ *   0 on success, -1 with errno set on failure
+ */
+static int make_view(const struct frame_service *s, struct fs_view *v)
+{
+    void *map;
+    int fd, err;
+
+    fd = memfd_create("frame", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1)
+        return -1;
+    if (ftruncate(fd, v->size) == -1)
+        goto fail;
+    map = mmap(NULL, v->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        goto fail;
+    convert(s, v, map);
+    munmap(map, v->size);
+
+    // F_SEAL_WRITE needs the writable mapping gone
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1)
+        goto fail;
+    v->memfd = fd;
+    return 0;
+
+fail:
+    err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+}
+
+// fs_publish() reads the count to skip the copy when nobody listens
+static void set_subscribers(struct frame_service *s, int delta)
+{
+    pthread_mutex_lock(&s->lock);
+    s->subscribers += delta;
+    pthread_mutex_unlock(&s->lock);
+}
+
+/*
+ * Attach a client to the view matching its subscription
+ *
+ * Parameters:
+ *   struct frame_service *s -> The service
+ *   struct fs_client *c -> The client
+ *   const struct fs_subscribe *sub -> Requested format, rate and region
+ *   struct fs_reply *reply -> Effective format and region
+ *
+ * Returns:
+ *   0 on success, a negative errno for an unacceptable subscription
+ *   (the previous subscription stays in effect)
+ */
+static int subscribe(struct frame_service *s, struct fs_client *c, const struct fs_subscribe *sub,
+                     struct fs_reply *reply)
+{
+    uint32_t x = sub->roi_x, y = sub->roi_y, w = sub->roi_width, h = sub->roi_height;
+    bool raw = sub->pixelformat == s->pixelformat;
+    struct fs_view *v, *free_view = NULL;
+    unsigned int i;
+
+    if (sub->magic != FS_MAGIC)
+        return -EPROTO;
+    if (!raw && sub->pixelformat != V4L2_PIX_FMT_RGB24 && sub->pixelformat != V4L2_PIX_FMT_GREY)
+        return -EINVAL;
+    if (w == 0 || h == 0)
+    {
+        x = y = 0;
+        w = s->width;
+        h = s->height;
+    }
+    if (x >= s->width || y >= s->height)
+        return -EINVAL;
+    if (w > s->width - x)
+        w = s->width - x;
+    if (h > s->height - y)
+        h = s->height - y;
+    // Raw crops keep whole two-pixel groups
+    if (raw)
+    {
+        x &= ~1u;
+        w = (w + 1) & ~1u;
+        if (w > s->width - x)
+            w = s->width - x;
+    }
+
+    if (c->view >= 0)
+    {
+        s->views[c->view].users--;
+        c->view = -1;
+        set_subscribers(s, -1);
+    }
+    for (i = 0; i < FS_MAX_CLIENTS; i++)
+    {
+        v = &s->views[i];
+        if (v->users == 0)
+        {
+            if (!free_view)
+                free_view = v;
+            continue;
+        }
+        if (v->pixelformat == sub->pixelformat && v->x == x && v->y == y && v->width == w && v->height == h)
+            break;
+    }
+    if (i == FS_MAX_CLIENTS)
+    {
+        // There are as many views as clients, so one is always free
+        v = free_view;
+        v->pixelformat = sub->pixelformat;
+        v->x = x;
+        v->y = y;
+        v->width = w;
+        v->height = h;
+        v->size = fs_frame_size(sub->pixelformat, w, h);
+        v->memfd = -1;
+    }
+    v->users++;
+    c->view = v - s->views;
+    c->sub = *sub;
+    c->next_due_ns = 0;
+    set_subscribers(s, 1);
+
+    reply->pixelformat = v->pixelformat;
+    reply->width = w;
+    reply->height = h;
+    return 0;
+}
+
+/*
+ * Read a (re)subscription from a client
+ *
+ * Parameters:
+ *   struct frame_service *s -> The service
+ *   struct fs_client *c -> The client
+ *
+ * Returns:
+ *   0 to keep the client, -1 to disconnect it
+ */
+static int handle_request(struct frame_service *s, struct fs_client *c)
+{
+    struct fs_subscribe sub;
+    struct fs_reply reply;
+    ssize_t n;
+
+    n = recv(c->fd, &sub, sizeof(sub), MSG_DONTWAIT);
+    if (n == -1 && (errno == EAGAIN || errno == EINTR))
+        return 0;
+    if (n <= 0)
+        return -1;
+
+    memset(&reply, 0, sizeof(reply));
+    reply.magic = FS_MAGIC;
+    if (n != sizeof(sub))
+        reply.status = -EPROTO;
+    else
+        reply.status = subscribe(s, c, &sub, &reply);
+    if (send(c->fd, &reply, sizeof(reply), MSG_DONTWAIT | MSG_NOSIGNAL) != sizeof(reply))
+        return -1;
+    return 0;
+}
+
+static void remove_client(struct frame_service *s, unsigned int i)
+{
+    struct fs_client *c = &s->clients[i];
+
+    if (c->view >= 0)
+    {
+        s->views[c->view].users--;
+        set_subscribers(s, -1);
+    }
+    close(c->fd);
+    s->clients[i] = s->clients[--s->nclients];
+}
+
+static void accept_clients(struct frame_service *s)
+{
+    int fd, sndbuf = FS_SNDBUF;
+
+    while ((fd = accept4(s->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+    {
+        if (s->nclients == FS_MAX_CLIENTS)
+        {
+            close(fd);
+            continue;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+        s->clients[s->nclients].fd = fd;
+        s->clients[s->nclients].view = -1;
+        s->clients[s->nclients].dropped = 0;
+        s->nclients++;
+    }
+}
+
+/*
+ * Send one frame message with its memfd attached
+ *
+ * Parameters:
+ *   int sock -> Client socket
+ *   const struct fs_frame *f -> Frame message
+ *   int memfd -> Sealed frame
+ *
+ * Returns:
+ *   0 on success, -1 with errno set (EAGAIN: client is behind)
+ */
+static int send_frame(int sock, const struct fs_frame *f, int memfd)
+{
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+    struct iovec iov = { (void *)f, sizeof(*f) };
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+
+    return sendmsg(sock, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) == sizeof(*f) ? 0 : -1;
+}
+
+/*
+ * Deliver the pending frame to every client that is due one
+ *
+ * Parameters:
+ *   struct frame_service *s -> The service
+ *
+ * Returns:
+ *   None
+ */
+static void deliver(struct frame_service *s)
+{
+    struct fs_frame f;
+    struct fs_client *c;
+    struct fs_view *v;
+    unsigned char *swap;
+    int64_t interval;
+    unsigned int i, conversions = 0, delivered = 0, dropped = 0;
+
+    pthread_mutex_lock(&s->lock);
+    if (!s->pending)
+    {
+        pthread_mutex_unlock(&s->lock);
+        return;
+    }
+    swap = s->current;
+    s->current = s->incoming;
+    s->incoming = swap;
+    s->pending = false;
+    f.seq = s->seq;
+    f.timestamp_ns = s->timestamp_ns;
+    pthread_mutex_unlock(&s->lock);
+
+    f.magic = FS_MAGIC;
+    for (i = 0; i < s->nclients; i++)
+    {
+        c = &s->clients[i];
+        if (c->view < 0)
+            continue;
+
+        // Rate limit with a quarter interval of slack for capture jitter
+        if (c->sub.max_fps)
+        {
+            interval = 1000000000 / c->sub.max_fps;
+            if (f.timestamp_ns < c->next_due_ns - interval / 4)
+                continue;
+            c->next_due_ns = c->next_due_ns + interval < f.timestamp_ns ? f.timestamp_ns + interval
+                                                                          : c->next_due_ns + interval;
+        }
+
+        // Converted on first use, shared by everyone on the same view
+        v = &s->views[c->view];
+        if (v->memfd == -1)
+        {
+            if (make_view(s, v) == -1)
+            {
+                syslog(LOG_ERR, "frame service: cannot build frame: %s", strerror(errno));
+                continue;
+            }
+            conversions++;
+        }
+
+        f.pixelformat = v->pixelformat;
+        f.width = v->width;
+        f.height = v->height;
+        f.size = v->size;
+        f.dropped = c->dropped;
+        if (send_frame(c->fd, &f, v->memfd) == -1)
+        {
+            c->dropped++;
+            dropped++;
+        }
+        else
+            delivered++;
+    }
+
+    // Clients hold their own references to the memfds now
+    for (i = 0; i < FS_MAX_CLIENTS; i++)
+    {
+        if (s->views[i].users && s->views[i].memfd != -1)
+        {
+            close(s->views[i].memfd);
+            s->views[i].memfd = -1;
+        }
+    }
+
+    pthread_mutex_lock(&s->lock);
+    s->stats.conversions += conversions;
+    s->stats.delivered += delivered;
+    s->stats.dropped += dropped;
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void *service_thread(void *arg)
+{
+    struct frame_service *s = arg;
+    struct pollfd pfd[FS_MAX_CLIENTS + 2];
+    unsigned int i, n;
+    uint64_t v;
+
+    while (!s->stop)
+    {
+        pfd[0].fd = s->wake_fd;
+        pfd[0].events = POLLIN;
+        pfd[1].fd = s->listen_fd;
+        pfd[1].events = POLLIN;
+        n = s->nclients;
+        for (i = 0; i < n; i++)
+        {
+            pfd[i + 2].fd = s->clients[i].fd;
+            pfd[i + 2].events = POLLIN;
+        }
+        if (poll(pfd, n + 2, -1) == -1)
+            continue;
+
+        // Requests and hang-ups first; walk backwards since removal moves the last client
+        for (i = n; i-- > 0;)
+        {
+            if (pfd[i + 2].revents && handle_request(s, &s->clients[i]) == -1)
+                remove_client(s, i);
+        }
+        if (pfd[1].revents & POLLIN)
+            accept_clients(s);
+        if (pfd[0].revents & POLLIN)
+        {
+            if (read(s->wake_fd, &v, sizeof(v)) == -1 && errno != EAGAIN)
+                syslog(LOG_WARNING, "frame service: wakeup read failed: %s", strerror(errno));
+            deliver(s);
+        }
+
+        pthread_mutex_lock(&s->lock);
+        s->stats.clients = s->nclients;
+        pthread_mutex_unlock(&s->lock);
+    }
+    return NULL;
+}
+
+/*
+ * Start the frame service
+ *
+ * Parameters:
+ *   struct frame_service *s -> Service state
+ *   const char *path -> Socket path (replaced if it exists)
+ *   uint32_t width, height -> Geometry of the published frames
+ *   uint32_t pixelformat -> V4L2_PIX_FMT_YUYV or V4L2_PIX_FMT_UYVY
+ *
+ * Returns:
+ *   0 on success, -1 with errno set on failure
+ */
+int fs_start(struct frame_service *s, const char *path, uint32_t width, uint32_t height, uint32_t pixelformat)
+{
+    struct sockaddr_un addr;
+    int err;
+
+    memset(s, 0, sizeof(*s));
+    if ((pixelformat != V4L2_PIX_FMT_YUYV && pixelformat != V4L2_PIX_FMT_UYVY) || width < 2 || height == 0 ||
+        strlen(path) >= sizeof(addr.sun_path))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    strcpy(s->path, path);
+    s->width = width;
+    s->height = height;
+    s->pixelformat = pixelformat;
+    s->frame_size = fs_frame_size(pixelformat, width, height);
+    s->listen_fd = -1;
+    s->wake_fd = -1;
+
+    s->incoming = malloc(s->frame_size);
+    s->current = malloc(s->frame_size);
+    if (!s->incoming || !s->current)
+    {
+        errno = ENOMEM;
+        goto fail;
+    }
+    mem_charge(MEM_SERVICE, 2 * s->frame_size);
+
+    s->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    s->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (s->wake_fd == -1 || s->listen_fd == -1)
+        goto fail;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(s->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(s->listen_fd, FS_BACKLOG) == -1)
+        goto fail;
+
+    pthread_mutex_init(&s->lock, NULL);
+    err = pthread_create(&s->thread, NULL, service_thread, s);
+    if (err != 0)
+    {
+        pthread_mutex_destroy(&s->lock);
+        unlink(path);
+        errno = err;
+        goto fail;
+    }
+    return 0;
+
+fail:
+    err = errno;
+    if (s->listen_fd != -1)
+        close(s->listen_fd);
+    if (s->wake_fd != -1)
+        close(s->wake_fd);
+    if (s->incoming && s->current)
+        mem_release(MEM_SERVICE, 2 * s->frame_size);
+    free(s->incoming);
+    free(s->current);
+    errno = err;
+    return -1;
+}
+
+/*
+ * Offer a captured frame to the subscribers; called on the capture path
+ *
+ * Only copies the frame (and not even that without subscribers); all
+ * conversion and I/O happens on the service thread.
+ *
+ * Parameters:
+ *   struct frame_service *s -> The service
+ *   const void *frame -> Frame in the format given to fs_start()
+ *   size_t size -> Bytes in frame
+ *   const struct timespec *ts -> CLOCK_REALTIME capture time
+ *
+ * Returns:
+ *   None
+ */
+void fs_publish(struct frame_service *s, const void *frame, size_t size, const struct timespec *ts)
+{
+    uint64_t one = 1;
+
+    pthread_mutex_lock(&s->lock);
+    s->stats.published++;
+    if (s->subscribers == 0 || size < s->frame_size)
+    {
+        pthread_mutex_unlock(&s->lock);
+        return;
+    }
+    if (s->pending)
+        s->stats.skipped++;
+    memcpy(s->incoming, frame, s->frame_size);
+    s->seq = s->stats.published - 1;
+    s->timestamp_ns = (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+    s->pending = true;
+    pthread_mutex_unlock(&s->lock);
+
+    if (write(s->wake_fd, &one, sizeof(one)) == -1)
+        return;
+}
+
+/*
+ * Snapshot of the service counters
+ *
+ * Parameters:
+ *   struct frame_service *s -> The service
+ *   struct fs_stats *out -> Copy of the counters
+ *
+ * Returns:
+ *   None
+ */
+void fs_get_stats(struct frame_service *s, struct fs_stats *out)
+{
+    pthread_mutex_lock(&s->lock);
+    *out = s->stats;
+    pthread_mutex_unlock(&s->lock);
+}
+
+/*
+ * Stop the service, disconnect all clients and remove the socket
+ *
+ * Parameters:
+ *   struct frame_service *s -> The service
+ *
+ * Returns:
+ *   None
+ */
+void fs_stop(struct frame_service *s)
+{
+    uint64_t one = 1;
+
+    s->stop = true;
+    if (write(s->wake_fd, &one, sizeof(one)) == -1)
+        syslog(LOG_WARNING, "frame service: wakeup failed: %s", strerror(errno));
+    pthread_join(s->thread, NULL);
+
+    while (s->nclients)
+        remove_client(s, 0);
+    close(s->listen_fd);
+    close(s->wake_fd);
+    unlink(s->path);
+    pthread_mutex_destroy(&s->lock);
+    mem_release(MEM_SERVICE, 2 * s->frame_size);
+    free(s->incoming);
+    free(s->current);
+}
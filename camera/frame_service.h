@@ -0,0 +1,128 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Frame subscription service on a Unix domain socket
+ *
+ * Local clients connect to a SOCK_SEQPACKET socket and send one
+ * struct fs_subscribe naming the pixel format, maximum rate and region of
+ * interest they want; they can resubscribe at any time. The service
+ * answers with a struct fs_reply, then sends one struct fs_frame message
+ * per delivered frame with a sealed, read-only memfd holding the pixels
+ * attached as SCM_RIGHTS.
+ *
+ * Clients asking for the same format and region share a "view": it is
+ * converted at most once per frame, and only if some client is due a
+ * frame. A client that does not keep up loses frames (counted in
+ * fs_frame.dropped) instead of stalling the service or the camera.
+ */
+
+#ifndef FRAME_SERVICE_H
+#define FRAME_SERVICE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+
+#define FS_MAGIC        0x43565346u    // "FSVC"
+#define FS_MAX_CLIENTS  64
+
+// Client -> service
+struct fs_subscribe
+{
+    uint32_t magic;
+    uint32_t pixelformat;       // V4L2_PIX_FMT_YUYV, _RGB24 or _GREY
+    uint32_t max_fps;           // 0 for every frame
+    uint32_t roi_x;
+    uint32_t roi_y;
+    uint32_t roi_width;         // 0 for the full frame
+    uint32_t roi_height;
+};
+
+// Service -> client, answer to a subscription
+struct fs_reply
+{
+    uint32_t magic;
+    int32_t status;             // 0, or a negative errno
+    uint32_t pixelformat;
+    uint32_t width;             // Effective region after clamping/alignment
+    uint32_t height;
+};
+
+// Service -> client, one per frame; the memfd comes as SCM_RIGHTS
+struct fs_frame
+{
+    uint32_t magic;
+    uint32_t pixelformat;
+    uint32_t width;
+    uint32_t height;
+    uint64_t seq;
+    int64_t timestamp_ns;       // CLOCK_REALTIME of the capture
+    uint32_t size;              // Bytes in the memfd
+    uint32_t dropped;           // Frames this client missed so far
+};
+
+struct fs_stats
+{
+    uint64_t published;         // Frames handed to fs_publish()
+    uint64_t skipped;           // Replaced before the service got to them
+    uint64_t conversions;       // Views produced
+    uint64_t delivered;         // Frame messages sent
+    uint64_t dropped;           // Not sent because a client's socket was full
+    unsigned int clients;
+};
+
+struct fs_client
+{
+    int fd;
+    int view;                   // Index into views, -1 until subscribed
+    struct fs_subscribe sub;
+    int64_t next_due_ns;
+    uint32_t dropped;
+};
+
+// One format/region combination and its memfd for the current frame
+struct fs_view
+{
+    uint32_t pixelformat;
+    uint32_t x, y, width, height;
+    unsigned int users;
+    int memfd;                  // -1 until converted for the current frame
+    size_t size;
+};
+
+struct frame_service
+{
+    char path[108];
+    int listen_fd;
+    int wake_fd;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pixelformat;       // Of the published frames: YUYV or UYVY
+    size_t frame_size;
+    pthread_t thread;
+    volatile bool stop;
+
+    // Hand-over from the capture thread, double buffered under lock
+    pthread_mutex_t lock;
+    unsigned char *incoming;
+    unsigned char *current;
+    bool pending;
+    uint64_t seq;
+    int64_t timestamp_ns;
+    unsigned int subscribers;
+
+    struct fs_client clients[FS_MAX_CLIENTS];
+    unsigned int nclients;
+    struct fs_view views[FS_MAX_CLIENTS];
+    struct fs_stats stats;
+};
+
+int fs_start(struct frame_service *s, const char *path, uint32_t width, uint32_t height, uint32_t pixelformat);
+void fs_publish(struct frame_service *s, const void *frame, size_t size, const struct timespec *ts);
+void fs_get_stats(struct frame_service *s, struct fs_stats *out);
+void fs_stop(struct frame_service *s);
+
+size_t fs_frame_size(uint32_t pixelformat, uint32_t width, uint32_t height);
+
+#endif
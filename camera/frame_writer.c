@@ -0,0 +1,325 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Aligned frame writer (O_DIRECT with buffered fallback)
+ *
+ * O_DIRECT requires the user buffer, the file offset and the transfer
+ * length to be multiples of the logical block size. Frames are copied
+ * into a block-aligned staging buffer and written out one full buffer at
+ * a time; the tail is zero padded on close and the file is truncated
+ * back to its logical length, which also returns any space reserved with
+ * fw_preallocate() that was not used.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "frame_writer.h"
+#include "memacct.h"
+
+#define ROUND_UP(x, a) ((((x) + (a) - 1) / (a)) * (a))
+
+/*
+ * Write the whole buffer, restarting on EINTR and short writes
+ *
+ * Parameters:
+ *   int fd -> Destination file descriptor
+ *   const void *p -> Data to write
+ *   size_t size -> Number of bytes to write
+ *
+ * Returns:
+ *   0 on success, -1 with errno set on failure (ENOSPC if the device
+ *   stopped accepting data)
+ */
+static int write_all(int fd, const void *p, size_t size)
+{
+    const unsigned char *ptr = p;
+    ssize_t written;
+
+    while (size > 0)
+    {
+        written = write(fd, ptr, size);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (written == 0)
+        {
+            errno = ENOSPC;
+            return -1;
+        }
+        ptr += written;
+        size -= written;
+    }
+    return 0;
+}
+
+/*
+ * Drop O_DIRECT on the writer after the filesystem refused a direct write
+ *
+ * Parameters:
+ *   struct frame_writer *w -> The writer
+ *
+ * Returns:
+ *   0 on success, -1 if the descriptor flags could not be changed
+ */
+static int fallback_to_buffered(struct frame_writer *w)
+{
+    int flags = fcntl(w->fd, F_GETFL);
+
+    if (flags == -1 || fcntl(w->fd, F_SETFL, flags & ~O_DIRECT) == -1)
+        return -1;
+    w->direct = false;
+    return 0;
+}
+
+/*
+ * Write n bytes from p, falling back to buffered I/O on EINVAL
+ *
+ * Parameters:
+ *   struct frame_writer *w -> The writer
+ *   const void *p -> Block-aligned data (when direct)
+ *   size_t n -> Number of bytes, a multiple of the block size (when direct)
+ *   off_t off -> File offset the data starts at
+ *
+ * Returns:
+ *   0 on success, -1 with errno set on failure
+ */
+static int fw_emit(struct frame_writer *w, const void *p, size_t n, off_t off)
+{
+    if (write_all(w->fd, p, n) == 0)
+        return 0;
+
+    // Some filesystems accept O_DIRECT at open time and only fail the I/O
+    if (w->direct && errno == EINVAL)
+    {
+        if (fallback_to_buffered(w) == 0 && lseek(w->fd, off, SEEK_SET) == off)
+            return write_all(w->fd, p, n);
+        errno = EINVAL;
+    }
+    return -1;
+}
+
+/*
+ * Open a file for frame writing
+ *
+ * Parameters:
+ *   struct frame_writer *w -> Writer state to initialise
+ *   const char *path -> File to create (truncated if it exists)
+ *   bool direct -> Try O_DIRECT; buffered I/O is used if it is rejected
+ *   size_t stage_size -> Bytes staged per write (0 for FW_STAGE_SIZE),
+ *                        rounded up to the block size
+ *
+ * Returns:
+ *   0 on success, -1 with errno set on failure
+ */
+int fw_open(struct frame_writer *w, const char *path, bool direct, size_t stage_size)
+{
+    struct stat st;
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+    memset(w, 0, sizeof(*w));
+    w->fd = -1;
+
+    if (direct)
+    {
+        w->fd = open(path, flags | O_DIRECT, 00666);
+        w->direct = (w->fd != -1);
+    }
+    if (w->fd == -1)
+        w->fd = open(path, flags, 00666);
+    if (w->fd == -1)
+        return -1;
+
+    // st_blksize is a multiple of the logical block size on every Linux filesystem
+    w->align = 4096;
+    if (fstat(w->fd, &st) == 0 && st.st_blksize >= 512 && (st.st_blksize & (st.st_blksize - 1)) == 0)
+        w->align = st.st_blksize;
+
+    w->stage_cap = ROUND_UP(stage_size ? stage_size : FW_STAGE_SIZE, w->align);
+    if (posix_memalign((void **)&w->stage, w->align, w->stage_cap) != 0)
+    {
+        close(w->fd);
+        w->fd = -1;
+        errno = ENOMEM;
+        return -1;
+    }
+    mem_charge(MEM_WRITER, w->stage_cap);
+    return 0;
+}
+
+/*
+ * Append data to the file
+ *
+ * Data is staged until a full staging buffer can be written. Block
+ * aligned input that arrives while the stage is empty bypasses the copy.
+ *
+ * Parameters:
+ *   struct frame_writer *w -> The writer
+ *   const void *p -> Data to append
+ *   size_t size -> Number of bytes
+ *
+ * Returns:
+ *   0 on success, -1 with errno set on failure
+ */
+int fw_write(struct frame_writer *w, const void *p, size_t size)
+{
+    const unsigned char *src = p;
+    size_t chunk;
+
+    while (size > 0)
+    {
+        if (w->stage_len == 0 && size >= w->align && ((uintptr_t)src % w->align) == 0)
+        {
+            chunk = size - (size % w->align);
+            if (fw_emit(w, src, chunk, w->length) == -1)
+                return -1;
+            w->length += chunk;
+            src += chunk;
+            size -= chunk;
+            continue;
+        }
+
+        chunk = w->stage_cap - w->stage_len;
+        if (chunk > size)
+            chunk = size;
+        memcpy(w->stage + w->stage_len, src, chunk);
+        w->stage_len += chunk;
+        w->length += chunk;
+        src += chunk;
+        size -= chunk;
+
+        if (w->stage_len == w->stage_cap)
+        {
+            if (fw_emit(w, w->stage, w->stage_cap, w->length - w->stage_cap) == -1)
+                return -1;
+            w->stage_len = 0;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Hand everything staged so far to the kernel without closing the file
+ *
+ * With O_DIRECT the partial block is written zero padded and kept in the
+ * stage; the file position is rewound so the next full write replaces it.
+ * Readers must therefore tolerate zero bytes past the logical length.
+ *
+ * Parameters:
+ *   struct frame_writer *w -> The writer
+ *
+ * Returns:
+ *   0 on success, -1 with errno set on failure
+ */
+int fw_flush(struct frame_writer *w)
+{
+    off_t start = w->length - w->stage_len;
+    size_t tail;
+
+    if (w->stage_len == 0)
+        return 0;
+
+    if (!w->direct)
+    {
+        if (fw_emit(w, w->stage, w->stage_len, start) == -1)
+            return -1;
+        w->stage_len = 0;
+        return 0;
+    }
+
+    tail = ROUND_UP(w->stage_len, w->align);
+    memset(w->stage + w->stage_len, 0, tail - w->stage_len);
+    if (fw_emit(w, w->stage, tail, start) == -1)
+        return -1;
+
+    // A fallback to buffered I/O inside fw_emit wrote the stage out for good
+    if (!w->direct)
+    {
+        if (ftruncate(w->fd, w->length) == -1 || lseek(w->fd, w->length, SEEK_SET) == -1)
+            return -1;
+        w->stage_len = 0;
+        return 0;
+    }
+    return lseek(w->fd, start, SEEK_SET) == -1 ? -1 : 0;
+}
+
+/*
+ * Reserve space for the file without changing its size
+ *
+ * Parameters:
+ *   struct frame_writer *w -> The writer
+ *   off_t size -> Bytes to reserve from the start of the file
+ *
+ * Returns:
+ *   0 on success, -1 with errno set on failure (EOPNOTSUPP, ENOSYS: the
+ *   filesystem cannot reserve space, which is harmless)
+ */
+int fw_preallocate(struct frame_writer *w, off_t size)
+{
+    if (fallocate(w->fd, FALLOC_FL_KEEP_SIZE, 0, size) == -1)
+        return -1;
+    w->preallocated = true;
+    return 0;
+}
+
+/*
+ * Flush the padded tail, trim the file to its logical length and close it
+ *
+ * Parameters:
+ *   struct frame_writer *w -> The writer
+ *
+ * Returns:
+ *   0 on success, -1 with errno set if any step failed (the descriptor
+ *   is closed either way)
+ */
+int fw_close(struct frame_writer *w)
+{
+    int ret = 0, saved_errno = 0;
+    size_t tail;
+
+    if (w->fd == -1)
+        return 0;
+
+    if (w->stage_len > 0)
+    {
+        tail = w->direct ? ROUND_UP(w->stage_len, w->align) : w->stage_len;
+        memset(w->stage + w->stage_len, 0, tail - w->stage_len);
+        if (fw_emit(w, w->stage, tail, w->length - w->stage_len) == -1 ||
+            ftruncate(w->fd, w->length) == -1)
+        {
+            ret = -1;
+            saved_errno = errno;
+        }
+        w->stage_len = 0;
+    }
+    // Even with nothing left to write, the unused reservation is released
+    else if (w->preallocated && ftruncate(w->fd, w->length) == -1)
+    {
+        ret = -1;
+        saved_errno = errno;
+    }
+
+    if (close(w->fd) == -1 && ret == 0)
+    {
+        ret = -1;
+        saved_errno = errno;
+    }
+    w->fd = -1;
+    if (w->stage)
+        mem_release(MEM_WRITER, w->stage_cap);
+    free(w->stage);
+    w->stage = NULL;
+
+    if (ret == -1)
+        errno = saved_errno;
+    return ret;
+}
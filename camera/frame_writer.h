@@ -0,0 +1,39 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Aligned frame writer
+ *
+ * Frames are staged in a block-aligned buffer and written with O_DIRECT
+ * in multiples of the device block size so that recording does not
+ * push the rest of the system out of the page cache. Filesystems that
+ * reject O_DIRECT (tmpfs, some FUSE mounts) fall back to buffered I/O.
+ */
+
+#ifndef FRAME_WRITER_H
+#define FRAME_WRITER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// Default staging buffer size, rounded up to the block size on open
+#define FW_STAGE_SIZE   (256 * 1024)
+
+struct frame_writer
+{
+    int fd;
+    bool direct;            // O_DIRECT is active on fd
+    size_t align;           // Block size every direct write is a multiple of
+    unsigned char *stage;   // Block-aligned staging buffer
+    size_t stage_cap;
+    size_t stage_len;
+    off_t length;           // Logical number of bytes written so far
+    bool preallocated;      // Space was reserved past the end: trimmed on close
+};
+
+int fw_open(struct frame_writer *w, const char *path, bool direct, size_t stage_size);
+int fw_write(struct frame_writer *w, const void *p, size_t size);
+int fw_flush(struct frame_writer *w);
+int fw_preallocate(struct frame_writer *w, off_t size);
+int fw_close(struct frame_writer *w);
+
+#endif
@@ -0,0 +1,460 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Baseline JPEG encoder for packed 4:2:2 frames
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <linux/videodev2.h>
+
+#include "jpeg.h"
+
+// Natural (row-major) index of the k-th coefficient in zigzag order
+static const uint8_t zigzag[64] = {
+    0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6,  7,  14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+// Annex K quantisation tables, natural order
+static const uint8_t base_qtable[2][64] = {
+    {
+        16, 11, 10, 16, 24,  40,  51,  61,
+        12, 12, 14, 19, 26,  58,  60,  55,
+        14, 13, 16, 24, 40,  57,  69,  56,
+        14, 17, 22, 29, 51,  87,  80,  62,
+        18, 22, 37, 56, 68,  109, 103, 77,
+        24, 35, 55, 64, 81,  104, 113, 92,
+        49, 64, 78, 87, 103, 121, 120, 101,
+        72, 92, 95, 98, 112, 100, 103, 99,
+    },
+    {
+        17, 18, 24, 47, 99, 99, 99, 99,
+        18, 21, 26, 66, 99, 99, 99, 99,
+        24, 26, 56, 99, 99, 99, 99, 99,
+        47, 66, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+    },
+};
+
+// Annex K Huffman tables: code counts per length 1..16, then the symbols
+static const uint8_t dc_bits[2][16] = {
+    { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 },
+};
+static const uint8_t dc_values[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+static const uint8_t ac_bits[2][16] = {
+    { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d },
+    { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 },
+};
+static const uint8_t ac_values[2][162] = {
+    {
+        0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+        0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+        0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+        0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+        0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+        0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+        0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+        0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+        0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+        0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+        0xf9, 0xfa,
+    },
+    {
+        0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+        0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+        0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+        0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+        0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+        0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+        0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+        0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+        0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+        0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+        0xf9, 0xfa,
+    },
+};
+
+// Output scale of the AAN transform per frequency: cos(k * pi / 16) * sqrt(2), 1 for k = 0
+static const float aan_scale[8] = {
+    1.0f, 1.387039845f, 1.306562965f, 1.175875602f, 1.0f, 0.785694958f, 0.541196100f, 0.275899379f,
+};
+
+// Entropy-coded segment being written, 0xff bytes stuffed
+struct bit_writer
+{
+    uint8_t *p;
+    uint8_t *end;
+    uint32_t acc;
+    int n;                      // Bits pending in acc, below 8 between calls
+    bool overflow;
+};
+
+/*
+ * Assign the canonical codes of a table given as counts per length
+ */
+static void build_huffman(struct jpeg_huffman *h, const uint8_t *bits, const uint8_t *values)
+{
+    unsigned int len, i, k = 0;
+    uint16_t code = 0;
+
+    memset(h, 0, sizeof(*h));
+    for (len = 1; len <= 16; len++)
+    {
+        for (i = 0; i < bits[len - 1]; i++, k++, code++)
+        {
+            h->code[values[k]] = code;
+            h->size[values[k]] = len;
+        }
+        code <<= 1;
+    }
+}
+
+/*
+ * Set up an encoder for one frame geometry and quality
+ *
+ * Parameters:
+ *   struct jpeg_encoder *e -> Encoder to initialise
+ *   uint32_t width, height -> Frame geometry in pixels (width even, at most 65535 each)
+ *   uint32_t pixelformat -> V4L2_PIX_FMT_YUYV or V4L2_PIX_FMT_UYVY
+ *   unsigned int quality -> 1..100
+ *
+ * Returns:
+ *   0 on success, -1 with errno set to EINVAL
+ */
+int jpeg_init(struct jpeg_encoder *e, uint32_t width, uint32_t height, uint32_t pixelformat, unsigned int quality)
+{
+    unsigned int t, k, scale;
+    int v;
+
+    memset(e, 0, sizeof(*e));
+    if ((pixelformat != V4L2_PIX_FMT_YUYV && pixelformat != V4L2_PIX_FMT_UYVY) || width < 2 || width % 2 ||
+        height < 1 || width > 65535 || height > 65535 || quality < 1 || quality > 100)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    e->width = width;
+    e->height = height;
+    e->y_offset = (pixelformat == V4L2_PIX_FMT_UYVY) ? 1 : 0;
+    e->quality = quality;
+
+    scale = quality < 50 ? 5000 / quality : 200 - 2 * quality;
+    for (t = 0; t < 2; t++)
+    {
+        for (k = 0; k < 64; k++)
+        {
+            v = (base_qtable[t][zigzag[k]] * scale + 50) / 100;
+            v = v < 1 ? 1 : v > 255 ? 255 : v;
+            e->qtable[t][k] = v;
+            e->divisor[t][zigzag[k]] = 1.0f / (v * aan_scale[zigzag[k] / 8] * aan_scale[zigzag[k] % 8] * 8);
+        }
+        build_huffman(&e->dc[t], dc_bits[t], dc_values);
+        build_huffman(&e->ac[t], ac_bits[t], ac_values[t]);
+    }
+
+    // Studio range (16..235, 16..240) to full range, minus the 128 level shift of the DCT input
+    for (k = 0; k < 256; k++)
+    {
+        v = ((int)k - 16) * 255 / 219;
+        e->ylevel[k] = (v < 0 ? 0 : v > 255 ? 255 : v) - 128;
+        v = ((int)k - 128) * 255 / 224;
+        e->clevel[k] = v < -128 ? -128 : v > 127 ? 127 : v;
+    }
+    return 0;
+}
+
+/*
+ * Output buffer size that holds any frame of the encoder's geometry
+ *
+ * Parameters:
+ *   const struct jpeg_encoder *e -> The encoder
+ *
+ * Returns:
+ *   Bytes
+ */
+size_t jpeg_bound(const struct jpeg_encoder *e)
+{
+    // Quality 100 on noise stays well below 4 bytes per pixel; headers and tables are about 600 bytes
+    return (size_t)((e->width + 15) & ~15u) * ((e->height + 7) & ~7u) * 4 + 1024;
+}
+
+static inline void put_byte(struct bit_writer *b, uint8_t v)
+{
+    if (b->end - b->p < 2)
+    {
+        b->overflow = true;
+        return;
+    }
+    *b->p++ = v;
+    if (v == 0xff)
+        *b->p++ = 0;
+}
+
+static inline void put_bits(struct bit_writer *b, uint32_t code, int len)
+{
+    b->acc = (b->acc << len) | code;
+    b->n += len;
+    while (b->n >= 8)
+    {
+        b->n -= 8;
+        put_byte(b, b->acc >> b->n);
+    }
+    b->acc &= (1u << b->n) - 1;
+}
+
+// Huffman code of a symbol, then the value's magnitude category bits
+static inline void put_coefficient(struct bit_writer *b, const struct jpeg_huffman *h, unsigned int run, int v)
+{
+    unsigned int mag = v < 0 ? -v : v, cat = 0, sym;
+
+    while (mag >> cat)
+        cat++;
+    sym = (run << 4) | cat;
+    put_bits(b, h->code[sym], h->size[sym]);
+    if (cat)
+        put_bits(b, (v < 0 ? v - 1 : v) & ((1u << cat) - 1), cat);
+}
+
+/*
+ * AAN forward DCT of an 8x8 block in place, outputs scaled by 8 * aan_scale[u] * aan_scale[v]
+ */
+static void fdct(float *d)
+{
+    float t0, t1, t2, t3, t4, t5, t6, t7, t10, t11, t12, t13, z1, z2, z3, z4, z5, z11, z13;
+    float *p;
+    unsigned int i, step, stride;
+
+    // Rows, then columns: element stride 1 and row stride 8, then the other way round
+    for (stride = 1, step = 8; stride <= 8; stride *= 8, step /= 8)
+    {
+        for (p = d, i = 0; i < 8; i++, p += step)
+        {
+            t0 = p[0] + p[7 * stride];
+            t7 = p[0] - p[7 * stride];
+            t1 = p[stride] + p[6 * stride];
+            t6 = p[stride] - p[6 * stride];
+            t2 = p[2 * stride] + p[5 * stride];
+            t5 = p[2 * stride] - p[5 * stride];
+            t3 = p[3 * stride] + p[4 * stride];
+            t4 = p[3 * stride] - p[4 * stride];
+
+            // Even part
+            t10 = t0 + t3;
+            t13 = t0 - t3;
+            t11 = t1 + t2;
+            t12 = t1 - t2;
+            p[0] = t10 + t11;
+            p[4 * stride] = t10 - t11;
+            z1 = (t12 + t13) * 0.707106781f;
+            p[2 * stride] = t13 + z1;
+            p[6 * stride] = t13 - z1;
+
+            // Odd part
+            t10 = t4 + t5;
+            t11 = t5 + t6;
+            t12 = t6 + t7;
+            z5 = (t10 - t12) * 0.382683433f;
+            z2 = 0.541196100f * t10 + z5;
+            z4 = 1.306562965f * t12 + z5;
+            z3 = t11 * 0.707106781f;
+            z11 = t7 + z3;
+            z13 = t7 - z3;
+            p[5 * stride] = z13 + z2;
+            p[3 * stride] = z13 - z2;
+            p[stride] = z11 + z4;
+            p[7 * stride] = z11 - z4;
+        }
+    }
+}
+
+/*
+ * Transform, quantise and entropy code one block
+ */
+static void encode_block(struct bit_writer *b, float *block, const float *divisor, int *dc,
+                         const struct jpeg_huffman *dct, const struct jpeg_huffman *act)
+{
+    unsigned int k, run = 0;
+    float f;
+    int v;
+
+    fdct(block);
+    f = block[0] * divisor[0];
+    v = (int)(f < 0 ? f - 0.5f : f + 0.5f);
+    put_coefficient(b, dct, 0, v - *dc);
+    *dc = v;
+
+    for (k = 1; k < 64; k++)
+    {
+        f = block[zigzag[k]] * divisor[zigzag[k]];
+        v = (int)(f < 0 ? f - 0.5f : f + 0.5f);
+        if (v == 0)
+        {
+            run++;
+            continue;
+        }
+        for (; run >= 16; run -= 16)
+            put_bits(b, act->code[0xf0], act->size[0xf0]);
+        put_coefficient(b, act, run, v);
+        run = 0;
+    }
+    if (run)
+        put_bits(b, act->code[0x00], act->size[0x00]);
+}
+
+static uint8_t *put_marker(uint8_t *p, uint8_t marker, unsigned int length)
+{
+    *p++ = 0xff;
+    *p++ = marker;
+    *p++ = length >> 8;
+    *p++ = length & 0xff;
+    return p;
+}
+
+static uint8_t *put_huffman(uint8_t *p, uint8_t id, const uint8_t *bits, const uint8_t *values)
+{
+    unsigned int i, n = 0;
+
+    *p++ = id;
+    for (i = 0; i < 16; i++)
+        n += *p++ = bits[i];
+    memcpy(p, values, n);
+    return p + n;
+}
+
+/*
+ * Marker segments up to and including the start of scan
+ */
+static uint8_t *put_headers(const struct jpeg_encoder *e, uint8_t *p, const char *comment)
+{
+    static const uint8_t jfif[] = { 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+    static const uint8_t sos[] = { 3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0 };
+    size_t n;
+
+    *p++ = 0xff;
+    *p++ = 0xd8;
+    p = put_marker(p, 0xe0, 2 + sizeof(jfif));
+    memcpy(p, jfif, sizeof(jfif));
+    p += sizeof(jfif);
+
+    if (comment && (n = strnlen(comment, JPEG_MAX_COMMENT)) > 0)
+    {
+        p = put_marker(p, 0xfe, 2 + n);
+        memcpy(p, comment, n);
+        p += n;
+    }
+
+    p = put_marker(p, 0xdb, 2 + 2 * 65);
+    *p++ = 0;
+    memcpy(p, e->qtable[0], 64);
+    p += 64;
+    *p++ = 1;
+    memcpy(p, e->qtable[1], 64);
+    p += 64;
+
+    // Baseline, 8-bit, three components: luma sampled 2x1 with table 0, Cb and Cr 1x1 with table 1
+    p = put_marker(p, 0xc0, 17);
+    *p++ = 8;
+    *p++ = e->height >> 8;
+    *p++ = e->height & 0xff;
+    *p++ = e->width >> 8;
+    *p++ = e->width & 0xff;
+    *p++ = 3;
+    *p++ = 1, *p++ = 0x21, *p++ = 0;
+    *p++ = 2, *p++ = 0x11, *p++ = 1;
+    *p++ = 3, *p++ = 0x11, *p++ = 1;
+
+    p = put_marker(p, 0xc4, 2 + 4 * 17 + 2 * sizeof(dc_values) + 2 * sizeof(ac_values[0]));
+    p = put_huffman(p, 0x00, dc_bits[0], dc_values);
+    p = put_huffman(p, 0x10, ac_bits[0], ac_values[0]);
+    p = put_huffman(p, 0x01, dc_bits[1], dc_values);
+    p = put_huffman(p, 0x11, ac_bits[1], ac_values[1]);
+
+    p = put_marker(p, 0xda, 2 + sizeof(sos));
+    memcpy(p, sos, sizeof(sos));
+    return p + sizeof(sos);
+}
+
+/*
+ * Encode one frame as a baseline JFIF file
+ *
+ * Parameters:
+ *   const struct jpeg_encoder *e -> Encoder set up for the frame's geometry
+ *   const uint8_t *frame -> Packed 4:2:2 frame, rows contiguous
+ *   const char *comment -> Text of a COM segment (truncated to JPEG_MAX_COMMENT), NULL for none
+ *   uint8_t *out -> Output buffer
+ *   size_t size -> Its size, jpeg_bound() is always enough
+ *
+ * Returns:
+ *   Bytes written, 0 with errno set to ENOSPC if out was too small
+ */
+size_t jpeg_encode(const struct jpeg_encoder *e, const uint8_t *frame, const char *comment, uint8_t *out,
+                   size_t size)
+{
+    float block[4][64];
+    const uint8_t *row;
+    struct bit_writer b;
+    uint32_t mx, my, x, y, cx, half = e->width / 2;
+    unsigned int r, c, yo = e->y_offset, co = 1 - yo;
+    int dc[3] = { 0, 0, 0 };
+
+    if (size < 1024)
+    {
+        errno = ENOSPC;
+        return 0;
+    }
+    b.p = put_headers(e, out, comment);
+    b.end = out + size - 2;
+    b.acc = 0;
+    b.n = 0;
+    b.overflow = false;
+
+    for (my = 0; my < e->height; my += 8)
+    {
+        for (mx = 0; mx < e->width && !b.overflow; mx += 16)
+        {
+            // Two luma blocks side by side, then Cb and Cr of the same 16x8 pixels
+            for (r = 0; r < 8; r++)
+            {
+                y = my + r < e->height ? my + r : e->height - 1;
+                row = frame + (size_t)y * e->width * 2;
+                for (c = 0; c < 16; c++)
+                {
+                    x = mx + c < e->width ? mx + c : e->width - 1;
+                    block[c / 8][r * 8 + c % 8] = e->ylevel[row[2 * x + yo]];
+                }
+                for (c = 0; c < 8; c++)
+                {
+                    cx = mx / 2 + c < half ? mx / 2 + c : half - 1;
+                    block[2][r * 8 + c] = e->clevel[row[4 * cx + co]];
+                    block[3][r * 8 + c] = e->clevel[row[4 * cx + co + 2]];
+                }
+            }
+            encode_block(&b, block[0], e->divisor[0], &dc[0], &e->dc[0], &e->ac[0]);
+            encode_block(&b, block[1], e->divisor[0], &dc[0], &e->dc[0], &e->ac[0]);
+            encode_block(&b, block[2], e->divisor[1], &dc[1], &e->dc[1], &e->ac[1]);
+            encode_block(&b, block[3], e->divisor[1], &dc[2], &e->dc[1], &e->ac[1]);
+        }
+    }
+
+    // Pad the last byte with ones, then end of image
+    if (b.n)
+        put_bits(&b, (1u << (8 - b.n)) - 1, 8 - b.n);
+    if (b.overflow)
+    {
+        errno = ENOSPC;
+        return 0;
+    }
+    *b.p++ = 0xff;
+    *b.p++ = 0xd9;
+    return b.p - out;
+}
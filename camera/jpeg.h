@@ -0,0 +1,56 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Baseline JPEG encoder for packed 4:2:2 frames
+ *
+ * The capture format is already YCbCr 4:2:2, which is one of the sampling
+ * layouts baseline JPEG stores natively (luma H2V1, one chroma sample per
+ * two pixels), so frames are encoded straight from the raw stream with no
+ * RGB round trip: each 16x8 MCU is two luma blocks plus one Cb and one Cr
+ * block gathered from the macropixels. Samples are stretched from the
+ * camera's studio range to the full range JFIF decoders assume, so a
+ * decoded JPEG has the same colours as the PPM of the frame.
+ *
+ * The forward DCT is the separable AAN float transform with its output
+ * scaling folded into the quantiser, and entropy coding uses the example
+ * Huffman tables of the standard (Annex K), so no second pass over the
+ * coefficients is needed. Quality scales the Annex K quantisation tables
+ * as the IJG library does, 50 giving the tables as printed. Frames whose
+ * width or height is not a multiple of the MCU are padded by repeating
+ * the last column and row.
+ */
+
+#ifndef JPEG_H
+#define JPEG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define JPEG_QUALITY    85      // Default quality, 1..100
+#define JPEG_MAX_COMMENT 64     // Longest COM segment text
+
+struct jpeg_huffman
+{
+    uint16_t code[256];
+    uint8_t size[256];
+};
+
+struct jpeg_encoder
+{
+    uint32_t width;
+    uint32_t height;
+    unsigned int y_offset;      // Byte of the first luma sample in a macropixel (0 YUYV, 1 UYVY)
+    unsigned int quality;
+    uint8_t qtable[2][64];      // Luma and chroma quantisers, zigzag order as stored in the file
+    float divisor[2][64];       // Reciprocal quantisers with the DCT scaling, natural order
+    float ylevel[256];          // Studio to full range, level shifted
+    float clevel[256];
+    struct jpeg_huffman dc[2];
+    struct jpeg_huffman ac[2];
+};
+
+int jpeg_init(struct jpeg_encoder *e, uint32_t width, uint32_t height, uint32_t pixelformat, unsigned int quality);
+size_t jpeg_bound(const struct jpeg_encoder *e);
+size_t jpeg_encode(const struct jpeg_encoder *e, const uint8_t *frame, const char *comment, uint8_t *out,
+                   size_t size);
+
+#endif
@@ -0,0 +1,231 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Memory accounting and budget enforcement
+ *
+ * Shrinkers run on whichever thread calls mem_enforce(); the capture
+ * loop calls it between frames, where no capture buffer is in use, so
+ * a shrinker may even re-size the V4L2 queue.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <pthread.h>
+
+#include "memacct.h"
+
+static uint64_t current[MEM_COUNT];
+static uint64_t peak[MEM_COUNT];
+static uint64_t total, total_peak, budget;
+static unsigned int shrinks;
+
+static pthread_mutex_t shrink_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct
+{
+    const char *name;
+    mem_shrink_fn fn;
+    void *arg;
+} shrinkers[MEM_MAX_SHRINKERS];
+static unsigned int nshrinkers;
+static bool over_reported = false;
+
+static const char *const category_names[MEM_COUNT] = {
+    [MEM_V4L2] = "v4l2",
+    [MEM_CONVERT] = "convert",
+    [MEM_WRITER] = "writer",
+    [MEM_INDEX] = "index",
+    [MEM_ANALYSIS] = "analysis",
+    [MEM_SERVICE] = "service",
+    [MEM_STREAM] = "stream",
+};
+
+static void raise_peak(uint64_t *p, uint64_t v)
+{
+    uint64_t seen = __atomic_load_n(p, __ATOMIC_RELAXED);
+
+    while (v > seen && !__atomic_compare_exchange_n(p, &seen, v, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/*
+ * Charge an allocation to a category
+ *
+ * Parameters:
+ *   enum mem_category c -> Owner of the memory
+ *   size_t bytes -> Size allocated
+ *
+ * Returns:
+ *   None
+ */
+void mem_charge(enum mem_category c, size_t bytes)
+{
+    raise_peak(&peak[c], __atomic_add_fetch(&current[c], bytes, __ATOMIC_RELAXED));
+    raise_peak(&total_peak, __atomic_add_fetch(&total, bytes, __ATOMIC_RELAXED));
+}
+
+/*
+ * Release a charge made with mem_charge()
+ *
+ * Parameters:
+ *   enum mem_category c -> Owner of the memory
+ *   size_t bytes -> Size freed
+ *
+ * Returns:
+ *   None
+ */
+void mem_release(enum mem_category c, size_t bytes)
+{
+    __atomic_sub_fetch(&current[c], bytes, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&total, bytes, __ATOMIC_RELAXED);
+}
+
+/*
+ * Set the budget mem_enforce() keeps usage under
+ *
+ * Parameters:
+ *   uint64_t bytes -> Budget, 0 for none
+ *
+ * Returns:
+ *   None
+ */
+void mem_set_budget(uint64_t bytes)
+{
+    __atomic_store_n(&budget, bytes, __ATOMIC_RELAXED);
+}
+
+/*
+ * Register a shrinker; earlier registrations are asked first
+ *
+ * Parameters:
+ *   const char *name -> For the log
+ *   mem_shrink_fn fn -> Releases optional memory
+ *   void *arg -> Passed to fn
+ *
+ * Returns:
+ *   0 on success, -1 with errno set to ENOSPC when the table is full
+ */
+int mem_register_shrinker(const char *name, mem_shrink_fn fn, void *arg)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&shrink_lock);
+    if (nshrinkers == MEM_MAX_SHRINKERS)
+    {
+        errno = ENOSPC;
+        ret = -1;
+    }
+    else
+    {
+        shrinkers[nshrinkers].name = name;
+        shrinkers[nshrinkers].fn = fn;
+        shrinkers[nshrinkers].arg = arg;
+        nshrinkers++;
+    }
+    pthread_mutex_unlock(&shrink_lock);
+    return ret;
+}
+
+/*
+ * Remove a shrinker before the memory it manages goes away
+ *
+ * Parameters:
+ *   mem_shrink_fn fn, void *arg -> As registered
+ *
+ * Returns:
+ *   None
+ */
+void mem_unregister_shrinker(mem_shrink_fn fn, void *arg)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&shrink_lock);
+    for (i = 0; i < nshrinkers; i++)
+    {
+        if (shrinkers[i].fn == fn && shrinkers[i].arg == arg)
+        {
+            memmove(&shrinkers[i], &shrinkers[i + 1], (nshrinkers - i - 1) * sizeof(shrinkers[0]));
+            nshrinkers--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&shrink_lock);
+}
+
+/*
+ * Shrink optional memory while usage is over budget
+ *
+ * Cheap when under budget: two relaxed loads. Safe to call on every
+ * frame.
+ *
+ * Parameters:
+ *   None
+ *
+ * Returns:
+ *   None
+ */
+void mem_enforce(void)
+{
+    uint64_t limit = __atomic_load_n(&budget, __ATOMIC_RELAXED);
+    uint64_t used = __atomic_load_n(&total, __ATOMIC_RELAXED);
+    unsigned int i;
+    size_t freed;
+
+    if (limit == 0 || used <= limit)
+    {
+        over_reported = false;
+        return;
+    }
+
+    // A shrinker charging or releasing memory must not recurse into us
+    if (pthread_mutex_trylock(&shrink_lock) != 0)
+        return;
+    for (i = 0; i < nshrinkers && used > limit; i++)
+    {
+        freed = shrinkers[i].fn(used - limit, shrinkers[i].arg);
+        if (freed == 0)
+            continue;
+        __atomic_fetch_add(&shrinks, 1, __ATOMIC_RELAXED);
+        syslog(LOG_WARNING, "Memory %llu KB over the %llu KB budget: %s released %zu KB",
+               (unsigned long long)(used - limit) >> 10, (unsigned long long)limit >> 10, shrinkers[i].name,
+               freed >> 10);
+        used = __atomic_load_n(&total, __ATOMIC_RELAXED);
+    }
+    if (used > limit && !over_reported)
+    {
+        syslog(LOG_ERR, "Memory use %llu KB stays over the %llu KB budget", (unsigned long long)used >> 10,
+               (unsigned long long)limit >> 10);
+        over_reported = true;
+    }
+    pthread_mutex_unlock(&shrink_lock);
+}
+
+/*
+ * Snapshot of current and peak usage
+ *
+ * Parameters:
+ *   struct mem_usage *out -> Usage per category and in total
+ *
+ * Returns:
+ *   None
+ */
+void mem_get_usage(struct mem_usage *out)
+{
+    unsigned int i;
+
+    for (i = 0; i < MEM_COUNT; i++)
+    {
+        out->current[i] = __atomic_load_n(&current[i], __ATOMIC_RELAXED);
+        out->peak[i] = __atomic_load_n(&peak[i], __ATOMIC_RELAXED);
+    }
+    out->total = __atomic_load_n(&total, __ATOMIC_RELAXED);
+    out->total_peak = __atomic_load_n(&total_peak, __ATOMIC_RELAXED);
+    out->budget = __atomic_load_n(&budget, __ATOMIC_RELAXED);
+    out->shrinks = __atomic_load_n(&shrinks, __ATOMIC_RELAXED);
+}
+
+const char *mem_category_name(enum mem_category c)
+{
+    return c < MEM_COUNT ? category_names[c] : "unknown";
+}
@@ -0,0 +1,59 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Memory accounting and budget enforcement
+ *
+ * Every subsystem charges its long-lived buffers to a category when it
+ * allocates them and releases the charge when it frees them, so current
+ * and peak usage per category can be reported. With a budget set,
+ * subsystems that hold optional memory (deeper queues, caches) register
+ * shrinkers; mem_enforce() calls them in registration order until usage
+ * is back under budget, rather than the process growing into the OOM
+ * killer.
+ *
+ * Charges are lock-free and may be made from any thread.
+ */
+
+#ifndef MEMACCT_H
+#define MEMACCT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define MEM_MAX_SHRINKERS 8
+
+enum mem_category
+{
+    MEM_V4L2,                   // Capture buffers mapped from the driver
+    MEM_CONVERT,                // RGB conversion output
+    MEM_WRITER,                 // Staging and checkpoint buffers of the recording path
+    MEM_INDEX,                  // Segment index builder
+    MEM_ANALYSIS,
+    MEM_SERVICE,                // Frame service hand-over buffers
+    MEM_STREAM,                 // UDP stream hand-over buffers
+    MEM_COUNT
+};
+
+struct mem_usage
+{
+    uint64_t current[MEM_COUNT];
+    uint64_t peak[MEM_COUNT];
+    uint64_t total;
+    uint64_t total_peak;
+    uint64_t budget;            // 0 for none
+    unsigned int shrinks;       // Shrinker calls that released memory
+};
+
+// Returns the bytes released, at most a best effort towards excess
+typedef size_t (*mem_shrink_fn)(size_t excess, void *arg);
+
+void mem_charge(enum mem_category c, size_t bytes);
+void mem_release(enum mem_category c, size_t bytes);
+void mem_set_budget(uint64_t bytes);
+int mem_register_shrinker(const char *name, mem_shrink_fn fn, void *arg);
+void mem_unregister_shrinker(mem_shrink_fn fn, void *arg);
+void mem_enforce(void);
+void mem_get_usage(struct mem_usage *out);
+const char *mem_category_name(enum mem_category c);
+
+#endif
@@ -0,0 +1,368 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Capture metrics in Prometheus text format
+ *
+ * The exposition is rendered from relaxed loads of the counters; a
+ * scrape may see a histogram mid-update (count one ahead of its bucket),
+ * which Prometheus tolerates.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <syslog.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "metrics.h"
+
+#define METRICS_REQUEST_MAX     4096
+#define METRICS_IO_TIMEOUT_SEC  1
+
+uint64_t metrics_counters[MC_COUNT];
+int64_t metrics_gauges[MG_COUNT];
+struct metrics_histogram metrics_stages[MS_COUNT];
+
+// 10 us .. 1 s
+const uint64_t metrics_bounds_ns[METRICS_BUCKETS] = {
+    10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000,
+    25000000, 50000000, 100000000, 250000000, 500000000, 1000000000,
+};
+
+static const struct
+{
+    const char *name;
+    const char *help;
+} counters[MC_COUNT] = {
+    [MC_FRAMES_CAPTURED] = { "camera_frames_captured_total", "Frames dequeued from the camera" },
+    [MC_FRAMES_DROPPED] = { "camera_frames_dropped_total", "Frames the driver dropped (sequence gaps)" },
+    [MC_FRAMES_CONVERTED] = { "camera_frames_converted_total", "Frames converted to RGB" },
+    [MC_FRAMES_WRITTEN] = { "camera_frames_written_total", "Frames recorded to storage" },
+    [MC_BYTES_WRITTEN] = { "camera_bytes_written_total", "Frame bytes recorded to storage" },
+    [MC_WRITE_ERRORS] = { "camera_write_errors_total", "Frames that could not be recorded" },
+    [MC_DEVICE_RESTARTS] = { "camera_device_restarts_total", "Streaming restarts after the camera stalled" },
+};
+
+// Series of one family are adjacent; the help text comes with the first
+static const struct
+{
+    const char *name;
+    const char *help;
+    const char *labels;
+} gauges[MG_COUNT] = {
+    [MG_BUFFERS_TOTAL] = { "camera_buffers", "V4L2 capture buffers in the pool", NULL },
+    [MG_BUFFERS_HELD] = { "camera_buffers_held", "V4L2 buffers dequeued and being processed", NULL },
+    [MG_QUEUE_EMPTY] = { "camera_driver_queue_depth", "V4L2 buffers queued in the driver", "state=\"empty\"" },
+    [MG_QUEUE_FILLED] = { "camera_driver_queue_depth", NULL, "state=\"filled\"" },
+};
+
+static const char *const stage_names[MS_COUNT] = {
+    [MS_DEQUEUE] = "dequeue",
+    [MS_CONVERT] = "convert",
+    [MS_ANALYZE] = "analyze",
+    [MS_WRITE] = "write",
+    [MS_PUBLISH] = "publish",
+    [MS_READY] = "ready",
+    [MS_TIMELAPSE] = "timelapse",
+    [MS_CLASSIFY] = "classify",
+    [MS_EDGE] = "edge",
+    [MS_THUMBNAIL] = "thumbnail",
+    [MS_COLOR] = "color",
+};
+
+/*
+ * Write one sample, with its HELP/TYPE lines when help is given
+ *
+ * Parameters:
+ *   FILE *out -> Exposition being built
+ *   const char *name -> Metric name
+ *   const char *type -> "counter" or "gauge"
+ *   const char *help -> Description, or NULL for further samples of the same metric
+ *   const char *labels -> e.g. "state=\"queued\"", or NULL
+ *   double value -> Sample value
+ *
+ * Returns:
+ *   None
+ */
+void metrics_print(FILE *out, const char *name, const char *type, const char *help, const char *labels,
+                   double value)
+{
+    if (help)
+        fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+    if (labels)
+        fprintf(out, "%s{%s} %.17g\n", name, labels, value);
+    else
+        fprintf(out, "%s %.17g\n", name, value);
+}
+
+/*
+ * Upper bound of the histogram bucket holding a quantile of a stage
+ *
+ * Parameters:
+ *   enum metrics_stage s -> The stage
+ *   double q -> Quantile, 0..1
+ *
+ * Returns:
+ *   Bound in seconds, the largest bound if the quantile is beyond it,
+ *   0 when nothing was observed
+ */
+double metrics_quantile(enum metrics_stage s, double q)
+{
+    const struct metrics_histogram *h = &metrics_stages[s];
+    uint64_t count = __atomic_load_n(&h->count, __ATOMIC_RELAXED), rank, cumulative = 0;
+    unsigned int b;
+
+    if (count == 0)
+        return 0;
+
+    rank = (uint64_t)(q * count);
+    if (rank >= count)
+        rank = count - 1;
+    for (b = 0; b < METRICS_BUCKETS; b++)
+    {
+        cumulative += __atomic_load_n(&h->bucket[b], __ATOMIC_RELAXED);
+        if (cumulative > rank)
+            break;
+    }
+    return metrics_bounds_ns[b < METRICS_BUCKETS ? b : METRICS_BUCKETS - 1] / 1e9;
+}
+
+/*
+ * Render all metrics in Prometheus text exposition format
+ *
+ * Parameters:
+ *   FILE *out -> Output
+ *   metrics_collector_fn collect -> Adds module metrics (may be NULL)
+ *   void *arg -> Passed to collect
+ *
+ * Returns:
+ *   None
+ */
+void metrics_render(FILE *out, metrics_collector_fn collect, void *arg)
+{
+    const struct metrics_histogram *h;
+    uint64_t cumulative;
+    unsigned int i, b;
+
+    for (i = 0; i < MC_COUNT; i++)
+        metrics_print(out, counters[i].name, "counter", counters[i].help, NULL,
+                      __atomic_load_n(&metrics_counters[i], __ATOMIC_RELAXED));
+    for (i = 0; i < MG_COUNT; i++)
+        metrics_print(out, gauges[i].name, "gauge", gauges[i].help, gauges[i].labels,
+                      __atomic_load_n(&metrics_gauges[i], __ATOMIC_RELAXED));
+
+    fprintf(out, "# HELP camera_stage_latency_seconds Time spent per frame in each capture stage\n"
+                 "# TYPE camera_stage_latency_seconds histogram\n");
+    for (i = 0; i < MS_COUNT; i++)
+    {
+        h = &metrics_stages[i];
+        cumulative = 0;
+        for (b = 0; b <= METRICS_BUCKETS; b++)
+        {
+            cumulative += __atomic_load_n(&h->bucket[b], __ATOMIC_RELAXED);
+            if (b < METRICS_BUCKETS)
+                fprintf(out, "camera_stage_latency_seconds_bucket{stage=\"%s\",le=\"%g\"} %llu\n", stage_names[i],
+                        metrics_bounds_ns[b] / 1e9, (unsigned long long)cumulative);
+            else
+                fprintf(out, "camera_stage_latency_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n",
+                        stage_names[i], (unsigned long long)cumulative);
+        }
+        fprintf(out, "camera_stage_latency_seconds_sum{stage=\"%s\"} %.9f\n", stage_names[i],
+                __atomic_load_n(&h->sum_ns, __ATOMIC_RELAXED) / 1e9);
+        fprintf(out, "camera_stage_latency_seconds_count{stage=\"%s\"} %llu\n", stage_names[i],
+                (unsigned long long)cumulative);
+    }
+
+    if (collect)
+        collect(out, arg);
+}
+
+/*
+ * Answer one HTTP request
+ *
+ * Parameters:
+ *   struct metrics_server *m -> The server
+ *   int fd -> Accepted connection
+ *
+ * Returns:
+ *   None
+ */
+static void serve(struct metrics_server *m, int fd)
+{
+    struct timeval tv = { METRICS_IO_TIMEOUT_SEC, 0 };
+    char req[METRICS_REQUEST_MAX + 1], head[160];
+    char *body = NULL;
+    size_t len = 0, got = 0, off;
+    ssize_t n;
+    FILE *out;
+    bool found;
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    // Only the request line matters; read until the end of the headers
+    while (got < METRICS_REQUEST_MAX)
+    {
+        n = recv(fd, req + got, METRICS_REQUEST_MAX - got, 0);
+        if (n <= 0)
+            return;
+        got += n;
+        req[got] = '\0';
+        if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n"))
+            break;
+    }
+    found = strncmp(req, "GET /metrics ", 13) == 0 || strncmp(req, "GET / ", 6) == 0;
+
+    out = open_memstream(&body, &len);
+    if (!out)
+        return;
+    if (found)
+        metrics_render(out, m->collect, m->arg);
+    else
+        fputs("not found\n", out);
+    fclose(out);
+
+    snprintf(head, sizeof(head),
+             "HTTP/1.1 %s\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n"
+             "Connection: close\r\n\r\n", found ? "200 OK" : "404 Not Found", len);
+    if (send(fd, head, strlen(head), MSG_NOSIGNAL) == (ssize_t)strlen(head))
+    {
+        for (off = 0; off < len; off += n)
+        {
+            n = send(fd, body + off, len - off, MSG_NOSIGNAL);
+            if (n <= 0)
+                break;
+        }
+    }
+    free(body);
+}
+
+static void *metrics_thread(void *arg)
+{
+    struct metrics_server *m = arg;
+    struct pollfd pfd[2] = { { .fd = m->wake_fd, .events = POLLIN }, { .fd = m->listen_fd, .events = POLLIN } };
+    int fd;
+
+    while (!m->stop)
+    {
+        if (poll(pfd, 2, -1) <= 0 || !(pfd[1].revents & POLLIN))
+            continue;
+        fd = accept4(m->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd == -1)
+            continue;
+        serve(m, fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+/*
+ * Start serving metrics
+ *
+ * Parameters:
+ *   struct metrics_server *m -> Server state
+ *   const char *where -> TCP port on 127.0.0.1, or a Unix socket path (starting with '/')
+ *   metrics_collector_fn collect -> Adds module metrics at scrape time (may be NULL)
+ *   void *arg -> Passed to collect
+ *
+ * Returns:
+ *   0 on success, -1 with errno set on failure
+ */
+int metrics_start(struct metrics_server *m, const char *where, metrics_collector_fn collect, void *arg)
+{
+    struct sockaddr_un un;
+    struct sockaddr_in in;
+    int one = 1, err;
+
+    memset(m, 0, sizeof(*m));
+    m->collect = collect;
+    m->arg = arg;
+    m->listen_fd = -1;
+    m->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m->wake_fd == -1)
+        return -1;
+
+    if (where[0] == '/')
+    {
+        memset(&un, 0, sizeof(un));
+        un.sun_family = AF_UNIX;
+        if (strlen(where) >= sizeof(un.sun_path))
+        {
+            errno = EINVAL;
+            goto fail;
+        }
+        strcpy(un.sun_path, where);
+        strcpy(m->path, where);
+        unlink(where);
+        m->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (m->listen_fd == -1 || bind(m->listen_fd, (struct sockaddr *)&un, sizeof(un)) == -1)
+            goto fail;
+    }
+    else
+    {
+        // Localhost only: the endpoint has no authentication
+        memset(&in, 0, sizeof(in));
+        in.sin_family = AF_INET;
+        in.sin_port = htons(atoi(where));
+        in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        m->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (m->listen_fd == -1)
+            goto fail;
+        setsockopt(m->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (in.sin_port == 0 || bind(m->listen_fd, (struct sockaddr *)&in, sizeof(in)) == -1)
+        {
+            if (in.sin_port == 0)
+                errno = EINVAL;
+            goto fail;
+        }
+    }
+    if (listen(m->listen_fd, 8) == -1)
+        goto fail;
+
+    err = pthread_create(&m->thread, NULL, metrics_thread, m);
+    if (err == 0)
+        return 0;
+    errno = err;
+
+fail:
+    err = errno;
+    if (m->listen_fd != -1)
+        close(m->listen_fd);
+    close(m->wake_fd);
+    if (m->path[0])
+        unlink(m->path);
+    errno = err;
+    return -1;
+}
+
+/*
+ * Stop the metrics server
+ *
+ * Parameters:
+ *   struct metrics_server *m -> The server
+ *
+ * Returns:
+ *   None
+ */
+void metrics_stop(struct metrics_server *m)
+{
+    uint64_t one = 1;
+
+    m->stop = true;
+    if (write(m->wake_fd, &one, sizeof(one)) == -1)
+        syslog(LOG_WARNING, "metrics: wakeup failed: %s", strerror(errno));
+    pthread_join(m->thread, NULL);
+    close(m->listen_fd);
+    close(m->wake_fd);
+    if (m->path[0])
+        unlink(m->path);
+}
@@ -0,0 +1,131 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Capture metrics in Prometheus text format
+ *
+ * Counters, gauges and per-stage latency histograms live in fixed global
+ * arrays and are updated with relaxed atomic adds, so instrumenting the
+ * capture path costs a few nanoseconds and never takes a lock. A small
+ * HTTP server thread renders them on request ("GET /metrics") on a
+ * localhost TCP port or a Unix socket; modules with their own counters
+ * are added through a collector callback at scrape time.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+enum metrics_counter
+{
+    MC_FRAMES_CAPTURED,
+    MC_FRAMES_DROPPED,          // Sequence gaps reported by the driver
+    MC_FRAMES_CONVERTED,
+    MC_FRAMES_WRITTEN,
+    MC_BYTES_WRITTEN,
+    MC_WRITE_ERRORS,
+    MC_DEVICE_RESTARTS,
+    MC_COUNT
+};
+
+enum metrics_gauge
+{
+    MG_BUFFERS_TOTAL,           // V4L2 buffers in the pool
+    MG_BUFFERS_HELD,            // Dequeued and being processed
+    MG_QUEUE_EMPTY,             // Queued in the driver, waiting to be filled (sampled by the capture thread)
+    MG_QUEUE_FILLED,            // Filled by the driver, waiting to be dequeued (same)
+    MG_COUNT
+};
+
+enum metrics_stage
+{
+    MS_DEQUEUE,                 // Waiting for and dequeuing a buffer
+    MS_CONVERT,
+    MS_ANALYZE,
+    MS_WRITE,
+    MS_PUBLISH,                 // Hand-over to the frame service and UDP stream
+    MS_READY,                   // Buffer filled by the driver until dequeued
+    MS_TIMELAPSE,               // Adding a frame to the timelapse window
+    MS_CLASSIFY,                // Classifying the motion blobs of a frame
+    MS_EDGE,                    // Gradient statistics of a frame
+    MS_THUMBNAIL,               // Index thumbnail of a stored frame
+    MS_COLOR,                   // Colour-cast statistics of a frame
+    MS_COUNT
+};
+
+#define METRICS_BUCKETS 16
+
+struct metrics_histogram
+{
+    uint64_t bucket[METRICS_BUCKETS + 1];   // Not cumulative; the last one is +Inf
+    uint64_t sum_ns;
+    uint64_t count;
+};
+
+extern uint64_t metrics_counters[MC_COUNT];
+extern int64_t metrics_gauges[MG_COUNT];
+extern struct metrics_histogram metrics_stages[MS_COUNT];
+extern const uint64_t metrics_bounds_ns[METRICS_BUCKETS];
+
+static inline void metrics_add(enum metrics_counter c, uint64_t n)
+{
+    __atomic_fetch_add(&metrics_counters[c], n, __ATOMIC_RELAXED);
+}
+
+static inline void metrics_gauge_set(enum metrics_gauge g, int64_t v)
+{
+    __atomic_store_n(&metrics_gauges[g], v, __ATOMIC_RELAXED);
+}
+
+static inline void metrics_gauge_add(enum metrics_gauge g, int64_t delta)
+{
+    __atomic_fetch_add(&metrics_gauges[g], delta, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t metrics_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Record the time since start (from metrics_now()) for a stage
+static inline void metrics_observe(enum metrics_stage s, uint64_t start)
+{
+    struct metrics_histogram *h = &metrics_stages[s];
+    uint64_t ns = metrics_now() - start;
+    unsigned int i = 0;
+
+    while (i < METRICS_BUCKETS && ns > metrics_bounds_ns[i])
+        i++;
+    __atomic_fetch_add(&h->bucket[i], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum_ns, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+}
+
+// Appends module metrics to a scrape
+typedef void (*metrics_collector_fn)(FILE *out, void *arg);
+
+struct metrics_server
+{
+    int listen_fd;
+    int wake_fd;
+    char path[108];             // Unix socket to remove on stop, or empty
+    metrics_collector_fn collect;
+    void *arg;
+    pthread_t thread;
+    volatile bool stop;
+};
+
+int metrics_start(struct metrics_server *m, const char *where, metrics_collector_fn collect, void *arg);
+void metrics_stop(struct metrics_server *m);
+void metrics_render(FILE *out, metrics_collector_fn collect, void *arg);
+void metrics_print(FILE *out, const char *name, const char *type, const char *help, const char *labels,
+                   double value);
+double metrics_quantile(enum metrics_stage s, double q);
+
+#endif
@@ -0,0 +1,703 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Declarative list of recording outputs
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <syslog.h>
+#include <linux/videodev2.h>
+
+#include "outputs.h"
+#include "frame_writer.h"
+#include "convert.h"
+#include "metrics.h"
+#include "memacct.h"
+
+static const char *const format_names[OUT_FORMATS] = { "raw", "ppm", "pgm", "jpeg", "container" };
+static const char *const extensions[OUT_FORMATS] = { "yuv", "ppm", "pgm", "jpg", NULL };
+
+static int parse_format(const char *s, enum out_format *format)
+{
+    unsigned int i;
+
+    for (i = 0; i < OUT_FORMATS; i++)
+    {
+        if (strcmp(s, format_names[i]) == 0)
+        {
+            *format = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// "always", "motion:LEVEL", "blobs:N" or "detect:LABEL"
+static int parse_trigger(const char *s, struct out_spec *spec)
+{
+    double level;
+    char *end;
+
+    if (strcmp(s, "always") == 0)
+    {
+        spec->trigger = OUT_ALWAYS;
+        return 0;
+    }
+    if (strncmp(s, "motion:", 7) == 0)
+    {
+        level = strtod(s + 7, &end);
+        if (end == s + 7 || *end != '\0' || level < 0 || level > 255)
+            return -1;
+        spec->trigger = OUT_MOTION;
+        spec->threshold = lround(level * 256);
+        return 0;
+    }
+    if (strncmp(s, "blobs:", 6) == 0)
+    {
+        spec->threshold = strtoul(s + 6, &end, 0);
+        if (end == s + 6 || *end != '\0' || spec->threshold == 0)
+            return -1;
+        spec->trigger = OUT_BLOBS;
+        return 0;
+    }
+    if (strncmp(s, "detect:", 7) == 0 && s[7] != '\0' && strlen(s + 7) < sizeof(spec->label))
+    {
+        strcpy(spec->label, s + 7);
+        spec->trigger = OUT_DETECT;
+        return 0;
+    }
+    return -1;
+}
+
+/*
+ * Parse an output spec: "format[,key=value]...", see outputs.h
+ *
+ * Parameters:
+ *   const char *s -> The string
+ *   struct out_spec *spec -> The output, defaults for what s leaves out
+ *
+ * Returns:
+ *   0 on success, -1 with errno set to EINVAL
+ */
+int out_parse(const char *s, struct out_spec *spec)
+{
+    char buf[256], *tok, *save, *val, *end;
+    unsigned long n;
+    bool first = true;
+
+    memset(spec, 0, sizeof(*spec));
+    spec->format = OUT_PPM;
+    spec->scale = 1;
+    spec->every = 1;
+    spec->trigger = OUT_ALWAYS;
+    spec->quality = JPEG_QUALITY;
+    strcpy(spec->dir, "frames");
+    strcpy(spec->prefix, "test");
+    if (strlen(s) >= sizeof(buf))
+        goto invalid;
+    strcpy(buf, s);
+
+    for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save), first = false)
+    {
+        val = strchr(tok, '=');
+        if (!val)
+        {
+            if (!first || parse_format(tok, &spec->format) == -1)
+                goto invalid;
+            continue;
+        }
+        *val++ = '\0';
+
+        if (strcmp(tok, "format") == 0)
+        {
+            if (parse_format(val, &spec->format) == -1)
+                goto invalid;
+        }
+        else if (strcmp(tok, "when") == 0)
+        {
+            if (parse_trigger(val, spec) == -1)
+                goto invalid;
+        }
+        else if (strcmp(tok, "dir") == 0)
+        {
+            if (val[0] == '\0' || strlen(val) >= sizeof(spec->dir))
+                goto invalid;
+            strcpy(spec->dir, val);
+        }
+        else if (strcmp(tok, "prefix") == 0)
+        {
+            if (strlen(val) >= sizeof(spec->prefix) || strchr(val, '/'))
+                goto invalid;
+            strcpy(spec->prefix, val);
+        }
+        else
+        {
+            n = strtoul(val, &end, 0);
+            if (end == val || *end != '\0')
+                goto invalid;
+            if (strcmp(tok, "scale") == 0 && n >= 1 && n <= OUT_MAX_SCALE && (n & (n - 1)) == 0)
+                spec->scale = n;
+            else if (strcmp(tok, "every") == 0 && n >= 1)
+                spec->every = n;
+            else if (strcmp(tok, "quality") == 0 && n >= 1 && n <= 100)
+                spec->quality = n;
+            else
+                goto invalid;
+        }
+    }
+    if (!first)
+        return 0;
+
+invalid:
+    errno = EINVAL;
+    return -1;
+}
+
+/*
+ * Read a list of output specs, one per line; blank lines and '#' comments are skipped
+ *
+ * Parameters:
+ *   const char *path -> The file
+ *   struct out_spec *specs -> Where the outputs go, from specs[*count] on
+ *   unsigned int max -> Size of specs
+ *   unsigned int *count -> Outputs in specs, updated
+ *
+ * Returns:
+ *   0 on success, -1 with errno set (that of fopen(), EINVAL for a bad line, E2BIG for too many)
+ */
+int out_load(const char *path, struct out_spec *specs, unsigned int max, unsigned int *count)
+{
+    char line[256], *p, *e;
+    int ret = 0;
+    FILE *f;
+
+    f = fopen(path, "r");
+    if (!f)
+        return -1;
+    while (ret == 0 && fgets(line, sizeof(line), f))
+    {
+        for (p = line; isspace((unsigned char)*p); p++)
+            ;
+        for (e = p + strlen(p); e > p && isspace((unsigned char)e[-1]); e--)
+            ;
+        *e = '\0';
+        if (*p == '\0' || *p == '#')
+            continue;
+        if (*count == max)
+        {
+            errno = E2BIG;
+            ret = -1;
+        }
+        else if (out_parse(p, &specs[*count]) == 0)
+            (*count)++;
+        else
+            ret = -1;
+    }
+    fclose(f);
+    return ret;
+}
+
+/*
+ * Whether two outputs would write the same files
+ *
+ * Per-frame files are named by directory, prefix and extension; segment
+ * names only by directory.
+ *
+ * Parameters:
+ *   const struct out_spec *a, *b -> The outputs
+ *
+ * Returns:
+ *   true if they collide
+ */
+static bool same_target(const struct out_spec *a, const struct out_spec *b)
+{
+    if (a->format != b->format || strcmp(a->dir, b->dir) != 0)
+        return false;
+    return a->format == OUT_CONTAINER || strcmp(a->prefix, b->prefix) == 0;
+}
+
+/*
+ * Take on a list of outputs
+ *
+ * Runs before the capture geometry is known: segments torn by a crash in
+ * the container directories are repaired here, so it can overlap with
+ * the camera coming up.
+ *
+ * Parameters:
+ *   struct outputs *o -> Outputs to initialise
+ *   const struct out_config *cfg -> Settings shared by all outputs
+ *   const struct out_spec *specs -> The outputs
+ *   unsigned int count -> 1..OUT_MAX, no two writing the same files
+ *
+ * Returns:
+ *   0 on success, -1 with errno set to EINVAL
+ */
+int out_init(struct outputs *o, const struct out_config *cfg, const struct out_spec *specs, unsigned int count)
+{
+    struct output *out;
+    unsigned int i, j;
+
+    memset(o, 0, sizeof(*o));
+    if (count == 0 || count > OUT_MAX)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    for (i = 0; i < count; i++)
+    {
+        for (j = 0; j < i; j++)
+        {
+            if (same_target(&specs[i], &specs[j]))
+            {
+                syslog(LOG_ERR, "Outputs %u and %u both write %s files to %s/", j, i,
+                       out_format_name(specs[i].format), specs[i].dir);
+                errno = EINVAL;
+                return -1;
+            }
+        }
+    }
+    o->cfg = *cfg;
+    o->count = count;
+    for (i = 0; i < count; i++)
+    {
+        out = &o->out[i];
+        out->spec = specs[i];
+        for (out->shift = 0; (1u << out->shift) < out->spec.scale; out->shift++)
+            ;
+        // A segment is one long stream; the other formats are a file per frame
+        dur_init(&out->durability, &cfg->policy, out->spec.format == OUT_CONTAINER ? DUR_SCOPE_STREAM : DUR_SCOPE_FILE,
+                 cfg->on_event, cfg->arg);
+        if (out->spec.format == OUT_CONTAINER && fc_recover_dir(out->spec.dir, &out->first_seq) == -1)
+            syslog(LOG_ERR, "Recovery of %s/ failed: %s", out->spec.dir, strerror(errno));
+    }
+    return 0;
+}
+
+// Index of the product of this kind and scale, added if no output needed it yet
+static unsigned int add_product(struct outputs *o, enum out_kind kind, unsigned int shift)
+{
+    struct out_product *p;
+    unsigned int i, source = 0;
+
+    for (i = 0; i < o->n_products; i++)
+        if (o->products[i].kind == kind && o->products[i].shift == shift)
+            return i;
+
+    // Conversions read the 4:2:2 frame at their scale, which comes first
+    if (kind != OUT_YUYV)
+        source = add_product(o, OUT_YUYV, shift);
+    p = &o->products[o->n_products];
+    p->kind = kind;
+    p->shift = shift;
+    p->source = source;
+    p->size = (size_t)(o->width >> shift) * (o->height >> shift) * (kind == OUT_YUYV ? 2 : kind == OUT_RGB ? 3 : 1);
+    return o->n_products++;
+}
+
+/*
+ * Set up the outputs for the capture geometry
+ *
+ * Every scaled output needs its block size to divide the frame, with an
+ * even output width.
+ *
+ * Parameters:
+ *   struct outputs *o -> Outputs from out_init()
+ *   uint32_t width, height -> Capture geometry in pixels
+ *   uint32_t pixelformat -> V4L2_PIX_FMT_YUYV or V4L2_PIX_FMT_UYVY
+ *
+ * Returns:
+ *   0 on success, -1 with errno set (EINVAL, ENOMEM)
+ */
+int out_start(struct outputs *o, uint32_t width, uint32_t height, uint32_t pixelformat)
+{
+    struct output *out;
+    struct fc_config fc;
+    unsigned int i, s;
+    size_t need;
+
+    if (pixelformat != V4L2_PIX_FMT_YUYV && pixelformat != V4L2_PIX_FMT_UYVY)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    o->width = width;
+    o->height = height;
+    o->pixelformat = pixelformat;
+
+    for (i = 0; i < o->count; i++)
+    {
+        out = &o->out[i];
+        s = out->spec.scale;
+        if (width % s || height % s || (width / s) % 2)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+        out->width = width / s;
+        out->height = height / s;
+        switch (out->spec.format)
+        {
+        case OUT_RAW:
+        case OUT_JPEG:
+            out->product = add_product(o, OUT_YUYV, out->shift);
+            break;
+        case OUT_PGM:
+            out->product = add_product(o, OUT_GREY, out->shift);
+            break;
+        default:
+            out->product = add_product(o, OUT_RGB, out->shift);
+            break;
+        }
+
+        need = 0;
+        if (out->spec.format == OUT_JPEG)
+        {
+            out->jpeg = malloc(sizeof(*out->jpeg));
+            if (!out->jpeg)
+                goto nomem;
+            if (jpeg_init(out->jpeg, out->width, out->height, pixelformat, out->spec.quality) == -1)
+                return -1;
+            need = jpeg_bound(out->jpeg);
+        }
+        if (out->spec.format == OUT_CONTAINER)
+        {
+            memset(&fc, 0, sizeof(fc));
+            fc.dir = out->spec.dir;
+            fc.width = out->width;
+            fc.height = out->height;
+            fc.pixelformat = V4L2_PIX_FMT_RGB24;
+            fc.direct = o->cfg.direct;
+            fc.first_seq = out->first_seq;
+            fc.durability = &out->durability;
+            // A thumbnail close to the size of the frame costs index space and saves no reading
+            fc.thumb_width = o->cfg.thumb_width < out->width / OUT_THUMB_RATIO ? o->cfg.thumb_width
+                                                                                : out->width / OUT_THUMB_RATIO;
+            if (o->cfg.thumb_every && fc.thumb_width >= OUT_THUMB_MIN)
+            {
+                fc.thumb_height = fc.thumb_width * out->height / out->width;
+                if (fc.thumb_height == 0)
+                    fc.thumb_height = 1;
+                fc.thumb_every = o->cfg.thumb_every;
+            }
+            else
+                fc.thumb_width = 0;
+            if (fc_writer_init(&out->container, &fc) == -1)
+                return -1;
+            need = (size_t)fc.thumb_width * fc.thumb_height * 3;
+        }
+        if (need > o->scratch_size)
+            o->scratch_size = need;
+    }
+
+    // The raw frame is its own full-resolution product
+    for (i = 0; i < o->n_products; i++)
+    {
+        if (o->products[i].kind == OUT_YUYV && o->products[i].shift == 0)
+            continue;
+        o->products[i].buf = malloc(o->products[i].size);
+        if (!o->products[i].buf)
+            goto nomem;
+        mem_charge(MEM_CONVERT, o->products[i].size);
+        o->charged += o->products[i].size;
+    }
+    if (o->scratch_size)
+    {
+        o->scratch = malloc(o->scratch_size);
+        if (!o->scratch)
+            goto nomem;
+        mem_charge(MEM_CONVERT, o->scratch_size);
+        o->charged += o->scratch_size;
+    }
+    o->started = true;
+    return 0;
+
+nomem:
+    errno = ENOMEM;
+    return -1;
+}
+
+/*
+ * Whether any output needs the frame analysis: for its trigger, or for a segment index
+ *
+ * Parameters:
+ *   const struct outputs *o -> The outputs
+ *
+ * Returns:
+ *   true if out_frame() should be given the frame's statistics
+ */
+bool out_needs_meta(const struct outputs *o)
+{
+    unsigned int i;
+
+    for (i = 0; i < o->count; i++)
+        if (o->out[i].spec.format == OUT_CONTAINER || o->out[i].spec.trigger == OUT_MOTION ||
+            o->out[i].spec.trigger == OUT_BLOBS)
+            return true;
+    return false;
+}
+
+/*
+ * A product of the current frame, made now if no output has asked for it yet
+ */
+static const uint8_t *product(struct outputs *o, unsigned int i, const struct out_frame *f)
+{
+    struct out_product *p = &o->products[i];
+    uint32_t n = (o->width >> p->shift) * (o->height >> p->shift);
+    const uint8_t *src;
+    uint64_t t;
+
+    if (p->generation == o->generation)
+        return p->data;
+
+    if (!p->buf)
+        p->data = f->data;
+    else
+    {
+        src = p->kind == OUT_YUYV ? f->data : product(o, p->source, f);
+        t = metrics_now();
+        // Rows are contiguous and of even width, so a frame converts as one long row
+        if (p->kind == OUT_YUYV)
+            cv_downscale(src, o->width, o->height, o->pixelformat, p->shift, p->buf);
+        else if (p->kind == OUT_RGB)
+            cv_to_rgb24(src, 0, n, o->pixelformat, p->buf);
+        else
+            cv_to_grey(src, 0, n, o->pixelformat, p->buf);
+        metrics_observe(MS_CONVERT, t);
+        if (p->kind == OUT_RGB)
+            metrics_add(MC_FRAMES_CONVERTED, 1);
+        p->data = p->buf;
+    }
+    p->generation = o->generation;
+    return p->data;
+}
+
+/*
+ * Write one file: optional header, then the data, under the output's durability policy
+ *
+ * Returns:
+ *   0 on success, -1 if the frame did not make it (reported through the durability event sink)
+ */
+static int write_file(struct output *out, bool direct, const char *path, const char *header, size_t hlen,
+                      const void *p, size_t size)
+{
+    struct frame_writer writer;
+    int ret = 0;
+
+    // With -D the writer bypasses the page cache so recording does not evict everyone else's data
+    if (fw_open(&writer, path, direct, 0) == -1)
+    {
+        dur_report(&out->durability, errno, path);
+        return -1;
+    }
+
+    if ((hlen && fw_write(&writer, header, hlen) == -1) || fw_write(&writer, p, size) == -1)
+    {
+        dur_report(&out->durability, errno, path);
+        ret = -1;
+    }
+    else if (dur_frame_written(&out->durability))
+    {
+        if (fw_flush(&writer) == -1)
+        {
+            dur_report(&out->durability, errno, path);
+            ret = -1;
+        }
+        else if (dur_sync(&out->durability, writer.fd, writer.length, path) == -1)
+            ret = -1;
+    }
+
+    if (fw_close(&writer) == -1)
+    {
+        dur_report(&out->durability, errno, path);
+        ret = -1;
+    }
+    return ret;
+}
+
+/*
+ * Store one frame on an output
+ *
+ * Returns:
+ *   Bytes stored, 0 on failure
+ */
+static size_t store(struct outputs *o, struct output *out, const uint8_t *data, const struct out_frame *f)
+{
+    size_t size = o->products[out->product].size, hlen = 0;
+    const uint8_t *thumb = NULL;
+    char path[OUT_PATH_LEN + OUT_NAME_LEN + 16], header[80];
+    uint64_t t;
+
+    if (out->spec.format == OUT_CONTAINER)
+    {
+        // Previews for browsing the recordings, taken while the converted frame is still in cache
+        if (out->container.cfg.thumb_width && out->thumb_phase++ % o->cfg.thumb_every == 0)
+        {
+            t = metrics_now();
+            cv_thumbnail(data, out->width, out->height, o->scratch, out->container.cfg.thumb_width,
+                         out->container.cfg.thumb_height);
+            thumb = o->scratch;
+            metrics_observe(MS_THUMBNAIL, t);
+        }
+        // Failures are reported through the durability event sink
+        return fc_append(&out->container, data, size, &f->time, f->meta, thumb) == 0 ? size : 0;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s%08u.%s", out->spec.dir, out->spec.prefix, f->number,
+             extensions[out->spec.format]);
+    switch (out->spec.format)
+    {
+    case OUT_PPM:
+    case OUT_PGM:
+        hlen = snprintf(header, sizeof(header), "P%c\n#%010d sec %010d msec \n%u %u\n255\n",
+                        out->spec.format == OUT_PPM ? '6' : '5', (int)f->time.tv_sec,
+                        (int)(f->time.tv_nsec / 1000000), out->width, out->height);
+        break;
+    case OUT_JPEG:
+        snprintf(header, sizeof(header), "%010d sec %010d msec", (int)f->time.tv_sec,
+                 (int)(f->time.tv_nsec / 1000000));
+        size = jpeg_encode(out->jpeg, data, header, o->scratch, o->scratch_size);
+        if (size == 0)
+            return 0;
+        data = o->scratch;
+        break;
+    default:
+        break;
+    }
+    if (write_file(out, o->cfg.direct, path, header, hlen, data, size) == -1)
+        return 0;
+    printf("Wrote a frame\n");
+    return hlen + size;
+}
+
+static bool triggered(const struct output *out, const struct out_frame *f)
+{
+    switch (out->spec.trigger)
+    {
+    case OUT_MOTION:
+        return f->meta && f->meta->motion >= out->spec.threshold;
+    case OUT_BLOBS:
+        return f->meta && f->meta->blobs >= out->spec.threshold;
+    case OUT_DETECT:
+        return out->spec.threshold < 32 && (f->detected >> out->spec.threshold) & 1;
+    default:
+        return true;
+    }
+}
+
+/*
+ * Offer a frame to every output
+ *
+ * Each output whose trigger the frame passes keeps one in every= of
+ * those frames; the products the kept frames need are made once.
+ *
+ * Parameters:
+ *   struct outputs *o -> Started outputs
+ *   const struct out_frame *f -> The frame
+ *
+ * Returns:
+ *   None
+ */
+void out_frame(struct outputs *o, const struct out_frame *f)
+{
+    struct output *out;
+    const uint8_t *data;
+    unsigned int i;
+    size_t n;
+    uint64_t t;
+
+    o->generation++;
+    for (i = 0; i < o->count; i++)
+    {
+        out = &o->out[i];
+        if (!triggered(out, f))
+            continue;
+        __atomic_fetch_add(&out->stats.triggered, 1, __ATOMIC_RELAXED);
+        if (out->passed++ % out->spec.every)
+            continue;
+
+        data = product(o, out->product, f);
+        t = metrics_now();
+        n = store(o, out, data, f);
+        metrics_observe(MS_WRITE, t);
+        if (n)
+        {
+            __atomic_fetch_add(&out->stats.written, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&out->stats.bytes, n, __ATOMIC_RELAXED);
+            metrics_add(MC_FRAMES_WRITTEN, 1);
+            metrics_add(MC_BYTES_WRITTEN, n);
+        }
+        else
+        {
+            __atomic_fetch_add(&out->stats.errors, 1, __ATOMIC_RELAXED);
+            metrics_add(MC_WRITE_ERRORS, 1);
+        }
+    }
+}
+
+/*
+ * Snapshot of an output's counters; safe from any thread
+ *
+ * Parameters:
+ *   struct outputs *o -> The outputs
+ *   unsigned int i -> Output index, below o->count
+ *   struct out_stats *st -> Where the counters go
+ *
+ * Returns:
+ *   None
+ */
+void out_get_stats(struct outputs *o, unsigned int i, struct out_stats *st)
+{
+    st->triggered = __atomic_load_n(&o->out[i].stats.triggered, __ATOMIC_RELAXED);
+    st->written = __atomic_load_n(&o->out[i].stats.written, __ATOMIC_RELAXED);
+    st->bytes = __atomic_load_n(&o->out[i].stats.bytes, __ATOMIC_RELAXED);
+    st->errors = __atomic_load_n(&o->out[i].stats.errors, __ATOMIC_RELAXED);
+}
+
+/*
+ * Close the segment files and free the shared buffers
+ *
+ * Parameters:
+ *   struct outputs *o -> The outputs
+ *
+ * Returns:
+ *   0 on success, -1 with errno set if a container could not be closed cleanly
+ */
+int out_close(struct outputs *o)
+{
+    unsigned int i;
+    int ret = 0, err = 0;
+
+    for (i = 0; i < o->count; i++)
+    {
+        if (o->started && o->out[i].spec.format == OUT_CONTAINER && fc_writer_close(&o->out[i].container) == -1)
+        {
+            err = errno;
+            ret = -1;
+        }
+        free(o->out[i].jpeg);
+        o->out[i].jpeg = NULL;
+    }
+    for (i = 0; i < o->n_products; i++)
+    {
+        free(o->products[i].buf);
+        o->products[i].buf = NULL;
+    }
+    free(o->scratch);
+    o->scratch = NULL;
+    mem_release(MEM_CONVERT, o->charged);
+    o->charged = 0;
+    o->started = false;
+    if (ret)
+        errno = err;
+    return ret;
+}
+
+const char *out_format_name(enum out_format format)
+{
+    return format < OUT_FORMATS ? format_names[format] : "unknown";
+}
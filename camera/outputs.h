@@ -0,0 +1,180 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Declarative list of recording outputs
+ *
+ * One capture feeds any number of outputs, each declared by a spec string
+ * of comma-separated settings (out_parse()):
+ *
+ *   format       raw, ppm, pgm, jpeg or container (a bare first word is the format)
+ *   scale=N      1, 2, 4 or 8: record at 1/N of the capture resolution
+ *   every=N      keep one in N of the frames that pass the trigger
+ *   when=T       always, motion:LEVEL (mean cell change of the frame
+ *                analysis), blobs:N (changed regions) or detect:LABEL
+ *                (a classifier class seen within the classification interval)
+ *   quality=Q    JPEG quality (default JPEG_QUALITY)
+ *   dir=PATH     output directory (default frames)
+ *   prefix=NAME  file name prefix of the per-frame formats (default test)
+ *
+ * e.g. "container" next to "jpeg,scale=2,when=motion:3,every=5".
+ *
+ * Every output reads one of a small set of shared products per frame:
+ * the packed 4:2:2 frame at its scale, and the RGB24 or grey conversion
+ * of that. An output names the product it needs and the products are
+ * made on demand, at most once per frame, and only for frames that some
+ * output actually keeps: two outputs at the same scale share the
+ * downscale and the conversion, and a frame kept by no output costs
+ * nothing. The buffers are allocated once by out_start().
+ *
+ * The per-frame formats are written one file each through the frame
+ * writer, named <dir>/<prefix><frame number>.<ext>, PPM and PGM headers
+ * and the JPEG comment carrying the capture time; raw files are headerless
+ * 4:2:2. Container outputs append to segment files with thumbnails in the
+ * index. No two outputs may write the same files: per-frame outputs of
+ * one format need distinct directories or prefixes, container outputs
+ * distinct directories. Every output applies the durability policy to
+ * its own files and keeps its own counters, which can be read from
+ * another thread.
+ */
+
+#ifndef OUTPUTS_H
+#define OUTPUTS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "frame_container.h"
+#include "frame_analysis.h"
+#include "durability.h"
+#include "jpeg.h"
+
+#define OUT_MAX         8       // Outputs per capture
+#define OUT_MAX_SCALE   8       // Largest resolution divisor (1 << CV_MAX_SHIFT)
+#define OUT_PATH_LEN    128
+#define OUT_NAME_LEN    32
+#define OUT_THUMB_RATIO 4       // Thumbnails are at most this many times narrower than the stored frame
+#define OUT_THUMB_MIN   4       // Narrowest thumbnail kept; smaller outputs get none
+
+enum out_format
+{
+    OUT_RAW,
+    OUT_PPM,
+    OUT_PGM,
+    OUT_JPEG,
+    OUT_CONTAINER,
+    OUT_FORMATS
+};
+
+enum out_trigger
+{
+    OUT_ALWAYS,
+    OUT_MOTION,                 // threshold: motion score, 8.8 fixed point as in struct frame_meta
+    OUT_BLOBS,                  // threshold: changed regions
+    OUT_DETECT,                 // threshold: classifier class, set by the caller from label
+};
+
+struct out_spec
+{
+    enum out_format format;
+    unsigned int scale;
+    unsigned int every;
+    enum out_trigger trigger;
+    uint32_t threshold;
+    char label[OUT_NAME_LEN];   // OUT_DETECT: class name
+    unsigned int quality;
+    char dir[OUT_PATH_LEN];
+    char prefix[OUT_NAME_LEN];
+};
+
+// What the capture path knows about a frame
+struct out_frame
+{
+    const uint8_t *data;        // Raw frame at the capture geometry
+    unsigned int number;        // Capture frame number, names the files
+    struct timespec time;
+    const struct frame_meta *meta;  // NULL if the frame was not analysed
+    uint32_t detected;          // Bit per classifier class recently detected
+};
+
+struct out_config
+{
+    bool direct;                // Write with O_DIRECT
+    struct durability_policy policy;
+    storage_event_fn on_event;  // Storage failures of every output
+    void *arg;
+    unsigned int thumb_every;   // Containers: thumbnail of one in thumb_every stored frames, 0 for none
+    uint32_t thumb_width;
+};
+
+struct out_stats
+{
+    uint64_t triggered;         // Frames that passed the trigger
+    uint64_t written;
+    uint64_t bytes;
+    uint64_t errors;
+};
+
+enum out_kind
+{
+    OUT_YUYV,                   // Packed 4:2:2 in the capture byte order
+    OUT_RGB,
+    OUT_GREY,
+};
+
+// A shared per-frame product
+struct out_product
+{
+    enum out_kind kind;
+    unsigned int shift;
+    unsigned int source;        // OUT_RGB, OUT_GREY: the OUT_YUYV product at the same scale
+    uint8_t *buf;               // NULL for the raw frame itself
+    const uint8_t *data;        // Valid while generation matches the frame's
+    size_t size;
+    uint64_t generation;
+};
+
+struct output
+{
+    struct out_spec spec;
+    uint32_t width;
+    uint32_t height;
+    unsigned int shift;
+    unsigned int product;       // What the output stores
+    uint64_t passed;            // Frames that passed the trigger, for every=
+    struct durability durability;
+    struct fc_writer container;
+    uint64_t first_seq;         // From recovery of the container directory
+    unsigned int thumb_phase;
+    struct jpeg_encoder *jpeg;
+    struct out_stats stats;
+};
+
+struct outputs
+{
+    struct out_config cfg;
+    struct output out[OUT_MAX];
+    unsigned int count;
+    struct out_product products[2 * OUT_MAX];
+    unsigned int n_products;
+    uint32_t width;             // Capture geometry
+    uint32_t height;
+    uint32_t pixelformat;
+    uint64_t generation;
+    uint8_t *scratch;           // Encoded JPEG or thumbnail of the output being written
+    size_t scratch_size;
+    size_t charged;             // Bytes charged to the memory accountant
+    bool started;
+};
+
+int out_parse(const char *s, struct out_spec *spec);
+int out_load(const char *path, struct out_spec *specs, unsigned int max, unsigned int *count);
+int out_init(struct outputs *o, const struct out_config *cfg, const struct out_spec *specs, unsigned int count);
+int out_start(struct outputs *o, uint32_t width, uint32_t height, uint32_t pixelformat);
+bool out_needs_meta(const struct outputs *o);
+void out_frame(struct outputs *o, const struct out_frame *f);
+void out_get_stats(struct outputs *o, unsigned int i, struct out_stats *st);
+int out_close(struct outputs *o);
+const char *out_format_name(enum out_format format);
+
+#endif
@@ -0,0 +1,396 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Recording retention manager
+ *
+ * Recordings (container segments and the per-frame files of every output
+ * format) are removed oldest first by modification time, across all the
+ * recording directories. The newest file of each kind in a directory is
+ * never touched since it may be the one being written. Large files are
+ * shrunk with ftruncate() in steps before the final unlink so freeing a
+ * 64 MB segment does not turn into one long journal/discard burst that
+ * stalls the capture writes.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <dirent.h>
+#include <syslog.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+#include "retention.h"
+#include "background.h"
+#include "frame_index.h"
+
+#define RETENTION_INTERVAL_MS   5000
+#define RETENTION_TRIM_STEP     (8u << 20)
+#define RETENTION_TRIM_PAUSE_NS 20000000
+
+struct recording
+{
+    char name[64];
+    unsigned int dir;               // Index into the configured directories
+    unsigned int kind;              // Index into suffixes
+    bool newest;                    // Newest of its kind in its directory
+    uint64_t bytes;
+    time_t mtime;
+};
+
+// Every file type outputs.c writes: segments, and raw, PPM, PGM and JPEG frames
+static const char *const suffixes[] = { ".fcs", ".yuv", ".ppm", ".pgm", ".jpg" };
+#define N_SUFFIXES  (sizeof(suffixes) / sizeof(suffixes[0]))
+
+/*
+ * Whether a directory entry is a recording the manager may delete
+ *
+ * Parameters:
+ *   const char *name -> File name
+ *
+ * Returns:
+ *   Index of the recording's suffix, -1 if it is not a recording
+ */
+static int recording_kind(const char *name)
+{
+    size_t len = strlen(name), i, n;
+
+    for (i = 0; i < N_SUFFIXES; i++)
+    {
+        n = strlen(suffixes[i]);
+        if (len > n && strcmp(name + len - n, suffixes[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static int by_age(const void *a, const void *b)
+{
+    const struct recording *ra = a, *rb = b;
+
+    if (ra->mtime != rb->mtime)
+        return ra->mtime < rb->mtime ? -1 : 1;
+    return strcmp(ra->name, rb->name);
+}
+
+/*
+ * Collect all recordings in the configured directories, oldest first
+ *
+ * Parameters:
+ *   const struct retention_config *cfg -> Recording directories
+ *   struct recording **out -> Allocated array (caller frees)
+ *   uint64_t *total -> Sum of allocated bytes
+ *
+ * Returns:
+ *   Number of recordings, or -1 if no directory could be read
+ */
+static int list_recordings(const struct retention_config *cfg, struct recording **out, uint64_t *total)
+{
+    struct recording *list = NULL, *grown;
+    size_t count = 0, cap = 0, i;
+    char path[512];
+    struct dirent *de;
+    struct stat st;
+    unsigned int dir, opened = 0;
+    bool seen[RETENTION_MAX_DIRS][N_SUFFIXES] = { { false } };
+    int kind;
+    DIR *d;
+
+    *total = 0;
+    for (dir = 0; dir < cfg->n_dirs; dir++)
+    {
+        d = opendir(cfg->dirs[dir]);
+        if (!d)
+            continue;
+        opened++;
+
+        while ((de = readdir(d)) != NULL)
+        {
+            kind = recording_kind(de->d_name);
+            if (kind < 0 || strlen(de->d_name) >= sizeof(list->name))
+                continue;
+            snprintf(path, sizeof(path), "%s/%s", cfg->dirs[dir], de->d_name);
+            if (stat(path, &st) == -1 || !S_ISREG(st.st_mode))
+                continue;
+
+            if (count == cap)
+            {
+                cap = cap ? cap * 2 : 64;
+                grown = realloc(list, cap * sizeof(*list));
+                if (!grown)
+                    break;
+                list = grown;
+            }
+            strcpy(list[count].name, de->d_name);
+            list[count].dir = dir;
+            list[count].kind = kind;
+            list[count].newest = false;
+            list[count].bytes = (uint64_t)st.st_blocks * 512;
+            list[count].mtime = st.st_mtime;
+            *total += list[count].bytes;
+            count++;
+        }
+        closedir(d);
+    }
+    if (!opened)
+        return -1;
+
+    if (count)
+        qsort(list, count, sizeof(*list), by_age);
+
+    // Walking back from the newest, the first entry of each (directory, kind) is the one in progress
+    for (i = count; i-- > 0;)
+    {
+        if (!seen[list[i].dir][list[i].kind])
+        {
+            seen[list[i].dir][list[i].kind] = true;
+            list[i].newest = true;
+        }
+    }
+    *out = list;
+    return count;
+}
+
+/*
+ * Filesystem usage of a recording directory in percent
+ *
+ * Parameters:
+ *   const char *dir -> Recording directory
+ *
+ * Returns:
+ *   Used percentage as seen by unprivileged users, or -1 on error
+ */
+static int fs_used_percent(const char *dir)
+{
+    struct statvfs vfs;
+    uint64_t used, avail;
+
+    if (statvfs(dir, &vfs) == -1 || vfs.f_blocks == 0)
+        return -1;
+    used = vfs.f_blocks - vfs.f_bfree;
+    avail = vfs.f_bavail;
+    return (int)((used * 100 + used + avail - 1) / (used + avail));
+}
+
+/*
+ * Shrink a file in steps, then unlink it
+ *
+ * Parameters:
+ *   struct retention *r -> The manager
+ *   const char *path -> File to delete
+ *   uint64_t bytes -> Current size of the file
+ *
+ * Returns:
+ *   0 on success, -1 if the file could not be unlinked
+ */
+static int remove_recording(struct retention *r, const char *path, uint64_t bytes)
+{
+    struct timespec pause = { 0, RETENTION_TRIM_PAUSE_NS };
+    char idx[520];
+    int fd;
+
+    if (bytes > r->cfg.trim_step)
+    {
+        fd = open(path, O_WRONLY | O_CLOEXEC);
+        while (fd != -1 && bytes > r->cfg.trim_step && !r->stop)
+        {
+            bytes -= r->cfg.trim_step;
+            if (ftruncate(fd, bytes) == -1)
+                break;
+            nanosleep(&pause, NULL);
+        }
+        if (fd != -1)
+            close(fd);
+    }
+    if (unlink(path) == -1)
+        return -1;
+
+    // A segment's metadata index goes with it
+    fi_index_path(idx, sizeof(idx), path);
+    if (strcmp(idx, path) != 0)
+        unlink(idx);
+    return 0;
+}
+
+/*
+ * One retention pass
+ *
+ * Parameters:
+ *   struct retention *r -> The manager
+ *
+ * Returns:
+ *   None
+ */
+static void enforce(struct retention *r)
+{
+    struct recording *list = NULL;
+    uint64_t total, deleted = 0;
+    unsigned int files = 0, dir;
+    char path[512];
+    time_t now = time(NULL);
+    bool cleaning[RETENTION_MAX_DIRS] = { false }, over;
+    int used[RETENTION_MAX_DIRS];
+    int count, i;
+
+    count = list_recordings(&r->cfg, &list, &total);
+    if (count < 0)
+        return;
+
+    // Directories on one filesystem share its usage; each is checked against its own
+    for (dir = 0; dir < r->cfg.n_dirs; dir++)
+    {
+        used[dir] = fs_used_percent(r->cfg.dirs[dir]);
+        if (r->cfg.high_watermark && used[dir] >= (int)r->cfg.high_watermark)
+        {
+            cleaning[dir] = true;
+            syslog(LOG_INFO, "retention: %s at %d%%, cleaning down to %u%%", r->cfg.dirs[dir], used[dir],
+                   r->cfg.low_watermark);
+        }
+    }
+
+    for (i = 0; i < count && !r->stop; i++)
+    {
+        dir = list[i].dir;
+        over = (r->cfg.max_bytes && total > r->cfg.max_bytes) ||
+               (r->cfg.max_age_sec && now - list[i].mtime > (time_t)r->cfg.max_age_sec) ||
+               (cleaning[dir] && used[dir] >= (int)r->cfg.low_watermark);
+        if (!over || list[i].newest)
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", r->cfg.dirs[dir], list[i].name);
+        if (remove_recording(r, path, list[i].bytes) == -1)
+        {
+            syslog(LOG_WARNING, "retention: cannot remove %s: %s", path, strerror(errno));
+            continue;
+        }
+        total -= list[i].bytes;
+        deleted += list[i].bytes;
+        files++;
+        for (dir = 0; dir < r->cfg.n_dirs; dir++)
+            if (cleaning[dir])
+                used[dir] = fs_used_percent(r->cfg.dirs[dir]);
+    }
+    free(list);
+
+    pthread_mutex_lock(&r->lock);
+    r->stats.scans++;
+    r->stats.files_deleted += files;
+    r->stats.bytes_deleted += deleted;
+    r->stats.bytes_used = total;
+    pthread_mutex_unlock(&r->lock);
+}
+
+static void *retention_thread(void *arg)
+{
+    struct retention *r = arg;
+    struct pollfd pfd = { .fd = r->wake_fd, .events = POLLIN };
+    uint64_t v;
+
+    bg_lower_priority("retention");
+    while (!r->stop)
+    {
+        enforce(r);
+        if (poll(&pfd, 1, r->cfg.interval_ms) > 0 && read(r->wake_fd, &v, sizeof(v)) == -1)
+            continue;
+    }
+    return NULL;
+}
+
+/*
+ * Start the retention thread
+ *
+ * Parameters:
+ *   struct retention *r -> Manager state
+ *   const struct retention_config *cfg -> Limits; zero interval/trim step pick defaults
+ *
+ * Returns:
+ *   0 on success, -1 with errno set on failure
+ */
+int retention_start(struct retention *r, const struct retention_config *cfg)
+{
+    int err;
+
+    memset(r, 0, sizeof(*r));
+    r->cfg = *cfg;
+    if (r->cfg.interval_ms == 0)
+        r->cfg.interval_ms = RETENTION_INTERVAL_MS;
+    if (r->cfg.trim_step == 0)
+        r->cfg.trim_step = RETENTION_TRIM_STEP;
+    if (r->cfg.low_watermark == 0 || r->cfg.low_watermark > r->cfg.high_watermark)
+        r->cfg.low_watermark = r->cfg.high_watermark;
+
+    r->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (r->wake_fd == -1)
+        return -1;
+    pthread_mutex_init(&r->lock, NULL);
+
+    err = pthread_create(&r->thread, NULL, retention_thread, r);
+    if (err != 0)
+    {
+        close(r->wake_fd);
+        pthread_mutex_destroy(&r->lock);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Ask for a retention pass now; safe to call from the capture path
+ *
+ * Parameters:
+ *   struct retention *r -> The manager
+ *
+ * Returns:
+ *   None
+ */
+void retention_kick(struct retention *r)
+{
+    uint64_t one = 1;
+
+    // Non-blocking eventfd: at worst the counter is saturated and a pass is pending anyway
+    if (write(r->wake_fd, &one, sizeof(one)) == -1)
+        return;
+}
+
+/*
+ * Snapshot of the retention counters
+ *
+ * Parameters:
+ *   struct retention *r -> The manager
+ *   struct retention_stats *out -> Copy of the counters
+ *
+ * Returns:
+ *   None
+ */
+void retention_get_stats(struct retention *r, struct retention_stats *out)
+{
+    pthread_mutex_lock(&r->lock);
+    *out = r->stats;
+    pthread_mutex_unlock(&r->lock);
+}
+
+/*
+ * Stop the retention thread and release its resources
+ *
+ * Parameters:
+ *   struct retention *r -> The manager
+ *
+ * Returns:
+ *   None
+ */
+void retention_stop(struct retention *r)
+{
+    r->stop = true;
+    retention_kick(r);
+    pthread_join(r->thread, NULL);
+    close(r->wake_fd);
+    pthread_mutex_destroy(&r->lock);
+}
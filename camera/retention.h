@@ -0,0 +1,57 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Recording retention manager
+ *
+ * A low-priority background thread (SCHED_IDLE, idle I/O class) keeps the
+ * recording directories within a size budget, an age limit and a
+ * filesystem usage watermark by removing the oldest recordings. The
+ * budgets span every directory the outputs record into. Nothing
+ * on the capture path ever deletes; it can only nudge the thread with
+ * retention_kick() (e.g. after an out-of-space event).
+ */
+
+#ifndef RETENTION_H
+#define RETENTION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#define RETENTION_MAX_DIRS  8
+
+struct retention_config
+{
+    const char *dirs[RETENTION_MAX_DIRS];   // Recording directories
+    unsigned int n_dirs;
+    uint64_t max_bytes;             // 0 for no size budget
+    unsigned int max_age_sec;       // 0 for no age limit
+    unsigned int high_watermark;    // Filesystem used % that starts cleanup (0 disables)
+    unsigned int low_watermark;     // Cleanup continues until usage is below this %
+    unsigned int interval_ms;       // Scan period when not kicked
+    uint64_t trim_step;             // Large files are shrunk in steps of this size before unlink
+};
+
+struct retention_stats
+{
+    unsigned int scans;
+    unsigned int files_deleted;
+    uint64_t bytes_deleted;
+    uint64_t bytes_used;            // Recording size at the last scan
+};
+
+struct retention
+{
+    struct retention_config cfg;
+    pthread_t thread;
+    int wake_fd;                    // eventfd: kicks and stop requests
+    volatile bool stop;
+    pthread_mutex_t lock;           // Protects stats
+    struct retention_stats stats;
+};
+
+int retention_start(struct retention *r, const struct retention_config *cfg);
+void retention_kick(struct retention *r);
+void retention_get_stats(struct retention *r, struct retention_stats *out);
+void retention_stop(struct retention *r);
+
+#endif
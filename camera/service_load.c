@@ -0,0 +1,345 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Load test for the frame subscription service
+ *
+ * Connects dozens of subscribers with a mix of formats, rates and regions
+ * of interest, maps every frame they receive and reports per profile the
+ * delivered rate, delivery latency (capture timestamp to receipt) and
+ * dropped frames.
+ *
+ * With -S the tool hosts the service itself and feeds it a synthetic
+ * 320x240 YUYV source, so it also reports how many conversions were
+ * shared between subscribers and the CPU time the whole process used.
+ * Without -S it attaches to a running "camera_driver -U path".
+ *
+ * usage: service_load [-a socket] [-c clients] [-t seconds] [-S] [-r fps]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <linux/videodev2.h>
+
+#include "frame_service.h"
+
+#define SOURCE_WIDTH    320
+#define SOURCE_HEIGHT   240
+
+struct profile
+{
+    const char *name;
+    uint32_t pixelformat;
+    uint32_t max_fps;
+    uint32_t roi_x, roi_y, roi_width, roi_height;
+};
+
+static const struct profile profiles[] = {
+    { "rgb-full", V4L2_PIX_FMT_RGB24, 0, 0, 0, 0, 0 },
+    { "grey-15fps", V4L2_PIX_FMT_GREY, 15, 0, 0, 0, 0 },
+    { "rgb-roi-10fps", V4L2_PIX_FMT_RGB24, 10, 80, 60, 160, 120 },
+    { "raw-5fps", V4L2_PIX_FMT_YUYV, 5, 0, 0, 0, 0 },
+    { "grey-roi", V4L2_PIX_FMT_GREY, 0, 0, 0, 64, 64 },
+};
+#define N_PROFILES (sizeof(profiles) / sizeof(profiles[0]))
+
+struct subscriber
+{
+    pthread_t thread;
+    const char *path;
+    const struct profile *profile;
+    bool failed;
+    uint64_t frames;
+    uint32_t dropped;
+    unsigned int bad;               // Wrong size or unsealed memfd
+    double latency_sum_ms;
+    double latency_max_ms;
+};
+
+static volatile bool stop;
+
+static double realtime_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/*
+ * Receive one frame message and its memfd
+ *
+ * Parameters:
+ *   int sock -> Subscriber socket
+ *   struct fs_frame *f -> Frame message
+ *
+ * Returns:
+ *   The memfd, or -1 if none was received
+ */
+static int recv_frame(int sock, struct fs_frame *f)
+{
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+    struct iovec iov = { f, sizeof(*f) };
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    int fd = -1;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != sizeof(*f))
+        return -1;
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    return fd;
+}
+
+static void *subscriber_thread(void *arg)
+{
+    struct subscriber *sub = arg;
+    const struct profile *p = sub->profile;
+    struct fs_subscribe req = { FS_MAGIC, p->pixelformat, p->max_fps, p->roi_x, p->roi_y, p->roi_width,
+                                p->roi_height };
+    struct sockaddr_un addr;
+    struct fs_reply reply;
+    struct fs_frame f;
+    struct pollfd pfd;
+    const volatile unsigned char *map;
+    unsigned char sum = 0;
+    double lat;
+    size_t i;
+    int sock, fd;
+
+    sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, sub->path, sizeof(addr.sun_path) - 1);
+    if (sock == -1 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        send(sock, &req, sizeof(req), 0) != sizeof(req) || recv(sock, &reply, sizeof(reply), 0) != sizeof(reply) ||
+        reply.status != 0)
+    {
+        sub->failed = true;
+        if (sock != -1)
+            close(sock);
+        return NULL;
+    }
+
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+    while (!stop)
+    {
+        if (poll(&pfd, 1, 100) <= 0)
+            continue;
+        fd = recv_frame(sock, &f);
+        if (fd == -1)
+            break;
+
+        lat = realtime_ms() - f.timestamp_ns / 1e6;
+        sub->latency_sum_ms += lat;
+        if (lat > sub->latency_max_ms)
+            sub->latency_max_ms = lat;
+        sub->frames++;
+        sub->dropped = f.dropped;
+
+        if (f.size != fs_frame_size(reply.pixelformat, reply.width, reply.height) ||
+            !(fcntl(fd, F_GET_SEALS) & F_SEAL_WRITE))
+            sub->bad++;
+        map = mmap(NULL, f.size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED)
+            sub->bad++;
+        else
+        {
+            // Touch every page like a real consumer would
+            for (i = 0; i < f.size; i += 4096)
+                sum += map[i];
+            munmap((void *)map, f.size);
+        }
+        close(fd);
+    }
+    close(sock);
+    return (void *)(uintptr_t)sum;
+}
+
+struct source
+{
+    struct frame_service *svc;
+    unsigned int fps;
+};
+
+// Synthetic YUYV source: a moving gradient
+static void *source_thread(void *arg)
+{
+    struct source *src = arg;
+    static unsigned char frame[SOURCE_WIDTH * SOURCE_HEIGHT * 2];
+    struct timespec next, now;
+    unsigned int n = 0, i;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (!stop)
+    {
+        for (i = 0; i < sizeof(frame); i++)
+            frame[i] = (i & 1) ? 128 : (unsigned char)(i / 2 + n * 4);
+        clock_gettime(CLOCK_REALTIME, &now);
+        fs_publish(src->svc, frame, sizeof(frame), &now);
+        n++;
+
+        next.tv_nsec += 1000000000 / src->fps;
+        if (next.tv_nsec >= 1000000000)
+        {
+            next.tv_nsec -= 1000000000;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    return NULL;
+}
+
+static double cpu_sec(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-a socket] [-c clients] [-t seconds] [-S] [-r fps]\n"
+                    "  -a  service socket (default /tmp/camera.sock)\n"
+                    "  -c  number of subscribers (default 48, at most %d)\n"
+                    "  -t  test duration in seconds (default 10)\n"
+                    "  -S  host the service with a synthetic %ux%u YUYV source\n"
+                    "  -r  frame rate of the synthetic source (default 30)\n",
+            prog, FS_MAX_CLIENTS, SOURCE_WIDTH, SOURCE_HEIGHT);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = "/tmp/camera.sock";
+    unsigned int clients = 48, seconds = 10, i, p, n;
+    struct source src = { NULL, 30 };
+    struct frame_service svc;
+    struct subscriber *subs;
+    struct fs_stats st;
+    pthread_t source;
+    bool host = false;
+    uint64_t frames;
+    uint32_t dropped;
+    unsigned int bad, failed;
+    double lat_sum, lat_max, cpu;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "a:c:t:Sr:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'a':
+            path = optarg;
+            break;
+        case 'c':
+            clients = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            seconds = strtoul(optarg, NULL, 0);
+            break;
+        case 'S':
+            host = true;
+            break;
+        case 'r':
+            src.fps = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (clients == 0 || clients > FS_MAX_CLIENTS || seconds == 0 || src.fps == 0)
+        usage(argv[0]);
+
+    if (host)
+    {
+        if (fs_start(&svc, path, SOURCE_WIDTH, SOURCE_HEIGHT, V4L2_PIX_FMT_YUYV) == -1)
+        {
+            perror("fs_start");
+            return EXIT_FAILURE;
+        }
+        src.svc = &svc;
+        pthread_create(&source, NULL, source_thread, &src);
+    }
+
+    subs = calloc(clients, sizeof(*subs));
+    if (!subs)
+        return EXIT_FAILURE;
+    cpu = cpu_sec();
+    for (i = 0; i < clients; i++)
+    {
+        subs[i].path = path;
+        subs[i].profile = &profiles[i % N_PROFILES];
+        pthread_create(&subs[i].thread, NULL, subscriber_thread, &subs[i]);
+    }
+    sleep(seconds);
+    stop = true;
+    for (i = 0; i < clients; i++)
+        pthread_join(subs[i].thread, NULL);
+    cpu = cpu_sec() - cpu;
+
+    printf("%-14s %8s %12s %12s %12s %8s %6s\n", "profile", "clients", "fps/client", "avg_lat_ms", "max_lat_ms",
+           "dropped", "bad");
+    for (p = 0; p < N_PROFILES; p++)
+    {
+        n = failed = bad = 0;
+        frames = dropped = 0;
+        lat_sum = lat_max = 0;
+        for (i = p; i < clients; i += N_PROFILES)
+        {
+            n++;
+            failed += subs[i].failed;
+            frames += subs[i].frames;
+            dropped += subs[i].dropped;
+            bad += subs[i].bad;
+            lat_sum += subs[i].latency_sum_ms;
+            if (subs[i].latency_max_ms > lat_max)
+                lat_max = subs[i].latency_max_ms;
+        }
+        if (n == 0)
+            continue;
+        printf("%-14s %8u %12.1f %12.2f %12.2f %8u %6u", profiles[p].name, n, (double)frames / n / seconds,
+               frames ? lat_sum / frames : 0, lat_max, dropped, bad);
+        if (failed)
+            printf("  (%u could not subscribe)", failed);
+        printf("\n");
+    }
+
+    if (host)
+    {
+        fs_get_stats(&svc, &st);
+        printf("published %llu, skipped %llu, conversions %llu, delivered %llu (%.1f per conversion), "
+               "dropped %llu\n", (unsigned long long)st.published, (unsigned long long)st.skipped,
+               (unsigned long long)st.conversions, (unsigned long long)st.delivered,
+               st.conversions ? (double)st.delivered / st.conversions : 0, (unsigned long long)st.dropped);
+        pthread_join(source, NULL);
+        fs_stop(&svc);
+    }
+    printf("process CPU: %.1f%% of one core\n", cpu * 100 / seconds);
+    free(subs);
+    return 0;
+}
@@ -0,0 +1,715 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Frame storage benchmark
+ *
+ * Replays the camera_driver frame-write workload against a directory and
+ * reports throughput, the p50/p99/max time a frame write blocks the
+ * caller, CPU time per MB written and how much of another process'
+ * working set survived in the page cache (its hit rate if it re-read the
+ * data right now).
+ *
+ * Strategies: per-file write() as dump_ppm does it, per-file writev() of
+ * header and pixels, per-file O_DIRECT, batched container appends, and
+ * asynchronous O_DIRECT appends through io_uring (raw system calls, no
+ * liburing needed; skipped where the kernel refuses io_uring).
+ *
+ * With -p every mode applies a durability policy and also reports the
+ * number of syncs and the worst data-loss window (frames and ms that a
+ * power cut at the worst moment would have cost).
+ *
+ * usage: storage_bench [-d dir] [-n frames] [-s frame_bytes] [-w working_set_MB] [-p policy] [mode...]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <linux/videodev2.h>
+#include <linux/io_uring.h>
+
+#include "frame_writer.h"
+#include "frame_container.h"
+#include "durability.h"
+
+// Default frame: 320x240 RGB plus the dump_ppm header
+#define DEFAULT_FRAME_BYTES (320 * 240 * 3 + 50)
+#define PPM_HEADER_BYTES    50
+
+// io_uring mode: frames in flight, and the alignment O_DIRECT needs
+#define URING_DEPTH         8
+#define URING_ALIGN         4096
+
+struct bench_config
+{
+    const char *dir;
+    unsigned int frames;
+    size_t frame_bytes;
+    size_t working_set;
+    struct durability_policy policy;
+};
+
+struct bench_result
+{
+    double seconds;
+    double *latency_ms;         // One per frame write (plus one for a final flush)
+    unsigned int samples;
+    unsigned int failures;
+    bool unavailable;           // Strategy not supported here
+    struct durability dur;
+};
+
+typedef int (*bench_fn)(const struct bench_config *cfg, const unsigned char *frame, struct bench_result *res);
+
+struct bench_mode
+{
+    const char *name;
+    const char *description;
+    bench_fn run;
+};
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void frame_path(char *path, size_t len, const struct bench_config *cfg, unsigned int tag)
+{
+    snprintf(path, len, "%s/bench%08u.ppm", cfg->dir, tag);
+}
+
+/*
+ * Record the latency of one frame write in the result
+ *
+ * Parameters:
+ *   struct bench_result *res -> Result to update
+ *   double start -> now_sec() before the write
+ *
+ * Returns:
+ *   None
+ */
+static void note_latency(struct bench_result *res, double start)
+{
+    res->latency_ms[res->samples++] = (now_sec() - start) * 1000.0;
+}
+
+// User plus system CPU time of the process
+static double cpu_ms(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e3 + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e3;
+}
+
+static int by_value(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+// Percentile of the sorted latencies
+static double percentile(const struct bench_result *res, double p)
+{
+    unsigned int i = (unsigned int)(p / 100 * (res->samples - 1) + 0.5);
+
+    return res->samples ? res->latency_ms[i] : 0;
+}
+
+// One file per frame through the page cache, as dump_ppm does it
+static int run_buffered(const struct bench_config *cfg, const unsigned char *frame, struct bench_result *res)
+{
+    char path[512];
+    unsigned int i;
+    size_t done;
+    ssize_t written;
+    double start;
+    int fd;
+
+    for (i = 0; i < cfg->frames; i++)
+    {
+        start = now_sec();
+        frame_path(path, sizeof(path), cfg, i);
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 00666);
+        if (fd == -1)
+        {
+            res->failures++;
+            continue;
+        }
+        for (done = 0; done < cfg->frame_bytes; done += written)
+        {
+            written = write(fd, frame + done, cfg->frame_bytes - done);
+            if (written <= 0)
+            {
+                res->failures++;
+                break;
+            }
+        }
+        if (dur_frame_written(&res->dur))
+            dur_sync(&res->dur, fd, cfg->frame_bytes, path);
+        close(fd);
+        note_latency(res, start);
+    }
+    return 0;
+}
+
+// One file per frame, header and pixels in a single writev() as dump_ppm could do it
+static int run_writev(const struct bench_config *cfg, const unsigned char *frame, struct bench_result *res)
+{
+    size_t header = cfg->frame_bytes > PPM_HEADER_BYTES ? PPM_HEADER_BYTES : 0;
+    struct iovec iov[2];
+    char path[512];
+    unsigned int i;
+    ssize_t written;
+    double start;
+    int fd;
+
+    for (i = 0; i < cfg->frames; i++)
+    {
+        start = now_sec();
+        frame_path(path, sizeof(path), cfg, i);
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 00666);
+        if (fd == -1)
+        {
+            res->failures++;
+            continue;
+        }
+        iov[0].iov_base = (void *)frame;
+        iov[0].iov_len = header;
+        iov[1].iov_base = (void *)(frame + header);
+        iov[1].iov_len = cfg->frame_bytes - header;
+        written = writev(fd, iov, 2);
+        // A short write is finished with plain write()s, as the kernel rarely splits a regular file write
+        while (written >= 0 && (size_t)written < cfg->frame_bytes)
+        {
+            ssize_t more = write(fd, frame + written, cfg->frame_bytes - written);
+
+            written = more <= 0 ? -1 : written + more;
+        }
+        if (written == -1)
+            res->failures++;
+        if (dur_frame_written(&res->dur))
+            dur_sync(&res->dur, fd, cfg->frame_bytes, path);
+        close(fd);
+        note_latency(res, start);
+    }
+    return 0;
+}
+
+// One file per frame through the aligned O_DIRECT writer
+static int run_direct(const struct bench_config *cfg, const unsigned char *frame, struct bench_result *res)
+{
+    struct frame_writer w;
+    char path[512];
+    unsigned int i;
+    double start;
+    bool warned = false;
+
+    for (i = 0; i < cfg->frames; i++)
+    {
+        start = now_sec();
+        frame_path(path, sizeof(path), cfg, i);
+        if (fw_open(&w, path, true, 0) == -1)
+        {
+            res->failures++;
+            continue;
+        }
+        if (!w.direct && !warned)
+        {
+            fprintf(stderr, "direct: O_DIRECT rejected by %s, using buffered fallback\n", cfg->dir);
+            warned = true;
+        }
+        if (fw_write(&w, frame, cfg->frame_bytes) == -1)
+            res->failures++;
+        else if (dur_frame_written(&res->dur) && fw_flush(&w) == 0)
+            dur_sync(&res->dur, w.fd, w.length, path);
+        if (fw_close(&w) == -1)
+            res->failures++;
+        note_latency(res, start);
+    }
+    return 0;
+}
+
+// Records batched into erase-block sized chunks of preallocated segments
+static int run_container(const struct bench_config *cfg, const unsigned char *frame, struct bench_result *res)
+{
+    struct fc_config fcfg = {
+        .dir = cfg->dir,
+        .width = 320,
+        .height = 240,
+        .pixelformat = V4L2_PIX_FMT_RGB24,
+        .direct = true,
+        .durability = &res->dur,
+    };
+    struct fc_writer cw;
+    struct timespec ts;
+    unsigned int i;
+    double start;
+
+    if (fc_writer_init(&cw, &fcfg) == -1)
+        return -1;
+    for (i = 0; i < cfg->frames; i++)
+    {
+        start = now_sec();
+        clock_gettime(CLOCK_REALTIME, &ts);
+        if (fc_append(&cw, frame, cfg->frame_bytes, &ts, NULL, NULL) == -1)
+            res->failures++;
+        note_latency(res, start);
+    }
+    start = now_sec();
+    if (fc_writer_close(&cw) == -1)
+        res->failures++;
+    note_latency(res, start);
+    return 0;
+}
+
+// Minimal io_uring: one submission and one completion ring, mapped once
+struct uring
+{
+    int fd;
+    void *sq_map;
+    void *cq_map;
+    size_t sq_map_len;
+    size_t cq_map_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+static int uring_init(struct uring *u, unsigned int entries)
+{
+    struct io_uring_params p;
+
+    memset(u, 0, sizeof(*u));
+    memset(&p, 0, sizeof(p));
+    u->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (u->fd == -1)
+        return -1;
+
+    u->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    u->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (u->cq_map_len > u->sq_map_len)
+            u->sq_map_len = u->cq_map_len;
+        u->cq_map_len = 0;
+    }
+    u->sq_map = mmap(NULL, u->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd,
+                     IORING_OFF_SQ_RING);
+    u->cq_map = u->cq_map_len ? mmap(NULL, u->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                     u->fd, IORING_OFF_CQ_RING) : u->sq_map;
+    u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sq_map == MAP_FAILED || u->cq_map == MAP_FAILED || u->sqes == MAP_FAILED)
+    {
+        close(u->fd);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    u->sq_head = (unsigned int *)((char *)u->sq_map + p.sq_off.head);
+    u->sq_tail = (unsigned int *)((char *)u->sq_map + p.sq_off.tail);
+    u->sq_mask = (unsigned int *)((char *)u->sq_map + p.sq_off.ring_mask);
+    u->sq_array = (unsigned int *)((char *)u->sq_map + p.sq_off.array);
+    u->cq_head = (unsigned int *)((char *)u->cq_map + p.cq_off.head);
+    u->cq_tail = (unsigned int *)((char *)u->cq_map + p.cq_off.tail);
+    u->cq_mask = (unsigned int *)((char *)u->cq_map + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)((char *)u->cq_map + p.cq_off.cqes);
+    return 0;
+}
+
+static void uring_exit(struct uring *u)
+{
+    munmap(u->sqes, u->sqes_len);
+    if (u->cq_map != u->sq_map)
+        munmap(u->cq_map, u->cq_map_len);
+    munmap(u->sq_map, u->sq_map_len);
+    close(u->fd);
+}
+
+// Queue and submit one write; the ring never holds more than URING_DEPTH
+static int uring_write(struct uring *u, int fd, const void *buf, size_t len, off_t off, uint64_t user_data)
+{
+    unsigned int tail = *u->sq_tail, index = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->user_data = user_data;
+    u->sq_array[index] = index;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    return syscall(__NR_io_uring_enter, u->fd, 1, 0, 0, NULL, 0) == 1 ? 0 : -1;
+}
+
+/*
+ * Reap one completion, waiting for it if none is ready
+ *
+ * Parameters:
+ *   struct uring *u -> The ring
+ *   uint64_t *user_data -> Of the completed request
+ *
+ * Returns:
+ *   The request's result (bytes written or -errno), or -errno of the wait
+ */
+static int uring_reap(struct uring *u, uint64_t *user_data)
+{
+    unsigned int head = *u->cq_head;
+    struct io_uring_cqe *cqe;
+    int res;
+
+    while (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        if (syscall(__NR_io_uring_enter, u->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) == -1 && errno != EINTR)
+            return -errno;
+    }
+    cqe = &u->cqes[head & *u->cq_mask];
+    *user_data = cqe->user_data;
+    res = cqe->res;
+    __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+    return res;
+}
+
+/*
+ * Asynchronous O_DIRECT appends through io_uring
+ *
+ * Each frame is copied into one of URING_DEPTH aligned slots and
+ * submitted; the caller only blocks when every slot is still in flight,
+ * so the latency reported is the time the capture path would be held.
+ * A due sync waits for the writes in flight first.
+ */
+static int run_uring(const struct bench_config *cfg, const unsigned char *frame, struct bench_result *res)
+{
+    size_t slot_bytes = (cfg->frame_bytes + URING_ALIGN - 1) & ~(size_t)(URING_ALIGN - 1);
+    unsigned int i, free_slots[URING_DEPTH], nfree = URING_DEPTH, inflight = 0;
+    unsigned char *slots;
+    struct uring u;
+    uint64_t done;
+    char path[512];
+    double start;
+    off_t off = 0;
+    int fd, ret;
+
+    if (uring_init(&u, URING_DEPTH) == -1)
+    {
+        fprintf(stderr, "uring: io_uring unavailable: %s\n", strerror(errno));
+        res->unavailable = true;
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s/bench_uring.dat", cfg->dir);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 00666);
+    if (fd == -1)
+    {
+        fprintf(stderr, "uring: O_DIRECT rejected by %s, using buffered writes\n", cfg->dir);
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 00666);
+    }
+    if (fd == -1 || posix_memalign((void **)&slots, URING_ALIGN, slot_bytes * URING_DEPTH) != 0)
+    {
+        if (fd != -1)
+            close(fd);
+        uring_exit(&u);
+        return -1;
+    }
+    // Preallocation is an optimisation only, as in the container writer
+    fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)slot_bytes * cfg->frames);
+    memset(slots, 0, slot_bytes * URING_DEPTH);
+    for (i = 0; i < URING_DEPTH; i++)
+        free_slots[i] = i;
+
+    for (i = 0; i < cfg->frames; i++)
+    {
+        start = now_sec();
+        while (nfree == 0)
+        {
+            ret = uring_reap(&u, &done);
+            if (ret < (int)slot_bytes)
+                res->failures++;
+            free_slots[nfree++] = done;
+            inflight--;
+        }
+        nfree--;
+        memcpy(slots + free_slots[nfree] * slot_bytes, frame, cfg->frame_bytes);
+        if (uring_write(&u, fd, slots + free_slots[nfree] * slot_bytes, slot_bytes, off, free_slots[nfree]) == -1)
+        {
+            res->failures++;
+            nfree++;
+        }
+        else
+        {
+            inflight++;
+            off += slot_bytes;
+        }
+
+        if (dur_frame_written(&res->dur))
+        {
+            for (; inflight; inflight--)
+            {
+                ret = uring_reap(&u, &done);
+                if (ret < (int)slot_bytes)
+                    res->failures++;
+                free_slots[nfree++] = done;
+            }
+            dur_sync(&res->dur, fd, off, path);
+        }
+        note_latency(res, start);
+    }
+
+    start = now_sec();
+    for (; inflight; inflight--)
+    {
+        if (uring_reap(&u, &done) < (int)slot_bytes)
+            res->failures++;
+    }
+    if (dur_finish(&res->dur, fd, path) == -1)
+        res->failures++;
+    note_latency(res, start);
+
+    close(fd);
+    free(slots);
+    uring_exit(&u);
+    return 0;
+}
+
+static const struct bench_mode modes[] = {
+    { "buffered", "per-file open/write/close (dump_ppm)", run_buffered },
+    { "writev", "per-file open/writev/close, header and pixels in one call", run_writev },
+    { "direct", "per-file O_DIRECT aligned writer", run_direct },
+    { "container", "4 MB aligned chunks into preallocated segments", run_container },
+    { "uring", "O_DIRECT appends queued through io_uring, 8 in flight", run_uring },
+};
+
+#define N_MODES (sizeof(modes) / sizeof(modes[0]))
+
+/*
+ * Fraction of a file's pages currently resident in the page cache
+ *
+ * Parameters:
+ *   int fd -> Open file
+ *   size_t size -> File size in bytes
+ *
+ * Returns:
+ *   Resident fraction in [0, 1], or -1 on error
+ */
+static double residency(int fd, size_t size)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    size_t pages = (size + page - 1) / page, i, resident = 0;
+    unsigned char *vec;
+    void *map;
+
+    if (size == 0)
+        return -1;
+    map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        return -1;
+    vec = malloc(pages);
+    if (vec && mincore(map, size, vec) == 0)
+    {
+        for (i = 0; i < pages; i++)
+            resident += vec[i] & 1;
+    }
+    free(vec);
+    munmap(map, size);
+    return (double)resident / pages;
+}
+
+/*
+ * Create (once) and read the working set file so that it is fully cached
+ *
+ * Parameters:
+ *   const struct bench_config *cfg -> Benchmark configuration
+ *
+ * Returns:
+ *   Descriptor of the working set file, or -1 if disabled/failed
+ */
+static int warm_working_set(const struct bench_config *cfg)
+{
+    static unsigned char chunk[1 << 16];
+    char path[512];
+    size_t done;
+    int fd;
+
+    if (cfg->working_set == 0)
+        return -1;
+
+    snprintf(path, sizeof(path), "%s/bench_working_set", cfg->dir);
+    fd = open(path, O_RDWR | O_CREAT, 00666);
+    if (fd == -1)
+        return -1;
+
+    if ((size_t)lseek(fd, 0, SEEK_END) != cfg->working_set)
+    {
+        memset(chunk, 0xa5, sizeof(chunk));
+        if (ftruncate(fd, 0) == -1)
+            return -1;
+        for (done = 0; done < cfg->working_set; done += sizeof(chunk))
+        {
+            if (write(fd, chunk, sizeof(chunk)) != sizeof(chunk))
+                break;
+        }
+    }
+
+    lseek(fd, 0, SEEK_SET);
+    while (read(fd, chunk, sizeof(chunk)) > 0)
+        ;
+    return fd;
+}
+
+static void cleanup(const struct bench_config *cfg)
+{
+    char path[512];
+    unsigned int i;
+    struct dirent *de;
+    DIR *d;
+
+    for (i = 0; i < cfg->frames; i++)
+    {
+        frame_path(path, sizeof(path), cfg, i);
+        unlink(path);
+    }
+
+    snprintf(path, sizeof(path), "%s/bench_uring.dat", cfg->dir);
+    unlink(path);
+
+    d = opendir(cfg->dir);
+    while (d && (de = readdir(d)) != NULL)
+    {
+        size_t len = strlen(de->d_name);
+
+        if (strncmp(de->d_name, "seg", 3) == 0 && len > 4 &&
+            (strcmp(de->d_name + len - 4, ".fcs") == 0 || strcmp(de->d_name + len - 4, ".idx") == 0))
+        {
+            snprintf(path, sizeof(path), "%s/%s", cfg->dir, de->d_name);
+            unlink(path);
+        }
+    }
+    if (d)
+        closedir(d);
+}
+
+static void usage(const char *prog)
+{
+    size_t i;
+
+    fprintf(stderr, "usage: %s [-d dir] [-n frames] [-s frame_bytes] [-w working_set_MB] [-p policy] [mode...]\n"
+                    "policy: none, frames:N, ms:M, frames:N,ms:M or writeback\nmodes:\n", prog);
+    for (i = 0; i < N_MODES; i++)
+        fprintf(stderr, "  %-10s %s\n", modes[i].name, modes[i].description);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    struct bench_config cfg = { ".", 500, DEFAULT_FRAME_BYTES, 64u << 20 };
+    struct bench_result res;
+    unsigned char *frame;
+    double *latency;
+    char path[512];
+    double mb, hit, cpu;
+    size_t i;
+    int opt, ws_fd, a;
+    bool any = false;
+
+    while ((opt = getopt(argc, argv, "d:n:s:w:p:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'd':
+            cfg.dir = optarg;
+            break;
+        case 'n':
+            cfg.frames = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            cfg.frame_bytes = strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            cfg.working_set = strtoul(optarg, NULL, 0) << 20;
+            break;
+        case 'p':
+            if (dur_parse(optarg, &cfg.policy) == -1)
+                usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    frame = malloc(cfg.frame_bytes);
+    latency = malloc((cfg.frames + 1) * sizeof(*latency));
+    if (!frame || !latency || cfg.frames == 0)
+        usage(argv[0]);
+    for (i = 0; i < cfg.frame_bytes; i++)
+        frame[i] = (unsigned char)(i * 31);
+
+    printf("%-10s %9s %9s %8s %8s %8s %9s %8s %7s %6s %8s %8s\n", "mode", "MB/s", "frames/s", "p50_ms", "p99_ms",
+           "max_ms", "cpu_ms/MB", "ws_hit_%", "errors", "syncs", "loss_frm", "loss_ms");
+    for (i = 0; i < N_MODES; i++)
+    {
+        for (a = optind; a < argc; a++)
+        {
+            if (strcmp(argv[a], modes[i].name) == 0)
+                break;
+        }
+        if (optind < argc && a == argc)
+            continue;
+        any = true;
+
+        ws_fd = warm_working_set(&cfg);
+        memset(&res, 0, sizeof(res));
+        res.latency_ms = latency;
+        dur_init(&res.dur, &cfg.policy, strcmp(modes[i].name, "container") == 0 ? DUR_SCOPE_STREAM : DUR_SCOPE_FILE,
+                 NULL, NULL);
+        cpu = cpu_ms();
+        res.seconds = now_sec();
+        modes[i].run(&cfg, frame, &res);
+        res.seconds = now_sec() - res.seconds;
+        cpu = cpu_ms() - cpu;
+        qsort(res.latency_ms, res.samples, sizeof(*res.latency_ms), by_value);
+
+        hit = ws_fd == -1 ? -1 : residency(ws_fd, cfg.working_set) * 100.0;
+        if (ws_fd != -1)
+            close(ws_fd);
+        cleanup(&cfg);
+
+        if (res.unavailable)
+        {
+            printf("%-10s unavailable\n", modes[i].name);
+            continue;
+        }
+        mb = (double)cfg.frame_bytes * cfg.frames / (1 << 20);
+        printf("%-10s %9.1f %9.1f %8.3f %8.3f %8.2f %9.2f %8.1f %7u %6u %8u %8.1f\n", modes[i].name,
+               mb / res.seconds, cfg.frames / res.seconds, percentile(&res, 50), percentile(&res, 99),
+               res.samples ? res.latency_ms[res.samples - 1] : 0, cpu / mb, hit, res.failures + res.dur.events,
+               res.dur.syncs, res.dur.max_loss_frames, res.dur.max_loss_ns / 1e6);
+    }
+    if (!any)
+        usage(argv[0]);
+
+    snprintf(path, sizeof(path), "%s/bench_working_set", cfg.dir);
+    unlink(path);
+    free(latency);
+    free(frame);
+    return 0;
+}
@@ -0,0 +1,262 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Timelapse by on-the-fly frame averaging
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "timelapse.h"
+#include "memacct.h"
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Add a frame to 16-bit partial sums
+ *
+ * Parameters:
+ *   uint16_t *partial -> n partial sums
+ *   const uint8_t *frame -> n samples
+ *   size_t n -> Number of samples
+ *
+ * Returns:
+ *   None
+ */
+void tl_accumulate(uint16_t *partial, const uint8_t *frame, size_t n)
+{
+    size_t i = 0;
+
+#if defined(__x86_64__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i v;
+
+    for (; i + 16 <= n; i += 16)
+    {
+        v = _mm_loadu_si128((const __m128i *)(frame + i));
+        _mm_storeu_si128((__m128i *)(partial + i),
+                         _mm_add_epi16(_mm_loadu_si128((const __m128i *)(partial + i)), _mm_unpacklo_epi8(v, zero)));
+        _mm_storeu_si128((__m128i *)(partial + i + 8),
+                         _mm_add_epi16(_mm_loadu_si128((const __m128i *)(partial + i + 8)),
+                                       _mm_unpackhi_epi8(v, zero)));
+    }
+#elif defined(__ARM_NEON)
+    uint8x16_t v;
+
+    for (; i + 16 <= n; i += 16)
+    {
+        v = vld1q_u8(frame + i);
+        vst1q_u16(partial + i, vaddw_u8(vld1q_u16(partial + i), vget_low_u8(v)));
+        vst1q_u16(partial + i + 8, vaddw_u8(vld1q_u16(partial + i + 8), vget_high_u8(v)));
+    }
+#endif
+    for (; i < n; i++)
+        partial[i] += frame[i];
+}
+
+/*
+ * Add the partial sums into the 32-bit totals and clear them
+ *
+ * Parameters:
+ *   uint32_t *total -> n totals
+ *   uint16_t *partial -> n partial sums, zero afterwards
+ *   size_t n -> Number of samples
+ *
+ * Returns:
+ *   None
+ */
+void tl_fold(uint32_t *total, uint16_t *partial, size_t n)
+{
+    size_t i = 0;
+
+#if defined(__x86_64__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i v;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        v = _mm_loadu_si128((const __m128i *)(partial + i));
+        _mm_storeu_si128((__m128i *)(total + i),
+                         _mm_add_epi32(_mm_loadu_si128((const __m128i *)(total + i)), _mm_unpacklo_epi16(v, zero)));
+        _mm_storeu_si128((__m128i *)(total + i + 4),
+                         _mm_add_epi32(_mm_loadu_si128((const __m128i *)(total + i + 4)),
+                                       _mm_unpackhi_epi16(v, zero)));
+    }
+#elif defined(__ARM_NEON)
+    uint16x8_t v;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        v = vld1q_u16(partial + i);
+        vst1q_u32(total + i, vaddw_u16(vld1q_u32(total + i), vget_low_u16(v)));
+        vst1q_u32(total + i + 4, vaddw_u16(vld1q_u32(total + i + 4), vget_high_u16(v)));
+    }
+#endif
+    for (; i < n; i++)
+        total[i] += partial[i];
+    memset(partial, 0, n * sizeof(*partial));
+}
+
+/*
+ * Rounded average of the totals
+ *
+ * Runs once per window, so plain division is fine here.
+ *
+ * Parameters:
+ *   const uint32_t *total -> n totals
+ *   size_t n -> Number of samples
+ *   uint32_t window -> Frames summed
+ *   uint8_t *out -> n averaged samples
+ *
+ * Returns:
+ *   None
+ */
+void tl_average(const uint32_t *total, size_t n, uint32_t window, uint8_t *out)
+{
+    uint32_t half = window / 2;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        out[i] = (total[i] + half) / window;
+}
+
+/*
+ * Name of the accumulation kernel in use
+ *
+ * Parameters:
+ *   None
+ *
+ * Returns:
+ *   "sse2", "neon" or "scalar"
+ */
+const char *tl_impl(void)
+{
+#if defined(__x86_64__)
+    return "sse2";
+#elif defined(__ARM_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
+
+/*
+ * Set up a timelapse
+ *
+ * Parameters:
+ *   struct timelapse *tl -> Timelapse to initialise
+ *   size_t samples -> Bytes per raw frame
+ *   uint32_t window -> Frames averaged into one (1..TL_MAX_WINDOW)
+ *   uint32_t interval_sec -> Seconds between window starts, 0 for back to back
+ *
+ * Returns:
+ *   0 on success, -1 with errno set (EINVAL, ENOMEM)
+ */
+int tl_init(struct timelapse *tl, size_t samples, uint32_t window, uint32_t interval_sec)
+{
+    memset(tl, 0, sizeof(*tl));
+    if (samples == 0 || window == 0 || window > TL_MAX_WINDOW)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    tl->samples = samples;
+    tl->window = window;
+    tl->interval_ns = (uint64_t)interval_sec * 1000000000;
+    tl->partial = calloc(samples, sizeof(*tl->partial));
+    tl->total = calloc(samples, sizeof(*tl->total));
+    tl->out = malloc(samples);
+    if (!tl->partial || !tl->total || !tl->out)
+    {
+        tl_free(tl);
+        errno = ENOMEM;
+        return -1;
+    }
+    mem_charge(MEM_CONVERT, samples * (sizeof(*tl->partial) + sizeof(*tl->total) + 1));
+    return 0;
+}
+
+/*
+ * Offer the next captured frame
+ *
+ * Parameters:
+ *   struct timelapse *tl -> The timelapse
+ *   const uint8_t *frame -> Raw frame of tl->samples bytes
+ *   const struct timespec *time -> Its capture time
+ *
+ * Returns:
+ *   The averaged frame when this frame completed a window (valid until the
+ *   next call; tl->first holds the capture time of the window's first
+ *   frame), NULL otherwise
+ */
+const uint8_t *tl_add(struct timelapse *tl, const uint8_t *frame, const struct timespec *time)
+{
+    uint64_t now;
+
+    if (tl->frames == 0)
+    {
+        now = now_ns();
+        if (tl->window_start_ns && tl->interval_ns)
+        {
+            if (now < tl->window_start_ns + tl->interval_ns)
+                return NULL;
+            // Stay on the interval grid unless a whole interval was missed
+            if (now < tl->window_start_ns + 2 * tl->interval_ns)
+                tl->window_start_ns += tl->interval_ns;
+            else
+                tl->window_start_ns = now;
+        }
+        else
+            tl->window_start_ns = now;
+        tl->first = *time;
+    }
+
+    tl_accumulate(tl->partial, frame, tl->samples);
+    tl->frames++;
+    if (tl->frames % TL_PARTIAL_FRAMES == 0 && tl->frames < tl->window)
+        tl_fold(tl->total, tl->partial, tl->samples);
+    if (tl->frames < tl->window)
+        return NULL;
+
+    tl_fold(tl->total, tl->partial, tl->samples);
+    tl_average(tl->total, tl->samples, tl->window, tl->out);
+    memset(tl->total, 0, tl->samples * sizeof(*tl->total));
+    tl->frames = 0;
+    tl->emitted++;
+    return tl->out;
+}
+
+/*
+ * Release the timelapse buffers
+ *
+ * Parameters:
+ *   struct timelapse *tl -> The timelapse
+ *
+ * Returns:
+ *   None
+ */
+void tl_free(struct timelapse *tl)
+{
+    if (tl->partial && tl->total && tl->out)
+        mem_release(MEM_CONVERT, tl->samples * (sizeof(*tl->partial) + sizeof(*tl->total) + 1));
+    free(tl->partial);
+    free(tl->total);
+    free(tl->out);
+    memset(tl, 0, sizeof(*tl));
+}
@@ -0,0 +1,52 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Timelapse by on-the-fly frame averaging
+ *
+ * A window of consecutive raw frames is summed sample by sample (luma
+ * and chroma alike) and emitted as one averaged frame, which removes most
+ * of the sensor noise of a static scene; the frames in between are never
+ * stored. Each frame is added to 16-bit partial sums with SIMD (SSE2 on
+ * x86, NEON on ARM), which cuts the per-frame memory traffic almost in
+ * half compared with 32-bit sums; the partial sums are folded into 32-bit
+ * totals every 256 frames, before they can overflow, so a window may be
+ * up to TL_MAX_WINDOW frames long. Windows start every interval seconds,
+ * or back to back.
+ */
+
+#ifndef TIMELAPSE_H
+#define TIMELAPSE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+// 255 * TL_MAX_WINDOW still fits the 32-bit totals
+#define TL_MAX_WINDOW  (1u << 24)
+
+// Frames a 16-bit partial sum can take before it is folded into the totals
+#define TL_PARTIAL_FRAMES  256
+
+struct timelapse
+{
+    size_t samples;             // Bytes per frame
+    uint32_t window;            // Frames averaged into one
+    uint64_t interval_ns;       // Between window starts, 0 for back to back
+    uint16_t *partial;
+    uint32_t *total;
+    uint8_t *out;               // Last averaged frame
+    uint32_t frames;            // Frames in the current window
+    uint64_t window_start_ns;   // Monotonic start of the current (or last) window
+    struct timespec first;      // Capture time of the first frame of the window
+    uint64_t emitted;
+};
+
+int tl_init(struct timelapse *tl, size_t samples, uint32_t window, uint32_t interval_sec);
+const uint8_t *tl_add(struct timelapse *tl, const uint8_t *frame, const struct timespec *time);
+void tl_free(struct timelapse *tl);
+
+void tl_accumulate(uint16_t *partial, const uint8_t *frame, size_t n);
+void tl_fold(uint32_t *total, uint16_t *partial, size_t n);
+void tl_average(const uint32_t *total, size_t n, uint32_t window, uint8_t *out);
+const char *tl_impl(void);
+
+#endif
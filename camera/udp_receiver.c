@@ -0,0 +1,417 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Receiver for the paced UDP frame stream
+ *
+ * Reassembles frames sent by "camera_driver -N host:port" (udp_stream.h)
+ * with recvmmsg() and reports once a second the complete frames, frames
+ * and datagrams lost, throughput and capture-to-reassembly latency.
+ *
+ * With -S the tool also runs the streamer itself against the loopback
+ * interface, feeding it synthetic frames at the given rate, and checks
+ * the content of every reassembled frame.
+ *
+ * usage: udp_receiver [-p port] [-t seconds] [-S fps] [-s frame_bytes] [-m mtu] [-P pace_percent]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <endian.h>
+#include <poll.h>
+#include <time.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <linux/videodev2.h>
+
+#include "udp_stream.h"
+
+#define RX_BATCH        64
+#define RX_DATAGRAM     9216            // Up to jumbo frames
+#define RX_SLOTS        8               // Frames being reassembled at once
+#define RX_RCVBUF       (8u << 20)
+
+struct slot
+{
+    bool used;
+    uint32_t frame;
+    uint32_t size;
+    uint32_t received;          // Payload bytes
+    uint32_t datagrams;
+    int64_t timestamp_ns;
+    unsigned char *data;
+    uint32_t cap;
+};
+
+struct rx_stats
+{
+    uint64_t complete;
+    uint64_t incomplete;        // Evicted with fragments missing
+    uint64_t missing;           // Never seen at all
+    uint64_t corrupt;           // Complete but wrong content (-S only)
+    uint64_t datagrams;
+    uint64_t datagrams_lost;
+    uint64_t bytes;
+    double latency_sum_ms;
+    double latency_max_ms;
+};
+
+struct receiver
+{
+    struct slot slots[RX_SLOTS];
+    bool started;
+    uint32_t newest;            // Highest frame number seen
+    uint32_t payload;           // Largest fragment seen, i.e. the sender's fragment size
+    bool verify;
+    struct rx_stats st;
+};
+
+struct source
+{
+    struct udp_stream *stream;
+    unsigned int fps;
+    size_t frame_bytes;
+};
+
+static volatile bool stop;
+
+static double realtime_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Synthetic frames: source frame number n, then bytes (n + i) & 0xff
+static void *source_thread(void *arg)
+{
+    struct source *src = arg;
+    unsigned char *frame = src->frame_bytes >= 4 ? malloc(src->frame_bytes) : NULL;
+    struct timespec next, now;
+    uint32_t n = 1;
+    size_t i;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (frame && !stop)
+    {
+        memcpy(frame, &n, sizeof(n));
+        for (i = sizeof(n); i < src->frame_bytes; i++)
+            frame[i] = (unsigned char)(n + i);
+        clock_gettime(CLOCK_REALTIME, &now);
+        us_publish(src->stream, frame, src->frame_bytes, &now);
+        n++;
+
+        next.tv_nsec += 1000000000 / src->fps;
+        while (next.tv_nsec >= 1000000000)
+        {
+            next.tv_nsec -= 1000000000;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    free(frame);
+    return NULL;
+}
+
+/*
+ * Account for a frame leaving its reassembly slot
+ *
+ * Parameters:
+ *   struct receiver *rx -> Receiver state
+ *   struct slot *s -> The slot being evicted
+ *
+ * Returns:
+ *   None
+ */
+static void evict(struct receiver *rx, struct slot *s)
+{
+    uint32_t expected;
+
+    if (!s->used)
+        return;
+    if (s->received < s->size)
+    {
+        rx->st.incomplete++;
+        expected = rx->payload ? (s->size + rx->payload - 1) / rx->payload : s->datagrams;
+        if (expected > s->datagrams)
+            rx->st.datagrams_lost += expected - s->datagrams;
+    }
+    s->used = false;
+}
+
+/*
+ * Handle one datagram
+ *
+ * Parameters:
+ *   struct receiver *rx -> Receiver state
+ *   const unsigned char *buf -> Datagram
+ *   size_t len -> Datagram length
+ *
+ * Returns:
+ *   None
+ */
+static void receive(struct receiver *rx, const unsigned char *buf, size_t len)
+{
+    struct us_header h;
+    struct slot *s;
+    uint32_t frame, offset, size, payload, i, n;
+    unsigned char *grown;
+    double lat;
+
+    if (len < sizeof(h))
+        return;
+    memcpy(&h, buf, sizeof(h));
+    if (ntohl(h.magic) != US_MAGIC)
+        return;
+    frame = ntohl(h.frame);
+    offset = ntohl(h.offset);
+    size = ntohl(h.frame_size);
+    payload = len - sizeof(h);
+    if (offset > size || payload > size - offset)
+        return;
+
+    rx->st.datagrams++;
+    rx->st.bytes += payload;
+    if (payload > rx->payload)
+        rx->payload = payload;
+
+    if (!rx->started)
+    {
+        rx->started = true;
+        rx->newest = frame - 1;
+    }
+    // Frame numbers wrap; compare by signed difference. Skipped frames count as
+    // missing until (if ever) a datagram of theirs shows up out of order
+    if ((int32_t)(frame - rx->newest) > 0)
+    {
+        rx->st.missing += frame - rx->newest - 1;
+        rx->newest = frame;
+    }
+    else if ((int32_t)(rx->newest - frame) >= RX_SLOTS)
+        return;     // Too late to place
+
+    s = &rx->slots[frame % RX_SLOTS];
+    if (!s->used || s->frame != frame)
+    {
+        evict(rx, s);
+        if (frame != rx->newest && rx->st.missing)
+            rx->st.missing--;
+        if (size > s->cap)
+        {
+            grown = realloc(s->data, size);
+            if (!grown)
+                return;
+            s->data = grown;
+            s->cap = size;
+        }
+        s->used = true;
+        s->frame = frame;
+        s->size = size;
+        s->received = 0;
+        s->datagrams = 0;
+        s->timestamp_ns = be64toh(h.timestamp_ns);
+    }
+    memcpy(s->data + offset, buf + sizeof(h), payload);
+    s->received += payload;
+    s->datagrams++;
+    if (s->received < s->size)
+        return;
+
+    rx->st.complete++;
+    lat = realtime_ms() - s->timestamp_ns / 1e6;
+    rx->st.latency_sum_ms += lat;
+    if (lat > rx->st.latency_max_ms)
+        rx->st.latency_max_ms = lat;
+    if (rx->verify && s->size >= sizeof(n))
+    {
+        memcpy(&n, s->data, sizeof(n));
+        for (i = sizeof(n); i < s->size; i++)
+        {
+            if (s->data[i] != (unsigned char)(n + i))
+            {
+                rx->st.corrupt++;
+                break;
+            }
+        }
+    }
+    s->used = false;
+}
+
+static void report(const char *label, const struct rx_stats *d, double seconds)
+{
+    uint64_t sent = d->datagrams + d->datagrams_lost;
+
+    printf("%-8s %9.1f %9.1f %10llu %10llu %9.3f %10.2f %10.2f %8llu\n", label, d->complete / seconds,
+           d->bytes * 8 / seconds / 1e6, (unsigned long long)(d->incomplete + d->missing),
+           (unsigned long long)d->datagrams_lost, sent ? d->datagrams_lost * 100.0 / sent : 0,
+           d->complete ? d->latency_sum_ms / d->complete : 0, d->latency_max_ms, (unsigned long long)d->corrupt);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-p port] [-t seconds] [-S fps] [-s frame_bytes] [-m mtu] [-P pace_percent]\n"
+                    "  -p  UDP port to listen on (default 5000)\n"
+                    "  -t  stop after this many seconds (default: run until killed)\n"
+                    "  -S  also stream synthetic frames at fps to 127.0.0.1 and verify them\n"
+                    "  -s  synthetic frame size (default 153600, 320x240 YUYV)\n"
+                    "  -m  streamer MTU (default %d)\n"
+                    "  -P  streamer pacing window in percent of the frame interval (default %d)\n",
+            prog, US_MTU, US_PACE_PERCENT);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    static unsigned char bufs[RX_BATCH][RX_DATAGRAM];
+    struct mmsghdr msgs[RX_BATCH];
+    struct iovec iov[RX_BATCH];
+    struct udp_stream_config cfg = { "127.0.0.1", "5000", 0, 0, 0 };
+    struct udp_stream stream;
+    struct udp_stream_stats ss;
+    struct source src = { &stream, 0, 320 * 240 * 2 };
+    struct receiver rx;
+    struct rx_stats last;
+    struct sockaddr_in addr;
+    struct pollfd pfd;
+    pthread_t source;
+    const char *port = "5000";
+    unsigned int seconds = 0, i;
+    int sock, n, opt, rcvbuf = RX_RCVBUF;
+    double start, tick, now;
+    socklen_t optlen = sizeof(rcvbuf);
+
+    while ((opt = getopt(argc, argv, "p:t:S:s:m:P:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            port = optarg;
+            break;
+        case 't':
+            seconds = strtoul(optarg, NULL, 0);
+            break;
+        case 'S':
+            src.fps = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            src.frame_bytes = strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            cfg.mtu = strtoul(optarg, NULL, 0);
+            break;
+        case 'P':
+            cfg.pace_percent = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (src.frame_bytes < 4 || cfg.mtu > RX_DATAGRAM)
+        usage(argv[0]);
+
+    sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(port));
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (sock == -1 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        perror("bind");
+        return EXIT_FAILURE;
+    }
+    // A full frame must fit while the reader is descheduled; FORCE works for root
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) == -1)
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    getsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &optlen);
+    fprintf(stderr, "listening on port %s, receive buffer %d KB\n", port, rcvbuf >> 10);
+
+    memset(&rx, 0, sizeof(rx));
+    if (src.fps)
+    {
+        cfg.port = port;
+        if (us_start(&stream, &cfg, 0, 0, V4L2_PIX_FMT_YUYV, src.frame_bytes) == -1)
+        {
+            perror("us_start");
+            return EXIT_FAILURE;
+        }
+        rx.verify = true;
+        pthread_create(&source, NULL, source_thread, &src);
+    }
+
+    for (i = 0; i < RX_BATCH; i++)
+    {
+        iov[i].iov_base = bufs[i];
+        iov[i].iov_len = RX_DATAGRAM;
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    printf("%-8s %9s %9s %10s %10s %9s %10s %10s %8s\n", "time_s", "frames/s", "Mbit/s", "lost_frm", "lost_dgram",
+           "loss_%", "avg_lat_ms", "max_lat_ms", "corrupt");
+    start = tick = now_sec();
+    last = rx.st;
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+    while (!stop)
+    {
+        if (poll(&pfd, 1, 100) > 0)
+        {
+            n = recvmmsg(sock, msgs, RX_BATCH, MSG_DONTWAIT, NULL);
+            for (i = 0; n > 0 && i < (unsigned int)n; i++)
+                receive(&rx, bufs[i], msgs[i].msg_len);
+        }
+
+        now = now_sec();
+        if (now - tick >= 1.0)
+        {
+            char label[16];
+            struct rx_stats d = rx.st;
+
+            d.complete -= last.complete;
+            d.incomplete -= last.incomplete;
+            d.missing -= last.missing;
+            d.corrupt -= last.corrupt;
+            d.datagrams -= last.datagrams;
+            d.datagrams_lost -= last.datagrams_lost;
+            d.bytes -= last.bytes;
+            d.latency_sum_ms -= last.latency_sum_ms;
+            snprintf(label, sizeof(label), "%.0f", now - start);
+            report(label, &d, now - tick);
+            rx.st.latency_max_ms = 0;
+            last = rx.st;
+            tick = now;
+        }
+        if (seconds && now - start >= seconds)
+            stop = true;
+    }
+
+    if (src.fps)
+    {
+        pthread_join(source, NULL);
+        us_get_stats(&stream, &ss);
+        us_stop(&stream);
+        printf("sent %llu frames (%llu skipped), %llu datagrams, %llu send errors\n",
+               (unsigned long long)ss.frames, (unsigned long long)ss.skipped, (unsigned long long)ss.datagrams,
+               (unsigned long long)ss.send_errors);
+    }
+    close(sock);
+    for (i = 0; i < RX_SLOTS; i++)
+        free(rx.slots[i].data);
+    return 0;
+}
@@ -0,0 +1,364 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Paced UDP streaming of raw frames
+ *
+ * The capture thread copies the newest frame into a hand-over buffer;
+ * the stream thread fragments and paces it. A frame that is still
+ * pending when the next one arrives is replaced, so a slow link costs
+ * whole frames rather than building up latency.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <endian.h>
+#include <netdb.h>
+#include <syslog.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "udp_stream.h"
+#include "memacct.h"
+
+#define US_DEFAULT_INTERVAL_NS  33333333
+#define US_MIN_WINDOW_NS        1000000
+#define US_SNDBUF               (1u << 20)
+
+static int64_t now_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until(int64_t t)
+{
+    struct timespec ts = { t / 1000000000, t % 1000000000 };
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+/*
+ * Parse "host:port" (the last colon separates the port)
+ *
+ * Parameters:
+ *   const char *s -> Option string, e.g. "192.168.1.20:5000"
+ *   struct udp_stream_config *cfg -> host and port are set
+ *   char *buf -> Storage for the host and port strings
+ *   size_t len -> Size of buf
+ *
+ * Returns:
+ *   0 on success, -1 on a malformed string
+ */
+int us_parse(const char *s, struct udp_stream_config *cfg, char *buf, size_t len)
+{
+    char *colon;
+
+    if (strlen(s) >= len)
+        return -1;
+    strcpy(buf, s);
+    colon = strrchr(buf, ':');
+    if (!colon || colon == buf || colon[1] == '\0')
+        return -1;
+    *colon = '\0';
+    cfg->host = buf;
+    cfg->port = colon + 1;
+    return 0;
+}
+
+/*
+ * Send one frame as paced sendmmsg() batches
+ *
+ * Parameters:
+ *   struct udp_stream *s -> The stream
+ *   const struct us_header *h -> Frame header (host order)
+ *   size_t size -> Frame bytes in s->sending
+ *   int64_t window_ns -> Time to spread the frame over
+ *
+ * Returns:
+ *   None
+ */
+static void send_frame(struct udp_stream *s, const struct us_header *h, size_t size, int64_t window_ns)
+{
+    size_t off = 0, len, datagrams = (size + s->payload - 1) / s->payload;
+    size_t batches = (datagrams + s->cfg.batch - 1) / s->cfg.batch;
+    int64_t gap = batches > 1 ? window_ns / (int64_t)(batches - 1) : 0, t = now_ns(CLOCK_MONOTONIC);
+    unsigned int n, sent_total;
+    uint64_t bytes = 0, errors = 0, count = 0;
+    int sent;
+
+    while (off < size)
+    {
+        for (n = 0; n < s->cfg.batch && off < size; n++, off += len)
+        {
+            len = size - off < s->payload ? size - off : s->payload;
+            s->headers[n].magic = htonl(US_MAGIC);
+            s->headers[n].frame = htonl(h->frame);
+            s->headers[n].offset = htonl(off);
+            s->headers[n].frame_size = htonl(size);
+            s->headers[n].width = htons(h->width);
+            s->headers[n].height = htons(h->height);
+            s->headers[n].pixelformat = htonl(h->pixelformat);
+            s->headers[n].timestamp_ns = htobe64(h->timestamp_ns);
+            s->iov[2 * n].iov_base = &s->headers[n];
+            s->iov[2 * n].iov_len = sizeof(s->headers[n]);
+            s->iov[2 * n + 1].iov_base = s->sending + off;
+            s->iov[2 * n + 1].iov_len = len;
+            memset(&s->msgs[n], 0, sizeof(s->msgs[n]));
+            s->msgs[n].msg_hdr.msg_iov = &s->iov[2 * n];
+            s->msgs[n].msg_hdr.msg_iovlen = 2;
+            bytes += len;
+        }
+
+        // A datagram the kernel refuses is dropped, not retried: the frame is late already
+        for (sent_total = 0; sent_total < n;)
+        {
+            sent = sendmmsg(s->sock, s->msgs + sent_total, n - sent_total, 0);
+            if (sent <= 0)
+            {
+                if (sent == -1 && errno == EINTR)
+                    continue;
+                errors++;
+                sent_total++;
+                continue;
+            }
+            sent_total += sent;
+        }
+        count += n;
+
+        if (off < size)
+        {
+            t += gap;
+            sleep_until(t);
+        }
+    }
+
+    pthread_mutex_lock(&s->lock);
+    s->stats.frames++;
+    s->stats.datagrams += count - errors;
+    s->stats.bytes += bytes;
+    s->stats.send_errors += errors;
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void *stream_thread(void *arg)
+{
+    struct udp_stream *s = arg;
+    struct us_header h;
+    unsigned char *swap;
+    uint32_t frame = 0;
+    int64_t window;
+    size_t size;
+
+    pthread_mutex_lock(&s->lock);
+    while (!s->stop)
+    {
+        if (!s->pending)
+        {
+            pthread_cond_wait(&s->ready, &s->lock);
+            continue;
+        }
+        swap = s->sending;
+        s->sending = s->incoming;
+        s->incoming = swap;
+        s->pending = false;
+        h = s->next;
+        // Numbered as sent, so gaps at the receiver are network loss only
+        h.frame = ++frame;
+        size = s->size;
+        window = s->interval_ns * s->cfg.pace_percent / 100;
+        pthread_mutex_unlock(&s->lock);
+
+        send_frame(s, &h, size, window < US_MIN_WINDOW_NS ? US_MIN_WINDOW_NS : window);
+
+        pthread_mutex_lock(&s->lock);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+/*
+ * Resolve the destination and start the stream thread
+ *
+ * Parameters:
+ *   struct udp_stream *s -> Stream state
+ *   const struct udp_stream_config *cfg -> Destination and pacing
+ *   uint32_t width, height, pixelformat -> Frame description sent in every header
+ *   size_t max_frame -> Largest frame that will be published
+ *
+ * Returns:
+ *   0 on success, -1 with errno set on failure
+ */
+int us_start(struct udp_stream *s, const struct udp_stream_config *cfg, uint32_t width, uint32_t height,
+             uint32_t pixelformat, size_t max_frame)
+{
+    struct addrinfo hints, *res = NULL, *ai;
+    int sndbuf = US_SNDBUF, err;
+
+    memset(s, 0, sizeof(*s));
+    s->cfg = *cfg;
+    if (s->cfg.mtu == 0)
+        s->cfg.mtu = US_MTU;
+    if (s->cfg.batch == 0)
+        s->cfg.batch = US_BATCH;
+    if (s->cfg.pace_percent == 0 || s->cfg.pace_percent > 100)
+        s->cfg.pace_percent = US_PACE_PERCENT;
+    if (s->cfg.mtu <= US_IP6_UDP_OVERHEAD + sizeof(struct us_header) + 8 || width > UINT16_MAX ||
+        height > UINT16_MAX || max_frame == 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    s->max_frame = max_frame;
+    s->next.width = width;
+    s->next.height = height;
+    s->next.pixelformat = pixelformat;
+    s->interval_ns = US_DEFAULT_INTERVAL_NS;
+    s->sock = -1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    err = getaddrinfo(cfg->host, cfg->port, &hints, &res);
+    if (err != 0)
+    {
+        syslog(LOG_ERR, "udp stream: %s:%s: %s", cfg->host, cfg->port, gai_strerror(err));
+        errno = EINVAL;
+        return -1;
+    }
+    for (ai = res; ai; ai = ai->ai_next)
+    {
+        s->sock = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (s->sock == -1)
+            continue;
+        if (connect(s->sock, ai->ai_addr, ai->ai_addrlen) == 0)
+        {
+            // The host may resolve to either family; the IPv6 header is 20 bytes longer
+            s->payload = s->cfg.mtu - (ai->ai_family == AF_INET6 ? US_IP6_UDP_OVERHEAD : US_IP_UDP_OVERHEAD) -
+                         sizeof(struct us_header);
+            break;
+        }
+        close(s->sock);
+        s->sock = -1;
+    }
+    freeaddrinfo(res);
+    if (s->sock == -1)
+        return -1;
+    setsockopt(s->sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    s->incoming = malloc(max_frame);
+    s->sending = malloc(max_frame);
+    s->headers = calloc(s->cfg.batch, sizeof(*s->headers));
+    s->iov = calloc(2 * s->cfg.batch, sizeof(*s->iov));
+    s->msgs = calloc(s->cfg.batch, sizeof(*s->msgs));
+    if (!s->incoming || !s->sending || !s->headers || !s->iov || !s->msgs)
+    {
+        err = ENOMEM;
+        goto fail;
+    }
+    mem_charge(MEM_STREAM, 2 * max_frame);
+
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->ready, NULL);
+    err = pthread_create(&s->thread, NULL, stream_thread, s);
+    if (err == 0)
+        return 0;
+    pthread_cond_destroy(&s->ready);
+    pthread_mutex_destroy(&s->lock);
+    mem_release(MEM_STREAM, 2 * max_frame);
+
+fail:
+    close(s->sock);
+    free(s->incoming);
+    free(s->sending);
+    free(s->headers);
+    free(s->iov);
+    free(s->msgs);
+    errno = err;
+    return -1;
+}
+
+/*
+ * Queue a captured frame for streaming; called on the capture path
+ *
+ * Parameters:
+ *   struct udp_stream *s -> The stream
+ *   const void *frame -> Frame bytes
+ *   size_t size -> At most the max_frame given to us_start()
+ *   const struct timespec *ts -> CLOCK_REALTIME capture time
+ *
+ * Returns:
+ *   None
+ */
+void us_publish(struct udp_stream *s, const void *frame, size_t size, const struct timespec *ts)
+{
+    int64_t now = now_ns(CLOCK_MONOTONIC);
+
+    if (size > s->max_frame)
+        size = s->max_frame;
+
+    pthread_mutex_lock(&s->lock);
+    // Pace against the rate frames actually arrive at
+    if (s->last_publish_ns)
+        s->interval_ns += (now - s->last_publish_ns - s->interval_ns) / 8;
+    s->last_publish_ns = now;
+    if (s->pending)
+        s->stats.skipped++;
+    memcpy(s->incoming, frame, size);
+    s->size = size;
+    s->next.timestamp_ns = (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+    s->pending = true;
+    pthread_cond_signal(&s->ready);
+    pthread_mutex_unlock(&s->lock);
+}
+
+/*
+ * Snapshot of the stream counters
+ *
+ * Parameters:
+ *   struct udp_stream *s -> The stream
+ *   struct udp_stream_stats *out -> Copy of the counters
+ *
+ * Returns:
+ *   None
+ */
+void us_get_stats(struct udp_stream *s, struct udp_stream_stats *out)
+{
+    pthread_mutex_lock(&s->lock);
+    *out = s->stats;
+    pthread_mutex_unlock(&s->lock);
+}
+
+/*
+ * Stop streaming; a frame being sent is finished first
+ *
+ * Parameters:
+ *   struct udp_stream *s -> The stream
+ *
+ * Returns:
+ *   None
+ */
+void us_stop(struct udp_stream *s)
+{
+    pthread_mutex_lock(&s->lock);
+    s->stop = true;
+    pthread_cond_signal(&s->ready);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->thread, NULL);
+
+    close(s->sock);
+    pthread_cond_destroy(&s->ready);
+    pthread_mutex_destroy(&s->lock);
+    mem_release(MEM_STREAM, 2 * s->max_frame);
+    free(s->incoming);
+    free(s->sending);
+    free(s->headers);
+    free(s->iov);
+    free(s->msgs);
+}
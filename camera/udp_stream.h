@@ -0,0 +1,94 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Paced UDP streaming of raw frames
+ *
+ * Every frame is cut into datagrams that fit the link MTU, each carrying
+ * a struct us_header with the frame number and the byte offset of its
+ * fragment, so a receiver can reassemble frames and tell exactly what
+ * was lost. Fragments are handed to the kernel in sendmmsg() batches
+ * that are spread evenly over part of the frame interval instead of
+ * bursting a whole frame into the switch and receiver buffers at once.
+ *
+ * All header fields are in network byte order.
+ */
+
+#ifndef UDP_STREAM_H
+#define UDP_STREAM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+
+#define US_MAGIC            0x4d524655u    // "UFRM"
+#define US_MTU              1500
+#define US_BATCH            16
+#define US_PACE_PERCENT     75
+#define US_IP_UDP_OVERHEAD  28              // IPv4 + UDP headers
+#define US_IP6_UDP_OVERHEAD 48              // IPv6 + UDP headers
+
+struct us_header
+{
+    uint32_t magic;
+    uint32_t frame;             // Frame number, wraps
+    uint32_t offset;            // Of this fragment's payload in the frame
+    uint32_t frame_size;
+    uint16_t width;
+    uint16_t height;
+    uint32_t pixelformat;       // V4L2 fourcc
+    int64_t timestamp_ns;       // CLOCK_REALTIME of the capture
+};
+
+struct udp_stream_config
+{
+    const char *host;
+    const char *port;
+    unsigned int mtu;           // 0 for US_MTU
+    unsigned int batch;         // Datagrams per sendmmsg(), 0 for US_BATCH
+    unsigned int pace_percent;  // Share of the frame interval a frame is spread over, 0 for US_PACE_PERCENT
+};
+
+struct udp_stream_stats
+{
+    uint64_t frames;            // Frames sent
+    uint64_t skipped;           // Replaced by a newer frame before they were sent
+    uint64_t datagrams;
+    uint64_t bytes;             // Payload bytes
+    uint64_t send_errors;       // Datagrams the kernel refused
+};
+
+struct udp_stream
+{
+    struct udp_stream_config cfg;
+    int sock;
+    size_t payload;             // Frame bytes per datagram
+    pthread_t thread;
+    bool stop;
+
+    // Hand-over from the capture thread, double buffered under lock
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    unsigned char *incoming;
+    unsigned char *sending;
+    size_t max_frame;
+    size_t size;
+    bool pending;
+    struct us_header next;      // Header of the pending frame (host order)
+    int64_t last_publish_ns;
+    int64_t interval_ns;        // Smoothed frame interval
+
+    struct us_header *headers;  // One batch worth of send state
+    struct iovec *iov;
+    struct mmsghdr *msgs;
+    struct udp_stream_stats stats;
+};
+
+int us_start(struct udp_stream *s, const struct udp_stream_config *cfg, uint32_t width, uint32_t height,
+             uint32_t pixelformat, size_t max_frame);
+void us_publish(struct udp_stream *s, const void *frame, size_t size, const struct timespec *ts);
+void us_get_stats(struct udp_stream *s, struct udp_stream_stats *out);
+void us_stop(struct udp_stream *s);
+int us_parse(const char *s, struct udp_stream_config *cfg, char *buf, size_t len);
+
+#endif
@@ -0,0 +1,147 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Sensor warm-up detection
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <linux/videodev2.h>
+
+#include "warmup.h"
+
+// Every WU_ROW_STEP-th row and every WU_COL_STEP-th pixel are sampled
+#define WU_ROW_STEP          4
+#define WU_COL_STEP          2
+
+// Frame to frame change still considered settled
+#define WU_LUMA_TOLERANCE    (2 * 256)     // Mean luma levels, x256
+#define WU_SHARP_PERCENT     8             // Relative change of the sharpness
+#define WU_SHARP_SLACK       64            // Plus a quarter level for featureless scenes, x256
+
+// Consecutive settled frames before the sensor counts as stable
+#define WU_STABLE_FRAMES     3
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Start watching a stream that has just been turned on
+ *
+ * Parameters:
+ *   struct warmup *w -> Detector to initialise
+ *   uint32_t width, height -> Frame geometry in pixels
+ *   uint32_t pixelformat -> V4L2_PIX_FMT_YUYV or V4L2_PIX_FMT_UYVY
+ *   uint32_t timeout_ms -> Give up waiting for stability after this long
+ *
+ * Returns:
+ *   0 on success, -1 with errno set to EINVAL for other formats
+ */
+int wu_init(struct warmup *w, uint32_t width, uint32_t height, uint32_t pixelformat, uint32_t timeout_ms)
+{
+    memset(w, 0, sizeof(*w));
+    if ((pixelformat != V4L2_PIX_FMT_YUYV && pixelformat != V4L2_PIX_FMT_UYVY) ||
+        width < 2 * WU_COL_STEP || height < WU_ROW_STEP)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    w->width = width;
+    w->height = height;
+    w->y_offset = (pixelformat == V4L2_PIX_FMT_UYVY) ? 1 : 0;
+    w->timeout_ns = (uint64_t)timeout_ms * 1000000;
+    w->start_ns = now_ns();
+    return 0;
+}
+
+/*
+ * Mean luma and mean horizontal luma gradient of the sampled pixels, both x256
+ */
+static void frame_stats(const struct warmup *w, const uint8_t *frame, uint32_t *luma, uint32_t *sharpness)
+{
+    size_t stride = (size_t)w->width * 2;
+    uint64_t sum = 0, grad = 0, n = 0;
+    uint32_t x, y;
+    const uint8_t *p;
+
+    for (y = 0; y < w->height; y += WU_ROW_STEP)
+    {
+        p = frame + y * stride + w->y_offset;
+        for (x = 0; x + WU_COL_STEP < w->width; x += WU_COL_STEP)
+        {
+            sum += p[x * 2];
+            grad += abs((int)p[(x + WU_COL_STEP) * 2] - (int)p[x * 2]);
+            n++;
+        }
+    }
+    *luma = (sum << 8) / n;
+    *sharpness = (grad << 8) / n;
+}
+
+/*
+ * Feed the next dequeued frame
+ *
+ * Once stable or timed out the detector stays in that state. An
+ * incomplete frame is never released.
+ *
+ * Parameters:
+ *   struct warmup *w -> The detector
+ *   const uint8_t *frame -> Packed 4:2:2 frame
+ *   size_t bytesused -> Bytes the driver filled in
+ *
+ * Returns:
+ *   WU_SETTLING to discard the frame, WU_STABLE or WU_TIMEOUT to use it
+ */
+enum warmup_state wu_feed(struct warmup *w, const uint8_t *frame, size_t bytesused)
+{
+    uint32_t luma, sharpness, sharp_delta;
+
+    if (w->state != WU_SETTLING)
+        return w->state;
+
+    w->frames++;
+    if (bytesused < (size_t)w->width * w->height * 2)
+    {
+        w->settled = 0;
+        return WU_SETTLING;
+    }
+
+    frame_stats(w, frame, &luma, &sharpness);
+    sharp_delta = sharpness > w->sharpness ? sharpness - w->sharpness : w->sharpness - sharpness;
+    if (w->frames > 1 && abs((int)luma - (int)w->luma) <= WU_LUMA_TOLERANCE &&
+        sharp_delta <= (uint64_t)w->sharpness * WU_SHARP_PERCENT / 100 + WU_SHARP_SLACK)
+        w->settled++;
+    else
+        w->settled = 0;
+    w->luma = luma;
+    w->sharpness = sharpness;
+
+    if (w->settled >= WU_STABLE_FRAMES)
+        w->state = WU_STABLE;
+    else if (wu_elapsed_ns(w) >= w->timeout_ns)
+        w->state = WU_TIMEOUT;
+    return w->state;
+}
+
+/*
+ * Time since the detector was started
+ *
+ * Parameters:
+ *   const struct warmup *w -> The detector
+ *
+ * Returns:
+ *   Nanoseconds since wu_init()
+ */
+uint64_t wu_elapsed_ns(const struct warmup *w)
+{
+    return now_ns() - w->start_ns;
+}
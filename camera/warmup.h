@@ -0,0 +1,46 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Sensor warm-up detection
+ *
+ * Right after STREAMON a UVC camera is still converging its auto
+ * exposure (and often focus): the first frames are dark or washed out
+ * and the first one may be incomplete. Instead of throwing away a fixed
+ * number of frames, the detector watches the mean luma and a sharpness
+ * measure (mean horizontal luma gradient) of a sparse sample of every
+ * frame and declares the sensor stable once both have stopped moving
+ * for a few consecutive frames, or gives up after a timeout and lets
+ * the caller take what it has.
+ */
+
+#ifndef WARMUP_H
+#define WARMUP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+enum warmup_state
+{
+    WU_SETTLING,                // Discard this frame
+    WU_STABLE,                  // Statistics settled; this frame is usable
+    WU_TIMEOUT,                 // Did not settle in time; this frame is the best there is
+};
+
+struct warmup
+{
+    uint32_t width;
+    uint32_t height;
+    unsigned int y_offset;      // Byte offset of the first luma sample (0 YUYV, 1 UYVY)
+    uint64_t start_ns;
+    uint64_t timeout_ns;
+    uint32_t luma;              // Mean luma of the previous frame, x256
+    uint32_t sharpness;         // Mean horizontal gradient of the previous frame, x256
+    unsigned int frames;        // Frames seen
+    unsigned int settled;       // Consecutive frames without significant change
+    enum warmup_state state;
+};
+
+int wu_init(struct warmup *w, uint32_t width, uint32_t height, uint32_t pixelformat, uint32_t timeout_ms);
+enum warmup_state wu_feed(struct warmup *w, const uint8_t *frame, size_t bytesused);
+uint64_t wu_elapsed_ns(const struct warmup *w);
+
+#endif
@@ -0,0 +1,351 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Gray-world and white-patch colour statistics
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <linux/videodev2.h>
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "white_balance.h"
+
+// Where the white-patch level starts before it has tracked a frame
+#define WB_START_LEVEL  200
+
+/*
+ * Set up the statistics for a packed 4:2:2 stream
+ *
+ * Parameters:
+ *   struct white_balance *wb -> Statistics to initialise
+ *   uint32_t width, height -> Frame geometry in pixels
+ *   uint32_t pixelformat -> V4L2_PIX_FMT_YUYV or V4L2_PIX_FMT_UYVY
+ *
+ * Returns:
+ *   0 on success, -1 with errno set to EINVAL
+ */
+int wb_init(struct white_balance *wb, uint32_t width, uint32_t height, uint32_t pixelformat)
+{
+    memset(wb, 0, sizeof(*wb));
+    if (width < 2 || height == 0 || width % 2 ||
+        (pixelformat != V4L2_PIX_FMT_YUYV && pixelformat != V4L2_PIX_FMT_UYVY))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    wb->width = width;
+    wb->height = height;
+    wb->y_offset = pixelformat == V4L2_PIX_FMT_UYVY ? 1 : 0;
+    wb->stats.patch_level = WB_START_LEVEL;
+    return 0;
+}
+
+// One macropixel into the sums
+static inline void add_macropixel(struct wb_sums *s, const uint8_t *p, unsigned int yo, uint32_t level)
+{
+    uint32_t y = (p[yo] + p[yo + 2]) >> 1, u = p[1 - yo], v = p[3 - yo];
+
+    if (y < WB_DARK || y >= WB_CLIP)
+        return;
+    s->usable++;
+    s->y += y;
+    s->u += u;
+    s->v += v;
+    s->chroma += (u > 128 ? u - 128 : 128 - u) + (v > 128 ? v - 128 : 128 - v);
+    if (y >= level)
+    {
+        s->patch++;
+        s->patch_y += y;
+        s->patch_u += u;
+        s->patch_v += v;
+    }
+}
+
+#if defined(__x86_64__) || defined(__ARM_NEON)
+// Vector accumulators, in the order of struct wb_sums, added to the scalar tail sums
+static inline void add_sums(struct wb_sums *s, const uint32_t sums[9])
+{
+    s->usable += sums[0];
+    s->y += sums[1];
+    s->u += sums[2];
+    s->v += sums[3];
+    s->chroma += sums[4];
+    s->patch += sums[5];
+    s->patch_y += sums[6];
+    s->patch_u += sums[7];
+    s->patch_v += sums[8];
+}
+#endif
+
+/*
+ * Sums over the measured rows of a frame
+ *
+ * Parameters:
+ *   const struct white_balance *wb -> The statistics (for the geometry)
+ *   const uint8_t *frame -> Packed 4:2:2 frame
+ *   uint32_t level -> White-patch luma level
+ *   struct wb_sums *s -> The sums
+ *
+ * Returns:
+ *   None
+ */
+void wb_measure(const struct white_balance *wb, const uint8_t *frame, uint32_t level, struct wb_sums *s)
+{
+    uint32_t n = wb->width / 2, y, i;
+    size_t stride = (size_t)wb->width * 2;
+    unsigned int yo = wb->y_offset;
+    const uint8_t *row;
+
+    memset(s, 0, sizeof(*s));
+#if defined(__x86_64__)
+    // Four macropixels per vector, one per 32-bit lane; a mask lane is -1, so subtracting it counts
+    const __m128i byte = _mm_set1_epi32(0xff), c128 = _mm_set1_epi32(128);
+    const __m128i dark = _mm_set1_epi32(WB_DARK - 1), clip = _mm_set1_epi32(WB_CLIP);
+    const __m128i lvl = _mm_set1_epi32((int)level - 1);
+    const __m128i sy0 = _mm_cvtsi32_si128(8 * yo), sy1 = _mm_cvtsi32_si128(16 + 8 * yo);
+    const __m128i su = _mm_cvtsi32_si128(8 - 8 * yo), sv = _mm_cvtsi32_si128(24 - 8 * yo);
+    __m128i acc[9], m, luma, u, v, ok, bright, du, dv, sign;
+    uint32_t sums[9], lanes[4];
+    int k;
+
+    for (k = 0; k < 9; k++)
+        acc[k] = _mm_setzero_si128();
+    for (y = 0; y < wb->height; y += WB_ROW_STEP)
+    {
+        row = frame + y * stride;
+        for (i = 0; i + 4 <= n; i += 4)
+        {
+            m = _mm_loadu_si128((const __m128i *)(row + i * 4));
+            luma = _mm_srli_epi32(_mm_add_epi32(_mm_and_si128(_mm_srl_epi32(m, sy0), byte),
+                                                _mm_and_si128(_mm_srl_epi32(m, sy1), byte)), 1);
+            u = _mm_and_si128(_mm_srl_epi32(m, su), byte);
+            v = _mm_and_si128(_mm_srl_epi32(m, sv), byte);
+            ok = _mm_and_si128(_mm_cmpgt_epi32(luma, dark), _mm_cmplt_epi32(luma, clip));
+            bright = _mm_and_si128(ok, _mm_cmpgt_epi32(luma, lvl));
+
+            du = _mm_sub_epi32(u, c128);
+            sign = _mm_srai_epi32(du, 31);
+            du = _mm_sub_epi32(_mm_xor_si128(du, sign), sign);
+            dv = _mm_sub_epi32(v, c128);
+            sign = _mm_srai_epi32(dv, 31);
+            dv = _mm_sub_epi32(_mm_xor_si128(dv, sign), sign);
+
+            acc[0] = _mm_sub_epi32(acc[0], ok);
+            acc[1] = _mm_add_epi32(acc[1], _mm_and_si128(ok, luma));
+            acc[2] = _mm_add_epi32(acc[2], _mm_and_si128(ok, u));
+            acc[3] = _mm_add_epi32(acc[3], _mm_and_si128(ok, v));
+            acc[4] = _mm_add_epi32(acc[4], _mm_and_si128(ok, _mm_add_epi32(du, dv)));
+            acc[5] = _mm_sub_epi32(acc[5], bright);
+            acc[6] = _mm_add_epi32(acc[6], _mm_and_si128(bright, luma));
+            acc[7] = _mm_add_epi32(acc[7], _mm_and_si128(bright, u));
+            acc[8] = _mm_add_epi32(acc[8], _mm_and_si128(bright, v));
+        }
+        for (; i < n; i++)
+            add_macropixel(s, row + i * 4, yo, level);
+    }
+    for (k = 0; k < 9; k++)
+    {
+        _mm_storeu_si128((__m128i *)lanes, acc[k]);
+        sums[k] = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+    add_sums(s, sums);
+#elif defined(__ARM_NEON)
+    const uint32x4_t byte = vdupq_n_u32(0xff), c128 = vdupq_n_u32(128);
+    const uint32x4_t dark = vdupq_n_u32(WB_DARK), clip = vdupq_n_u32(WB_CLIP), lvl = vdupq_n_u32(level);
+    const int32x4_t sy0 = vdupq_n_s32(-8 * (int)yo), sy1 = vdupq_n_s32(-16 - 8 * (int)yo);
+    const int32x4_t su = vdupq_n_s32(-8 + 8 * (int)yo), sv = vdupq_n_s32(-24 + 8 * (int)yo);
+    uint32x4_t acc[9], m, luma, u, v, ok, bright, chroma;
+    uint64x2_t pair;
+    uint32_t sums[9];
+    int k;
+
+    for (k = 0; k < 9; k++)
+        acc[k] = vdupq_n_u32(0);
+    for (y = 0; y < wb->height; y += WB_ROW_STEP)
+    {
+        row = frame + y * stride;
+        for (i = 0; i + 4 <= n; i += 4)
+        {
+            // Negative counts make vshlq a right shift
+            m = vld1q_u32((const uint32_t *)(row + i * 4));
+            luma = vshrq_n_u32(vaddq_u32(vandq_u32(vshlq_u32(m, sy0), byte),
+                                         vandq_u32(vshlq_u32(m, sy1), byte)), 1);
+            u = vandq_u32(vshlq_u32(m, su), byte);
+            v = vandq_u32(vshlq_u32(m, sv), byte);
+            ok = vandq_u32(vcgeq_u32(luma, dark), vcltq_u32(luma, clip));
+            bright = vandq_u32(ok, vcgeq_u32(luma, lvl));
+            chroma = vaddq_u32(vabdq_u32(u, c128), vabdq_u32(v, c128));
+
+            acc[0] = vsubq_u32(acc[0], ok);
+            acc[1] = vaddq_u32(acc[1], vandq_u32(ok, luma));
+            acc[2] = vaddq_u32(acc[2], vandq_u32(ok, u));
+            acc[3] = vaddq_u32(acc[3], vandq_u32(ok, v));
+            acc[4] = vaddq_u32(acc[4], vandq_u32(ok, chroma));
+            acc[5] = vsubq_u32(acc[5], bright);
+            acc[6] = vaddq_u32(acc[6], vandq_u32(bright, luma));
+            acc[7] = vaddq_u32(acc[7], vandq_u32(bright, u));
+            acc[8] = vaddq_u32(acc[8], vandq_u32(bright, v));
+        }
+        for (; i < n; i++)
+            add_macropixel(s, row + i * 4, yo, level);
+    }
+    for (k = 0; k < 9; k++)
+    {
+        pair = vpaddlq_u32(acc[k]);
+        sums[k] = vgetq_lane_u64(pair, 0) + vgetq_lane_u64(pair, 1);
+    }
+    add_sums(s, sums);
+#else
+    for (y = 0; y < wb->height; y += WB_ROW_STEP)
+    {
+        row = frame + y * stride;
+        for (i = 0; i < n; i++)
+            add_macropixel(s, row + i * 4, yo, level);
+    }
+#endif
+}
+
+// Mean of a sum, x256
+static inline int32_t mean256(uint32_t sum, uint32_t count, int32_t offset)
+{
+    return (int32_t)(((uint64_t)sum * 256 + count / 2) / count) - offset * 256;
+}
+
+// Exponential smoothing; the first frame is taken as it is
+static inline void smooth(int32_t *avg, int32_t value, bool primed)
+{
+    int32_t next = primed ? *avg + (value - *avg) / (1 << WB_SMOOTH_SHIFT) : value;
+
+    __atomic_store_n(avg, next, __ATOMIC_RELAXED);
+}
+
+/*
+ * Measure one frame and update the smoothed statistics
+ *
+ * Parameters:
+ *   struct white_balance *wb -> The statistics
+ *   const uint8_t *frame -> Packed 4:2:2 frame of the configured geometry
+ *
+ * Returns:
+ *   None
+ */
+void wb_frame(struct white_balance *wb, const uint8_t *frame)
+{
+    struct wb_stats *st = &wb->stats;
+    uint32_t level = st->patch_level, target;
+    struct wb_sums s;
+
+    wb_measure(wb, frame, level, &s);
+    __atomic_store_n(&st->frames, st->frames + 1, __ATOMIC_RELAXED);
+    if (s.usable == 0)
+        return;
+
+    smooth(&st->mean[WB_GRAY_WORLD][0], mean256(s.y, s.usable, 0), wb->primed);
+    smooth(&st->mean[WB_GRAY_WORLD][1], mean256(s.u, s.usable, 128), wb->primed);
+    smooth(&st->mean[WB_GRAY_WORLD][2], mean256(s.v, s.usable, 128), wb->primed);
+    smooth(&st->chroma, mean256(s.chroma, s.usable, 0), wb->primed);
+    if (s.patch)
+    {
+        smooth(&st->mean[WB_WHITE_PATCH][0], mean256(s.patch_y, s.patch, 0), wb->primed);
+        smooth(&st->mean[WB_WHITE_PATCH][1], mean256(s.patch_u, s.patch, 128), wb->primed);
+        smooth(&st->mean[WB_WHITE_PATCH][2], mean256(s.patch_v, s.patch, 128), wb->primed);
+    }
+    wb->primed = true;
+
+    // Move the white-patch level towards the brightest share, faster when far off
+    target = s.usable / WB_PATCH_SHARE;
+    if (s.patch > target + target / 4 && level < WB_CLIP - 1)
+        level += s.patch > 2 * target && level + 4 < WB_CLIP ? 4 : 1;
+    else if (s.patch + target / 4 < target && level > WB_DARK + 1)
+        level -= 2 * s.patch < target && level > WB_DARK + 4 ? 4 : 1;
+    __atomic_store_n(&st->patch_level, level, __ATOMIC_RELAXED);
+}
+
+/*
+ * Snapshot the statistics (safe from another thread)
+ *
+ * Parameters:
+ *   struct white_balance *wb -> The statistics
+ *   struct wb_stats *out -> Copy of the statistics
+ *
+ * Returns:
+ *   None
+ */
+void wb_get_stats(struct white_balance *wb, struct wb_stats *out)
+{
+    int m, c;
+
+    out->frames = __atomic_load_n(&wb->stats.frames, __ATOMIC_RELAXED);
+    out->patch_level = __atomic_load_n(&wb->stats.patch_level, __ATOMIC_RELAXED);
+    out->chroma = __atomic_load_n(&wb->stats.chroma, __ATOMIC_RELAXED);
+    for (m = 0; m < WB_METHODS; m++)
+        for (c = 0; c < 3; c++)
+            out->mean[m][c] = __atomic_load_n(&wb->stats.mean[m][c], __ATOMIC_RELAXED);
+}
+
+/*
+ * Red and blue gains that would make an estimate of the illuminant neutral
+ *
+ * The smoothed Y, U, V means are taken to RGB with the coefficients of
+ * yuv2rgb() (before clipping, where the conversion is linear, so the
+ * mean converts exactly); the gains are G/R and G/B.
+ *
+ * Parameters:
+ *   const struct wb_stats *st -> Statistics snapshot
+ *   enum wb_method method -> Gray world or white patch
+ *   double *red, *blue -> The gains, 0 when undefined
+ *
+ * Returns:
+ *   None
+ */
+void wb_gains(const struct wb_stats *st, enum wb_method method, double *red, double *blue)
+{
+    double y = st->mean[method][0] / 256.0 - 16, u = st->mean[method][1] / 256.0, v = st->mean[method][2] / 256.0;
+    double r = (298 * y + 409 * v) / 256, g = (298 * y - 100 * u - 208 * v) / 256, b = (298 * y + 516 * u) / 256;
+
+    *red = r > 0 && g > 0 ? g / r : 0;
+    *blue = b > 0 && g > 0 ? g / b : 0;
+}
+
+/*
+ * Strength of the colour cast: distance of the estimate from neutral chroma
+ *
+ * Parameters:
+ *   const struct wb_stats *st -> Statistics snapshot
+ *   enum wb_method method -> Gray world or white patch
+ *
+ * Returns:
+ *   sqrt(U^2 + V^2) of the mean chroma, in levels
+ */
+double wb_cast(const struct wb_stats *st, enum wb_method method)
+{
+    return hypot(st->mean[method][1] / 256.0, st->mean[method][2] / 256.0);
+}
+
+/*
+ * Name of the kernels in use
+ *
+ * Parameters:
+ *   None
+ *
+ * Returns:
+ *   "sse2", "neon" or "scalar"
+ */
+const char *wb_impl(void)
+{
+#if defined(__x86_64__)
+    return "sse2";
+#elif defined(__ARM_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,82 @@
+/*
+ * ECEN-5713 Advanced Embedded Software Development
+ * File Description - Gray-world and white-patch colour statistics
+ *
+ * A camera whose IR-cut filter is stuck, or whose white balance was left
+ * on a wrong preset, keeps producing plausible frames; the fault only
+ * shows as a colour cast. This stage measures the cast from the chroma
+ * samples of the packed 4:2:2 stream, without converting anything: every
+ * WB_ROW_STEP-th row is read as 4:2:2 macropixels (one U and V sample per
+ * two luma samples), 4 macropixels at a time with SSE2 or NEON (scalar
+ * fallback).
+ *
+ * Two estimates of the illuminant are kept. Gray world takes the mean
+ * chroma of all usable pixels (neither near black, where chroma is noise,
+ * nor clipped); white patch takes the mean chroma of the brightest few
+ * percent of them, above a luma level that tracks that share from frame
+ * to frame so no histogram is needed. Both, and the mean chroma
+ * magnitude (which collapses when a camera sits in IR night mode), are
+ * smoothed over about 2^WB_SMOOTH_SHIFT frames and turned into the red
+ * and blue gains that would neutralise the cast. The statistics can be
+ * read from another thread.
+ */
+
+#ifndef WHITE_BALANCE_H
+#define WHITE_BALANCE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define WB_ROW_STEP     4       // Rows between two measured rows
+#define WB_DARK         24      // Pixels darker than this are not used
+#define WB_CLIP         250     // Nor pixels at or above this
+#define WB_PATCH_SHARE  32      // White patch: the brightest 1/32 of the usable pixels
+#define WB_SMOOTH_SHIFT 5       // Exponential smoothing over 2^5 frames
+
+enum wb_method
+{
+    WB_GRAY_WORLD,
+    WB_WHITE_PATCH,
+    WB_METHODS
+};
+
+// Raw sums over the measured macropixels of one frame
+struct wb_sums
+{
+    uint32_t usable;            // Macropixels between WB_DARK and WB_CLIP
+    uint32_t y;                 // Their luma (mean of the two samples), U and V
+    uint32_t u;
+    uint32_t v;
+    uint32_t chroma;            // |U - 128| + |V - 128|
+    uint32_t patch;             // Macropixels at or above the white-patch level
+    uint32_t patch_y;
+    uint32_t patch_u;
+    uint32_t patch_v;
+};
+
+struct wb_stats
+{
+    uint64_t frames;
+    uint32_t patch_level;       // Current white-patch luma level
+    int32_t mean[WB_METHODS][3];    // Smoothed mean Y, U - 128, V - 128, x256
+    int32_t chroma;             // Smoothed mean |U - 128| + |V - 128|, x256
+};
+
+struct white_balance
+{
+    uint32_t width;
+    uint32_t height;
+    unsigned int y_offset;      // Byte of the first luma sample in a macropixel (0 YUYV, 1 UYVY)
+    bool primed;                // The smoothed values hold at least one frame
+    struct wb_stats stats;
+};
+
+int wb_init(struct white_balance *wb, uint32_t width, uint32_t height, uint32_t pixelformat);
+void wb_measure(const struct white_balance *wb, const uint8_t *frame, uint32_t level, struct wb_sums *s);
+void wb_frame(struct white_balance *wb, const uint8_t *frame);
+void wb_get_stats(struct white_balance *wb, struct wb_stats *out);
+void wb_gains(const struct wb_stats *st, enum wb_method method, double *red, double *blue);
+double wb_cast(const struct wb_stats *st, enum wb_method method);
+const char *wb_impl(void);
+
+#endif